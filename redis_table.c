@@ -15,9 +15,17 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-
-// Initial capacity for dynamic arrays in filtering operations
-#define INITIAL_FILTER_CAPACITY 100
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNELS 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_NEON_KERNELS 1
+#endif
 
 // Module version
 #define REDISTABLE_VERSION_MAJOR 1
@@ -25,40 +33,108 @@
 #define REDISTABLE_VERSION_PATCH 0
 #define REDISTABLE_VERSION_STRING "1.1.0"
 
+// Rows per page of a SELECT with CURSOR and no LIMIT
+#define SELECT_DEFAULT_PAGE_SIZE 100
+
 // Default maximum number of rows to scan in a single query operation
 #define DEFAULT_MAX_ROWS_SCAN_LIMIT 100000
 
 // Configurable scan limit (can be changed via CONFIG SET)
 static long long g_max_rows_scan_limit = DEFAULT_MAX_ROWS_SCAN_LIMIT;
 
+// Queries checking more rows than this one by one run in a background thread (0 = never)
+#define DEFAULT_ASYNC_SCAN_ROWS 10000
+static long long g_async_scan_rows = DEFAULT_ASYNC_SCAN_ROWS;
+
+// Rows a background query processes between two releases of the global lock; native
+// tables are filtered in memory by the worker pool, in larger chunks
+#define ASYNC_CHUNK_ROWS 1000
+#define ASYNC_NATIVE_CHUNK_ROWS 65536
+
+// Rows of an UPDATE or DELETE whose index edits and key removals are applied together
+#define INDEX_BATCH_ROWS 1000
+
+// Threads evaluating row filters on native tables, the calling thread included
+#define DEFAULT_WORKER_THREADS 4
+#define MAX_WORKER_THREADS 64
+static int g_worker_threads = DEFAULT_WORKER_THREADS;
+
+// Memory for cached query replies, in megabytes (0 = no result cache)
+#define DEFAULT_RESULT_CACHE_MB 0
+#define MAX_RESULT_CACHE_MB 65536
+static long long g_result_cache_mb = DEFAULT_RESULT_CACHE_MB;
+
+// Filters over fewer rows run on the calling thread only
+#define PARALLEL_MIN_ROWS 16384
+
+// Index kinds
+// hash:  one module-typed key per column, {ns.t}:hash:<col> -> value -> sorted row IDs
+// btree: one ZSET per column, {ns.t}:btree:<col>, ordered by column value
+// unique: one HASH per column, {ns.t}:unique:<col> -> value -> the row ID holding it;
+//         a value is held by one row at most. The primary key of TABLE.GET is a unique
+//         column declared "primary" at TABLE.SCHEMA.CREATE, every row has a value for it.
+#define INDEX_NONE    0
+#define INDEX_HASH    1
+#define INDEX_BTREE   2
+#define INDEX_UNIQUE  3
+#define INDEX_PRIMARY 4     // declared only, the column then has INDEX_UNIQUE
+
+// Storage engines
+// hash:   one hash per row {ns.t}:<id>, the {ns.t}:rows set and index keys (default)
+// native: rows and indexes in a single module-typed key {ns.t}:data
+#define ENGINE_HASH   0
+#define ENGINE_NATIVE 1
+
+// Column types
+#define COLTYPE_STRING  0
+#define COLTYPE_INTEGER 1
+#define COLTYPE_FLOAT   2
+#define COLTYPE_DATE    3
+
+// Module type holding the rows and indexes of native tables
+static RedisModuleType *NativeTableType = NULL;
+// Module type holding one hash index of a hash table
+static RedisModuleType *HashIndexType = NULL;
+
 // Index type validation
-// Returns: 0 = none (no index), 1 = hash, -1 = invalid
+// Returns: INDEX_NONE, INDEX_HASH, INDEX_BTREE, INDEX_UNIQUE, INDEX_PRIMARY, -1 = invalid
 // Default: none (0)
 static int parse_index_type(const char *str, size_t len) {
-    // Valid values: hash, btree, none
-    if (len == 4 && strncasecmp(str, "hash", 4) == 0) return 1;
-    if (len == 5 && strncasecmp(str, "btree", 5) == 0) return 1;  // btree treated as hash for now
-    if (len == 4 && strncasecmp(str, "none", 4) == 0) return 0;
+    // Valid values: hash, btree, unique, primary, none
+    if (len == 4 && strncasecmp(str, "hash", 4) == 0) return INDEX_HASH;
+    if (len == 5 && strncasecmp(str, "btree", 5) == 0) return INDEX_BTREE;
+    if (len == 6 && strncasecmp(str, "unique", 6) == 0) return INDEX_UNIQUE;
+    if (len == 7 && strncasecmp(str, "primary", 7) == 0) return INDEX_PRIMARY;
+    if (len == 4 && strncasecmp(str, "none", 4) == 0) return INDEX_NONE;
     
     // Backward compatibility (deprecated)
-    if (len == 4 && strncasecmp(str, "true", 4) == 0) return 1;
-    if (len == 5 && strncasecmp(str, "false", 5) == 0) return 0;
+    if (len == 4 && strncasecmp(str, "true", 4) == 0) return INDEX_HASH;
+    if (len == 5 && strncasecmp(str, "false", 5) == 0) return INDEX_NONE;
     
     return -1; // Invalid
 }
 
+static const char *index_type_name(int kind) {
+    switch (kind) {
+    case INDEX_HASH: return "hash";
+    case INDEX_BTREE: return "btree";
+    case INDEX_UNIQUE: return "unique";
+    case INDEX_PRIMARY: return "primary";
+    default: return "none";
+    }
+}
+
+static inline int is_word(RedisModuleString *arg, const char *word) {
+    size_t l; const char *w = RedisModule_StringPtrLen(arg, &l);
+    return l == strlen(word) && strncasecmp(w, word, l) == 0;
+}
+
 static inline RedisModuleString *fmt(RedisModuleCtx *ctx, const char *fmt, RedisModuleString *a) {
     return RedisModule_CreateStringPrintf(ctx, fmt, RedisModule_StringPtrLen(a, NULL));
 }
 static inline RedisModuleString *fmt2(RedisModuleCtx *ctx, const char *fmt, RedisModuleString *a, RedisModuleString *b) {
     return RedisModule_CreateStringPrintf(ctx, fmt, RedisModule_StringPtrLen(a, NULL), RedisModule_StringPtrLen(b, NULL));
 }
-static inline RedisModuleString *fmt3(RedisModuleCtx *ctx, const char *fmt, RedisModuleString *a, RedisModuleString *b, RedisModuleString *c) {
-    return RedisModule_CreateStringPrintf(ctx, fmt,
-        RedisModule_StringPtrLen(a, NULL),
-        RedisModule_StringPtrLen(b, NULL),
-        RedisModule_StringPtrLen(c, NULL));
-}
 
 // Split "col=value" or "col>value" etc into (col, op, value)
 static int split_condition(RedisModuleCtx *ctx, RedisModuleString *in, 
@@ -90,343 +166,4385 @@ static int split_condition(RedisModuleCtx *ctx, RedisModuleString *in,
     return REDISMODULE_OK;
 }
 
-// Check if column is indexed
-static int is_column_indexed(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *col) {
-    RedisModule_AutoMemory(ctx);
-    RedisModuleString *metaKey = fmt(ctx, "{%s}:idx:meta", table);
-    RedisModuleCallReply *r = RedisModule_Call(ctx, "SISMEMBER", "ss", metaKey, col);
-    return (r && RedisModule_CallReplyType(r) == REDISMODULE_REPLY_INTEGER && 
-            RedisModule_CallReplyInteger(r) == 1) ? 1 : 0;
+/* ================== Typed values ================== */
+
+// Comparison operators
+#define OP_EQ 0
+#define OP_GT 1
+#define OP_LT 2
+#define OP_GE 3
+#define OP_LE 4
+
+static int parse_op(const char *op) {
+    if (op[0] == '>') return op[1] == '=' ? OP_GE : OP_GT;
+    if (op[0] == '<') return op[1] == '=' ? OP_LE : OP_LT;
+    return OP_EQ;
 }
 
-// Compare two values based on operator and type
-static int compare_values(const char *v1, const char *v2, const char *op, const char *type) {
-    if (strcmp(type, "integer") == 0) {
-        long long n1 = atoll(v1);
-        long long n2 = atoll(v2);
-        if (strcmp(op, "=") == 0) return n1 == n2;
-        if (strcmp(op, ">") == 0) return n1 > n2;
-        if (strcmp(op, "<") == 0) return n1 < n2;
-        if (strcmp(op, ">=") == 0) return n1 >= n2;
-        if (strcmp(op, "<=") == 0) return n1 <= n2;
-    } else if (strcmp(type, "float") == 0) {
-        double d1 = atof(v1);
-        double d2 = atof(v2);
-        if (strcmp(op, "=") == 0) return d1 == d2;
-        if (strcmp(op, ">") == 0) return d1 > d2;
-        if (strcmp(op, "<") == 0) return d1 < d2;
-        if (strcmp(op, ">=") == 0) return d1 >= d2;
-        if (strcmp(op, "<=") == 0) return d1 <= d2;
-    } else if (strcmp(type, "date") == 0) {
-        // Date comparison as string (YYYY-MM-DD format sorts correctly)
-        int cmp = strcmp(v1, v2);
-        if (strcmp(op, "=") == 0) return cmp == 0;
-        if (strcmp(op, ">") == 0) return cmp > 0;
-        if (strcmp(op, "<") == 0) return cmp < 0;
-        if (strcmp(op, ">=") == 0) return cmp >= 0;
-        if (strcmp(op, "<=") == 0) return cmp <= 0;
-    } else {
-        // String comparison
-        int cmp = strcmp(v1, v2);
-        if (strcmp(op, "=") == 0) return cmp == 0;
-        if (strcmp(op, ">") == 0) return cmp > 0;
-        if (strcmp(op, "<") == 0) return cmp < 0;
-        if (strcmp(op, ">=") == 0) return cmp >= 0;
-        if (strcmp(op, "<=") == 0) return cmp <= 0;
+// Binary form of a value: int64 for integers, days since 1970-01-01 for dates,
+// double for floats and a length-prefixed buffer for strings
+typedef union {
+    int64_t i;
+    double d;
+    char *s;
+} TypedValue;
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+static int64_t date_to_days(int64_t y, int m, int d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static void days_to_date(int64_t z, int64_t *y, int *m, int *d) {
+    z += 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    int64_t doe = z - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+    *d = (int)(doy - (153 * mp + 2) / 5 + 1);
+    *m = (int)(mp < 10 ? mp + 3 : mp - 9);
+    *y = yoe + era * 400 + (*m <= 2);
+}
+
+static int days_in_month(int64_t y, int m) {
+    static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    if (m == 2 && ((y % 4 == 0 && y % 100 != 0) || y % 400 == 0)) return 29;
+    return days[m - 1];
+}
+
+// Parse YYYY-MM-DD into a day number; returns -1 if it is not a calendar date
+static int parse_date(const char *v, size_t vlen, int64_t *days) {
+    if (vlen != 10 || v[4] != '-' || v[7] != '-') return -1;
+    for (int i = 0; i < 10; i++) {
+        if (i == 4 || i == 7) continue;
+        if (v[i] < '0' || v[i] > '9') return -1;
     }
+    int64_t y = (v[0]-'0')*1000 + (v[1]-'0')*100 + (v[2]-'0')*10 + (v[3]-'0');
+    int m = (v[5]-'0')*10 + (v[6]-'0');
+    int d = (v[8]-'0')*10 + (v[9]-'0');
+    if (m < 1 || m > 12 || d < 1 || d > days_in_month(y, m)) return -1;
+    *days = date_to_days(y, m, d);
     return 0;
 }
 
-static int ensure_schema_exists(RedisModuleCtx *ctx, RedisModuleString *schemaName) {
-    RedisModule_AutoMemory(ctx);
-    RedisModuleKey *k = RedisModule_OpenKey(ctx, fmt(ctx, "schema:{%s}", schemaName), REDISMODULE_READ);
-    return RedisModule_KeyType(k) != REDISMODULE_KEYTYPE_EMPTY ? REDISMODULE_OK : REDISMODULE_ERR;
+// Parse the text of a numeric value (integer, float or date); returns -1 if malformed
+static int typed_parse(int type, const char *v, size_t vlen, TypedValue *out) {
+    if (type == COLTYPE_DATE) return parse_date(v, vlen, &out->i);
+    if (vlen == 0 || vlen > 63) return -1;
+    char buf[64], *end;
+    memcpy(buf, v, vlen);
+    buf[vlen] = '\0';
+    errno = 0;
+    if (type == COLTYPE_INTEGER) out->i = strtoll(buf, &end, 10);
+    else out->d = strtod(buf, &end);
+    return (errno == ERANGE || end != buf + vlen) ? -1 : 0;
 }
 
-static int ensure_table_exists(RedisModuleCtx *ctx, RedisModuleString *fullTableName) {
-    RedisModule_AutoMemory(ctx);
-    RedisModuleKey *k = RedisModule_OpenKey(ctx, fmt(ctx, "schema:{%s}", fullTableName), REDISMODULE_READ);
-    return RedisModule_KeyType(k) == REDISMODULE_KEYTYPE_HASH ? REDISMODULE_OK : REDISMODULE_ERR;
+// Format a numeric value back to text, floats use the shortest exact representation
+static size_t typed_format(int type, TypedValue v, char *buf, size_t buflen) {
+    int n;
+    if (type == COLTYPE_INTEGER) {
+        n = snprintf(buf, buflen, "%lld", (long long)v.i);
+    } else if (type == COLTYPE_DATE) {
+        int64_t y; int m, d;
+        days_to_date(v.i, &y, &m, &d);
+        n = snprintf(buf, buflen, "%04lld-%02d-%02d", (long long)y, m, d);
+    } else {
+        n = snprintf(buf, buflen, "%.15g", v.d);
+        if (strtod(buf, NULL) != v.d) n = snprintf(buf, buflen, "%.17g", v.d);
+    }
+    return n < 0 ? 0 : (size_t)n;
 }
 
-static RedisModuleString* extract_schema(RedisModuleCtx *ctx, RedisModuleString *fullTable) {
-    size_t len; const char *s = RedisModule_StringPtrLen(fullTable, &len);
-    const char *dot = memchr(s, '.', len);
-    if (!dot) return NULL;
-    return RedisModule_CreateString(ctx, s, (size_t)(dot - s));
+typedef int (*typed_cmp_fn)(TypedValue a, TypedValue b);
+
+static int cmp_int_eq(TypedValue a, TypedValue b) { return a.i == b.i; }
+static int cmp_int_gt(TypedValue a, TypedValue b) { return a.i > b.i; }
+static int cmp_int_lt(TypedValue a, TypedValue b) { return a.i < b.i; }
+static int cmp_int_ge(TypedValue a, TypedValue b) { return a.i >= b.i; }
+static int cmp_int_le(TypedValue a, TypedValue b) { return a.i <= b.i; }
+static int cmp_dbl_eq(TypedValue a, TypedValue b) { return a.d == b.d; }
+static int cmp_dbl_gt(TypedValue a, TypedValue b) { return a.d > b.d; }
+static int cmp_dbl_lt(TypedValue a, TypedValue b) { return a.d < b.d; }
+static int cmp_dbl_ge(TypedValue a, TypedValue b) { return a.d >= b.d; }
+static int cmp_dbl_le(TypedValue a, TypedValue b) { return a.d <= b.d; }
+
+// Indexed by OP_*
+static const typed_cmp_fn int_cmp[] = { cmp_int_eq, cmp_int_gt, cmp_int_lt, cmp_int_ge, cmp_int_le };
+static const typed_cmp_fn dbl_cmp[] = { cmp_dbl_eq, cmp_dbl_gt, cmp_dbl_lt, cmp_dbl_ge, cmp_dbl_le };
+
+// Outcome of an operator given the sign of a three-way comparison
+static inline int op_holds(int op, int cmp) {
+    switch (op) {
+    case OP_EQ: return cmp == 0;
+    case OP_GT: return cmp > 0;
+    case OP_LT: return cmp < 0;
+    case OP_GE: return cmp >= 0;
+    default:    return cmp <= 0;
+    }
 }
 
-static RedisModuleString* extract_table(RedisModuleCtx *ctx, RedisModuleString *fullTable) {
-    size_t len; const char *s = RedisModule_StringPtrLen(fullTable, &len);
-    const char *dot = memchr(s, '.', len);
-    if (!dot) return NULL;
-    return RedisModule_CreateString(ctx, dot + 1, len - (size_t)(dot - s) - 1);
+// A WHERE condition resolved once per query: operator, column type and parsed constant
+typedef struct {
+    int type;               // COLTYPE_*
+    int op;                 // OP_*
+    int numeric;            // compare parsed numbers, otherwise strcmp on the text
+    typed_cmp_fn cmp;       // numeric comparison for type and op
+    TypedValue arg;         // parsed constant
+    const char *text;       // constant as text (NUL-terminated)
+} Predicate;
+
+static void predicate_init(Predicate *p, int type, const char *op, const char *val) {
+    p->type = type;
+    p->op = parse_op(op);
+    p->text = val;
+    p->numeric = 0;
+    if (type == COLTYPE_INTEGER) {
+        p->numeric = 1; p->arg.i = atoll(val); p->cmp = int_cmp[p->op];
+    } else if (type == COLTYPE_FLOAT) {
+        p->numeric = 1; p->arg.d = atof(val); p->cmp = dbl_cmp[p->op];
+    } else if (type == COLTYPE_DATE) {
+        // Calendar dates compare as day numbers, anything else as text
+        p->numeric = parse_date(val, strlen(val), &p->arg.i) == 0;
+        p->cmp = int_cmp[p->op];
+    }
 }
 
-static int validate_and_typecheck(RedisModuleCtx *ctx, RedisModuleString *fullTableName,
-                                  RedisModuleString *col, RedisModuleString *val) {
-    RedisModule_AutoMemory(ctx);
-    RedisModuleKey *schemaKey = RedisModule_OpenKey(ctx, fmt(ctx, "schema:{%s}", fullTableName), REDISMODULE_READ);
-    if (RedisModule_KeyType(schemaKey) != REDISMODULE_KEYTYPE_HASH) return REDISMODULE_ERR;
-    RedisModuleString *typeStr = NULL;
-    if (RedisModule_HashGet(schemaKey, REDISMODULE_HASH_NONE, col, &typeStr, NULL) != REDISMODULE_OK || !typeStr) return REDISMODULE_ERR;
-    size_t tlen; const char *t = RedisModule_StringPtrLen(typeStr, &tlen);
-    
-    if (tlen == 7 && strncasecmp(t, "integer", 7) == 0) {
-        // Validate integer
-        size_t vlen; const char *vs = RedisModule_StringPtrLen(val, &vlen);
-        if (vlen == 0) return REDISMODULE_ERR;
-        size_t i = 0; if (vs[0] == '-' || vs[0] == '+') i = 1; if (i >= vlen) return REDISMODULE_ERR;
-        for (; i < vlen; i++) if (vs[i] < '0' || vs[i] > '9') return REDISMODULE_ERR;
-    } else if (tlen == 5 && strncasecmp(t, "float", 5) == 0) {
-        // Validate float (simple check for digits, optional decimal point)
-        size_t vlen; const char *vs = RedisModule_StringPtrLen(val, &vlen);
-        if (vlen == 0) return REDISMODULE_ERR;
-        int hasDot = 0;
-        size_t i = 0; if (vs[0] == '-' || vs[0] == '+') i = 1; if (i >= vlen) return REDISMODULE_ERR;
-        for (; i < vlen; i++) {
-            if (vs[i] == '.') { if (hasDot) return REDISMODULE_ERR; hasDot = 1; }
-            else if (vs[i] < '0' || vs[i] > '9') return REDISMODULE_ERR;
+// Evaluate a predicate against a value stored as text
+static int predicate_match_text(const Predicate *p, const char *v) {
+    TypedValue tv;
+    if (p->type == COLTYPE_INTEGER) { tv.i = atoll(v); return p->cmp(tv, p->arg); }
+    if (p->type == COLTYPE_FLOAT) { tv.d = atof(v); return p->cmp(tv, p->arg); }
+    // Dates in YYYY-MM-DD format sort correctly as strings
+    return op_holds(p->op, strcmp(v, p->text));
+}
+
+/* ================== Comparison kernels ================== */
+
+// Numeric predicates on native tables compare a constant with runs of stored values,
+// integers and day numbers as int64 and floats as double. The kernels write one bit per
+// value; the widest one the CPU supports is picked when the module loads.
+
+// bits[k / 64] bit k set when vals[k] op c, for k in [0, n)
+typedef void (*CmpKernel)(const TypedValue *vals, size_t n, int op, TypedValue c, uint64_t *bits);
+
+#define KERNEL_LOOP(from, expr) \
+    for (size_t i = (from); i < n; i++) bits[i >> 6] |= (uint64_t)(expr) << (i & 63)
+
+static void cmp_i64_scalar(const TypedValue *vals, size_t n, int op, TypedValue c, uint64_t *bits) {
+    memset(bits, 0, sizeof(uint64_t) * ((n + 63) / 64));
+    int64_t k = c.i;
+    switch (op) {
+    case OP_EQ: KERNEL_LOOP(0, vals[i].i == k); break;
+    case OP_GT: KERNEL_LOOP(0, vals[i].i > k); break;
+    case OP_LT: KERNEL_LOOP(0, vals[i].i < k); break;
+    case OP_GE: KERNEL_LOOP(0, vals[i].i >= k); break;
+    default:    KERNEL_LOOP(0, vals[i].i <= k); break;
+    }
+}
+
+static void cmp_f64_scalar(const TypedValue *vals, size_t n, int op, TypedValue c, uint64_t *bits) {
+    memset(bits, 0, sizeof(uint64_t) * ((n + 63) / 64));
+    double k = c.d;
+    switch (op) {
+    case OP_EQ: KERNEL_LOOP(0, vals[i].d == k); break;
+    case OP_GT: KERNEL_LOOP(0, vals[i].d > k); break;
+    case OP_LT: KERNEL_LOOP(0, vals[i].d < k); break;
+    case OP_GE: KERNEL_LOOP(0, vals[i].d >= k); break;
+    default:    KERNEL_LOOP(0, vals[i].d <= k); break;
+    }
+}
+
+#ifdef HAVE_AVX2_KERNELS
+// Four values per instruction; a >= b is computed as !(b > a)
+__attribute__((target("avx2")))
+static void cmp_i64_avx2(const TypedValue *vals, size_t n, int op, TypedValue c, uint64_t *bits) {
+    memset(bits, 0, sizeof(uint64_t) * ((n + 63) / 64));
+    const __m256i k = _mm256_set1_epi64x(c.i), ones = _mm256_set1_epi64x(-1);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(vals + i)), m;
+        switch (op) {
+        case OP_EQ: m = _mm256_cmpeq_epi64(v, k); break;
+        case OP_GT: m = _mm256_cmpgt_epi64(v, k); break;
+        case OP_LT: m = _mm256_cmpgt_epi64(k, v); break;
+        case OP_GE: m = _mm256_xor_si256(_mm256_cmpgt_epi64(k, v), ones); break;
+        default:    m = _mm256_xor_si256(_mm256_cmpgt_epi64(v, k), ones); break;
         }
-    } else if (tlen == 4 && strncasecmp(t, "date", 4) == 0) {
-        // Validate date format YYYY-MM-DD
-        size_t vlen; const char *vs = RedisModule_StringPtrLen(val, &vlen);
-        if (vlen != 10) return REDISMODULE_ERR;
-        if (vs[4] != '-' || vs[7] != '-') return REDISMODULE_ERR;
-        for (int i = 0; i < 10; i++) {
-            if (i == 4 || i == 7) continue;
-            if (vs[i] < '0' || vs[i] > '9') return REDISMODULE_ERR;
+        bits[i >> 6] |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(m)) << (i & 63);
+    }
+    KERNEL_LOOP(i, int_cmp[op](vals[i], c));
+}
+
+__attribute__((target("avx2")))
+static void cmp_f64_avx2(const TypedValue *vals, size_t n, int op, TypedValue c, uint64_t *bits) {
+    memset(bits, 0, sizeof(uint64_t) * ((n + 63) / 64));
+    const __m256d k = _mm256_set1_pd(c.d);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_loadu_pd((const double *)(vals + i)), m;
+        switch (op) {
+        case OP_EQ: m = _mm256_cmp_pd(v, k, _CMP_EQ_OQ); break;
+        case OP_GT: m = _mm256_cmp_pd(v, k, _CMP_GT_OQ); break;
+        case OP_LT: m = _mm256_cmp_pd(v, k, _CMP_LT_OQ); break;
+        case OP_GE: m = _mm256_cmp_pd(v, k, _CMP_GE_OQ); break;
+        default:    m = _mm256_cmp_pd(v, k, _CMP_LE_OQ); break;
         }
+        bits[i >> 6] |= (uint64_t)_mm256_movemask_pd(m) << (i & 63);
     }
-    // String type (no validation needed)
-    return REDISMODULE_OK;
+    KERNEL_LOOP(i, dbl_cmp[op](vals[i], c));
 }
-// Validate string length (max 64 characters)
-static int validate_string_length(RedisModuleCtx *ctx, RedisModuleString *str, const char *name) {
+#endif
+
+#ifdef HAVE_NEON_KERNELS
+// Two values per instruction, lane masks folded into bits 0 and 1
+#define NEON_BITS(m) ((vgetq_lane_u64((m), 0) & 1) | (vgetq_lane_u64((m), 1) & 2))
+
+static void cmp_i64_neon(const TypedValue *vals, size_t n, int op, TypedValue c, uint64_t *bits) {
+    memset(bits, 0, sizeof(uint64_t) * ((n + 63) / 64));
+    const int64x2_t k = vdupq_n_s64(c.i);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        int64x2_t v = vld1q_s64((const int64_t *)(vals + i));
+        uint64x2_t m;
+        switch (op) {
+        case OP_EQ: m = vceqq_s64(v, k); break;
+        case OP_GT: m = vcgtq_s64(v, k); break;
+        case OP_LT: m = vcltq_s64(v, k); break;
+        case OP_GE: m = vcgeq_s64(v, k); break;
+        default:    m = vcleq_s64(v, k); break;
+        }
+        bits[i >> 6] |= NEON_BITS(m) << (i & 63);
+    }
+    KERNEL_LOOP(i, int_cmp[op](vals[i], c));
+}
+
+static void cmp_f64_neon(const TypedValue *vals, size_t n, int op, TypedValue c, uint64_t *bits) {
+    memset(bits, 0, sizeof(uint64_t) * ((n + 63) / 64));
+    const float64x2_t k = vdupq_n_f64(c.d);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        float64x2_t v = vld1q_f64((const double *)(vals + i));
+        uint64x2_t m;
+        switch (op) {
+        case OP_EQ: m = vceqq_f64(v, k); break;
+        case OP_GT: m = vcgtq_f64(v, k); break;
+        case OP_LT: m = vcltq_f64(v, k); break;
+        case OP_GE: m = vcgeq_f64(v, k); break;
+        default:    m = vcleq_f64(v, k); break;
+        }
+        bits[i >> 6] |= NEON_BITS(m) << (i & 63);
+    }
+    KERNEL_LOOP(i, dbl_cmp[op](vals[i], c));
+}
+#endif
+
+// Kernels in use, set by kernels_init()
+static struct {
+    CmpKernel i64, f64;
+    const char *name;
+} g_kernels = { cmp_i64_scalar, cmp_f64_scalar, "scalar" };
+
+static void kernels_init(void) {
+#ifdef HAVE_AVX2_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        g_kernels.i64 = cmp_i64_avx2; g_kernels.f64 = cmp_f64_avx2; g_kernels.name = "AVX2";
+    }
+#elif defined(HAVE_NEON_KERNELS)
+    g_kernels.i64 = cmp_i64_neon; g_kernels.f64 = cmp_f64_neon; g_kernels.name = "NEON";
+#endif
+}
+
+// Kernel evaluating a predicate on the stored values of a column type, NULL if the
+// predicate is not numeric
+static CmpKernel predicate_kernel(const Predicate *p, int coltype) {
+    if (!p->numeric) return NULL;
+    return coltype == COLTYPE_FLOAT ? g_kernels.f64 : g_kernels.i64;
+}
+
+/* ================== Row ID sets ================== */
+
+// The rows matching a query are collected as sorted arrays of row IDs. Row IDs come
+// from an INCR counter, so they are dense integers: 8 bytes each instead of a string,
+// ordered numerically, and merged with linear or galloping kernels.
+// Arrays come from the command's memory pool and are sized before they are filled.
+
+typedef struct {
+    uint64_t *ids;              // ascending, no duplicates
     size_t len;
-    RedisModule_StringPtrLen(str, &len);
-    if (len > 64) {
-        char error_msg[128];
-        snprintf(error_msg, sizeof(error_msg), "ERR incorrect %s name, it exceeds the limit of 64 characters", name);
-        return RedisModule_ReplyWithError(ctx, error_msg);
+} IdSet;
+
+static IdSet idset_alloc(RedisModuleCtx *ctx, size_t cap) {
+    IdSet s = { RedisModule_PoolAlloc(ctx, sizeof(uint64_t) * (cap ? cap : 1)), 0 };
+    return s;
+}
+
+static int idset_cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// Sort IDs collected in any order and drop duplicates
+static void idset_normalize(IdSet *s) {
+    size_t i = 1;
+    while (i < s->len && s->ids[i - 1] < s->ids[i]) i++;
+    if (i >= s->len) return;
+    qsort(s->ids, s->len, sizeof(uint64_t), idset_cmp);
+    size_t n = 1;
+    for (i = 1; i < s->len; i++)
+        if (s->ids[i] != s->ids[n - 1]) s->ids[n++] = s->ids[i];
+    s->len = n;
+}
+
+// First position from lo on holding an ID >= id: doubling steps, then a binary search
+static size_t idset_seek(const uint64_t *ids, size_t len, size_t lo, uint64_t id) {
+    if (lo >= len || ids[lo] >= id) return lo;
+    size_t step = 1;
+    while (lo + step < len && ids[lo + step] < id) { lo += step; step <<= 1; }
+    size_t hi = lo + step < len ? lo + step : len;
+    lo++;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ids[mid] < id) lo = mid + 1; else hi = mid;
     }
-    return REDISMODULE_OK;
+    return lo;
 }
-static int TableNamespaceCreateCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-    if (argc != 2) return RedisModule_WrongArity(ctx);
-    RedisModule_AutoMemory(ctx);
 
-    // Validate namespace length (max 64 characters)
-    if (validate_string_length(ctx, argv[1], "namespace") != REDISMODULE_OK) {
-        return REDISMODULE_ERR;
+// Sets more than this many times larger than the other side are galloped through
+#define IDSET_GALLOP_RATIO 32
+
+static IdSet idset_intersect(RedisModuleCtx *ctx, IdSet a, IdSet b) {
+    if (a.len > b.len) { IdSet t = a; a = b; b = t; }
+    IdSet out = idset_alloc(ctx, a.len);
+    size_t i = 0, j = 0;
+    if (b.len / IDSET_GALLOP_RATIO > a.len) {
+        for (; i < a.len && j < b.len; i++) {
+            j = idset_seek(b.ids, b.len, j, a.ids[i]);
+            if (j < b.len && b.ids[j] == a.ids[i]) out.ids[out.len++] = a.ids[i];
+        }
+        return out;
+    }
+    while (i < a.len && j < b.len) {
+        if (a.ids[i] < b.ids[j]) i++;
+        else if (a.ids[i] > b.ids[j]) j++;
+        else { out.ids[out.len++] = a.ids[i]; i++; j++; }
     }
+    return out;
+}
 
-    RedisModuleKey *k = RedisModule_OpenKey(ctx, fmt(ctx, "schema:{%s}", argv[1]), REDISMODULE_WRITE);
-    if (RedisModule_KeyType(k) != REDISMODULE_KEYTYPE_EMPTY)
-        return RedisModule_ReplyWithError(ctx, "ERR namespace already exists");
-    RedisModule_StringSet(k, RedisModule_CreateString(ctx, "1", 1));
-    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+static IdSet idset_union(RedisModuleCtx *ctx, IdSet a, IdSet b) {
+    IdSet out = idset_alloc(ctx, a.len + b.len);
+    size_t i = 0, j = 0;
+    while (i < a.len && j < b.len) {
+        if (a.ids[i] < b.ids[j]) out.ids[out.len++] = a.ids[i++];
+        else if (a.ids[i] > b.ids[j]) out.ids[out.len++] = b.ids[j++];
+        else { out.ids[out.len++] = a.ids[i++]; j++; }
+    }
+    while (i < a.len) out.ids[out.len++] = a.ids[i++];
+    while (j < b.len) out.ids[out.len++] = b.ids[j++];
+    return out;
 }
 
-/* ================== TABLE.NAMESPACE.VIEW [<namespace>] ================== */
-static int TableNamespaceViewCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-    if (argc != 1 && argc != 2) return RedisModule_WrongArity(ctx);
-    RedisModule_AutoMemory(ctx);
-    
-    const char *filter_namespace = NULL;
-    size_t filter_len = 0;
-    if (argc == 2) {
-        filter_namespace = RedisModule_StringPtrLen(argv[1], &filter_len);
+static IdSet idset_copy(RedisModuleCtx *ctx, IdSet s) {
+    IdSet out = idset_alloc(ctx, s.len);
+    memcpy(out.ids, s.ids, sizeof(uint64_t) * s.len);
+    out.len = s.len;
+    return out;
+}
+
+// Parse a row ID; returns 0 if the text is not one
+static uint64_t idset_parse_id(const char *s, size_t len) {
+    if (len == 0 || len > 20) return 0;
+    uint64_t id = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9') return 0;
+        id = id * 10 + (uint64_t)(s[i] - '0');
     }
-    
-    // Use SCAN instead of KEYS to avoid blocking Redis on large keyspaces
-    // Collect namespace:table pairs with dynamic allocation
-    typedef struct {
-        char namespace[256];
-        char table[256];
-    } TableEntry;
-    
-    size_t capacity = 100;
-    size_t count = 0;
-    TableEntry *entries = RedisModule_Alloc(sizeof(TableEntry) * capacity);
-    if (entries == NULL) {
-        return RedisModule_ReplyWithError(ctx, "ERR out of memory");
+    return id;
+}
+
+// The IDs ids[from..to) as one comma separated string, as replicated to replicas
+static RedisModuleString *idset_format(RedisModuleCtx *ctx, IdSet ids, size_t from, size_t to) {
+    RedisModuleString *list = RedisModule_CreateString(ctx, "", 0);
+    char buf[24];
+    for (size_t i = from; i < to; i++) {
+        int n = snprintf(buf, sizeof(buf), i > from ? ",%llu" : "%llu", (unsigned long long)ids.ids[i]);
+        RedisModule_StringAppendBuffer(ctx, list, buf, (size_t)n);
     }
-    
-    // SCAN cursor-based iteration (non-blocking)
-    unsigned long long cursor = 0;
-    do {
-        // Convert cursor to string for SCAN command
-        char cursorBuf[32];
-        snprintf(cursorBuf, sizeof(cursorBuf), "%llu", cursor);
-        
-        // Call SCAN with cursor as string, MATCH pattern
-        RedisModuleCallReply *scanReply = RedisModule_Call(ctx, "SCAN", "ccc", 
-                                                            cursorBuf,
-                                                            "MATCH", "schema:{*.*}");
-        if (!scanReply || RedisModule_CallReplyType(scanReply) != REDISMODULE_REPLY_ARRAY) {
-            RedisModule_Free(entries);
-            return RedisModule_ReplyWithArray(ctx, 0);
-        }
-        
-        // Extract new cursor from reply[0]
-        RedisModuleCallReply *cursorReply = RedisModule_CallReplyArrayElement(scanReply, 0);
-        if (!cursorReply) break;
-        
-        size_t cursorStrLen;
-        const char *cursorStr = RedisModule_CallReplyStringPtr(cursorReply, &cursorStrLen);
-        if (!cursorStr) break;
-        
-        cursor = strtoull(cursorStr, NULL, 10);
-        
-        // Extract keys array from reply[1]
-        RedisModuleCallReply *keysReply = RedisModule_CallReplyArrayElement(scanReply, 1);
-        if (!keysReply || RedisModule_CallReplyType(keysReply) != REDISMODULE_REPLY_ARRAY) {
-            continue;
-        }
-        
-        size_t n = RedisModule_CallReplyLength(keysReply);
-        for (size_t i = 0; i < n; i++) {
-            RedisModuleCallReply *keyReply = RedisModule_CallReplyArrayElement(keysReply, i);
-            size_t keylen;
-            const char *keystr = RedisModule_CallReplyStringPtr(keyReply, &keylen);
-            
-            // Skip if not in format "schema:namespace.table"
-            if (keylen < 10 || strncmp(keystr, "schema:{", 8) != 0) continue;
-            
-            const char *fullname = keystr + 8;  // Skip "schema:{"
-            size_t fullname_len = keylen - 9;  // Exclude trailing }
-            
-            // Find the dot separator
-            const char *dot = memchr(fullname, '.', fullname_len);
-            if (!dot) continue;  // Not a table (just a namespace marker)
-            
-            size_t ns_len = (size_t)(dot - fullname);
-            size_t tbl_len = fullname_len - ns_len - 1;
-            
-            // Apply filter if provided
-            if (filter_namespace && (ns_len != filter_len || strncmp(fullname, filter_namespace, ns_len) != 0)) {
-                continue;
-            }
-            
-            // Resize array if needed
-            if (count >= capacity) {
-                capacity *= 2;
-                TableEntry *newEntries = RedisModule_Realloc(entries, sizeof(TableEntry) * capacity);
-                if (newEntries == NULL) {
-                    RedisModule_Free(entries);
-                    return RedisModule_ReplyWithError(ctx, "ERR out of memory");
-                }
-                entries = newEntries;
-            }
-            
-            // Store entry
-            if (ns_len < 256 && tbl_len < 256) {
-                strncpy(entries[count].namespace, fullname, ns_len);
-                entries[count].namespace[ns_len] = '\0';
-                strncpy(entries[count].table, dot + 1, tbl_len);
-                entries[count].table[tbl_len] = '\0';
-                count++;
-            }
-        }
-    } while (cursor != 0);
-    
-    // Simple bubble sort by namespace (then by table)
-    if (count > 1) {
-        for (size_t i = 0; i < count - 1; i++) {
-            for (size_t j = 0; j < count - i - 1; j++) {
-                int cmp = strcmp(entries[j].namespace, entries[j+1].namespace);
-                if (cmp > 0 || (cmp == 0 && strcmp(entries[j].table, entries[j+1].table) > 0)) {
-                    TableEntry temp = entries[j];
-                    entries[j] = entries[j+1];
-                    entries[j+1] = temp;
-                }
-            }
+    return list;
+}
+
+// Row IDs of a set or sorted set reply. With lex set the members are string btree
+// entries, the row ID following the last NUL separator
+static IdSet idset_from_reply(RedisModuleCtx *ctx, RedisModuleCallReply *r, int lex) {
+    if (!r || RedisModule_CallReplyType(r) != REDISMODULE_REPLY_ARRAY) return idset_alloc(ctx, 0);
+    size_t n = RedisModule_CallReplyLength(r);
+    IdSet s = idset_alloc(ctx, n);
+    for (size_t i = 0; i < n; i++) {
+        size_t l; const char *m = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(r, i), &l);
+        if (!m) continue;
+        if (lex) {
+            size_t sep = l;
+            while (sep > 0 && m[sep - 1] != '\0') sep--;
+            if (sep == 0) continue;
+            m += sep; l -= sep;
         }
+        uint64_t id = idset_parse_id(m, l);
+        if (id) s.ids[s.len++] = id;
     }
-    
-    // Reply with array of "namespace:table" strings
-    RedisModule_ReplyWithArray(ctx, count);
-    for (size_t i = 0; i < count; i++) {
-        RedisModuleString *result = RedisModule_CreateStringPrintf(ctx, "%s:%s", entries[i].namespace, entries[i].table);
-        RedisModule_ReplyWithString(ctx, result);
-    }
-    
-    RedisModule_Free(entries);
-    return REDISMODULE_OK;
+    idset_normalize(&s);
+    return s;
 }
 
-/* ================== TABLE.SCHEMA.VIEW <namespace.table> ================== */
-static int TableSchemaViewCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-    if (argc != 2) return RedisModule_WrongArity(ctx);
-    RedisModule_AutoMemory(ctx);
-    
-    if (ensure_table_exists(ctx, argv[1]) != REDISMODULE_OK)
-        return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
-    
-    // Get all columns from table schema
-    RedisModuleCallReply *fields = RedisModule_Call(ctx, "HGETALL", "s", fmt(ctx, "schema:{%s}", argv[1]));
-    if (!fields || RedisModule_CallReplyType(fields) != REDISMODULE_REPLY_ARRAY) {
-        return RedisModule_ReplyWithArray(ctx, 0);
+/* ================== Result cache ================== */
+// Replies of TABLE.SELECT and TABLE.AGGREGATE are kept when result_cache_mb is set, and
+// served again to the same query until its table is written. Queries are keyed by their
+// normalised form (see select_cache_key()), after the "<db>:<ns.t>" of their table.
+// Each table has a write version: a write drops the entries of the table and gives it a
+// new version, so a query begun before the write and answered after it is not kept.
+// The least recently used entries are evicted to stay within the memory cap.
+// Replies are recorded as they are built: the out_*() functions reply and, while a
+// capture is open, append the reply to it.
+
+// Captured replies: a tag byte, then its payload
+#define REPLY_ARRAY  'A'    // int64 length, then the elements
+#define REPLY_MAP    'M'    // int64 number of pairs, then the keys and values
+#define REPLY_BULK   'B'    // uint32 length, bytes
+#define REPLY_SIMPLE 'S'    // uint32 length, bytes
+#define REPLY_NULL   'N'
+#define REPLY_INT    'I'    // int64
+#define REPLY_ERROR  'E'    // uint32 length, bytes: in the replies of shards only (see "Sharded tables")
+
+// Postponed arrays and maps open at once in a captured reply
+#define REPLY_CAPTURE_DEPTH 8
+// A reply larger than this share of the cache is not kept
+#define RESULT_CACHE_ENTRY_SHARE 4
+
+typedef struct {
+    unsigned char *buf;
+    size_t len, cap;
+    size_t max;                         // the capture fails beyond
+    size_t open[REPLY_CAPTURE_DEPTH];   // offsets of postponed array and map lengths
+    int depth;
+    int failed;
+} ReplyCapture;
+
+static ReplyCapture g_capture;
+static int g_capturing = 0;
+
+static void capture_put(const void *p, size_t n) {
+    if (g_capture.failed) return;
+    if (g_capture.len + n > g_capture.max) {
+        g_capture.failed = 1;
+        return;
     }
-    
-    size_t n = RedisModule_CallReplyLength(fields);
-    size_t numCols = n / 2;
-    
-    // Reply format: array of [column, type, indexed]
-    RedisModule_ReplyWithArray(ctx, numCols);
-    
-    for (size_t i = 0; i < n; i += 2) {
-        RedisModuleCallReply *colReply = RedisModule_CallReplyArrayElement(fields, i);
-        RedisModuleCallReply *typeReply = RedisModule_CallReplyArrayElement(fields, i + 1);
-        
-        RedisModuleString *col = RedisModule_CreateStringFromCallReply(colReply);
-        RedisModuleString *type = RedisModule_CreateStringFromCallReply(typeReply);
-        
-        // Check if indexed
-        int indexed = is_column_indexed(ctx, argv[1], col);
-        
-        // Reply with array: [column, type, indexed]
-        RedisModule_ReplyWithArray(ctx, 3);
-        RedisModule_ReplyWithString(ctx, col);
-        RedisModule_ReplyWithString(ctx, type);
-        RedisModule_ReplyWithSimpleString(ctx, indexed ? "true" : "false");
+    if (g_capture.len + n > g_capture.cap) {
+        g_capture.cap = g_capture.cap ? g_capture.cap * 2 : 256;
+        if (g_capture.cap < g_capture.len + n) g_capture.cap = g_capture.len + n;
+        g_capture.buf = RedisModule_Realloc(g_capture.buf, g_capture.cap);
     }
-    
-    return REDISMODULE_OK;
+    memcpy(g_capture.buf + g_capture.len, p, n);
+    g_capture.len += n;
 }
 
-/* ================== TABLE.SCHEMA.CREATE <namespace.table> <col:type:index> ... ================== */
-static int TableSchemaCreateCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-    if (argc < 3) return RedisModule_WrongArity(ctx);
-    RedisModule_AutoMemory(ctx);
+static void capture_tagged(unsigned char tag, const void *p, size_t n, int sized) {
+    capture_put(&tag, 1);
+    if (sized) {
+        uint32_t l = (uint32_t)n;
+        capture_put(&l, sizeof(l));
+    }
+    if (n) capture_put(p, n);
+}
 
-    RedisModuleString *schema = extract_schema(ctx, argv[1]);
-    if (!schema) return RedisModule_ReplyWithError(ctx, "ERR table name must be namespace.table");
+// Field/value pairs are replied as a map: RESP3 clients get a map, RESP2 ones the flat
+// array of pairs they always had. Servers older than 7.0 lack maps and reply the array.
+static void reply_map(RedisModuleCtx *ctx, long pairs) {
+    if (RedisModule_ReplyWithMap) RedisModule_ReplyWithMap(ctx, pairs);
+    else RedisModule_ReplyWithArray(ctx, pairs == REDISMODULE_POSTPONED_LEN ? pairs : pairs * 2);
+}
 
-    // Validate namespace length (max 64 characters)
-    if (validate_string_length(ctx, schema, "namespace") != REDISMODULE_OK) {
-        return REDISMODULE_ERR;
+static void reply_set_map_length(RedisModuleCtx *ctx, long pairs) {
+    if (RedisModule_ReplySetMapLength) RedisModule_ReplySetMapLength(ctx, pairs);
+    else RedisModule_ReplySetArrayLength(ctx, pairs * 2);
+}
+
+static void capture_open(unsigned char tag, long len) {
+    if (len == REDISMODULE_POSTPONED_LEN) {
+        if (g_capture.depth == REPLY_CAPTURE_DEPTH) g_capture.failed = 1;
+        else g_capture.open[g_capture.depth++] = g_capture.len;
     }
+    int64_t n = len;
+    capture_tagged(tag, &n, sizeof(n), 0);
+}
 
-    // Validate table name length (max 64 characters)
-    RedisModuleString *table = extract_table(ctx, argv[1]);
-    if (!table || validate_string_length(ctx, table, "table") != REDISMODULE_OK) {
-        return REDISMODULE_ERR;
+static void capture_set_length(long len) {
+    if (g_capture.failed) return;
+    if (g_capture.depth == 0) {
+        g_capture.failed = 1;
+        return;
     }
+    int64_t n = len;
+    memcpy(g_capture.buf + g_capture.open[--g_capture.depth] + 1, &n, sizeof(n));
+}
 
-    if (ensure_schema_exists(ctx, schema) != REDISMODULE_OK)
-        return RedisModule_ReplyWithError(ctx, "ERR namespace does not exist");
+static void out_array(RedisModuleCtx *ctx, long len) {
+    RedisModule_ReplyWithArray(ctx, len);
+    if (g_capturing) capture_open(REPLY_ARRAY, len);
+}
 
-    RedisModuleKey *schemaKey = RedisModule_OpenKey(ctx, fmt(ctx, "schema:{%s}", argv[1]), REDISMODULE_WRITE);
-    if (RedisModule_KeyType(schemaKey) != REDISMODULE_KEYTYPE_EMPTY)
-        return RedisModule_ReplyWithError(ctx, "ERR table schema already exists");
+static void out_set_array_length(RedisModuleCtx *ctx, long len) {
+    RedisModule_ReplySetArrayLength(ctx, len);
+    if (g_capturing) capture_set_length(len);
+}
 
-    RedisModuleString *metaKey = fmt(ctx, "{%s}:idx:meta", argv[1]);
+static void out_map(RedisModuleCtx *ctx, long pairs) {
+    reply_map(ctx, pairs);
+    if (g_capturing) capture_open(REPLY_MAP, pairs);
+}
 
-    // Parse col:type:index (index is optional, defaults to none)
-    for (int i = 2; i < argc; i++) {
-        size_t len; const char *s = RedisModule_StringPtrLen(argv[i], &len);
+static void out_set_map_length(RedisModuleCtx *ctx, long pairs) {
+    reply_set_map_length(ctx, pairs);
+    if (g_capturing) capture_set_length(pairs);
+}
+
+static void out_buffer(RedisModuleCtx *ctx, const char *s, size_t len) {
+    RedisModule_ReplyWithStringBuffer(ctx, s, len);
+    if (g_capturing) capture_tagged(REPLY_BULK, s, len, 1);
+}
+
+static void out_string(RedisModuleCtx *ctx, RedisModuleString *s) {
+    RedisModule_ReplyWithString(ctx, s);
+    if (!g_capturing) return;
+    size_t len; const char *p = RedisModule_StringPtrLen(s, &len);
+    capture_tagged(REPLY_BULK, p, len, 1);
+}
+
+static void out_simple(RedisModuleCtx *ctx, const char *s) {
+    RedisModule_ReplyWithSimpleString(ctx, s);
+    if (g_capturing) capture_tagged(REPLY_SIMPLE, s, strlen(s), 1);
+}
+
+static void out_null(RedisModuleCtx *ctx) {
+    RedisModule_ReplyWithNull(ctx);
+    if (g_capturing) capture_tagged(REPLY_NULL, NULL, 0, 0);
+}
+
+static void out_longlong(RedisModuleCtx *ctx, long long v) {
+    RedisModule_ReplyWithLongLong(ctx, v);
+    int64_t n = v;
+    if (g_capturing) capture_tagged(REPLY_INT, &n, sizeof(n), 0);
+}
+
+// Reply again with a captured reply
+static void reply_replay(RedisModuleCtx *ctx, const unsigned char *p, size_t len) {
+    const unsigned char *end = p + len;
+    while (p < end) {
+        unsigned char tag = *p++;
+        int64_t n = 0;
+        uint32_t l = 0;
+        if (tag == REPLY_ARRAY || tag == REPLY_MAP || tag == REPLY_INT) {
+            memcpy(&n, p, sizeof(n));
+            p += sizeof(n);
+        } else if (tag == REPLY_BULK || tag == REPLY_SIMPLE) {
+            memcpy(&l, p, sizeof(l));
+            p += sizeof(l);
+        }
+        switch (tag) {
+        case REPLY_ARRAY: RedisModule_ReplyWithArray(ctx, (long)n); break;
+        case REPLY_MAP: reply_map(ctx, (long)n); break;
+        case REPLY_INT: RedisModule_ReplyWithLongLong(ctx, (long long)n); break;
+        case REPLY_NULL: RedisModule_ReplyWithNull(ctx); break;
+        case REPLY_BULK: RedisModule_ReplyWithStringBuffer(ctx, (const char *)p, l); break;
+        case REPLY_SIMPLE: {
+            // Simple strings are short: the cursor of a paged SELECT
+            char buf[64];
+            size_t cl = l < sizeof(buf) - 1 ? l : sizeof(buf) - 1;
+            memcpy(buf, p, cl);
+            buf[cl] = '\0';
+            RedisModule_ReplyWithSimpleString(ctx, buf);
+            break;
+        }
+        }
+        p += l;
+    }
+}
+
+struct CacheTable;
+
+typedef struct CacheEntry {
+    struct CacheEntry *prev, *next;     // LRU list, most recently used first
+    struct CacheEntry *tprev, *tnext;   // entries of the same table
+    struct CacheTable *table;
+    char *key;
+    size_t klen;
+    unsigned char *reply;
+    size_t len;
+    uint64_t version;                   // write version of the table the reply was built at
+} CacheEntry;
+
+typedef struct CacheTable {
+    uint64_t version;
+    CacheEntry *entries;
+} CacheTable;
+
+static RedisModuleDict *g_result_cache = NULL;  // "<db>:<ns.t>" + query -> CacheEntry*
+static RedisModuleDict *g_cache_tables = NULL;  // "<db>:<ns.t>" -> CacheTable*
+static CacheEntry *g_cache_head = NULL, *g_cache_tail = NULL;
+static size_t g_cache_used = 0;                 // bytes held by the entries
+static uint64_t g_cache_seq = 0;                // last write version handed out
+
+// Query looked up in the result cache
+typedef struct {
+    RedisModuleString *key;     // "<db>:<ns.t>" then the normalised query, NULL = not cached
+    size_t tlen;                // length of "<db>:<ns.t>"
+    uint64_t version;           // write version of the table when the query began
+} CachedQuery;
+
+static inline size_t result_cache_entry_size(CacheEntry *e) {
+    return sizeof(CacheEntry) + e->klen + e->len;
+}
+
+static void result_cache_lru_unlink(CacheEntry *e) {
+    if (e->prev) e->prev->next = e->next; else g_cache_head = e->next;
+    if (e->next) e->next->prev = e->prev; else g_cache_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void result_cache_lru_push(CacheEntry *e) {
+    e->prev = NULL;
+    e->next = g_cache_head;
+    if (g_cache_head) g_cache_head->prev = e; else g_cache_tail = e;
+    g_cache_head = e;
+}
+
+static void result_cache_remove(CacheEntry *e) {
+    result_cache_lru_unlink(e);
+    if (e->tprev) e->tprev->tnext = e->tnext; else e->table->entries = e->tnext;
+    if (e->tnext) e->tnext->tprev = e->tprev;
+    RedisModule_DictDelC(g_result_cache, e->key, e->klen, NULL);
+    g_cache_used -= result_cache_entry_size(e);
+    RedisModule_Free(e->key);
+    RedisModule_Free(e->reply);
+    RedisModule_Free(e);
+}
+
+// Drop the entries of a table, which gets a new write version when next queried
+static void result_cache_forget(int db, const char *name, size_t nlen) {
+    if (!g_cache_tables || RedisModule_DictSize(g_cache_tables) == 0) return;
+    char key[256];
+    int n = snprintf(key, sizeof(key), "%d:", db);
+    if (n < 0 || (size_t)n + nlen >= sizeof(key)) return;
+    memcpy(key + n, name, nlen);
+    CacheTable *ct = NULL;
+    if (RedisModule_DictDelC(g_cache_tables, key, (size_t)n + nlen, &ct) != REDISMODULE_OK || !ct) return;
+    while (ct->entries) result_cache_remove(ct->entries);
+    RedisModule_Free(ct);
+}
+
+static void result_cache_forget_table(RedisModuleCtx *ctx, RedisModuleString *table) {
+    size_t nlen; const char *name = RedisModule_StringPtrLen(table, &nlen);
+    result_cache_forget(RedisModule_GetSelectedDb(ctx), name, nlen);
+}
+
+// Drop every entry (FLUSHDB, SWAPDB, RDB load)
+static void result_cache_clear(void) {
+    if (!g_cache_tables) return;
+    while (g_cache_head) result_cache_remove(g_cache_head);
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(g_cache_tables, "^", NULL, 0);
+    CacheTable *ct;
+    while (RedisModule_DictNextC(it, NULL, (void**)&ct)) RedisModule_Free(ct);
+    RedisModule_DictIteratorStop(it);
+    RedisModule_FreeDict(NULL, g_cache_tables);
+    g_cache_tables = RedisModule_CreateDict(NULL);
+}
+
+// Start the cache key of a query on table; cq->key is left NULL when there is no cache
+static void cached_query_init(RedisModuleCtx *ctx, RedisModuleString *table, const char *cmd, CachedQuery *cq) {
+    cq->key = NULL;
+    cq->version = 0;
+    if (g_result_cache_mb <= 0) return;
+    cq->key = RedisModule_CreateStringPrintf(ctx, "%d:%s", RedisModule_GetSelectedDb(ctx),
+                                             RedisModule_StringPtrLen(table, NULL));
+    RedisModule_StringPtrLen(cq->key, &cq->tlen);
+    RedisModule_StringAppendBuffer(ctx, cq->key, "", 1);
+    RedisModule_StringAppendBuffer(ctx, cq->key, cmd, strlen(cmd));
+}
+
+// Append one component to the key, prefixed by its length
+static void cached_query_add(RedisModuleCtx *ctx, CachedQuery *cq, const char *p, size_t len) {
+    if (!cq->key) return;
+    uint32_t l = (uint32_t)len;
+    RedisModule_StringAppendBuffer(ctx, cq->key, (const char *)&l, sizeof(l));
+    RedisModule_StringAppendBuffer(ctx, cq->key, p, len);
+}
+
+static void cached_query_add_string(RedisModuleCtx *ctx, CachedQuery *cq, RedisModuleString *s) {
+    size_t len; const char *p = s ? RedisModule_StringPtrLen(s, &len) : "";
+    cached_query_add(ctx, cq, p, s ? len : 0);
+}
+
+static void cached_query_add_number(RedisModuleCtx *ctx, CachedQuery *cq, long long v) {
+    char buf[24];
+    int n = snprintf(buf, sizeof(buf), "%lld", v);
+    cached_query_add(ctx, cq, buf, (size_t)n);
+}
+
+// Reply from the cache if the query is there: returns 1 if it replied. Otherwise the
+// query is given the current write version of its table
+static int result_cache_reply(RedisModuleCtx *ctx, CachedQuery *cq) {
+    size_t klen; const char *k = RedisModule_StringPtrLen(cq->key, &klen);
+    CacheTable *ct = RedisModule_DictGetC(g_cache_tables, (void*)k, cq->tlen, NULL);
+    if (!ct) {
+        ct = RedisModule_Calloc(1, sizeof(CacheTable));
+        ct->version = ++g_cache_seq;
+        RedisModule_DictSetC(g_cache_tables, (void*)k, cq->tlen, ct);
+    }
+    cq->version = ct->version;
+    CacheEntry *e = RedisModule_DictGetC(g_result_cache, (void*)k, klen, NULL);
+    if (!e || e->version != ct->version) return 0;
+    result_cache_lru_unlink(e);
+    result_cache_lru_push(e);
+    reply_replay(ctx, e->reply, e->len);
+    return 1;
+}
+
+// Record the reply about to be built for the query
+static void result_cache_capture(CachedQuery *cq) {
+    if (!cq->key) return;
+    memset(&g_capture, 0, sizeof(g_capture));
+    g_capture.max = (size_t)g_result_cache_mb * 1024 * 1024 / RESULT_CACHE_ENTRY_SHARE;
+    g_capturing = 1;
+}
+
+// Keep the reply recorded since result_cache_capture(), unless the table was written
+// meanwhile or the reply was an error
+static void result_cache_store(CachedQuery *cq) {
+    if (!g_capturing) return;
+    g_capturing = 0;
+    size_t klen; const char *k = RedisModule_StringPtrLen(cq->key, &klen);
+    CacheTable *ct = RedisModule_DictGetC(g_cache_tables, (void*)k, cq->tlen, NULL);
+    if (g_capture.failed || g_capture.depth || !g_capture.len || !ct || ct->version != cq->version ||
+        RedisModule_DictGetC(g_result_cache, (void*)k, klen, NULL)) {
+        RedisModule_Free(g_capture.buf);
+        g_capture.buf = NULL;
+        return;
+    }
+    CacheEntry *e = RedisModule_Calloc(1, sizeof(CacheEntry));
+    e->key = RedisModule_Alloc(klen);
+    memcpy(e->key, k, klen);
+    e->klen = klen;
+    e->reply = RedisModule_Realloc(g_capture.buf, g_capture.len);
+    e->len = g_capture.len;
+    e->version = cq->version;
+    e->table = ct;
+    g_capture.buf = NULL;
+
+    size_t cap = (size_t)g_result_cache_mb * 1024 * 1024;
+    while (g_cache_tail && g_cache_used + result_cache_entry_size(e) > cap) result_cache_remove(g_cache_tail);
+    e->tnext = ct->entries;
+    if (ct->entries) ct->entries->tprev = e;
+    ct->entries = e;
+    result_cache_lru_push(e);
+    RedisModule_DictSetC(g_result_cache, e->key, e->klen, e);
+    g_cache_used += result_cache_entry_size(e);
+}
+
+/* ================== Schema cache ================== */
+
+static int parse_column_type(const char *t, size_t tlen) {
+    if (tlen == 7 && strncasecmp(t, "integer", 7) == 0) return COLTYPE_INTEGER;
+    if (tlen == 5 && strncasecmp(t, "float", 5) == 0) return COLTYPE_FLOAT;
+    if (tlen == 4 && strncasecmp(t, "date", 4) == 0) return COLTYPE_DATE;
+    return COLTYPE_STRING;
+}
+
+typedef struct {
+    RedisModuleString *name;
+    int type;       // COLTYPE_*
+    int index;      // INDEX_* used by queries
+    int building;   // INDEX_* being built by an index job, maintained by writes only
+    int ordinal;    // position of the column in schema:{ns.t}
+} ColumnSchema;
+
+// Index over a tuple of columns, named by the column list "c1,c2,..." (see composite_tuple)
+#define COMPOSITE_MAX_COLUMNS 8
+
+typedef struct {
+    RedisModuleString *name;
+    ColumnSchema **cols;        // in index order
+    int ncols;
+    int kind;                   // INDEX_HASH: equality on every column, INDEX_BTREE: equality
+                                // on all but the last, range on the last
+    int building;               // being built by an index job, maintained by writes only
+} CompositeIndex;
+
+// Parsed view of schema:{ns.t}, {ns.t}:idx:meta, {ns.t}:idx:btree, {ns.t}:idx:unique,
+// {ns.t}:idx:composite, {ns.t}:idx:jobs, {ns.t}:purge and {ns.t}:options
+typedef struct {
+    ColumnSchema *cols;
+    int ncols;
+    RedisModuleDict *byName;    // column name -> ColumnSchema*
+    ColumnSchema *primary;      // primary key column, NULL if none
+    CompositeIndex *composites;
+    int ncomposites;
+    int engine;                 // ENGINE_*
+    uint64_t purged;            // rows up to this ID are being purged, hidden from queries
+    ColumnSchema *partition;    // date column the rows are partitioned by, NULL if none
+    long long retention;        // days a partition is kept, 0 = forever
+    int ttl;                    // rows may have a TTL
+    long long expiryChecked;    // day the partitions were last checked for expiry, -1 = never
+    int shards;                 // shard tables holding the rows, 0 = not sharded
+} TableSchema;
+
+// "<db>:<ns.t>" -> TableSchema*, rebuilt lazily after invalidation
+static RedisModuleDict *g_schema_cache = NULL;
+
+// Invalidated descriptors may still be referenced by the running command,
+// they are released from a timer once it has returned
+static TableSchema **g_schema_retired = NULL;
+static size_t g_schema_retired_count = 0;
+static size_t g_schema_retired_cap = 0;
+static int g_schema_retire_pending = 0;
+
+static void schema_free(TableSchema *sch) {
+    for (int i = 0; i < sch->ncols; i++) RedisModule_FreeString(NULL, sch->cols[i].name);
+    for (int i = 0; i < sch->ncomposites; i++) {
+        RedisModule_FreeString(NULL, sch->composites[i].name);
+        RedisModule_Free(sch->composites[i].cols);
+    }
+    RedisModule_Free(sch->composites);
+    RedisModule_FreeDict(NULL, sch->byName);
+    RedisModule_Free(sch->cols);
+    RedisModule_Free(sch);
+}
+
+static void schema_retire_timer(RedisModuleCtx *ctx, void *data) {
+    for (size_t i = 0; i < g_schema_retired_count; i++) schema_free(g_schema_retired[i]);
+    g_schema_retired_count = 0;
+    g_schema_retire_pending = 0;
+}
+
+static void schema_retire(RedisModuleCtx *ctx, TableSchema *sch) {
+    if (g_schema_retired_count == g_schema_retired_cap) {
+        g_schema_retired_cap = g_schema_retired_cap ? g_schema_retired_cap * 2 : 16;
+        g_schema_retired = RedisModule_Realloc(g_schema_retired, sizeof(TableSchema*) * g_schema_retired_cap);
+    }
+    g_schema_retired[g_schema_retired_count++] = sch;
+    if (!g_schema_retire_pending) {
+        g_schema_retire_pending = 1;
+        RedisModule_CreateTimer(ctx, 0, schema_retire_timer, NULL);
+    }
+}
+
+// Build the cache key "<db>:<ns.t>"; returns its length, or 0 if it does not fit
+static size_t schema_cache_key(char *buf, size_t buflen, int db, const char *name, size_t nlen) {
+    int n = snprintf(buf, buflen, "%d:", db);
+    if (n < 0 || (size_t)n + nlen >= buflen) return 0;
+    memcpy(buf + n, name, nlen);
+    return (size_t)n + nlen;
+}
+
+// Read the descriptor of a table from the keyspace; NULL if the table does not exist
+static TableSchema *schema_load(RedisModuleCtx *ctx, RedisModuleString *table) {
+    RedisModuleString *schemaKey = fmt(ctx, "schema:{%s}", table);
+    RedisModuleCallReply *r = RedisModule_Call(ctx, "HGETALL", "s", schemaKey);
+    RedisModule_FreeString(ctx, schemaKey);
+    if (!r) return NULL;
+    size_t n = RedisModule_CallReplyType(r) == REDISMODULE_REPLY_ARRAY ? RedisModule_CallReplyLength(r) / 2 : 0;
+    if (n == 0) {
+        RedisModule_FreeCallReply(r);
+        return NULL;
+    }
+
+    TableSchema *sch = RedisModule_Calloc(1, sizeof(TableSchema));
+    sch->cols = RedisModule_Calloc(n, sizeof(ColumnSchema));
+    sch->ncols = (int)n;
+    sch->byName = RedisModule_CreateDict(NULL);
+    for (size_t i = 0; i < n; i++) {
+        size_t clen, tlen;
+        const char *c = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(r, i * 2), &clen);
+        const char *t = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(r, i * 2 + 1), &tlen);
+        ColumnSchema *cs = &sch->cols[i];
+        cs->name = RedisModule_CreateString(NULL, c, clen);
+        cs->type = parse_column_type(t, tlen);
+        cs->index = INDEX_NONE;
+        cs->building = INDEX_NONE;
+        cs->ordinal = (int)i;
+        RedisModule_DictSetC(sch->byName, (void*)c, clen, cs);
+    }
+    RedisModule_FreeCallReply(r);
+
+    // Indexed columns are listed in {ns.t}:idx:meta, ordered ones also in {ns.t}:idx:btree
+    const char *sets[2] = { "{%s}:idx:meta", "{%s}:idx:btree" };
+    for (int s = 0; s < 2; s++) {
+        RedisModuleString *setKey = fmt(ctx, sets[s], table);
+        r = RedisModule_Call(ctx, "SMEMBERS", "s", setKey);
+        RedisModule_FreeString(ctx, setKey);
+        if (!r) continue;
+        if (RedisModule_CallReplyType(r) == REDISMODULE_REPLY_ARRAY) {
+            size_t m = RedisModule_CallReplyLength(r);
+            for (size_t i = 0; i < m; i++) {
+                size_t clen;
+                const char *c = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(r, i), &clen);
+                ColumnSchema *cs = RedisModule_DictGetC(sch->byName, (void*)c, clen, NULL);
+                if (!cs) continue;
+                if (s == 0) cs->index = INDEX_HASH;
+                else if (cs->index == INDEX_HASH) cs->index = INDEX_BTREE;
+            }
+        }
+        RedisModule_FreeCallReply(r);
+    }
+
+    // Unique indexed columns are also listed in {ns.t}:idx:unique (column -> unique|primary)
+    RedisModuleString *uniqueKey = fmt(ctx, "{%s}:idx:unique", table);
+    r = RedisModule_Call(ctx, "HGETALL", "s", uniqueKey);
+    RedisModule_FreeString(ctx, uniqueKey);
+    if (r && RedisModule_CallReplyType(r) == REDISMODULE_REPLY_ARRAY) {
+        size_t m = RedisModule_CallReplyLength(r) / 2;
+        for (size_t i = 0; i < m; i++) {
+            size_t clen, klen;
+            const char *c = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(r, i * 2), &clen);
+            const char *k = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(r, i * 2 + 1), &klen);
+            ColumnSchema *cs = c ? RedisModule_DictGetC(sch->byName, (void*)c, clen, NULL) : NULL;
+            if (!cs || cs->index != INDEX_HASH) continue;
+            cs->index = INDEX_UNIQUE;
+            if (k && parse_index_type(k, klen) == INDEX_PRIMARY) sch->primary = cs;
+        }
+    }
+    if (r) RedisModule_FreeCallReply(r);
+
+    // Composite indexes are listed in {ns.t}:idx:composite (c1,c2,... -> hash|btree)
+    RedisModuleString *compositeKey = fmt(ctx, "{%s}:idx:composite", table);
+    r = RedisModule_Call(ctx, "HGETALL", "s", compositeKey);
+    RedisModule_FreeString(ctx, compositeKey);
+    if (r && RedisModule_CallReplyType(r) == REDISMODULE_REPLY_ARRAY && RedisModule_CallReplyLength(r) >= 2) {
+        size_t m = RedisModule_CallReplyLength(r) / 2;
+        sch->composites = RedisModule_Calloc(m, sizeof(CompositeIndex));
+        for (size_t i = 0; i < m; i++) {
+            size_t nlen, klen;
+            const char *nm = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(r, i * 2), &nlen);
+            const char *k = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(r, i * 2 + 1), &klen);
+            int kind = k ? parse_index_type(k, klen) : -1;
+            if (!nm || (kind != INDEX_HASH && kind != INDEX_BTREE)) continue;
+            CompositeIndex *ci = &sch->composites[sch->ncomposites];
+            ci->cols = RedisModule_Calloc(nlen / 2 + 1, sizeof(ColumnSchema*));
+            ci->ncols = 0;
+            for (size_t at = 0; at <= nlen; ) {
+                const char *comma = memchr(nm + at, ',', nlen - at);
+                size_t end = comma ? (size_t)(comma - nm) : nlen;
+                ColumnSchema *cs = RedisModule_DictGetC(sch->byName, (void*)(nm + at), end - at, NULL);
+                if (!cs) { ci->ncols = 0; break; }
+                ci->cols[ci->ncols++] = cs;
+                at = end + 1;
+            }
+            if (ci->ncols < 2 || ci->ncols > COMPOSITE_MAX_COLUMNS) {
+                RedisModule_Free(ci->cols);
+                continue;
+            }
+            ci->name = RedisModule_CreateString(NULL, nm, nlen);
+            ci->kind = kind;
+            sch->ncomposites++;
+        }
+    }
+    if (r) RedisModule_FreeCallReply(r);
+
+    // Indexes being built are listed in {ns.t}:idx:jobs (column or composite -> hash|btree|drop)
+    RedisModuleString *jobsKey = fmt(ctx, "{%s}:idx:jobs", table);
+    r = RedisModule_Call(ctx, "HGETALL", "s", jobsKey);
+    RedisModule_FreeString(ctx, jobsKey);
+    if (r && RedisModule_CallReplyType(r) == REDISMODULE_REPLY_ARRAY) {
+        size_t m = RedisModule_CallReplyLength(r) / 2;
+        for (size_t i = 0; i < m; i++) {
+            size_t clen, klen;
+            const char *c = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(r, i * 2), &clen);
+            const char *k = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(r, i * 2 + 1), &klen);
+            ColumnSchema *cs = c ? RedisModule_DictGetC(sch->byName, (void*)c, clen, NULL) : NULL;
+            int kind = k ? parse_index_type(k, klen) : -1;
+            if (kind != INDEX_HASH && kind != INDEX_BTREE && kind != INDEX_UNIQUE) continue;
+            if (cs) cs->building = kind;
+            for (int j = 0; !cs && c && j < sch->ncomposites; j++) {
+                size_t nlen; const char *nm = RedisModule_StringPtrLen(sch->composites[j].name, &nlen);
+                if (nlen == clen && memcmp(nm, c, clen) == 0) sch->composites[j].building = 1;
+            }
+        }
+    }
+    if (r) RedisModule_FreeCallReply(r);
+
+    // Rows being purged are listed in worklists {ns.t}:purge:<n>, recorded as fields of
+    // {ns.t}:purge, each holding rows up to ID n
+    RedisModuleString *purgeKey = fmt(ctx, "{%s}:purge", table);
+    r = RedisModule_Call(ctx, "HKEYS", "s", purgeKey);
+    RedisModule_FreeString(ctx, purgeKey);
+    if (r && RedisModule_CallReplyType(r) == REDISMODULE_REPLY_ARRAY) {
+        size_t m = RedisModule_CallReplyLength(r);
+        for (size_t i = 0; i < m; i++) {
+            size_t fl; const char *f = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(r, i), &fl);
+            uint64_t upto = f ? idset_parse_id(f, fl) : 0;
+            if (upto > sch->purged) sch->purged = upto;
+        }
+    }
+    if (r) RedisModule_FreeCallReply(r);
+
+    // Table options in {ns.t}:options: partition (column), retention (days), ttl (1), shards
+    RedisModuleString *optionsKey = fmt(ctx, "{%s}:options", table);
+    r = RedisModule_Call(ctx, "HGETALL", "s", optionsKey);
+    RedisModule_FreeString(ctx, optionsKey);
+    sch->expiryChecked = -1;
+    if (r && RedisModule_CallReplyType(r) == REDISMODULE_REPLY_ARRAY) {
+        size_t m = RedisModule_CallReplyLength(r) / 2;
+        for (size_t i = 0; i < m; i++) {
+            size_t fl, vl;
+            const char *f = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(r, i * 2), &fl);
+            const char *v = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(r, i * 2 + 1), &vl);
+            if (!f || !v) continue;
+            if (fl == 9 && memcmp(f, "partition", 9) == 0) {
+                ColumnSchema *cs = RedisModule_DictGetC(sch->byName, (void*)v, vl, NULL);
+                if (cs && cs->type == COLTYPE_DATE) sch->partition = cs;
+            } else if (fl == 9 && memcmp(f, "retention", 9) == 0) {
+                sch->retention = (long long)idset_parse_id(v, vl);
+            } else if (fl == 3 && memcmp(f, "ttl", 3) == 0) {
+                sch->ttl = 1;
+            } else if (fl == 6 && memcmp(f, "shards", 6) == 0) {
+                sch->shards = (int)idset_parse_id(v, vl);
+            }
+        }
+    }
+    if (r) RedisModule_FreeCallReply(r);
+
+    // Native tables keep their rows in {ns.t}:data
+    RedisModuleString *dataKey = fmt(ctx, "{%s}:data", table);
+    RedisModuleKey *k = RedisModule_OpenKey(ctx, dataKey, REDISMODULE_READ);
+    sch->engine = RedisModule_ModuleTypeGetType(k) == NativeTableType ? ENGINE_NATIVE : ENGINE_HASH;
+    RedisModule_CloseKey(k);
+    RedisModule_FreeString(ctx, dataKey);
+    return sch;
+}
+
+// Get the cached descriptor of a table, loading it on first use
+// Returns NULL if the table does not exist
+static TableSchema *schema_get(RedisModuleCtx *ctx, RedisModuleString *table) {
+    size_t nlen; const char *name = RedisModule_StringPtrLen(table, &nlen);
+    char key[256];
+    size_t klen = schema_cache_key(key, sizeof(key), RedisModule_GetSelectedDb(ctx), name, nlen);
+    if (klen) {
+        TableSchema *sch = RedisModule_DictGetC(g_schema_cache, key, klen, NULL);
+        if (sch) return sch;
+    }
+    TableSchema *sch = schema_load(ctx, table);
+    if (!sch) return NULL;
+    if (klen) RedisModule_DictSetC(g_schema_cache, key, klen, sch);
+    else schema_retire(ctx, sch);
+    return sch;
+}
+
+static ColumnSchema *schema_column(TableSchema *sch, RedisModuleString *col) {
+    return sch ? RedisModule_DictGet(sch->byName, col, NULL) : NULL;
+}
+
+// The composite index named name ("c1,c2,..."), NULL if none
+static CompositeIndex *schema_composite(TableSchema *sch, RedisModuleString *name) {
+    for (int i = 0; sch && i < sch->ncomposites; i++)
+        if (RedisModule_StringCompare(sch->composites[i].name, name) == 0) return &sch->composites[i];
+    return NULL;
+}
+
+// Index kept up to date by writes: the column's index, or the one being built
+static int column_write_index(ColumnSchema *cs) {
+    return cs->index != INDEX_NONE ? cs->index : cs->building;
+}
+
+// Table catalog of TABLE.NAMESPACE.VIEW: "<db>:<ns>\0<t>" -> NULL, so that the dict order is
+// namespace then table. Every way a schema key comes or goes keeps it complete without
+// scanning the keyspace: TABLE.SCHEMA.CREATE and TABLE.DROP, the keyspace events of schema
+// keys (commands, expiry, eviction, replication, AOF replay, restored keys) and the
+// "loaded" event of each key read from an RDB file or a full sync. FLUSHDB and SWAPDB
+// empty or swap the entries of their databases.
+// The shards of a sharded table (ns.t#k) are listed for ttl_resume(), but not shown by
+// TABLE.NAMESPACE.VIEW
+static RedisModuleDict *g_catalog = NULL;
+
+// Servers before 7.0 do not report the keys they load
+static int catalog_loaded_events(void) {
+    return RedisModule_GetServerVersion && RedisModule_GetServerVersion() >= 0x00070000;
+}
+
+// Build the catalog key of table name "ns.t"; returns its length, 0 if the name is not
+// listed or does not fit
+static size_t catalog_key(char *buf, size_t buflen, int db, const char *name, size_t nlen) {
+    const char *dot = memchr(name, '.', nlen);
+    if (!dot) return 0;
+    size_t klen = schema_cache_key(buf, buflen, db, name, nlen);
+    if (klen) buf[klen - nlen + (size_t)(dot - name)] = '\0';
+    return klen;
+}
+
+static void catalog_set(int db, const char *name, size_t nlen, int present) {
+    char key[256];
+    size_t klen = catalog_key(key, sizeof(key), db, name, nlen);
+    if (!klen) return;
+    if (present) RedisModule_DictReplaceC(g_catalog, key, klen, NULL);
+    else RedisModule_DictDelC(g_catalog, key, klen, NULL);
+}
+
+// The schema key of a table was written or removed: list the table while it exists
+static void catalog_note(RedisModuleCtx *ctx, const char *name, size_t nlen) {
+    if (!memchr(name, '.', nlen)) return;
+    RedisModuleString *k = RedisModule_CreateStringPrintf(ctx, "schema:{%.*s}", (int)nlen, name);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, k, REDISMODULE_READ);
+    catalog_set(RedisModule_GetSelectedDb(ctx), name, nlen, RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_HASH);
+    RedisModule_CloseKey(key);
+    RedisModule_FreeString(ctx, k);
+}
+
+static void catalog_table(RedisModuleCtx *ctx, RedisModuleString *table, int present) {
+    size_t nlen; const char *name = RedisModule_StringPtrLen(table, &nlen);
+    catalog_set(RedisModule_GetSelectedDb(ctx), name, nlen, present);
+}
+
+typedef struct {
+    char *name;                 // "<ns>\0<t>", the catalog key without "<db>:"
+    size_t len;
+} CatalogName;
+
+// Take the entries of database db out of the catalog, every database if db is -1; with
+// keep, returns their *count names (array and names RedisModule_Alloc'd)
+static CatalogName *catalog_take(int db, int keep, size_t *count) {
+    CatalogName *names = NULL;
+    size_t n = 0, cap = 0;
+    char prefix[32] = "";
+    int plen = db < 0 ? 0 : snprintf(prefix, sizeof(prefix), "%d:", db);
+    for (;;) {
+        RedisModuleDictIter *it = RedisModule_DictIteratorStartC(g_catalog, db < 0 ? "^" : ">=", prefix, (size_t)plen);
+        size_t kl; char *k = RedisModule_DictNextC(it, &kl, NULL);
+        if (!k || kl < (size_t)plen || memcmp(k, prefix, (size_t)plen) != 0) {
+            RedisModule_DictIteratorStop(it);
+            break;
+        }
+        if (keep) {
+            if (n == cap) {
+                cap = cap ? cap * 2 : 16;
+                names = RedisModule_Realloc(names, sizeof(CatalogName) * cap);
+            }
+            names[n].len = kl - (size_t)plen;
+            names[n].name = RedisModule_Alloc(names[n].len);
+            memcpy(names[n].name, k + plen, names[n].len);
+            n++;
+        }
+        RedisModule_DictDelC(g_catalog, k, kl, NULL);
+        RedisModule_DictIteratorStop(it);
+    }
+    *count = n;
+    return names;
+}
+
+// FLUSHDB, FLUSHALL (db -1) or a dataset about to be loaded
+static void catalog_clear(int db) {
+    size_t n;
+    catalog_take(db, 0, &n);
+}
+
+// SWAPDB a b: the entries of each database move to the other
+static void catalog_swap(int a, int b) {
+    size_t na, nb;
+    CatalogName *fromA = catalog_take(a, 1, &na), *fromB = catalog_take(b, 1, &nb);
+    char key[256];
+    for (int side = 0; side < 2; side++) {
+        CatalogName *names = side ? fromB : fromA;
+        size_t n = side ? nb : na;
+        for (size_t i = 0; i < n; i++) {
+            size_t klen = schema_cache_key(key, sizeof(key), side ? a : b, names[i].name, names[i].len);
+            if (klen) RedisModule_DictReplaceC(g_catalog, key, klen, NULL);
+            RedisModule_Free(names[i].name);
+        }
+        if (names) RedisModule_Free(names);
+    }
+}
+
+// Drop the cached descriptor of one table
+static void schema_invalidate_name(RedisModuleCtx *ctx, int db, const char *name, size_t nlen) {
+    char key[256];
+    size_t klen = schema_cache_key(key, sizeof(key), db, name, nlen);
+    TableSchema *old = NULL;
+    if (klen && RedisModule_DictDelC(g_schema_cache, key, klen, &old) == REDISMODULE_OK && old)
+        schema_retire(ctx, old);
+    result_cache_forget(db, name, nlen);
+}
+
+static void schema_invalidate(RedisModuleCtx *ctx, RedisModuleString *table) {
+    size_t nlen; const char *name = RedisModule_StringPtrLen(table, &nlen);
+    schema_invalidate_name(ctx, RedisModule_GetSelectedDb(ctx), name, nlen);
+}
+
+// Drop every cached descriptor (FLUSHDB, SWAPDB, RDB load)
+static void schema_invalidate_all(RedisModuleCtx *ctx) {
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(g_schema_cache, "^", NULL, 0);
+    TableSchema *sch;
+    while (RedisModule_DictNextC(it, NULL, (void**)&sch) != NULL) schema_retire(ctx, sch);
+    RedisModule_DictIteratorStop(it);
+    RedisModule_FreeDict(NULL, g_schema_cache);
+    g_schema_cache = RedisModule_CreateDict(NULL);
+    result_cache_clear();
+}
+
+// Keys that make up a table descriptor: schema:{ns.t}, {ns.t}:idx:meta, {ns.t}:idx:btree,
+// {ns.t}:idx:unique, {ns.t}:idx:composite, {ns.t}:idx:jobs, {ns.t}:purge, {ns.t}:options
+// and the native data key {ns.t}:data
+// Any write, deletion, expiry or eviction of them invalidates the cached descriptor; one
+// of any other key of a table, its cached query replies. One of the schema key also lists
+// or unlists the table in the catalog
+static int schema_keyspace_event(RedisModuleCtx *ctx, int type, const char *event, RedisModuleString *key) {
+    static const char *suffixes[] = { "}:idx:meta", "}:idx:btree", "}:idx:unique", "}:idx:composite", "}:idx:jobs",
+                                      "}:purge", "}:options", "}:data" };
+    size_t len; const char *k = RedisModule_StringPtrLen(key, &len);
+    int schemaKey = len > 9 && memcmp(k, "schema:{", 8) == 0 && k[len-1] == '}';
+    // Keys read from an RDB file: nothing is cached yet, the tables are listed
+    if (type == REDISMODULE_NOTIFY_LOADED) {
+        if (schemaKey) catalog_set(RedisModule_GetSelectedDb(ctx), k + 8, len - 9, 1);
+        return REDISMODULE_OK;
+    }
+    if (schemaKey) {
+        schema_invalidate_name(ctx, RedisModule_GetSelectedDb(ctx), k + 8, len - 9);
+        catalog_note(ctx, k + 8, len - 9);
+    } else if (len > 1 && k[0] == '{') {
+        for (size_t s = 0; s < sizeof(suffixes) / sizeof(suffixes[0]); s++) {
+            size_t slen = strlen(suffixes[s]);
+            if (len > slen + 1 && memcmp(k + len - slen, suffixes[s], slen) == 0) {
+                schema_invalidate_name(ctx, RedisModule_GetSelectedDb(ctx), k + 1, len - 1 - slen);
+                return REDISMODULE_OK;
+            }
+        }
+        const char *close = memchr(k, '}', len);
+        if (close) result_cache_forget(RedisModule_GetSelectedDb(ctx), k + 1, (size_t)(close - k - 1));
+    }
+    return REDISMODULE_OK;
+}
+
+static void schema_server_event(RedisModuleCtx *ctx, RedisModuleEvent e, uint64_t subevent, void *data) {
+    schema_invalidate_all(ctx);
+    if (e.id == REDISMODULE_EVENT_FLUSHDB && subevent == REDISMODULE_SUBEVENT_FLUSHDB_END) {
+        catalog_clear(((RedisModuleFlushInfo *)data)->dbnum);
+    } else if (e.id == REDISMODULE_EVENT_SWAPDB) {
+        RedisModuleSwapDbInfo *info = data;
+        catalog_swap(info->dbnum_first, info->dbnum_second);
+    }
+}
+
+// Check if column is indexed
+// Returns: INDEX_NONE, INDEX_HASH, INDEX_BTREE or INDEX_UNIQUE
+static int is_column_indexed(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *col) {
+    ColumnSchema *cs = schema_column(schema_get(ctx, table), col);
+    return cs ? cs->index : INDEX_NONE;
+}
+
+// Compare two values based on operator and type
+static int compare_values(const char *v1, const char *v2, const char *op, int type) {
+    Predicate p;
+    predicate_init(&p, type, op, v2);
+    return predicate_match_text(&p, v1);
+}
+
+static int ensure_schema_exists(RedisModuleCtx *ctx, RedisModuleString *schemaName) {
+    RedisModule_AutoMemory(ctx);
+    RedisModuleKey *k = RedisModule_OpenKey(ctx, fmt(ctx, "schema:{%s}", schemaName), REDISMODULE_READ);
+    return RedisModule_KeyType(k) != REDISMODULE_KEYTYPE_EMPTY ? REDISMODULE_OK : REDISMODULE_ERR;
+}
+
+static int ensure_table_exists(RedisModuleCtx *ctx, RedisModuleString *fullTableName) {
+    return schema_get(ctx, fullTableName) ? REDISMODULE_OK : REDISMODULE_ERR;
+}
+
+static RedisModuleString* extract_schema(RedisModuleCtx *ctx, RedisModuleString *fullTable) {
+    size_t len; const char *s = RedisModule_StringPtrLen(fullTable, &len);
+    const char *dot = memchr(s, '.', len);
+    if (!dot) return NULL;
+    return RedisModule_CreateString(ctx, s, (size_t)(dot - s));
+}
+
+static RedisModuleString* extract_table(RedisModuleCtx *ctx, RedisModuleString *fullTable) {
+    size_t len; const char *s = RedisModule_StringPtrLen(fullTable, &len);
+    const char *dot = memchr(s, '.', len);
+    if (!dot) return NULL;
+    return RedisModule_CreateString(ctx, dot + 1, len - (size_t)(dot - s) - 1);
+}
+
+// Check that a value is well formed for a column type
+// Integers must fit in 64 bits and dates must be real calendar days, so that the
+// binary form parsed from a validated value is always exact.
+static int validate_value(int type, RedisModuleString *val) {
+    if (type == COLTYPE_INTEGER) {
+        // Validate integer
+        size_t vlen; const char *vs = RedisModule_StringPtrLen(val, &vlen);
+        if (vlen == 0) return REDISMODULE_ERR;
+        size_t i = 0; if (vs[0] == '-' || vs[0] == '+') i = 1; if (i >= vlen) return REDISMODULE_ERR;
+        for (; i < vlen; i++) if (vs[i] < '0' || vs[i] > '9') return REDISMODULE_ERR;
+        TypedValue tv;
+        if (typed_parse(COLTYPE_INTEGER, vs, vlen, &tv) != 0) return REDISMODULE_ERR;
+    } else if (type == COLTYPE_FLOAT) {
+        // Validate float (simple check for digits, optional decimal point)
+        size_t vlen; const char *vs = RedisModule_StringPtrLen(val, &vlen);
+        if (vlen == 0) return REDISMODULE_ERR;
+        int hasDot = 0;
+        size_t i = 0; if (vs[0] == '-' || vs[0] == '+') i = 1; if (i >= vlen) return REDISMODULE_ERR;
+        for (; i < vlen; i++) {
+            if (vs[i] == '.') { if (hasDot) return REDISMODULE_ERR; hasDot = 1; }
+            else if (vs[i] < '0' || vs[i] > '9') return REDISMODULE_ERR;
+        }
+        TypedValue tv;
+        if (typed_parse(COLTYPE_FLOAT, vs, vlen, &tv) != 0) return REDISMODULE_ERR;
+    } else if (type == COLTYPE_DATE) {
+        // Validate date format YYYY-MM-DD and the day of the month
+        size_t vlen; const char *vs = RedisModule_StringPtrLen(val, &vlen);
+        int64_t days;
+        if (parse_date(vs, vlen, &days) != 0) return REDISMODULE_ERR;
+    }
+    // String type (no validation needed)
+    return REDISMODULE_OK;
+}
+
+// Validate string length (max 64 characters)
+static int validate_string_length(RedisModuleCtx *ctx, RedisModuleString *str, const char *name) {
+    size_t len;
+    RedisModule_StringPtrLen(str, &len);
+    if (len > 64) {
+        char error_msg[128];
+        snprintf(error_msg, sizeof(error_msg), "ERR incorrect %s name, it exceeds the limit of 64 characters", name);
+        return RedisModule_ReplyWithError(ctx, error_msg);
+    }
+    return REDISMODULE_OK;
+}
+// Resolve the declared type of a column (COLTYPE_*, unknown columns are strings)
+static int get_column_type(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *col) {
+    ColumnSchema *cs = schema_column(schema_get(ctx, table), col);
+    return cs ? cs->type : COLTYPE_STRING;
+}
+
+// The <col>=<value> fields of an INSERT or the SET list of an UPDATE
+typedef struct {
+    RedisModuleString **argv;       // the fields as given
+    int n;
+    ColumnSchema **cols;
+    RedisModuleString **vals;
+} Assignments;
+
+// Resolve and validate every field before anything is written, so that a write applies
+// all of them or none. A column can be assigned once.
+// Returns NULL or an error message
+static const char *parse_assignments(RedisModuleCtx *ctx, TableSchema *sch, RedisModuleString **argv, int n,
+                                     const char *syntaxErr, Assignments *a) {
+    a->argv = argv;
+    a->n = n;
+    a->cols = RedisModule_PoolAlloc(ctx, sizeof(ColumnSchema*) * (n ? n : 1));
+    a->vals = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleString*) * (n ? n : 1));
+    for (int i = 0; i < n; i++) {
+        RedisModuleString *col = NULL;
+        char op[3];
+        if (split_condition(ctx, argv[i], &col, op, &a->vals[i]) != REDISMODULE_OK || strcmp(op, "=") != 0)
+            return syntaxErr;
+        a->cols[i] = schema_column(sch, col);
+        if (!a->cols[i] || validate_value(a->cols[i]->type, a->vals[i]) != REDISMODULE_OK)
+            return "ERR invalid column or type";
+        for (int p = 0; p < i; p++)
+            if (a->cols[p] == a->cols[i]) return "ERR duplicate column";
+    }
+    return NULL;
+}
+
+/* ================== Command statistics ================== */
+// Latency of INSERT, SELECT, UPDATE and DELETE per command (TABLE.INSERTMANY counts as an
+// INSERT, TABLE.GET as a SELECT, TABLE.EXEC as the command it runs), and per table the query counters: rows
+// checked one by one, rows returned, index reads, full scans, scan limit errors, result
+// cache hits and misses.
+// Latencies go into log-linear histograms: 8 buckets per power of two microseconds,
+// so a percentile is known within 12.5% for the cost of an increment.
+// Reported by TABLE.STATS and INFO table.
+
+#define STATS_INSERT 0
+#define STATS_SELECT 1
+#define STATS_UPDATE 2
+#define STATS_DELETE 3
+#define STATS_NCMDS  4
+#define STATS_NONE   -1                     // background queries of commands without latency stats (AGGREGATE)
+
+#define STATS_SUB_BITS 3
+#define STATS_SUB      (1 << STATS_SUB_BITS)
+#define STATS_MAX_EXP  36                   // latencies are capped at 2^36 us (19 hours)
+#define STATS_BUCKETS  ((STATS_MAX_EXP - STATS_SUB_BITS + 2) * STATS_SUB)
+
+static const char *g_stats_names[STATS_NCMDS] = { "insert", "select", "update", "delete" };
+
+typedef struct {
+    long long calls;
+    long long usec;
+    long long max;
+    long long buckets[STATS_BUCKETS];
+} LatencyStats;
+
+typedef struct {
+    long long calls[STATS_NCMDS];
+    long long usec[STATS_NCMDS];
+    long long rowsScanned;      // rows checked one by one against a condition
+    long long rowsReturned;     // rows in SELECT replies
+    long long indexReads;       // hash index posting lists and btree ranges read
+    long long fullScans;        // conditions checked on every row of the table
+    long long scanLimit;        // queries rejected by max_rows_scan_limit
+    long long cacheHits;        // SELECT and AGGREGATE replies served by the result cache
+    long long cacheMisses;      // and the ones looked up there in vain
+} TableStats;
+
+static LatencyStats g_cmd_stats[STATS_NCMDS];
+static RedisModuleDict *g_table_stats = NULL;  // table name -> TableStats
+
+// Start of the command being run; set by query_start(): its latency is recorded with its reply
+static uint64_t g_stats_start = 0;
+static int g_stats_deferred = 0;
+
+static inline uint64_t stats_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static inline int stats_bucket(uint64_t v) {
+    if (v < STATS_SUB) return (int)v;
+    int e = 63 - __builtin_clzll(v);
+    if (e > STATS_MAX_EXP) return STATS_BUCKETS - 1;
+    return ((e - STATS_SUB_BITS + 1) << STATS_SUB_BITS) + (int)((v >> (e - STATS_SUB_BITS)) & (STATS_SUB - 1));
+}
+
+// Highest latency counted in a bucket
+static long long stats_bucket_value(int b) {
+    if (b < STATS_SUB) return b;
+    int e = (b >> STATS_SUB_BITS) + STATS_SUB_BITS - 1;
+    long long sub = b & (STATS_SUB - 1);
+    return ((STATS_SUB + sub + 1) << (e - STATS_SUB_BITS)) - 1;
+}
+
+// Latency under which a fraction p of the calls completed
+static long long stats_percentile(const LatencyStats *l, double p) {
+    if (!l->calls) return 0;
+    long long want = (long long)(p * (double)l->calls + 0.999999), seen = 0;
+    for (int b = 0; b < STATS_BUCKETS; b++)
+        if ((seen += l->buckets[b]) >= want) return stats_bucket_value(b) < l->max ? stats_bucket_value(b) : l->max;
+    return l->max;
+}
+
+static TableStats *stats_table(RedisModuleString *table) {
+    TableStats *ts = RedisModule_DictGet(g_table_stats, table, NULL);
+    if (!ts) {
+        ts = RedisModule_Calloc(1, sizeof(TableStats));
+        RedisModule_DictSet(g_table_stats, table, ts);
+    }
+    return ts;
+}
+
+static void stats_forget(RedisModuleString *table) {
+    TableStats *ts = NULL;
+    if (RedisModule_DictDel(g_table_stats, table, &ts) == REDISMODULE_OK) RedisModule_Free(ts);
+}
+
+static void stats_reset(void) {
+    memset(g_cmd_stats, 0, sizeof(g_cmd_stats));
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(g_table_stats, "^", NULL, 0);
+    TableStats *ts;
+    while (RedisModule_DictNextC(it, NULL, (void**)&ts)) RedisModule_Free(ts);
+    RedisModule_DictIteratorStop(it);
+    RedisModule_FreeDict(NULL, g_table_stats);
+    g_table_stats = RedisModule_CreateDict(NULL);
+}
+
+static void stats_record(RedisModuleCtx *ctx, int cmd, RedisModuleString *table, uint64_t start) {
+    uint64_t us = stats_usec() - start;
+    LatencyStats *l = &g_cmd_stats[cmd];
+    l->calls++;
+    l->usec += (long long)us;
+    if ((long long)us > l->max) l->max = (long long)us;
+    l->buckets[stats_bucket(us)]++;
+    if (!schema_get(ctx, table)) return;
+    TableStats *ts = stats_table(table);
+    ts->calls[cmd]++;
+    ts->usec[cmd] += (long long)us;
+}
+
+static inline void stats_begin(void) {
+    g_stats_deferred = 0;
+    g_stats_start = stats_usec();
+}
+
+// Record the command begun by stats_begin(), unless it went on in the background
+static void stats_end(RedisModuleCtx *ctx, int cmd, RedisModuleString *table) {
+    if (!g_stats_deferred) stats_record(ctx, cmd, table, g_stats_start);
+    g_stats_deferred = 0;
+}
+
+/* ================== Native storage engine ================== */
+
+// Tables created with ENGINE native keep all rows and indexes in one module-typed key,
+// {ns.t}:data, instead of one hash per row, the {ns.t}:rows set and one key per index.
+// Rows occupy slots ordered by row ID; deleted slots are tombstoned and compacted once
+// they make up half of the table. Values are stored in their binary form (see TypedValue),
+// validated once on write. Indexes map an order-preserving encoding of the value to the
+// sorted list of row IDs holding it, so the same structure serves hash and btree lookups.
+
+// 0: every value saved as a string, 1: integers, dates and floats saved in binary form
+#define NATIVE_ENCODING_VERSION 1
+#define NATIVE_INITIAL_SLOTS 16
+
+// Sorted row IDs sharing one indexed value
+typedef struct {
+    uint64_t *ids;
+    size_t len, cap;
+} NativePosting;
+
+typedef struct {
+    char *name;
+    size_t namelen;
+    int type;                   // COLTYPE_*
+    TypedValue *vals;           // per slot, strings as [uint32 length][bytes][\0]
+    uint8_t *present;           // per slot, 0 = no value
+    RedisModuleDict *index;     // encoded value -> NativePosting*, NULL = not indexed
+} NativeColumn;
+
+typedef struct {
+    uint64_t last_id;           // highest row ID handed out
+    uint64_t *ids;              // row ID of each slot, strictly increasing
+    uint8_t *live;              // 0 = deleted slot
+    size_t len, cap;            // used / allocated slots
+    size_t nrows;               // live slots
+    NativeColumn *cols;
+    int ncols;
+} NativeTable;
+
+static inline uint32_t native_str_len(const char *s) {
+    uint32_t l; memcpy(&l, s, sizeof(l)); return l;
+}
+static inline const char *native_str_ptr(const char *s) {
+    return s + sizeof(uint32_t);
+}
+
+static char *native_str_new(const char *v, size_t vlen) {
+    uint32_t l = (uint32_t)vlen;
+    char *s = RedisModule_Alloc(sizeof(l) + vlen + 1);
+    memcpy(s, &l, sizeof(l));
+    memcpy(s + sizeof(l), v, vlen);
+    s[sizeof(l) + vlen] = '\0';
+    return s;
+}
+
+// Text of a stored value; buf must hold 32 bytes for numeric types
+static const char *native_value_text(const NativeColumn *col, TypedValue v, char *buf, size_t *len) {
+    if (col->type == COLTYPE_STRING) {
+        *len = native_str_len(v.s);
+        return native_str_ptr(v.s);
+    }
+    *len = typed_format(col->type, v, buf, 32);
+    return buf;
+}
+
+// Binary form of a value written to a column (strings are copied)
+// Returns -1 if the text is not a valid value of the column type
+static int native_value_parse(const NativeColumn *col, const char *v, size_t vlen, TypedValue *out) {
+    if (col->type == COLTYPE_STRING) {
+        out->s = native_str_new(v, vlen);
+        return 0;
+    }
+    return typed_parse(col->type, v, vlen, out);
+}
+
+static NativeTable *native_new(void) {
+    return RedisModule_Calloc(1, sizeof(NativeTable));
+}
+
+static void native_index_free(RedisModuleDict *index) {
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(index, "^", NULL, 0);
+    NativePosting *p;
+    while (RedisModule_DictNextC(it, NULL, (void**)&p) != NULL) {
+        RedisModule_Free(p->ids);
+        RedisModule_Free(p);
+    }
+    RedisModule_DictIteratorStop(it);
+    RedisModule_FreeDict(NULL, index);
+}
+
+static void native_free(void *value) {
+    NativeTable *nt = value;
+    for (int c = 0; c < nt->ncols; c++) {
+        NativeColumn *col = &nt->cols[c];
+        if (col->type == COLTYPE_STRING)
+            for (size_t s = 0; s < nt->len; s++) if (col->present[s]) RedisModule_Free(col->vals[s].s);
+        RedisModule_Free(col->vals);
+        RedisModule_Free(col->present);
+        if (col->index) native_index_free(col->index);
+        RedisModule_Free(col->name);
+    }
+    RedisModule_Free(nt->cols);
+    RedisModule_Free(nt->ids);
+    RedisModule_Free(nt->live);
+    RedisModule_Free(nt);
+}
+
+// Order-preserving index key of a value
+// Integers, dates and floats become 8 big-endian bytes that compare like the numbers,
+// strings are used as is. Returns the key length.
+static size_t native_index_key(int type, TypedValue v, unsigned char *buf, const unsigned char **key) {
+    uint64_t u;
+    if (type == COLTYPE_STRING) {
+        *key = (const unsigned char *)native_str_ptr(v.s);
+        return native_str_len(v.s);
+    }
+    if (type == COLTYPE_FLOAT) {
+        double d = v.d == 0 ? 0 : v.d;  // -0.0 and 0.0 are the same key
+        memcpy(&u, &d, sizeof(u));
+        u = (u & 0x8000000000000000ULL) ? ~u : (u | 0x8000000000000000ULL);
+    } else {
+        u = (uint64_t)v.i ^ 0x8000000000000000ULL;
+    }
+    for (int i = 7; i >= 0; i--) { buf[i] = (unsigned char)(u & 0xff); u >>= 8; }
+    *key = buf;
+    return 8;
+}
+
+// Index key of a query constant; returns 0 if it is not a valid value of the type
+static size_t native_index_key_text(int type, const char *v, size_t vlen, unsigned char *buf, const unsigned char **key) {
+    if (type == COLTYPE_STRING) {
+        *key = (const unsigned char *)v;
+        return vlen;
+    }
+    TypedValue tv;
+    if (typed_parse(type, v, vlen, &tv) != 0) return 0;
+    return native_index_key(type, tv, buf, key);
+}
+
+// Compare two index keys in dictionary order
+static int native_key_cmp(const unsigned char *a, size_t alen, const unsigned char *b, size_t blen) {
+    int cmp = memcmp(a, b, alen < blen ? alen : blen);
+    if (cmp) return cmp;
+    return alen < blen ? -1 : (alen > blen ? 1 : 0);
+}
+
+// Position of id in a sorted ID array, or where it would be inserted
+static size_t native_id_pos(const uint64_t *ids, size_t len, uint64_t id) {
+    size_t lo = 0, hi = len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ids[mid] < id) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+// Add a row ID to the posting list of key in an index dictionary
+// Returns 1 if it was added, 0 if the list held it already
+static int posting_add(RedisModuleDict *index, const void *key, size_t klen, uint64_t id) {
+    NativePosting *p = RedisModule_DictGetC(index, (void*)key, klen, NULL);
+    if (!p) {
+        p = RedisModule_Calloc(1, sizeof(NativePosting));
+        RedisModule_DictSetC(index, (void*)key, klen, p);
+    }
+    size_t pos = native_id_pos(p->ids, p->len, id);
+    if (pos < p->len && p->ids[pos] == id) return 0;
+    if (p->len == p->cap) {
+        p->cap = p->cap ? p->cap * 2 : 4;
+        p->ids = RedisModule_Realloc(p->ids, sizeof(uint64_t) * p->cap);
+    }
+    memmove(p->ids + pos + 1, p->ids + pos, sizeof(uint64_t) * (p->len - pos));
+    p->ids[pos] = id;
+    p->len++;
+    return 1;
+}
+
+// Remove a row ID from the posting list of key, dropping the list once empty
+// Returns 1 if it was removed, 0 if the list did not hold it
+static int posting_rem(RedisModuleDict *index, const void *key, size_t klen, uint64_t id) {
+    NativePosting *p = RedisModule_DictGetC(index, (void*)key, klen, NULL);
+    if (!p) return 0;
+    size_t pos = native_id_pos(p->ids, p->len, id);
+    if (pos >= p->len || p->ids[pos] != id) return 0;
+    memmove(p->ids + pos, p->ids + pos + 1, sizeof(uint64_t) * (p->len - pos - 1));
+    if (--p->len == 0) {
+        RedisModule_DictDelC(index, (void*)key, klen, NULL);
+        RedisModule_Free(p->ids);
+        RedisModule_Free(p);
+    }
+    return 1;
+}
+
+static void native_index_add(NativeColumn *col, TypedValue v, uint64_t id) {
+    unsigned char buf[8]; const unsigned char *key;
+    size_t klen = native_index_key(col->type, v, buf, &key);
+    if (klen) posting_add(col->index, key, klen, id);
+}
+
+static void native_index_rem(NativeColumn *col, TypedValue v, uint64_t id) {
+    unsigned char buf[8]; const unsigned char *key;
+    size_t klen = native_index_key(col->type, v, buf, &key);
+    if (klen) posting_rem(col->index, key, klen, id);
+}
+
+// Index every live row of a column
+static void native_build_index(NativeTable *nt, NativeColumn *col) {
+    if (col->index) return;
+    col->index = RedisModule_CreateDict(NULL);
+    for (size_t s = 0; s < nt->len; s++)
+        if (nt->live[s] && col->present[s]) native_index_add(col, col->vals[s], nt->ids[s]);
+}
+
+static void native_drop_index(NativeColumn *col) {
+    if (!col->index) return;
+    native_index_free(col->index);
+    col->index = NULL;
+}
+
+static NativeColumn *native_find_column(NativeTable *nt, const char *name, size_t namelen) {
+    for (int c = 0; c < nt->ncols; c++)
+        if (nt->cols[c].namelen == namelen && memcmp(nt->cols[c].name, name, namelen) == 0) return &nt->cols[c];
+    return NULL;
+}
+
+static NativeColumn *native_add_column(NativeTable *nt, const char *name, size_t namelen, int type) {
+    nt->cols = RedisModule_Realloc(nt->cols, sizeof(NativeColumn) * (nt->ncols + 1));
+    NativeColumn *col = &nt->cols[nt->ncols++];
+    col->name = RedisModule_Alloc(namelen + 1);
+    memcpy(col->name, name, namelen);
+    col->name[namelen] = '\0';
+    col->namelen = namelen;
+    col->type = type;
+    col->vals = RedisModule_Calloc(nt->cap ? nt->cap : 1, sizeof(TypedValue));
+    col->present = RedisModule_Calloc(nt->cap ? nt->cap : 1, 1);
+    col->index = NULL;
+    return col;
+}
+
+// Storage of a schema column, created on first write
+// Columns indexed in the schema get their index built on first use
+static NativeColumn *native_column(NativeTable *nt, ColumnSchema *cs, int create) {
+    size_t namelen; const char *name = RedisModule_StringPtrLen(cs->name, &namelen);
+    NativeColumn *col = native_find_column(nt, name, namelen);
+    if (!col && !create) return NULL;
+    if (!col) col = native_add_column(nt, name, namelen, cs->type);
+    if (cs->index != INDEX_NONE && !col->index) native_build_index(nt, col);
+    return col;
+}
+
+// Slot of a live row, -1 if there is none
+static long long native_slot(NativeTable *nt, uint64_t id) {
+    size_t pos = native_id_pos(nt->ids, nt->len, id);
+    return (pos < nt->len && nt->ids[pos] == id && nt->live[pos]) ? (long long)pos : -1;
+}
+
+// Allocate the slot of a new row (IDs normally arrive in increasing order)
+static size_t native_insert_slot(NativeTable *nt, uint64_t id) {
+    size_t pos = native_id_pos(nt->ids, nt->len, id);
+    if (pos < nt->len && nt->ids[pos] == id) {
+        if (!nt->live[pos]) { nt->live[pos] = 1; nt->nrows++; }
+        return pos;
+    }
+    if (nt->len == nt->cap) {
+        nt->cap = nt->cap ? nt->cap * 2 : NATIVE_INITIAL_SLOTS;
+        nt->ids = RedisModule_Realloc(nt->ids, sizeof(uint64_t) * nt->cap);
+        nt->live = RedisModule_Realloc(nt->live, nt->cap);
+        for (int c = 0; c < nt->ncols; c++) {
+            NativeColumn *col = &nt->cols[c];
+            col->vals = RedisModule_Realloc(col->vals, sizeof(TypedValue) * nt->cap);
+            col->present = RedisModule_Realloc(col->present, nt->cap);
+            memset(col->present + nt->len, 0, nt->cap - nt->len);
+        }
+    }
+    size_t tail = nt->len - pos;
+    memmove(nt->ids + pos + 1, nt->ids + pos, sizeof(uint64_t) * tail);
+    memmove(nt->live + pos + 1, nt->live + pos, tail);
+    for (int c = 0; c < nt->ncols; c++) {
+        NativeColumn *col = &nt->cols[c];
+        memmove(col->vals + pos + 1, col->vals + pos, sizeof(TypedValue) * tail);
+        memmove(col->present + pos + 1, col->present + pos, tail);
+        col->present[pos] = 0;
+    }
+    nt->ids[pos] = id;
+    nt->live[pos] = 1;
+    nt->len++;
+    nt->nrows++;
+    if (id > nt->last_id) nt->last_id = id;
+    return pos;
+}
+
+// Store a value (ownership of strings passes to the table)
+static void native_set_value(NativeTable *nt, size_t slot, NativeColumn *col, TypedValue v) {
+    if (col->present[slot]) {
+        TypedValue old = col->vals[slot];
+        int same = col->type == COLTYPE_STRING
+            ? native_str_len(old.s) == native_str_len(v.s) && memcmp(old.s, v.s, sizeof(uint32_t) + native_str_len(v.s)) == 0
+            : old.i == v.i;
+        if (same) {
+            if (col->type == COLTYPE_STRING) RedisModule_Free(v.s);
+            return;
+        }
+        if (col->index) native_index_rem(col, old, nt->ids[slot]);
+        if (col->type == COLTYPE_STRING) RedisModule_Free(old.s);
+    }
+    col->vals[slot] = v;
+    col->present[slot] = 1;
+    if (col->index) native_index_add(col, v, nt->ids[slot]);
+}
+
+// Store a value given as text; returns -1 if it is not valid for the column type
+static int native_set_text(NativeTable *nt, size_t slot, NativeColumn *col, const char *v, size_t vlen) {
+    TypedValue tv;
+    if (native_value_parse(col, v, vlen, &tv) != 0) return -1;
+    native_set_value(nt, slot, col, tv);
+    return 0;
+}
+
+// Drop deleted slots once they make up half of the table
+static void native_compact(NativeTable *nt) {
+    if (nt->len < NATIVE_INITIAL_SLOTS || nt->nrows * 2 > nt->len) return;
+    size_t out = 0;
+    for (size_t s = 0; s < nt->len; s++) {
+        if (!nt->live[s]) continue;
+        nt->ids[out] = nt->ids[s];
+        nt->live[out] = 1;
+        for (int c = 0; c < nt->ncols; c++) {
+            nt->cols[c].vals[out] = nt->cols[c].vals[s];
+            nt->cols[c].present[out] = nt->cols[c].present[s];
+        }
+        out++;
+    }
+    for (int c = 0; c < nt->ncols; c++) memset(nt->cols[c].present + out, 0, nt->len - out);
+    nt->len = out;
+}
+
+static void native_delete_slot(NativeTable *nt, size_t slot) {
+    for (int c = 0; c < nt->ncols; c++) {
+        NativeColumn *col = &nt->cols[c];
+        if (!col->present[slot]) continue;
+        if (col->index) native_index_rem(col, col->vals[slot], nt->ids[slot]);
+        if (col->type == COLTYPE_STRING) RedisModule_Free(col->vals[slot].s);
+        col->present[slot] = 0;
+    }
+    nt->live[slot] = 0;
+    nt->nrows--;
+    native_compact(nt);
+}
+
+// Open the native data of a table; NULL if the table does not use the native engine
+static NativeTable *native_open(RedisModuleCtx *ctx, RedisModuleString *table, int mode) {
+    RedisModuleString *keyName = fmt(ctx, "{%s}:data", table);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, keyName, mode);
+    NativeTable *nt = NULL;
+    if (RedisModule_ModuleTypeGetType(key) == NativeTableType) nt = RedisModule_ModuleTypeGetValue(key);
+    RedisModule_CloseKey(key);
+    RedisModule_FreeString(ctx, keyName);
+    return nt;
+}
+
+// Reply with a row as a map of column/value pairs
+static void native_reply_row(RedisModuleCtx *ctx, NativeTable *nt, size_t slot) {
+    int n = 0;
+    for (int c = 0; c < nt->ncols; c++) if (nt->cols[c].present[slot]) n++;
+    out_map(ctx, n);
+    for (int c = 0; c < nt->ncols; c++) {
+        NativeColumn *col = &nt->cols[c];
+        if (!col->present[slot]) continue;
+        char buf[32]; size_t len;
+        const char *text = native_value_text(col, col->vals[slot], buf, &len);
+        out_buffer(ctx, col->name, col->namelen);
+        out_buffer(ctx, text, len);
+    }
+}
+
+// Reply with the values of the given columns only, in that order (NULL = no value)
+static void native_reply_values(RedisModuleCtx *ctx, NativeTable *nt, size_t slot, NativeColumn **cols, int ncols) {
+    out_array(ctx, ncols);
+    for (int c = 0; c < ncols; c++) {
+        NativeColumn *col = cols[c];
+        if (!col || !col->present[slot]) {
+            out_null(ctx);
+            continue;
+        }
+        char buf[32]; size_t len;
+        const char *text = native_value_text(col, col->vals[slot], buf, &len);
+        out_buffer(ctx, text, len);
+    }
+}
+
+// Evaluate a WHERE predicate against a stored value
+static int native_predicate_match(const Predicate *p, const NativeColumn *col, TypedValue v) {
+    if (p->numeric) return p->cmp(v, p->arg);
+    if (col->type == COLTYPE_STRING) return op_holds(p->op, strcmp(native_str_ptr(v.s), p->text));
+    // Date compared with a constant that is not a calendar date
+    char buf[32]; size_t len;
+    return op_holds(p->op, strcmp(native_value_text(col, v, buf, &len), p->text));
+}
+
+// IDs of rows whose indexed value lies within [min, max] (NULL = unbounded), written to
+// out in index order; with a NULL out the rows are only counted. Returns the number of rows.
+static size_t native_range_ids(NativeColumn *col, RedisModuleString *min, int minIncl,
+                               RedisModuleString *max, int maxIncl, uint64_t *out) {
+    unsigned char minbuf[8], maxbuf[8];
+    const unsigned char *minkey = NULL, *maxkey = NULL;
+    size_t minlen = 0, maxlen = 0;
+    if (min) {
+        size_t l; const char *v = RedisModule_StringPtrLen(min, &l);
+        if (!(minlen = native_index_key_text(col->type, v, l, minbuf, &minkey))) return 0;
+    }
+    if (max) {
+        size_t l; const char *v = RedisModule_StringPtrLen(max, &l);
+        if (!(maxlen = native_index_key_text(col->type, v, l, maxbuf, &maxkey))) return 0;
+    }
+    RedisModuleDictIter *it = min
+        ? RedisModule_DictIteratorStartC(col->index, minIncl ? ">=" : ">", (void*)minkey, minlen)
+        : RedisModule_DictIteratorStartC(col->index, "^", NULL, 0);
+    size_t klen, count = 0; unsigned char *k; NativePosting *p;
+    while ((k = RedisModule_DictNextC(it, &klen, (void**)&p)) != NULL) {
+        if (max) {
+            int cmp = native_key_cmp(k, klen, maxkey, maxlen);
+            if (cmp > 0 || (cmp == 0 && !maxIncl)) break;
+        }
+        if (out) memcpy(out + count, p->ids, sizeof(uint64_t) * p->len);
+        count += p->len;
+    }
+    RedisModule_DictIteratorStop(it);
+    return count;
+}
+
+/* ================== Worker pool ================== */
+
+// Row filters on native tables split their rows among worker_threads threads, the caller
+// included. The threads only read the column arrays of the table, and the caller holds the
+// global lock until every part is done, so the columns act as a snapshot no write can
+// change meanwhile. Callers all hold the global lock, so a single job runs at a time.
+
+typedef void (*PoolTask)(void *arg, int part, int nparts);
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // a new job is posted
+    pthread_cond_t idle;        // the last part of the job is done
+    PoolTask task;
+    void *arg;
+    int nparts, next, done;
+    unsigned long gen;          // incremented for every job
+} g_pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0, 0, 0 };
+
+// Run parts of the current job until none is left; called with the pool lock held
+static void pool_work(void) {
+    while (g_pool.next < g_pool.nparts) {
+        int part = g_pool.next++;
+        pthread_mutex_unlock(&g_pool.lock);
+        g_pool.task(g_pool.arg, part, g_pool.nparts);
+        pthread_mutex_lock(&g_pool.lock);
+        if (++g_pool.done == g_pool.nparts) pthread_cond_signal(&g_pool.idle);
+    }
+}
+
+static void *pool_thread(void *unused) {
+    unsigned long seen = 0;
+    pthread_mutex_lock(&g_pool.lock);
+    for (;;) {
+        while (g_pool.gen == seen) pthread_cond_wait(&g_pool.work, &g_pool.lock);
+        seen = g_pool.gen;
+        pool_work();
+    }
+    return NULL;
+}
+
+// Start worker_threads - 1 threads; returns the number of threads available to jobs
+static int pool_start(void) {
+    for (int i = 1; i < g_worker_threads; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, pool_thread, NULL) != 0) return g_worker_threads = i;
+        pthread_detach(tid);
+    }
+    return g_worker_threads;
+}
+
+// Run task(arg, part, nparts) for every part and wait for all of them
+static void pool_run(PoolTask task, void *arg, int nparts) {
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.task = task; g_pool.arg = arg;
+    g_pool.nparts = nparts; g_pool.next = 0; g_pool.done = 0;
+    g_pool.gen++;
+    pthread_cond_broadcast(&g_pool.work);
+    pool_work();
+    while (g_pool.done < g_pool.nparts) pthread_cond_wait(&g_pool.idle, &g_pool.lock);
+    pthread_mutex_unlock(&g_pool.lock);
+}
+
+// Predicate evaluation over the rows ids[0..len) of a native table, one bit per row in keep
+typedef struct {
+    const Predicate *pred;
+    CmpKernel kernel;           // comparison kernel for numeric predicates, NULL otherwise
+    NativeTable *nt;
+    NativeColumn *col;
+    const uint64_t *ids;
+    size_t len;
+    uint64_t *keep;
+} FilterJob;
+
+// Most slots a kernel compares to evaluate 64 candidate rows; sparser candidates are
+// compared one by one
+#define NATIVE_KERNEL_SPAN 256
+
+// Fill the words of keep covering rows [lo, hi), lo being a multiple of 64
+static void native_filter_rows(FilterJob *j, size_t lo, size_t hi) {
+    const NativeTable *nt = j->nt;
+    const NativeColumn *col = j->col;
+    size_t pos = 0, slots[64];
+    uint64_t span[NATIVE_KERNEL_SPAN / 64];
+    for (size_t w = lo / 64; w * 64 < hi; w++) {
+        size_t base = w * 64, n = base + 64 < hi ? 64 : hi - base;
+
+        // Candidates and slots are both in ID order: gallop from the previous slot
+        // Rows without a value get SIZE_MAX
+        size_t first = SIZE_MAX, last = 0;
+        for (size_t k = 0; k < n; k++) {
+            pos = idset_seek(nt->ids, nt->len, pos, j->ids[base + k]);
+            if (pos < nt->len && nt->ids[pos] == j->ids[base + k] && nt->live[pos] && col->present[pos]) {
+                if (first == SIZE_MAX) first = pos;
+                slots[k] = last = pos;
+            } else {
+                slots[k] = SIZE_MAX;
+            }
+        }
+
+        uint64_t bits = 0;
+        if (first == SIZE_MAX) {
+            j->keep[w] = 0;
+            continue;
+        }
+        if (j->kernel && last - first < NATIVE_KERNEL_SPAN) {
+            // Compare the whole run of slots at once and pick the candidates' bits
+            j->kernel(col->vals + first, last - first + 1, j->pred->op, j->pred->arg, span);
+            for (size_t k = 0; k < n; k++) {
+                size_t off = slots[k] - first;
+                if (slots[k] != SIZE_MAX && ((span[off >> 6] >> (off & 63)) & 1)) bits |= 1ULL << k;
+            }
+        } else {
+            for (size_t k = 0; k < n; k++)
+                if (slots[k] != SIZE_MAX && native_predicate_match(j->pred, col, col->vals[slots[k]]))
+                    bits |= 1ULL << k;
+        }
+        j->keep[w] = bits;
+    }
+}
+
+// Part of a FilterJob: an equal share of the 64 row words
+static void native_filter_part(void *arg, int part, int nparts) {
+    FilterJob *j = arg;
+    size_t words = (j->len + 63) / 64;
+    size_t per = (words + (size_t)nparts - 1) / (size_t)nparts;
+    size_t lo = (size_t)part * per * 64, hi = lo + per * 64;
+    if (hi > j->len) hi = j->len;
+    if (lo < hi) native_filter_rows(j, lo, hi);
+}
+
+/* ================== Native engine type callbacks ================== */
+
+static void *native_rdb_load(RedisModuleIO *rdb, int encver) {
+    if (encver > NATIVE_ENCODING_VERSION) {
+        RedisModule_LogIOError(rdb, "warning", "Table module: cannot load native table encoding %d", encver);
+        return NULL;
+    }
+    NativeTable *nt = native_new();
+    nt->last_id = RedisModule_LoadUnsigned(rdb);
+    int ncols = (int)RedisModule_LoadUnsigned(rdb);
+    int *indexed = RedisModule_Calloc(ncols ? ncols : 1, sizeof(int));
+    for (int c = 0; c < ncols; c++) {
+        size_t namelen;
+        char *name = RedisModule_LoadStringBuffer(rdb, &namelen);
+        int type = (int)RedisModule_LoadUnsigned(rdb);
+        indexed[c] = (int)RedisModule_LoadUnsigned(rdb);
+        native_add_column(nt, name, namelen, type);
+        RedisModule_Free(name);
+    }
+    uint64_t nrows = RedisModule_LoadUnsigned(rdb);
+    for (uint64_t r = 0; r < nrows; r++) {
+        size_t slot = native_insert_slot(nt, RedisModule_LoadUnsigned(rdb));
+        uint64_t ncells = RedisModule_LoadUnsigned(rdb);
+        for (uint64_t i = 0; i < ncells; i++) {
+            int c = (int)RedisModule_LoadUnsigned(rdb);
+            NativeColumn *col = (c >= 0 && c < nt->ncols) ? &nt->cols[c] : NULL;
+            TypedValue v;
+            if (encver == 0 || !col || col->type == COLTYPE_STRING) {
+                size_t vlen;
+                char *s = RedisModule_LoadStringBuffer(rdb, &vlen);
+                if (col && !col->present[slot]) native_set_text(nt, slot, col, s, vlen);
+                RedisModule_Free(s);
+                continue;
+            }
+            if (col->type == COLTYPE_FLOAT) v.d = RedisModule_LoadDouble(rdb);
+            else v.i = RedisModule_LoadSigned(rdb);
+            col->vals[slot] = v;
+            col->present[slot] = 1;
+        }
+    }
+    // Indexes are not persisted, rebuild them from the loaded rows
+    for (int c = 0; c < nt->ncols; c++) if (indexed[c]) native_build_index(nt, &nt->cols[c]);
+    RedisModule_Free(indexed);
+    if (RedisModule_IsIOError(rdb)) {
+        native_free(nt);
+        return NULL;
+    }
+    return nt;
+}
+
+static void native_rdb_save(RedisModuleIO *rdb, void *value) {
+    NativeTable *nt = value;
+    RedisModule_SaveUnsigned(rdb, nt->last_id);
+    RedisModule_SaveUnsigned(rdb, (uint64_t)nt->ncols);
+    for (int c = 0; c < nt->ncols; c++) {
+        RedisModule_SaveStringBuffer(rdb, nt->cols[c].name, nt->cols[c].namelen);
+        RedisModule_SaveUnsigned(rdb, (uint64_t)nt->cols[c].type);
+        RedisModule_SaveUnsigned(rdb, nt->cols[c].index ? 1 : 0);
+    }
+    RedisModule_SaveUnsigned(rdb, nt->nrows);
+    for (size_t s = 0; s < nt->len; s++) {
+        if (!nt->live[s]) continue;
+        RedisModule_SaveUnsigned(rdb, nt->ids[s]);
+        uint64_t ncells = 0;
+        for (int c = 0; c < nt->ncols; c++) if (nt->cols[c].present[s]) ncells++;
+        RedisModule_SaveUnsigned(rdb, ncells);
+        for (int c = 0; c < nt->ncols; c++) {
+            NativeColumn *col = &nt->cols[c];
+            if (!col->present[s]) continue;
+            RedisModule_SaveUnsigned(rdb, (uint64_t)c);
+            TypedValue v = col->vals[s];
+            if (col->type == COLTYPE_STRING) RedisModule_SaveStringBuffer(rdb, native_str_ptr(v.s), native_str_len(v.s));
+            else if (col->type == COLTYPE_FLOAT) RedisModule_SaveDouble(rdb, v.d);
+            else RedisModule_SaveSigned(rdb, v.i);
+        }
+    }
+}
+
+// Rewrite the table as TABLE._RESTORE commands:
+//   COLUMN <name> <type> <indexed>, LASTID <id>, then ROW <id> <col>=<value> ... per row
+static void native_aof_rewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
+    NativeTable *nt = value;
+    for (int c = 0; c < nt->ncols; c++)
+        RedisModule_EmitAOF(aof, "TABLE._RESTORE", "scbll", key, "COLUMN", nt->cols[c].name, nt->cols[c].namelen,
+                            (long long)nt->cols[c].type, (long long)(nt->cols[c].index ? 1 : 0));
+    RedisModule_EmitAOF(aof, "TABLE._RESTORE", "scl", key, "LASTID", (long long)nt->last_id);
+
+    RedisModuleString **fields = RedisModule_Alloc(sizeof(RedisModuleString*) * (nt->ncols ? nt->ncols : 1));
+    for (size_t s = 0; s < nt->len; s++) {
+        if (!nt->live[s]) continue;
+        size_t n = 0;
+        for (int c = 0; c < nt->ncols; c++) {
+            NativeColumn *col = &nt->cols[c];
+            if (!col->present[s]) continue;
+            char buf[32]; size_t len;
+            const char *text = native_value_text(col, col->vals[s], buf, &len);
+            fields[n] = RedisModule_CreateString(NULL, col->name, col->namelen);
+            RedisModule_StringAppendBuffer(NULL, fields[n], "=", 1);
+            RedisModule_StringAppendBuffer(NULL, fields[n], text, len);
+            n++;
+        }
+        RedisModule_EmitAOF(aof, "TABLE._RESTORE", "sclv", key, "ROW", (long long)nt->ids[s], fields, n);
+        for (size_t i = 0; i < n; i++) RedisModule_FreeString(NULL, fields[i]);
+    }
+    RedisModule_Free(fields);
+}
+
+static size_t native_mem_usage(const void *value) {
+    const NativeTable *nt = value;
+    size_t size = sizeof(*nt) + nt->cap * (sizeof(uint64_t) + 1) + sizeof(NativeColumn) * nt->ncols;
+    for (int c = 0; c < nt->ncols; c++) {
+        const NativeColumn *col = &nt->cols[c];
+        size += col->namelen + 1 + nt->cap * (sizeof(TypedValue) + 1);
+        if (col->type == COLTYPE_STRING)
+            for (size_t s = 0; s < nt->len; s++)
+                if (col->present[s]) size += sizeof(uint32_t) + native_str_len(col->vals[s].s) + 1;
+        if (col->index) {
+            RedisModuleDictIter *it = RedisModule_DictIteratorStartC(col->index, "^", NULL, 0);
+            size_t klen; NativePosting *p;
+            while (RedisModule_DictNextC(it, &klen, (void**)&p) != NULL)
+                size += klen + sizeof(*p) + p->cap * sizeof(uint64_t);
+            RedisModule_DictIteratorStop(it);
+        }
+    }
+    return size;
+}
+
+// Allocations released by native_free(): large tables are freed off the main thread by UNLINK
+static size_t native_free_effort(RedisModuleString *key, const void *value) {
+    const NativeTable *nt = value;
+    return nt->len * (size_t)(nt->ncols + 1);
+}
+
+static void native_digest(RedisModuleDigest *md, void *value) {
+    NativeTable *nt = value;
+    RedisModule_DigestAddLongLong(md, (long long)nt->last_id);
+    RedisModule_DigestEndSequence(md);
+    for (size_t s = 0; s < nt->len; s++) {
+        if (!nt->live[s]) continue;
+        RedisModule_DigestAddLongLong(md, (long long)nt->ids[s]);
+        for (int c = 0; c < nt->ncols; c++) {
+            NativeColumn *col = &nt->cols[c];
+            if (!col->present[s]) continue;
+            char buf[32]; size_t len;
+            const char *text = native_value_text(col, col->vals[s], buf, &len);
+            RedisModule_DigestAddStringBuffer(md, col->name, col->namelen);
+            RedisModule_DigestAddStringBuffer(md, text, len);
+        }
+        RedisModule_DigestEndSequence(md);
+    }
+}
+
+/* ================== Hash index type ================== */
+
+// The hash indexes of hash tables, on a column or a composite tuple, are one module-typed
+// key each, {ns.t}:hash:<col> (or <c1,c2,...>), mapping the text of each indexed value to
+// the sorted list of row IDs holding it, as native table indexes do. Index memory follows
+// the rows indexed rather than the number of distinct values, a lookup is one dictionary
+// read, and DROP INDEX unlinks one key. An index losing its last entry is deleted.
+
+#define HASH_INDEX_ENCODING_VERSION 0
+// Row IDs per TABLE._RESTORE command of an AOF rewrite
+#define HASH_INDEX_AOF_IDS 1000
+
+typedef struct {
+    RedisModuleDict *postings;  // value -> NativePosting*
+    size_t nids;                // row IDs over all posting lists
+} HashIndex;
+
+static HashIndex *hash_index_new(void) {
+    HashIndex *hi = RedisModule_Calloc(1, sizeof(HashIndex));
+    hi->postings = RedisModule_CreateDict(NULL);
+    return hi;
+}
+
+static void hash_index_free(void *value) {
+    HashIndex *hi = value;
+    native_index_free(hi->postings);
+    RedisModule_Free(hi);
+}
+
+static void *hash_index_rdb_load(RedisModuleIO *rdb, int encver) {
+    if (encver > HASH_INDEX_ENCODING_VERSION) {
+        RedisModule_LogIOError(rdb, "warning", "Table module: cannot load hash index encoding %d", encver);
+        return NULL;
+    }
+    HashIndex *hi = hash_index_new();
+    uint64_t nvals = RedisModule_LoadUnsigned(rdb);
+    for (uint64_t v = 0; v < nvals; v++) {
+        size_t klen;
+        char *key = RedisModule_LoadStringBuffer(rdb, &klen);
+        uint64_t n = RedisModule_LoadUnsigned(rdb);
+        // IDs are saved in order, the list is rebuilt as is
+        NativePosting *p = RedisModule_Calloc(1, sizeof(NativePosting));
+        p->cap = n ? n : 1;
+        p->ids = RedisModule_Alloc(sizeof(uint64_t) * p->cap);
+        for (uint64_t i = 0; i < n; i++) p->ids[p->len++] = RedisModule_LoadUnsigned(rdb);
+        if (!key || !p->len || RedisModule_DictSetC(hi->postings, key, klen, p) != REDISMODULE_OK) {
+            RedisModule_Free(p->ids);
+            RedisModule_Free(p);
+        } else {
+            hi->nids += p->len;
+        }
+        if (key) RedisModule_Free(key);
+    }
+    if (RedisModule_IsIOError(rdb)) {
+        hash_index_free(hi);
+        return NULL;
+    }
+    return hi;
+}
+
+static void hash_index_rdb_save(RedisModuleIO *rdb, void *value) {
+    HashIndex *hi = value;
+    RedisModule_SaveUnsigned(rdb, RedisModule_DictSize(hi->postings));
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(hi->postings, "^", NULL, 0);
+    size_t klen; char *key; NativePosting *p;
+    while ((key = RedisModule_DictNextC(it, &klen, (void**)&p)) != NULL) {
+        RedisModule_SaveStringBuffer(rdb, key, klen);
+        RedisModule_SaveUnsigned(rdb, p->len);
+        for (size_t i = 0; i < p->len; i++) RedisModule_SaveUnsigned(rdb, p->ids[i]);
+    }
+    RedisModule_DictIteratorStop(it);
+}
+
+// Rewrite the index as TABLE._RESTORE <key> POSTING <value> <id,...> commands
+static void hash_index_aof_rewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
+    HashIndex *hi = value;
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(hi->postings, "^", NULL, 0);
+    size_t klen; char *val; NativePosting *p;
+    while ((val = RedisModule_DictNextC(it, &klen, (void**)&p)) != NULL) {
+        IdSet ids = { p->ids, p->len };
+        for (size_t at = 0; at < p->len; at += HASH_INDEX_AOF_IDS) {
+            size_t to = at + HASH_INDEX_AOF_IDS < p->len ? at + HASH_INDEX_AOF_IDS : p->len;
+            RedisModuleString *list = idset_format(NULL, ids, at, to);
+            RedisModule_EmitAOF(aof, "TABLE._RESTORE", "scbs", key, "POSTING", val, klen, list);
+            RedisModule_FreeString(NULL, list);
+        }
+    }
+    RedisModule_DictIteratorStop(it);
+}
+
+static size_t hash_index_mem_usage(const void *value) {
+    const HashIndex *hi = value;
+    size_t size = sizeof(*hi);
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(hi->postings, "^", NULL, 0);
+    size_t klen; NativePosting *p;
+    while (RedisModule_DictNextC(it, &klen, (void**)&p) != NULL)
+        size += klen + sizeof(*p) + p->cap * sizeof(uint64_t);
+    RedisModule_DictIteratorStop(it);
+    return size;
+}
+
+// Allocations released by hash_index_free(): large indexes are freed off the main thread by UNLINK
+static size_t hash_index_free_effort(RedisModuleString *key, const void *value) {
+    const HashIndex *hi = value;
+    return RedisModule_DictSize(hi->postings);
+}
+
+static void hash_index_digest(RedisModuleDigest *md, void *value) {
+    HashIndex *hi = value;
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(hi->postings, "^", NULL, 0);
+    size_t klen; char *val; NativePosting *p;
+    while ((val = RedisModule_DictNextC(it, &klen, (void**)&p)) != NULL) {
+        RedisModule_DigestAddStringBuffer(md, val, klen);
+        for (size_t i = 0; i < p->len; i++) RedisModule_DigestAddLongLong(md, (long long)p->ids[i]);
+        RedisModule_DigestEndSequence(md);
+    }
+    RedisModule_DictIteratorStop(it);
+}
+
+// The hash index name (a column or composite index) of a table; with create, an empty
+// index is made if there is none. Returns NULL if there is none, or the key holds another type
+static HashIndex *hash_index_open(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *name, int create) {
+    RedisModuleString *keyName = fmt2(ctx, "{%s}:hash:%s", table, name);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, keyName, create ? REDISMODULE_READ | REDISMODULE_WRITE : REDISMODULE_READ);
+    HashIndex *hi = NULL;
+    if (RedisModule_ModuleTypeGetType(key) == HashIndexType) {
+        hi = RedisModule_ModuleTypeGetValue(key);
+    } else if (create && RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY) {
+        hi = hash_index_new();
+        RedisModule_ModuleTypeSetValue(key, HashIndexType, hi);
+    }
+    RedisModule_CloseKey(key);
+    RedisModule_FreeString(ctx, keyName);
+    return hi;
+}
+
+// Posting list of val in the hash index name of a table, NULL if no row holds it
+static NativePosting *hash_index_posting(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *name,
+                                         RedisModuleString *val) {
+    HashIndex *hi = hash_index_open(ctx, table, name, 0);
+    if (!hi) return NULL;
+    size_t vlen; const char *v = RedisModule_StringPtrLen(val, &vlen);
+    return RedisModule_DictGetC(hi->postings, (void*)v, vlen, NULL);
+}
+
+// Index edits of a batch of rows (UPDATE, DELETE, purges), applied per index rather than
+// per row: each hash index is opened once and changed in place, the btree entries of a
+// ZSET are removed and added by one ZREM and one ZADD for the whole batch, the rows of a
+// partition by one SREM and one SADD (see index_batch_flush()). Unique indexes are changed
+// at once, their values being checked row by row. A NULL batch applies every edit at once.
+typedef struct {
+    RedisModuleString *table;
+    RedisModuleDict *hash;      // hash index name -> HashIndex* opened for the batch, NULL = none
+    RedisModuleDict *btree;     // ZSET key -> BtreeEdits*
+    RedisModuleDict *sets;      // partition key -> BtreeEdits*, members only
+} IndexBatch;
+
+// Hash index name of a table, opened once per batch
+static HashIndex *index_batch_hash(RedisModuleCtx *ctx, IndexBatch *b, RedisModuleString *table,
+                                   RedisModuleString *name, int create) {
+    if (!b) return hash_index_open(ctx, table, name, create);
+    int nokey;
+    HashIndex *hi = RedisModule_DictGet(b->hash, name, &nokey);
+    if (nokey || (!hi && create)) {
+        hi = hash_index_open(ctx, table, name, create);
+        RedisModule_DictReplace(b->hash, name, hi);
+    }
+    return hi;
+}
+
+static void hash_index_add(RedisModuleCtx *ctx, IndexBatch *b, RedisModuleString *table, RedisModuleString *name,
+                           RedisModuleString *val, RedisModuleString *rowId) {
+    size_t l; const char *id = RedisModule_StringPtrLen(rowId, &l);
+    size_t vlen; const char *v = RedisModule_StringPtrLen(val, &vlen);
+    HashIndex *hi = index_batch_hash(ctx, b, table, name, 1);
+    if (hi) hi->nids += (size_t)posting_add(hi->postings, v, vlen, idset_parse_id(id, l));
+}
+
+// The key of an emptied index is deleted, at the end of the batch if there is one
+static void hash_index_rem(RedisModuleCtx *ctx, IndexBatch *b, RedisModuleString *table, RedisModuleString *name,
+                           RedisModuleString *val, RedisModuleString *rowId) {
+    size_t l; const char *id = RedisModule_StringPtrLen(rowId, &l);
+    size_t vlen; const char *v = RedisModule_StringPtrLen(val, &vlen);
+    HashIndex *hi = index_batch_hash(ctx, b, table, name, 0);
+    if (!hi || !posting_rem(hi->postings, v, vlen, idset_parse_id(id, l))) return;
+    if (--hi->nids == 0 && !b) RedisModule_Call(ctx, "DEL", "s", fmt2(ctx, "{%s}:hash:%s", table, name));
+}
+
+/* ================== Index maintenance ================== */
+
+// Convert a value of a numeric column into a ZSET score
+// Dates YYYY-MM-DD become YYYYMMDD so they order chronologically
+// Returns 0 on success, -1 if the value cannot be ordered as the column type
+static int btree_score(int type, const char *v, size_t vlen, char *out, size_t outlen) {
+    if (vlen == 0 || vlen >= outlen) return -1;
+    if (type == COLTYPE_DATE) {
+        if (vlen != 10 || v[4] != '-' || v[7] != '-') return -1;
+        size_t o = 0;
+        for (size_t i = 0; i < 10; i++) {
+            if (i == 4 || i == 7) continue;
+            if (v[i] < '0' || v[i] > '9') return -1;
+            out[o++] = v[i];
+        }
+        out[o] = '\0';
+        return 0;
+    }
+    // integer and float: optional sign, digits, one decimal point for float
+    int hasDot = 0, hasDigit = 0;
+    size_t i = (v[0] == '-' || v[0] == '+') ? 1 : 0;
+    for (; i < vlen; i++) {
+        if (v[i] == '.' && type == COLTYPE_FLOAT && !hasDot) hasDot = 1;
+        else if (v[i] >= '0' && v[i] <= '9') hasDigit = 1;
+        else return -1;
+    }
+    if (!hasDigit) return -1;
+    memcpy(out, v, vlen);
+    out[vlen] = '\0';
+    return 0;
+}
+
+// Integers of magnitude 2^53 or more share their double ZSET score with their neighbours
+#define BTREE_EXACT_INT 9007199254740992LL
+
+static int btree_score_inexact(int type, RedisModuleString *val) {
+    if (type != COLTYPE_INTEGER || !val) return 0;
+    const char *v = RedisModule_StringPtrLen(val, NULL);
+    errno = 0;
+    long long n = strtoll(v, NULL, 10);
+    return errno == ERANGE || n >= BTREE_EXACT_INT || n <= -BTREE_EXACT_INT;
+}
+
+// String btree entries all share score 0 and are ordered by member "<value>\0<rowId>"
+static RedisModuleString *btree_string_member(RedisModuleCtx *ctx, RedisModuleString *val, RedisModuleString *rowId) {
+    size_t vlen; const char *v = RedisModule_StringPtrLen(val, &vlen);
+    size_t idlen; const char *id = RedisModule_StringPtrLen(rowId, &idlen);
+    RedisModuleString *member = RedisModule_CreateString(ctx, v, vlen);
+    RedisModule_StringAppendBuffer(ctx, member, "\0", 1);
+    RedisModule_StringAppendBuffer(ctx, member, id, idlen);
+    return member;
+}
+
+// Btree entries of a ZSET edited by a batch
+typedef struct {
+    RedisModuleString *key;
+    RedisModuleString **rem;        // members to remove
+    size_t nrem, remCap;
+    RedisModuleString **add;        // score, member pairs to add
+    size_t nadd, addCap;
+} BtreeEdits;
+
+static void btree_edits_push(RedisModuleString ***v, size_t *n, size_t *cap, RedisModuleString *s) {
+    if (*n == *cap) {
+        *cap = *cap ? *cap * 2 : 16;
+        *v = RedisModule_Realloc(*v, sizeof(RedisModuleString*) * *cap);
+    }
+    (*v)[(*n)++] = s;
+}
+
+static BtreeEdits *index_batch_edits(RedisModuleDict *d, RedisModuleString *key) {
+    BtreeEdits *e = RedisModule_DictGet(d, key, NULL);
+    if (!e) {
+        e = RedisModule_Calloc(1, sizeof(BtreeEdits));
+        RedisModule_RetainString(NULL, key);
+        e->key = key;
+        RedisModule_DictSet(d, key, e);
+    }
+    return e;
+}
+
+static BtreeEdits *index_batch_btree(IndexBatch *b, RedisModuleString *btKey) {
+    return index_batch_edits(b->btree, btKey);
+}
+
+// Add a row to an ordered index ZSET, by the value of a column of the given type
+static void btree_entry_add(RedisModuleCtx *ctx, IndexBatch *b, RedisModuleString *btKey, int type,
+                            RedisModuleString *val, RedisModuleString *rowId) {
+    RedisModuleString *score, *member;
+    if (type == COLTYPE_STRING) {
+        score = RedisModule_CreateString(NULL, "0", 1);
+        member = btree_string_member(NULL, val, rowId);
+    } else {
+        char buf[64];
+        size_t vlen; const char *v = RedisModule_StringPtrLen(val, &vlen);
+        if (btree_score(type, v, vlen, buf, sizeof(buf)) != 0) return;
+        score = RedisModule_CreateString(NULL, buf, strlen(buf));
+        RedisModule_RetainString(NULL, rowId);
+        member = rowId;
+    }
+    if (!b) {
+        RedisModule_Call(ctx, "ZADD", "sss", btKey, score, member);
+        RedisModule_FreeString(NULL, score);
+        RedisModule_FreeString(NULL, member);
+        return;
+    }
+    BtreeEdits *e = index_batch_btree(b, btKey);
+    btree_edits_push(&e->add, &e->nadd, &e->addCap, score);
+    btree_edits_push(&e->add, &e->nadd, &e->addCap, member);
+}
+
+static void btree_entry_rem(RedisModuleCtx *ctx, IndexBatch *b, RedisModuleString *btKey, int type,
+                            RedisModuleString *val, RedisModuleString *rowId) {
+    RedisModuleString *member;
+    if (type == COLTYPE_STRING) {
+        member = btree_string_member(NULL, val, rowId);
+    } else {
+        RedisModule_RetainString(NULL, rowId);
+        member = rowId;
+    }
+    if (!b) {
+        RedisModule_Call(ctx, "ZREM", "ss", btKey, member);
+        RedisModule_FreeString(NULL, member);
+        return;
+    }
+    BtreeEdits *e = index_batch_btree(b, btKey);
+    btree_edits_push(&e->rem, &e->nrem, &e->remCap, member);
+}
+
+// Row holding val in the unique index of a column, 0 if none
+static uint64_t unique_owner(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *col,
+                             RedisModuleString *val) {
+    RedisModuleCallReply *r = RedisModule_Call(ctx, "HGET", "ss", fmt2(ctx, "{%s}:unique:%s", table, col), val);
+    if (!r || RedisModule_CallReplyType(r) != REDISMODULE_REPLY_STRING) return 0;
+    size_t l; const char *id = RedisModule_CallReplyStringPtr(r, &l);
+    return idset_parse_id(id, l);
+}
+
+// Give val to a row in the unique index of a column, unless another row holds it
+// Returns 0, or -1 if the value is taken
+static int unique_claim(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *col,
+                        RedisModuleString *val, RedisModuleString *rowId) {
+    uint64_t owner = unique_owner(ctx, table, col, val);
+    size_t l; const char *id = RedisModule_StringPtrLen(rowId, &l);
+    if (owner && owner != idset_parse_id(id, l)) return -1;
+    if (!owner) RedisModule_Call(ctx, "HSET", "sss", fmt2(ctx, "{%s}:unique:%s", table, col), val, rowId);
+    return 0;
+}
+
+#define UNIQUE_TAKEN_ERROR "ERR duplicate value for a unique column"
+#define PRIMARY_MISSING_ERROR "ERR the primary key column needs a value"
+
+// Check the values given to the rows ids, or to a new row when ids is NULL, against the
+// unique indexes: a value goes to one row only and must not be held by another row.
+// A new row needs a value for the primary key.
+// Returns NULL or an error message
+static const char *unique_check(RedisModuleCtx *ctx, RedisModuleString *table, TableSchema *sch,
+                                ColumnSchema **cols, RedisModuleString **vals, int n, const IdSet *ids) {
+    if (!ids && sch->primary) {
+        int found = 0;
+        for (int i = 0; i < n && !found; i++) found = cols[i] == sch->primary;
+        if (!found) return PRIMARY_MISSING_ERROR;
+    }
+    if (ids && ids->len == 0) return NULL;
+    for (int i = 0; i < n; i++) {
+        if (column_write_index(cols[i]) != INDEX_UNIQUE) continue;
+        if (ids && ids->len > 1) return UNIQUE_TAKEN_ERROR;
+        uint64_t owner = unique_owner(ctx, table, cols[i]->name, vals[i]);
+        if (owner && (!ids || owner != ids->ids[0])) return UNIQUE_TAKEN_ERROR;
+    }
+    return NULL;
+}
+
+// Add a row to the index of a column; unique values are checked by the caller
+static void index_add(RedisModuleCtx *ctx, IndexBatch *b, RedisModuleString *table, RedisModuleString *col,
+                      int kind, RedisModuleString *val, RedisModuleString *rowId) {
+    if (kind == INDEX_HASH) {
+        hash_index_add(ctx, b, table, col, val, rowId);
+    } else if (kind == INDEX_BTREE) {
+        btree_entry_add(ctx, b, fmt2(ctx, "{%s}:btree:%s", table, col), get_column_type(ctx, table, col), val, rowId);
+    } else if (kind == INDEX_UNIQUE) {
+        RedisModule_Call(ctx, "HSET", "sss", fmt2(ctx, "{%s}:unique:%s", table, col), val, rowId);
+    }
+}
+
+// Remove a row from the index of a column
+static void index_rem(RedisModuleCtx *ctx, IndexBatch *b, RedisModuleString *table, RedisModuleString *col,
+                      int kind, RedisModuleString *val, RedisModuleString *rowId) {
+    if (kind == INDEX_HASH) {
+        hash_index_rem(ctx, b, table, col, val, rowId);
+    } else if (kind == INDEX_BTREE) {
+        btree_entry_rem(ctx, b, fmt2(ctx, "{%s}:btree:%s", table, col), get_column_type(ctx, table, col), val, rowId);
+    } else if (kind == INDEX_UNIQUE) {
+        // The value may belong to a newer row already, once a purge has unlinked the index
+        size_t l; const char *id = RedisModule_StringPtrLen(rowId, &l);
+        if (unique_owner(ctx, table, col, val) == idset_parse_id(id, l))
+            RedisModule_Call(ctx, "HDEL", "ss", fmt2(ctx, "{%s}:unique:%s", table, col), val);
+    }
+}
+
+// Composite indexes are named by their column list and keyed by the tuple of values of
+// every column (hash: an entry of the hash index {ns.t}:hash:<c1,c2,...>), or of all but
+// the last (btree: one ZSET per tuple, {ns.t}:idx:<c1,c2,...>:<tuple>, ordered by the last
+// column as a btree index is). A tuple joins its values by ',', each as <length>:<value>.
+// A row lacking one of the values is not indexed. Composite indexes exist on hash tables only.
+
+// Tuple of vals (one value per column of the index) naming their entry
+static RedisModuleString *composite_tuple(RedisModuleCtx *ctx, CompositeIndex *ci, RedisModuleString **vals) {
+    RedisModuleString *tuple = RedisModule_CreateString(ctx, "", 0);
+    int n = ci->kind == INDEX_BTREE ? ci->ncols - 1 : ci->ncols;
+    for (int i = 0; i < n; i++) {
+        size_t vlen; const char *v = RedisModule_StringPtrLen(vals[i], &vlen);
+        char len[32];
+        int l = snprintf(len, sizeof(len), "%s%zu:", i ? "," : "", vlen);
+        RedisModule_StringAppendBuffer(ctx, tuple, len, (size_t)l);
+        RedisModule_StringAppendBuffer(ctx, tuple, v, vlen);
+    }
+    return tuple;
+}
+
+// Key of the ZSET of the tuple vals in a btree composite index
+static RedisModuleString *composite_key(RedisModuleCtx *ctx, RedisModuleString *table, CompositeIndex *ci,
+                                        RedisModuleString **vals) {
+    RedisModuleString *key = fmt2(ctx, "{%s}:idx:%s:", table, ci->name);
+    size_t tlen; const char *t = RedisModule_StringPtrLen(composite_tuple(ctx, ci, vals), &tlen);
+    RedisModule_StringAppendBuffer(ctx, key, t, tlen);
+    return key;
+}
+
+// Add (add set) or remove a row with the values vals to a composite index
+static void composite_entry(RedisModuleCtx *ctx, IndexBatch *b, RedisModuleString *table, CompositeIndex *ci,
+                            RedisModuleString **vals, RedisModuleString *rowId, int add) {
+    for (int i = 0; i < ci->ncols; i++) if (!vals[i]) return;
+    if (ci->kind == INDEX_HASH) {
+        RedisModuleString *tuple = composite_tuple(ctx, ci, vals);
+        if (add) hash_index_add(ctx, b, table, ci->name, tuple, rowId);
+        else hash_index_rem(ctx, b, table, ci->name, tuple, rowId);
+        return;
+    }
+    RedisModuleString *key = composite_key(ctx, table, ci, vals);
+    int last = ci->ncols - 1;
+    if (add) btree_entry_add(ctx, b, key, ci->cols[last]->type, vals[last], rowId);
+    else btree_entry_rem(ctx, b, key, ci->cols[last]->type, vals[last], rowId);
+}
+
+// Whether a composite index covers one of the columns cols
+static int composite_covers(CompositeIndex *ci, ColumnSchema **cols, int n) {
+    for (int i = 0; i < ci->ncols; i++)
+        for (int j = 0; j < n; j++) if (ci->cols[i] == cols[j]) return 1;
+    return 0;
+}
+
+// Add (add set) or remove an open row to the composite indexes of a table, from the values
+// it has now; with cols, only to the indexes covering one of the n columns
+static void composite_index_row(RedisModuleCtx *ctx, IndexBatch *b, RedisModuleString *table, TableSchema *sch,
+                                RedisModuleKey *row, RedisModuleString *rowId, int add,
+                                ColumnSchema **cols, int n) {
+    for (int c = 0; c < sch->ncomposites; c++) {
+        CompositeIndex *ci = &sch->composites[c];
+        if (cols && !composite_covers(ci, cols, n)) continue;
+        RedisModuleString *vals[COMPOSITE_MAX_COLUMNS];
+        for (int i = 0; i < ci->ncols; i++) {
+            vals[i] = NULL;
+            RedisModule_HashGet(row, REDISMODULE_HASH_NONE, ci->cols[i]->name, &vals[i], NULL);
+        }
+        composite_entry(ctx, b, table, ci, vals, rowId, add);
+    }
+}
+
+/* ================== Time partitions ================== */
+// A hash table created with PARTITION BY <date column> keeps the IDs of its rows per day
+// of that column, in a set {ns.t}:part:<YYYY-MM-DD>; the days in use are the members of
+// the ZSET {ns.t}:parts, scored as a btree index scores dates. All share the table's hash tag. A range
+// on the column without a btree index of its own reads the sets of the days it covers
+// only (see plan_leaf()), rows without a value are in no partition.
+// With RETENTION <days>, a partition older than that is handed to a purge as a whole
+// (see partition_expire()).
+
+static RedisModuleString *partition_key(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *day) {
+    return fmt2(ctx, "{%s}:part:%s", table, day);
+}
+
+// Add a row to the partition of day, recording the day in {ns.t}:parts
+static void partition_add(RedisModuleCtx *ctx, IndexBatch *b, RedisModuleString *table, RedisModuleString *day,
+                          RedisModuleString *rowId) {
+    size_t dl; const char *d = RedisModule_StringPtrLen(day, &dl);
+    char score[64];
+    if (btree_score(COLTYPE_DATE, d, dl, score, sizeof(score)) != 0) return;
+    RedisModuleString *key = partition_key(ctx, table, day);
+    RedisModuleString *parts = fmt(ctx, "{%s}:parts", table);
+    if (!b) {
+        RedisModule_Call(ctx, "SADD", "ss", key, rowId);
+        RedisModule_Call(ctx, "ZADD", "scs", parts, score, day);
+        return;
+    }
+    BtreeEdits *e = index_batch_edits(b->sets, key);
+    if (!e->nadd) {
+        BtreeEdits *p = index_batch_btree(b, parts);
+        btree_edits_push(&p->add, &p->nadd, &p->addCap, RedisModule_CreateString(NULL, score, strlen(score)));
+        btree_edits_push(&p->add, &p->nadd, &p->addCap, RedisModule_CreateStringFromString(NULL, day));
+    }
+    btree_edits_push(&e->add, &e->nadd, &e->addCap, RedisModule_CreateStringFromString(NULL, rowId));
+}
+
+static void partition_rem(RedisModuleCtx *ctx, IndexBatch *b, RedisModuleString *table, RedisModuleString *day,
+                          RedisModuleString *rowId) {
+    RedisModuleString *key = partition_key(ctx, table, day);
+    if (!b) {
+        RedisModule_Call(ctx, "SREM", "ss", key, rowId);
+        return;
+    }
+    BtreeEdits *e = index_batch_edits(b->sets, key);
+    btree_edits_push(&e->rem, &e->nrem, &e->remCap, RedisModule_CreateStringFromString(NULL, rowId));
+}
+
+// Add (add set) or remove an open row to the partition of the value it has now; with
+// cols, only if the partition column is one of the n columns
+static void partition_row(RedisModuleCtx *ctx, IndexBatch *b, RedisModuleString *table, TableSchema *sch,
+                          RedisModuleKey *row, RedisModuleString *rowId, int add, ColumnSchema **cols, int n) {
+    if (!sch->partition) return;
+    int covered = !cols;
+    for (int i = 0; i < n && !covered; i++) covered = cols[i] == sch->partition;
+    if (!covered) return;
+    RedisModuleString *day = NULL;
+    RedisModule_HashGet(row, REDISMODULE_HASH_NONE, sch->partition->name, &day, NULL);
+    if (!day) return;
+    if (add) partition_add(ctx, b, table, day, rowId);
+    else partition_rem(ctx, b, table, day, rowId);
+}
+
+// Remove a row from the indexes of every indexed column, from the composite indexes and
+// from its partition
+static void index_rem_row(RedisModuleCtx *ctx, IndexBatch *b, RedisModuleString *table, TableSchema *sch,
+                          RedisModuleString *rowKey, RedisModuleString *rowId) {
+    RedisModuleKey *row = RedisModule_OpenKey(ctx, rowKey, REDISMODULE_READ);
+    if (RedisModule_KeyType(row) != REDISMODULE_KEYTYPE_HASH) {
+        RedisModule_CloseKey(row);
+        return;
+    }
+    for (int c = 0; c < sch->ncols; c++) {
+        ColumnSchema *cs = &sch->cols[c];
+        int kind = column_write_index(cs);
+        if (kind == INDEX_NONE) continue;
+        RedisModuleString *oldv = NULL;
+        RedisModule_HashGet(row, REDISMODULE_HASH_NONE, cs->name, &oldv, NULL);
+        if (oldv) index_rem(ctx, b, table, cs->name, kind, oldv, rowId);
+    }
+    if (sch->ncomposites) composite_index_row(ctx, b, table, sch, row, rowId, 0, NULL, 0);
+    partition_row(ctx, b, table, sch, row, rowId, 0, NULL, 0);
+    RedisModule_CloseKey(row);
+}
+
+static int btree_edits_free(void *key, size_t klen, void *data) {
+    (void)key; (void)klen;
+    BtreeEdits *e = data;
+    for (size_t i = 0; i < e->nrem; i++) RedisModule_FreeString(NULL, e->rem[i]);
+    for (size_t i = 0; i < e->nadd; i++) RedisModule_FreeString(NULL, e->add[i]);
+    RedisModule_Free(e->rem);
+    RedisModule_Free(e->add);
+    RedisModule_FreeString(NULL, e->key);
+    RedisModule_Free(e);
+    return 1;
+}
+
+static void index_batch_init(IndexBatch *b, RedisModuleString *table) {
+    b->table = table;
+    b->hash = RedisModule_CreateDict(NULL);
+    b->btree = RedisModule_CreateDict(NULL);
+    b->sets = RedisModule_CreateDict(NULL);
+}
+
+// Apply the btree and partition edits of a batch, removals before additions so that a row
+// moved to another value of the same ZSET keeps its new entry, and delete the hash indexes the
+// batch emptied. Done before the lock is released, as other commands may then change
+// the keys, and the batch is left empty.
+static void index_batch_flush(RedisModuleCtx *ctx, IndexBatch *b) {
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(b->btree, "^", NULL, 0);
+    BtreeEdits *e;
+    while (RedisModule_DictNextC(it, NULL, (void**)&e)) {
+        if (e->nrem) RedisModule_Call(ctx, "ZREM", "sv", e->key, e->rem, e->nrem);
+        if (e->nadd) RedisModule_Call(ctx, "ZADD", "sv", e->key, e->add, e->nadd);
+        btree_edits_free(NULL, 0, e);
+    }
+    RedisModule_DictIteratorStop(it);
+    it = RedisModule_DictIteratorStartC(b->sets, "^", NULL, 0);
+    while (RedisModule_DictNextC(it, NULL, (void**)&e)) {
+        if (e->nrem) RedisModule_Call(ctx, "SREM", "sv", e->key, e->rem, e->nrem);
+        if (e->nadd) RedisModule_Call(ctx, "SADD", "sv", e->key, e->add, e->nadd);
+        btree_edits_free(NULL, 0, e);
+    }
+    RedisModule_DictIteratorStop(it);
+    it = RedisModule_DictIteratorStartC(b->hash, "^", NULL, 0);
+    RedisModuleString *name;
+    HashIndex *hi;
+    while ((name = RedisModule_DictNext(ctx, it, (void**)&hi)) != NULL)
+        if (hi && hi->nids == 0) RedisModule_Call(ctx, "DEL", "s", fmt2(ctx, "{%s}:hash:%s", b->table, name));
+    RedisModule_DictIteratorStop(it);
+    RedisModule_FreeDict(NULL, b->btree);
+    RedisModule_FreeDict(NULL, b->hash);
+    RedisModule_FreeDict(NULL, b->sets);
+    index_batch_init(b, b->table);
+}
+
+static void index_batch_free(RedisModuleCtx *ctx, IndexBatch *b) {
+    index_batch_flush(ctx, b);
+    RedisModule_FreeDict(NULL, b->btree);
+    RedisModule_FreeDict(NULL, b->hash);
+    RedisModule_FreeDict(NULL, b->sets);
+}
+
+// Value range on a btree column (NULL bound = unbounded)
+typedef struct {
+    RedisModuleString *min, *max;
+    int minIncl, maxIncl;
+} BtreeRange;
+
+// Narrow a range with one condition; returns -1 if the value cannot be ordered
+static int btree_range_apply(int type, BtreeRange *r, const char *op, RedisModuleString *val) {
+    size_t vlen; const char *v = RedisModule_StringPtrLen(val, &vlen);
+    char score[64];
+    if (type != COLTYPE_STRING && btree_score(type, v, vlen, score, sizeof(score)) != 0) return -1;
+
+    int lower = (op[0] == '>' || op[0] == '=');
+    int upper = (op[0] == '<' || op[0] == '=');
+    int incl = (op[0] == '=' || op[1] == '=');
+    if (lower) {
+        const char *cur = r->min ? RedisModule_StringPtrLen(r->min, NULL) : NULL;
+        if (!cur || compare_values(v, cur, ">", type) || (compare_values(v, cur, "=", type) && !incl)) {
+            r->min = val; r->minIncl = incl;
+        }
+    }
+    if (upper) {
+        const char *cur = r->max ? RedisModule_StringPtrLen(r->max, NULL) : NULL;
+        if (!cur || compare_values(v, cur, "<", type) || (compare_values(v, cur, "=", type) && !incl)) {
+            r->max = val; r->maxIncl = incl;
+        }
+    }
+    return 0;
+}
+
+// A bound beyond ±2^53 of an integer column matches rows on either side of it by score
+static int btree_range_inexact(int type, const BtreeRange *r) {
+    return btree_score_inexact(type, r->min) || btree_score_inexact(type, r->max);
+}
+
+// Bounds of a range in ZRANGEBYLEX (string columns) or ZRANGEBYSCORE syntax; bounds
+// beyond ±2^53 are inclusive of their score, the rows read need checking against them
+static void btree_range_bounds(RedisModuleCtx *ctx, int type, BtreeRange *r,
+                               RedisModuleString **minOut, RedisModuleString **maxOut) {
+    if (type == COLTYPE_STRING) {
+        // "<v>\0<id>" members: [v\0 is the first entry equal to v, [v\1 the first greater than v
+        RedisModuleString *min, *max;
+        if (r->min) {
+            min = RedisModule_CreateString(ctx, "[", 1);
+            size_t l; const char *v = RedisModule_StringPtrLen(r->min, &l);
+            RedisModule_StringAppendBuffer(ctx, min, v, l);
+            RedisModule_StringAppendBuffer(ctx, min, r->minIncl ? "\0" : "\1", 1);
+        } else {
+            min = RedisModule_CreateString(ctx, "-", 1);
+        }
+        if (r->max) {
+            max = RedisModule_CreateString(ctx, "(", 1);
+            size_t l; const char *v = RedisModule_StringPtrLen(r->max, &l);
+            RedisModule_StringAppendBuffer(ctx, max, v, l);
+            RedisModule_StringAppendBuffer(ctx, max, r->maxIncl ? "\1" : "\0", 1);
+        } else {
+            max = RedisModule_CreateString(ctx, "+", 1);
+        }
+        *minOut = min; *maxOut = max;
+        return;
+    }
+    char score[64];
+    *minOut = RedisModule_CreateString(ctx, "-inf", 4);
+    *maxOut = RedisModule_CreateString(ctx, "+inf", 4);
+    if (r->min) {
+        size_t l; const char *v = RedisModule_StringPtrLen(r->min, &l);
+        btree_score(type, v, l, score, sizeof(score));
+        *minOut = RedisModule_CreateStringPrintf(ctx, "%s%s", r->minIncl || btree_score_inexact(type, r->min) ? "" : "(", score);
+    }
+    if (r->max) {
+        size_t l; const char *v = RedisModule_StringPtrLen(r->max, &l);
+        btree_score(type, v, l, score, sizeof(score));
+        *maxOut = RedisModule_CreateStringPrintf(ctx, "%s%s", r->maxIncl || btree_score_inexact(type, r->max) ? "" : "(", score);
+    }
+}
+
+// Number of entries of an ordered index ZSET within a range
+static long long btree_key_count(RedisModuleCtx *ctx, RedisModuleString *btKey, int type, BtreeRange *r) {
+    RedisModuleString *min, *max;
+    btree_range_bounds(ctx, type, r, &min, &max);
+    RedisModuleCallReply *reply = RedisModule_Call(ctx, type == COLTYPE_STRING ? "ZLEXCOUNT" : "ZCOUNT", "sss",
+                                                   btKey, min, max);
+    return (reply && RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_INTEGER) ? RedisModule_CallReplyInteger(reply) : 0;
+}
+
+// Row IDs of the entries of an ordered index ZSET within a range
+static IdSet btree_key_range(RedisModuleCtx *ctx, RedisModuleString *btKey, int type, BtreeRange *r) {
+    RedisModuleString *min, *max;
+    btree_range_bounds(ctx, type, r, &min, &max);
+    int isString = type == COLTYPE_STRING;
+    RedisModuleCallReply *reply = RedisModule_Call(ctx, isString ? "ZRANGEBYLEX" : "ZRANGEBYSCORE", "sss",
+                                                   btKey, min, max);
+    return idset_from_reply(ctx, reply, isString);
+}
+
+// Number of rows within a range of a btree column
+static long long btree_range_count(RedisModuleCtx *ctx, RedisModuleString *table,
+                                   RedisModuleString *col, int type, BtreeRange *r) {
+    TableSchema *sch = schema_get(ctx, table);
+    if (sch && sch->engine == ENGINE_NATIVE) {
+        NativeTable *nt = native_open(ctx, table, REDISMODULE_READ);
+        ColumnSchema *cs = schema_column(sch, col);
+        NativeColumn *ncol = (nt && cs) ? native_column(nt, cs, 0) : NULL;
+        if (!ncol || !ncol->index) return 0;
+        return (long long)native_range_ids(ncol, r->min, r->minIncl, r->max, r->maxIncl, NULL);
+    }
+    return btree_key_count(ctx, fmt2(ctx, "{%s}:btree:%s", table, col), type, r);
+}
+
+// IDs of all rows within a range of a btree column
+static IdSet idset_btree_range(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *col,
+                               int type, BtreeRange *r) {
+    TableSchema *sch = schema_get(ctx, table);
+    if (sch && sch->engine == ENGINE_NATIVE) {
+        NativeTable *nt = native_open(ctx, table, REDISMODULE_READ);
+        ColumnSchema *cs = schema_column(sch, col);
+        NativeColumn *ncol = (nt && cs) ? native_column(nt, cs, 0) : NULL;
+        if (!ncol || !ncol->index) return idset_alloc(ctx, 0);
+        IdSet s = idset_alloc(ctx, native_range_ids(ncol, r->min, r->minIncl, r->max, r->maxIncl, NULL));
+        s.len = native_range_ids(ncol, r->min, r->minIncl, r->max, r->maxIncl, s.ids);
+        idset_normalize(&s);
+        return s;
+    }
+    return btree_key_range(ctx, fmt2(ctx, "{%s}:btree:%s", table, col), type, r);
+}
+
+// Partition keys of the days within a range of the partition column of a table
+static void partition_days(RedisModuleCtx *ctx, RedisModuleString *table, BtreeRange *r,
+                           RedisModuleString ***keys, size_t *n) {
+    RedisModuleString *min, *max;
+    btree_range_bounds(ctx, COLTYPE_DATE, r, &min, &max);
+    RedisModuleCallReply *days = RedisModule_Call(ctx, "ZRANGEBYSCORE", "sss", fmt(ctx, "{%s}:parts", table), min, max);
+    *n = days && RedisModule_CallReplyType(days) == REDISMODULE_REPLY_ARRAY ? RedisModule_CallReplyLength(days) : 0;
+    *keys = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleString*) * (*n ? *n : 1));
+    for (size_t i = 0; i < *n; i++)
+        (*keys)[i] = partition_key(ctx, table, RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(days, i)));
+}
+
+// Number of rows within a range of the partition column
+static long long partition_range_count(RedisModuleCtx *ctx, RedisModuleString *table, BtreeRange *r) {
+    RedisModuleString **keys;
+    size_t n;
+    partition_days(ctx, table, r, &keys, &n);
+    long long rows = 0;
+    for (size_t i = 0; i < n; i++) {
+        RedisModuleCallReply *c = RedisModule_Call(ctx, "SCARD", "s", keys[i]);
+        if (c && RedisModule_CallReplyType(c) == REDISMODULE_REPLY_INTEGER) rows += RedisModule_CallReplyInteger(c);
+    }
+    return rows;
+}
+
+// IDs of all rows within a range of the partition column, read from the partitions it covers
+static IdSet idset_partition_range(RedisModuleCtx *ctx, RedisModuleString *table, BtreeRange *r) {
+    RedisModuleString **keys;
+    size_t n;
+    partition_days(ctx, table, r, &keys, &n);
+    if (!n) return idset_alloc(ctx, 0);
+    return idset_from_reply(ctx, RedisModule_Call(ctx, "SUNION", "v", keys, n), 0);
+}
+
+/* ================== Index jobs ================== */
+
+// ADD INDEX on a hash table of more than INDEX_JOB_ROWS rows runs as a job doing one
+// batch per timer tick, so that other clients are served meanwhile. {ns.t}:idx:jobs maps
+// each column with a job to the index being built ("hash", "btree" or "unique") or to
+// "drop". An index being built is maintained by writes (ColumnSchema.building) but not
+// used by queries until every row is indexed and the column joins {ns.t}:idx:meta.
+// Composite indexes have jobs too, under their name "c1,c2,...": they are listed in
+// {ns.t}:idx:composite from the start and used once their job is done. The other indexes
+// are one key each, unlinked by DROP INDEX, but a btree composite index has one key per
+// tuple: once dropped it leaves queries at once and a job deletes its keys.
+// A unique index whose build meets a value held by two rows is abandoned: its key and job
+// are deleted and the column stays without index.
+// Jobs run on masters and replicate each batch as its effect. Jobs found unfinished
+// once a dataset is loaded, or when a replica becomes master, start over.
+
+// Rows indexed, or keys scanned for deletion, per tick
+#define INDEX_JOB_ROWS 1000
+
+typedef struct {
+    RedisModuleString *table, *col;     // retained
+    int db;
+    int kind;                   // index built, INDEX_NONE when dropping
+    unsigned long long cursor;  // SSCAN of {ns.t}:rows, or SCAN of the index keys
+    long long done;             // rows indexed or keys deleted
+    long long total;            // rows of the table when the build started
+    int failed;                 // unique index build met a duplicate value
+} IndexJob;
+
+// "<db>:<ns.t>\0<col>" -> IndexJob*. A job is freed by its own timer once it is no
+// longer registered here.
+static RedisModuleDict *g_index_jobs = NULL;
+
+static size_t index_job_key(char *buf, size_t buflen, int db, RedisModuleString *table, RedisModuleString *col) {
+    size_t tlen, clen;
+    const char *t = RedisModule_StringPtrLen(table, &tlen), *c = RedisModule_StringPtrLen(col, &clen);
+    size_t n = schema_cache_key(buf, buflen, db, t, tlen);
+    if (!n || n + 1 + clen > buflen) return 0;
+    buf[n++] = '\0';
+    memcpy(buf + n, c, clen);
+    return n + clen;
+}
+
+// The job of a column running on this server, NULL if none
+static IndexJob *index_job_find(int db, RedisModuleString *table, RedisModuleString *col) {
+    char key[512];
+    size_t klen = index_job_key(key, sizeof(key), db, table, col);
+    return klen ? RedisModule_DictGetC(g_index_jobs, key, klen, NULL) : NULL;
+}
+
+// The job recorded for a column: the index being built, INDEX_NONE for a drop, -1 if none
+static int index_job_state(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *col) {
+    RedisModuleCallReply *r = RedisModule_Call(ctx, "HGET", "ss", fmt(ctx, "{%s}:idx:jobs", table), col);
+    if (!r || RedisModule_CallReplyType(r) != REDISMODULE_REPLY_STRING) return -1;
+    size_t l; const char *s = RedisModule_CallReplyStringPtr(r, &l);
+    if (l == 4 && strncasecmp(s, "drop", 4) == 0) return INDEX_NONE;
+    int kind = parse_index_type(s, l);
+    return kind == INDEX_HASH || kind == INDEX_BTREE || kind == INDEX_UNIQUE ? kind : -1;
+}
+
+// Add the rows ids to an index of a column, or to the composite index named col, from the
+// values they have now
+// Returns the number of rows whose value is held by another row in a unique index
+static long long index_rows(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *col, int kind, IdSet ids) {
+    CompositeIndex *ci = schema_composite(schema_get(ctx, table), col);
+    long long taken = 0;
+    for (size_t i = 0; i < ids.len; i++) {
+        RedisModuleString *id = RedisModule_CreateStringFromLongLong(ctx, (long long)ids.ids[i]);
+        RedisModuleKey *row = RedisModule_OpenKey(ctx, fmt2(ctx, "{%s}:%s", table, id), REDISMODULE_READ);
+        RedisModuleString *val = NULL;
+        if (RedisModule_KeyType(row) != REDISMODULE_KEYTYPE_HASH) {
+            RedisModule_CloseKey(row);
+            continue;
+        }
+        if (ci) {
+            RedisModuleString *vals[COMPOSITE_MAX_COLUMNS];
+            for (int c = 0; c < ci->ncols; c++) {
+                vals[c] = NULL;
+                RedisModule_HashGet(row, REDISMODULE_HASH_NONE, ci->cols[c]->name, &vals[c], NULL);
+            }
+            composite_entry(ctx, NULL, table, ci, vals, id, 1);
+        } else {
+            RedisModule_HashGet(row, REDISMODULE_HASH_NONE, col, &val, NULL);
+        }
+        RedisModule_CloseKey(row);
+        if (val && kind == INDEX_UNIQUE) taken -= unique_claim(ctx, table, col, val, id);
+        else if (val) index_add(ctx, NULL, table, col, kind, val, id);
+    }
+    return taken;
+}
+
+// Take the cursor of a SCAN or SSCAN reply; returns its items, NULL once it is unusable
+static RedisModuleCallReply *index_job_scan_reply(RedisModuleCallReply *r, unsigned long long *cursor) {
+    if (!r || RedisModule_CallReplyType(r) != REDISMODULE_REPLY_ARRAY || RedisModule_CallReplyLength(r) != 2) {
+        *cursor = 0;
+        return NULL;
+    }
+    size_t l; const char *c = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(r, 0), &l);
+    *cursor = c ? strtoull(c, NULL, 10) : 0;
+    RedisModuleCallReply *items = RedisModule_CallReplyArrayElement(r, 1);
+    return items && RedisModule_CallReplyType(items) == REDISMODULE_REPLY_ARRAY ? items : NULL;
+}
+
+// Index the next batch of rows
+static void index_job_build(RedisModuleCtx *ctx, IndexJob *job) {
+    char cursor[32];
+    snprintf(cursor, sizeof(cursor), "%llu", job->cursor);
+    RedisModuleCallReply *r = RedisModule_Call(ctx, "SSCAN", "sccl", fmt(ctx, "{%s}:rows", job->table), cursor,
+                                               "COUNT", (long long)INDEX_JOB_ROWS);
+    RedisModuleCallReply *items = index_job_scan_reply(r, &job->cursor);
+    IdSet ids = items ? idset_from_reply(ctx, items, 0) : idset_alloc(ctx, 0);
+    if (ids.len && index_rows(ctx, job->table, job->col, job->kind, ids) > 0) {
+        job->failed = 1;
+        job->cursor = 0;
+    } else if (ids.len) {
+        // Replicas index the same rows at the same point of the stream
+        RedisModule_Replicate(ctx, "TABLE._APPLY", "scss", job->table, "INDEX", job->col,
+                              idset_format(ctx, ids, 0, ids.len));
+        job->done += (long long)ids.len;
+    }
+    if (r) RedisModule_FreeCallReply(r);
+}
+
+// Delete the index keys found in the next batch of the keyspace
+static void index_job_drop(RedisModuleCtx *ctx, IndexJob *job) {
+    char cursor[32];
+    snprintf(cursor, sizeof(cursor), "%llu", job->cursor);
+    RedisModuleString *pattern = fmt2(ctx, "{%s}:idx:%s:*", job->table, job->col);
+    RedisModuleCallReply *r = RedisModule_Call(ctx, "SCAN", "ccscl", cursor, "MATCH", pattern,
+                                               "COUNT", (long long)INDEX_JOB_ROWS);
+    RedisModuleCallReply *items = index_job_scan_reply(r, &job->cursor);
+    size_t n = items ? RedisModule_CallReplyLength(items) : 0;
+    if (n) {
+        RedisModuleString **keys = RedisModule_Alloc(sizeof(RedisModuleString*) * n);
+        for (size_t i = 0; i < n; i++)
+            keys[i] = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(items, i));
+        RedisModule_Call(ctx, "DEL", "!v", keys, n);
+        for (size_t i = 0; i < n; i++) RedisModule_FreeString(ctx, keys[i]);
+        RedisModule_Free(keys);
+        job->done += (long long)n;
+    }
+    RedisModule_FreeString(ctx, pattern);
+    if (r) RedisModule_FreeCallReply(r);
+}
+
+// Run one batch of a job; returns 1 once the job is complete: a built index is then used
+// by queries, and the record of the job is removed
+static int index_job_step(RedisModuleCtx *ctx, IndexJob *job) {
+    if (job->kind != INDEX_NONE) index_job_build(ctx, job);
+    else index_job_drop(ctx, job);
+    if (job->cursor != 0) return 0;
+    if (job->failed) {
+        RedisModule_Log(ctx, "warning", "Table module: unique index on %s of %s abandoned, duplicate values",
+                        RedisModule_StringPtrLen(job->col, NULL), RedisModule_StringPtrLen(job->table, NULL));
+        RedisModule_Call(ctx, "DEL", "!s", fmt2(ctx, "{%s}:unique:%s", job->table, job->col));
+    } else if (job->kind != INDEX_NONE && !schema_composite(schema_get(ctx, job->table), job->col)) {
+        RedisModule_Call(ctx, "SADD", "!ss", fmt(ctx, "{%s}:idx:meta", job->table), job->col);
+        if (job->kind == INDEX_BTREE)
+            RedisModule_Call(ctx, "SADD", "!ss", fmt(ctx, "{%s}:idx:btree", job->table), job->col);
+        if (job->kind == INDEX_UNIQUE)
+            RedisModule_Call(ctx, "HSET", "!ssc", fmt(ctx, "{%s}:idx:unique", job->table), job->col, "unique");
+    }
+    RedisModule_Call(ctx, "HDEL", "!ss", fmt(ctx, "{%s}:idx:jobs", job->table), job->col);
+    schema_invalidate(ctx, job->table);
+    return 1;
+}
+
+static void index_job_forget(IndexJob *job) {
+    char key[512];
+    size_t klen = index_job_key(key, sizeof(key), job->db, job->table, job->col);
+    if (klen && RedisModule_DictGetC(g_index_jobs, key, klen, NULL) == job)
+        RedisModule_DictDelC(g_index_jobs, key, klen, NULL);
+}
+
+static void index_job_tick(RedisModuleCtx *ctx, void *data) {
+    IndexJob *job = data;
+    RedisModule_AutoMemory(ctx);
+    RedisModule_SelectDb(ctx, job->db);
+    // A job replaced or completed meanwhile, or whose record is gone (table dropped,
+    // database flushed), stops
+    if (index_job_find(job->db, job->table, job->col) == job &&
+        index_job_state(ctx, job->table, job->col) == job->kind && !index_job_step(ctx, job)) {
+        RedisModule_CreateTimer(ctx, 0, index_job_tick, job);
+        return;
+    }
+    index_job_forget(job);
+    RedisModule_FreeString(NULL, job->table);
+    RedisModule_FreeString(NULL, job->col);
+    RedisModule_Free(job);
+}
+
+// Start the job recorded for a column, in place of the one running on it if any
+static void index_job_start(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *col, int kind) {
+    char key[512];
+    int db = RedisModule_GetSelectedDb(ctx);
+    size_t klen = index_job_key(key, sizeof(key), db, table, col);
+    if (!klen) return;
+    IndexJob *job = RedisModule_Calloc(1, sizeof(IndexJob));
+    job->table = RedisModule_CreateStringFromString(NULL, table);
+    job->col = RedisModule_CreateStringFromString(NULL, col);
+    job->db = db;
+    job->kind = kind;
+    if (kind != INDEX_NONE) {
+        RedisModuleCallReply *r = RedisModule_Call(ctx, "SCARD", "s", fmt(ctx, "{%s}:rows", table));
+        job->total = r && RedisModule_CallReplyType(r) == REDISMODULE_REPLY_INTEGER ? RedisModule_CallReplyInteger(r) : 0;
+    }
+    RedisModule_DictReplaceC(g_index_jobs, key, klen, job);
+    RedisModule_CreateTimer(ctx, 0, index_job_tick, job);
+}
+
+// Whether a command starts the jobs it records: replicas and AOF loading receive the
+// effects of the master's jobs instead
+static int jobs_run_here(RedisModuleCtx *ctx) {
+    return !(RedisModule_GetContextFlags(ctx) & (REDISMODULE_CTX_FLAGS_REPLICATED | REDISMODULE_CTX_FLAGS_LOADING));
+}
+
+// Complete the job of a column at once, for commands that cannot wait for it
+// Returns -1 if no job of the column runs on this server
+static int index_job_finish(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *col) {
+    IndexJob *job = index_job_find(RedisModule_GetSelectedDb(ctx), table, col);
+    if (!job) return -1;
+    while (!index_job_step(ctx, job)) {}
+    index_job_forget(job);
+    return 0;
+}
+
+// Start the jobs recorded in the dataset that do not run on this server
+static void index_jobs_resume(RedisModuleCtx *ctx) {
+    if (!(RedisModule_GetContextFlags(ctx) & REDISMODULE_CTX_FLAGS_MASTER)) return;
+    RedisModule_AutoMemory(ctx);
+    int selected = RedisModule_GetSelectedDb(ctx);
+    for (int db = 0; RedisModule_SelectDb(ctx, db) == REDISMODULE_OK; db++) {
+        unsigned long long cursor = 0;
+        do {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%llu", cursor);
+            RedisModuleCallReply *r = RedisModule_Call(ctx, "SCAN", "cccc", buf, "MATCH", "{*}:idx:jobs", "COUNT", "1000");
+            RedisModuleCallReply *keys = index_job_scan_reply(r, &cursor);
+            size_t n = keys ? RedisModule_CallReplyLength(keys) : 0;
+            for (size_t i = 0; i < n; i++) {
+                size_t kl; const char *k = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(keys, i), &kl);
+                if (!k || kl <= 11) continue;
+                RedisModuleString *table = RedisModule_CreateString(ctx, k + 1, kl - 11);
+                RedisModuleCallReply *jobs = RedisModule_Call(ctx, "HKEYS", "b", k, kl);
+                size_t m = jobs && RedisModule_CallReplyType(jobs) == REDISMODULE_REPLY_ARRAY ? RedisModule_CallReplyLength(jobs) : 0;
+                for (size_t j = 0; j < m; j++) {
+                    RedisModuleString *col = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(jobs, j));
+                    int kind = index_job_state(ctx, table, col);
+                    if (kind != -1 && !index_job_find(db, table, col)) index_job_start(ctx, table, col, kind);
+                }
+            }
+        } while (cursor != 0);
+    }
+    RedisModule_SelectDb(ctx, selected);
+}
+
+/* ================== Table purges ================== */
+
+// TABLE.DROP of a hash table, and TABLE.DELETE of all its rows, hand the rows to a purge
+// and return at once. The rows set is renamed to a worklist {ns.t}:purge:<n>, n being the
+// highest row ID handed out so far, and recorded as field n of {ns.t}:purge; field "drop"
+// marks a dropped table. Until the purge reaches them, rows up to the highest worklist
+// are skipped by queries (TableSchema.purged), new rows get higher IDs. An expired
+// partition is a worklist {ns.t}:purge:<YYYY-MM-DD> of its own (see partition_expire()).
+// A job on the master unlinks PURGE_JOB_ROWS rows per timer tick and replicates each batch
+// as TABLE._APPLY <ns.t> PURGE <n> <ids>. The keys of a dropped table left once its rows
+// are gone are found by SCAN MATCH {ns.t}:*; they all share the table's hash tag, so
+// every batch stays in one slot. Creating a dropped table again completes its purge first.
+
+// Rows unlinked, or keys scanned, per tick
+#define PURGE_JOB_ROWS 1000
+
+typedef struct {
+    RedisModuleString *table;   // retained
+    int db;
+    unsigned long long cursor;  // SCAN of the keys of a dropped table
+} PurgeJob;
+
+// "<db>:<ns.t>" -> PurgeJob*. A job is freed by its own timer once it is no longer
+// registered here.
+static RedisModuleDict *g_purge_jobs = NULL;
+
+static PurgeJob *purge_job_find(int db, RedisModuleString *table) {
+    char key[512];
+    size_t tlen; const char *t = RedisModule_StringPtrLen(table, &tlen);
+    size_t klen = schema_cache_key(key, sizeof(key), db, t, tlen);
+    return klen ? RedisModule_DictGetC(g_purge_jobs, key, klen, NULL) : NULL;
+}
+
+// Whether a worklist of a purge holds an expired partition, named by its day
+static int purge_is_partition(RedisModuleString *field) {
+    size_t l; const char *f = RedisModule_StringPtrLen(field, &l);
+    int64_t day;
+    return parse_date(f, l, &day) == 0;
+}
+
+// Unlink the rows ids of a worklist, removing them from the indexes of the table unless
+// it was dropped (its index keys then go as a whole), and from the rows set of the table
+// for the worklist of an expired partition
+static void purge_rows(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *worklist, IdSet ids,
+                       int partition) {
+    TableSchema *sch = schema_get(ctx, table);
+    RedisModuleString **rowKeys = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleString*) * (ids.len ? ids.len : 1));
+    RedisModuleString **idStrs = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleString*) * (ids.len ? ids.len : 1));
+    IndexBatch b;
+    index_batch_init(&b, table);
+    for (size_t i = 0; i < ids.len; i++) {
+        idStrs[i] = RedisModule_CreateStringFromLongLong(ctx, (long long)ids.ids[i]);
+        rowKeys[i] = fmt2(ctx, "{%s}:%s", table, idStrs[i]);
+        if (sch) index_rem_row(ctx, &b, table, sch, rowKeys[i], idStrs[i]);
+    }
+    index_batch_free(ctx, &b);
+    if (!ids.len) return;
+    RedisModule_Call(ctx, "UNLINK", "v", rowKeys, ids.len);
+    RedisModule_Call(ctx, "SREM", "sv", worklist, idStrs, ids.len);
+    if (partition) RedisModule_Call(ctx, "SREM", "sv", fmt(ctx, "{%s}:rows", table), idStrs, ids.len);
+    if (sch && sch->ttl) {
+        for (size_t i = 0; i < ids.len; i++) rowKeys[i] = fmt2(ctx, "{%s}:ttl:%s", table, idStrs[i]);
+        RedisModule_Call(ctx, "UNLINK", "v", rowKeys, ids.len);
+        RedisModule_Call(ctx, "ZREM", "sv", fmt(ctx, "{%s}:ttl", table), idStrs, ids.len);
+    }
+}
+
+// Next worklist of a purge (its field: n, or the day of an expired partition), NULL if
+// none; *drop tells whether the table was dropped
+// Returns -1 once the purge is complete
+static int purge_next(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString **next, int *drop) {
+    RedisModuleCallReply *r = RedisModule_Call(ctx, "HKEYS", "s", fmt(ctx, "{%s}:purge", table));
+    size_t m = r && RedisModule_CallReplyType(r) == REDISMODULE_REPLY_ARRAY ? RedisModule_CallReplyLength(r) : 0;
+    *next = NULL;
+    *drop = 0;
+    for (size_t i = 0; i < m; i++) {
+        size_t fl; const char *f = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(r, i), &fl);
+        if (!f) continue;
+        if (fl == 4 && strncasecmp(f, "drop", 4) == 0) *drop = 1;
+        else if (!*next) *next = RedisModule_CreateString(ctx, f, fl);
+    }
+    return m ? 0 : -1;
+}
+
+// Unlink the next batch of keys left by a dropped table
+// Returns 1 once they are all gone, with the record of the purge
+static int purge_job_sweep(RedisModuleCtx *ctx, PurgeJob *job) {
+    char cursor[32];
+    snprintf(cursor, sizeof(cursor), "%llu", job->cursor);
+    RedisModuleString *record = fmt(ctx, "{%s}:purge", job->table);
+    RedisModuleCallReply *r = RedisModule_Call(ctx, "SCAN", "ccscl", cursor, "MATCH", fmt(ctx, "{%s}:*", job->table),
+                                               "COUNT", (long long)PURGE_JOB_ROWS);
+    RedisModuleCallReply *items = index_job_scan_reply(r, &job->cursor);
+    size_t n = items ? RedisModule_CallReplyLength(items) : 0, nkeys = 0;
+    RedisModuleString **keys = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleString*) * (n ? n : 1));
+    for (size_t i = 0; i < n; i++) {
+        RedisModuleString *k = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(items, i));
+        if (RedisModule_StringCompare(k, record) != 0) keys[nkeys++] = k;
+    }
+    if (nkeys) RedisModule_Call(ctx, "UNLINK", "!v", keys, nkeys);
+    if (job->cursor != 0) return 0;
+    RedisModule_Call(ctx, "DEL", "!s", record);
+    return 1;
+}
+
+// Run one batch of a purge; returns 1 once it is complete
+static int purge_job_step(RedisModuleCtx *ctx, PurgeJob *job) {
+    int drop;
+    RedisModuleString *upto;
+    if (purge_next(ctx, job->table, &upto, &drop) < 0) return 1;
+    if (!upto) return drop ? purge_job_sweep(ctx, job) : 1;
+
+    RedisModuleString *worklist = fmt2(ctx, "{%s}:purge:%s", job->table, upto);
+    RedisModuleCallReply *r = RedisModule_Call(ctx, "SRANDMEMBER", "sl", worklist, (long long)PURGE_JOB_ROWS);
+    IdSet ids = r ? idset_from_reply(ctx, r, 0) : idset_alloc(ctx, 0);
+    if (ids.len) {
+        purge_rows(ctx, job->table, worklist, ids, purge_is_partition(upto));
+        RedisModule_Replicate(ctx, "TABLE._APPLY", "scss", job->table, "PURGE", upto,
+                              idset_format(ctx, ids, 0, ids.len));
+        return 0;
+    }
+    // The worklist is empty, its rows leave the index entries skipped by queries
+    RedisModule_Call(ctx, "HDEL", "!ss", fmt(ctx, "{%s}:purge", job->table), upto);
+    schema_invalidate(ctx, job->table);
+    return 0;
+}
+
+static void purge_job_forget(PurgeJob *job) {
+    char key[512];
+    size_t tlen; const char *t = RedisModule_StringPtrLen(job->table, &tlen);
+    size_t klen = schema_cache_key(key, sizeof(key), job->db, t, tlen);
+    if (klen && RedisModule_DictGetC(g_purge_jobs, key, klen, NULL) == job)
+        RedisModule_DictDelC(g_purge_jobs, key, klen, NULL);
+}
+
+static void purge_job_tick(RedisModuleCtx *ctx, void *data) {
+    PurgeJob *job = data;
+    RedisModule_AutoMemory(ctx);
+    RedisModule_SelectDb(ctx, job->db);
+    if (purge_job_find(job->db, job->table) == job && !purge_job_step(ctx, job)) {
+        RedisModule_CreateTimer(ctx, 0, purge_job_tick, job);
+        return;
+    }
+    purge_job_forget(job);
+    RedisModule_FreeString(NULL, job->table);
+    RedisModule_Free(job);
+}
+
+// Start the purge of a table unless it runs already
+static void purge_job_start(RedisModuleCtx *ctx, RedisModuleString *table) {
+    char key[512];
+    int db = RedisModule_GetSelectedDb(ctx);
+    size_t tlen; const char *t = RedisModule_StringPtrLen(table, &tlen);
+    size_t klen = schema_cache_key(key, sizeof(key), db, t, tlen);
+    if (!klen || RedisModule_DictGetC(g_purge_jobs, key, klen, NULL)) return;
+    PurgeJob *job = RedisModule_Calloc(1, sizeof(PurgeJob));
+    job->table = RedisModule_CreateStringFromString(NULL, table);
+    job->db = db;
+    RedisModule_DictSetC(g_purge_jobs, key, klen, job);
+    RedisModule_CreateTimer(ctx, 0, purge_job_tick, job);
+}
+
+// Hand the rows of a hash table to a purge, dropping the table too if drop is set;
+// returns the number of rows handed over
+static long long purge_table(RedisModuleCtx *ctx, RedisModuleString *table, int drop) {
+    RedisModuleString *rowsSet = fmt(ctx, "{%s}:rows", table);
+    RedisModuleString *record = fmt(ctx, "{%s}:purge", table);
+    RedisModuleCallReply *r = RedisModule_Call(ctx, "SCARD", "s", rowsSet);
+    long long rows = r && RedisModule_CallReplyType(r) == REDISMODULE_REPLY_INTEGER ? RedisModule_CallReplyInteger(r) : 0;
+    if (rows > 0) {
+        r = RedisModule_Call(ctx, "GET", "s", fmt(ctx, "{%s}:id", table));
+        size_t l; const char *v = r && RedisModule_CallReplyType(r) == REDISMODULE_REPLY_STRING ?
+                                  RedisModule_CallReplyStringPtr(r, &l) : NULL;
+        RedisModuleString *n = RedisModule_CreateStringFromLongLong(ctx, v ? (long long)idset_parse_id(v, l) : 0);
+        RedisModule_Call(ctx, "RENAME", "ss", rowsSet, fmt2(ctx, "{%s}:purge:%s", table, n));
+        RedisModule_Call(ctx, "HSET", "ssc", record, n, "rows");
+        // Ordered indexes hold only these rows and are read without the WHERE planner,
+        // unique indexes would keep their values from new rows, and so would partitions
+        TableSchema *sch = schema_get(ctx, table);
+        if (sch && sch->partition) {
+            RedisModuleString *parts = fmt(ctx, "{%s}:parts", table);
+            RedisModuleCallReply *days = RedisModule_Call(ctx, "ZRANGE", "scc", parts, "0", "-1");
+            size_t nd = days && RedisModule_CallReplyType(days) == REDISMODULE_REPLY_ARRAY ? RedisModule_CallReplyLength(days) : 0;
+            for (size_t i = 0; i < nd; i++)
+                RedisModule_Call(ctx, "UNLINK", "s", partition_key(ctx, table,
+                    RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(days, i))));
+            RedisModule_Call(ctx, "UNLINK", "s", parts);
+        }
+        for (int c = 0; sch && c < sch->ncols; c++) {
+            if (column_write_index(&sch->cols[c]) == INDEX_BTREE)
+                RedisModule_Call(ctx, "UNLINK", "s", fmt2(ctx, "{%s}:btree:%s", table, sch->cols[c].name));
+            else if (column_write_index(&sch->cols[c]) == INDEX_UNIQUE)
+                RedisModule_Call(ctx, "UNLINK", "s", fmt2(ctx, "{%s}:unique:%s", table, sch->cols[c].name));
+        }
+    }
+    if (drop) RedisModule_Call(ctx, "HSET", "scc", record, "drop", "1");
+    schema_invalidate(ctx, table);
+    if (jobs_run_here(ctx) && (rows > 0 || drop)) purge_job_start(ctx, table);
+    return rows;
+}
+
+// Hand the partitions of a table older than its retention to a purge, checked once a day
+// by the inserts of the table on the master. A partition set becomes the worklist
+// {ns.t}:purge:<day>, recorded as field <day> of {ns.t}:purge, and leaves {ns.t}:parts at
+// once: queries on the partition column skip it from then on, the others see its rows
+// until the purge reaches them.
+static void partition_expire(RedisModuleCtx *ctx, RedisModuleString *table, TableSchema *sch) {
+    if (!sch->partition || !sch->retention || !jobs_run_here(ctx)) return;
+    long long today = (long long)(RedisModule_Milliseconds() / 86400000);
+    if (sch->expiryChecked == today) return;
+    sch->expiryChecked = today;
+    int64_t y;
+    int m, d;
+    days_to_date(today - sch->retention, &y, &m, &d);
+    RedisModuleString *parts = fmt(ctx, "{%s}:parts", table);
+    RedisModuleCallReply *r = RedisModule_Call(ctx, "ZRANGEBYSCORE", "scs", parts, "-inf",
+                                               RedisModule_CreateStringPrintf(ctx, "(%04lld%02d%02d", (long long)y, m, d));
+    size_t n = r && RedisModule_CallReplyType(r) == REDISMODULE_REPLY_ARRAY ? RedisModule_CallReplyLength(r) : 0;
+    if (!n) return;
+    RedisModuleString *record = fmt(ctx, "{%s}:purge", table);
+    for (size_t i = 0; i < n; i++) {
+        RedisModuleString *day = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(r, i));
+        RedisModuleString *key = partition_key(ctx, table, day);
+        RedisModuleString *worklist = fmt2(ctx, "{%s}:purge:%s", table, day);
+        // Rows given the day again while its earlier purge runs join that worklist
+        RedisModuleCallReply *e = RedisModule_Call(ctx, "EXISTS", "s", worklist);
+        if (e && RedisModule_CallReplyType(e) == REDISMODULE_REPLY_INTEGER && RedisModule_CallReplyInteger(e)) {
+            RedisModule_Call(ctx, "SUNIONSTORE", "!sss", worklist, worklist, key);
+            RedisModule_Call(ctx, "UNLINK", "!s", key);
+        } else {
+            RedisModule_Call(ctx, "RENAME", "!ss", key, worklist);
+        }
+        RedisModule_Call(ctx, "HSET", "!ssc", record, day, "partition");
+        RedisModule_Call(ctx, "ZREM", "!ss", parts, day);
+    }
+    schema_invalidate(ctx, table);
+    purge_job_start(ctx, table);
+}
+
+// Complete the purge of a table at once, for commands that cannot wait for it
+static void purge_finish(RedisModuleCtx *ctx, RedisModuleString *table) {
+    PurgeJob job = { table, RedisModule_GetSelectedDb(ctx), 0 };
+    while (!purge_job_step(ctx, &job)) {}
+    PurgeJob *running = purge_job_find(job.db, table);
+    if (running) purge_job_forget(running);
+}
+
+// Start the purges recorded in the dataset that do not run on this server
+static void purge_jobs_resume(RedisModuleCtx *ctx) {
+    if (!(RedisModule_GetContextFlags(ctx) & REDISMODULE_CTX_FLAGS_MASTER)) return;
+    RedisModule_AutoMemory(ctx);
+    int selected = RedisModule_GetSelectedDb(ctx);
+    for (int db = 0; RedisModule_SelectDb(ctx, db) == REDISMODULE_OK; db++) {
+        unsigned long long cursor = 0;
+        do {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%llu", cursor);
+            RedisModuleCallReply *r = RedisModule_Call(ctx, "SCAN", "cccc", buf, "MATCH", "{*}:purge", "COUNT", "1000");
+            RedisModuleCallReply *keys = index_job_scan_reply(r, &cursor);
+            size_t n = keys ? RedisModule_CallReplyLength(keys) : 0;
+            for (size_t i = 0; i < n; i++) {
+                size_t kl; const char *k = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(keys, i), &kl);
+                if (k && kl > 8) purge_job_start(ctx, RedisModule_CreateString(ctx, k + 1, kl - 8));
+            }
+        } while (cursor != 0);
+    }
+    RedisModule_SelectDb(ctx, selected);
+}
+
+/* ================== Sharded tables ================== */
+// A table created with SHARDS <n> keeps no rows of its own: they are spread over the n
+// shard tables <ns.t>#0 .. <ns.t>#<n-1>, complete tables whose hash tags {ns.t#k} put
+// them on different nodes of a cluster. The sharded table holds the schema and the
+// "shards" field of {ns.t}:options. A command on it is run on its shards, by
+// RedisModule_Call() for the shards served here and by a cluster message to the node
+// serving each other one, and the replies of the shards are merged into its reply (see
+// shard_request_run()). A row goes to one shard, chosen by the hash of its primary key,
+// or else by the next row ID of the sharded table.
+// Commands replicated from the master or loaded from the AOF run on the table they
+// name only: each shard replicates its own writes.
+
+#define SHARD_MAX 64
+#define SHARD_TIMEOUT_MS 5000
+// Arrays nested in a shard reply: rows of values
+#define SHARD_REPLY_DEPTH 4
+// Cluster message types: a command for a shard, the reply of the shard
+#define SHARD_MSG_REQUEST 1
+#define SHARD_MSG_REPLY   2
+// Rows of a shard are checked against the rows of that shard only
+#define SHARD_UNIQUE_ERROR "ERR unique indexes other than the primary key are not supported on sharded tables"
+
+// Reply of a shard, decoded from the captured reply format (see "Result cache")
+typedef struct ShardValue {
+    unsigned char type;         // REPLY_INT, REPLY_ARRAY, REPLY_BULK, REPLY_NULL or REPLY_ERROR
+    int64_t n;                  // REPLY_INT: the integer, REPLY_ARRAY: the number of elements
+    const char *s;              // REPLY_BULK, REPLY_ERROR: into the encoded reply
+    uint32_t len;
+    struct ShardValue *elems;
+} ShardValue;
+
+typedef struct {
+    unsigned char *p;
+    size_t len, cap;
+} ShardBuf;
+
+// Command of a sharded table for one of its shards
+typedef struct {
+    RedisModuleString **argv;   // retained
+    int argc;
+    char node[REDISMODULE_NODE_ID_LEN + 1];    // node serving the shard, "" = this one
+    unsigned char *buf;         // the encoded reply, NULL until it arrives
+    ShardValue reply;
+} ShardCall;
+
+typedef struct ShardRequest {
+    uint64_t id;
+    RedisModuleBlockedClient *bc;
+    RedisModuleString **argv;   // the command on the sharded table, retained until the reply
+    int argc;
+    // Reply of the command, merged from the replies of the calls
+    int (*reply)(RedisModuleCtx *ctx, struct ShardRequest *r);
+    ShardCall *calls;
+    int ncalls, cap;
+    int pending;                // calls sent to other nodes and not answered yet
+} ShardRequest;
+
+static RedisModuleDict *g_shard_requests = NULL;   // request ID -> ShardRequest* waiting for other nodes
+static uint64_t g_shard_seq = 0;
+static int g_shard_direct = 0;  // running a command on a sharded table itself
+static int g_shard_call = 0;    // running a command on a shard for its sharded table
+
+static void shard_put(ShardBuf *b, const void *p, size_t n) {
+    if (b->len + n > b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 256;
+        if (b->cap < b->len + n) b->cap = b->len + n;
+        b->p = RedisModule_Realloc(b->p, b->cap);
+    }
+    if (n) memcpy(b->p + b->len, p, n);
+    b->len += n;
+}
+
+static void shard_put_tagged(ShardBuf *b, unsigned char tag, const char *s, size_t len) {
+    uint32_t l = (uint32_t)len;
+    shard_put(b, &tag, 1);
+    shard_put(b, &l, sizeof(l));
+    shard_put(b, s, len);
+}
+
+// Encode a reply of RedisModule_Call(), NULL when the command could not run
+static void shard_encode(ShardBuf *b, RedisModuleCallReply *r) {
+    int type = r ? RedisModule_CallReplyType(r) : REDISMODULE_REPLY_ERROR;
+    size_t len;
+    const char *s;
+    unsigned char tag;
+    int64_t n;
+    switch (type) {
+    case REDISMODULE_REPLY_STRING:
+        s = RedisModule_CallReplyStringPtr(r, &len);
+        shard_put_tagged(b, REPLY_BULK, s, len);
+        break;
+    case REDISMODULE_REPLY_ERROR:
+        s = r ? RedisModule_CallReplyStringPtr(r, &len) : NULL;
+        if (!s) { s = "ERR cannot run the command on a shard"; len = strlen(s); }
+        shard_put_tagged(b, REPLY_ERROR, s, len);
+        break;
+    case REDISMODULE_REPLY_INTEGER:
+    case REDISMODULE_REPLY_ARRAY:
+        tag = type == REDISMODULE_REPLY_INTEGER ? REPLY_INT : REPLY_ARRAY;
+        n = type == REDISMODULE_REPLY_INTEGER ? RedisModule_CallReplyInteger(r) : (int64_t)RedisModule_CallReplyLength(r);
+        shard_put(b, &tag, 1);
+        shard_put(b, &n, sizeof(n));
+        for (int64_t i = 0; tag == REPLY_ARRAY && i < n; i++) shard_encode(b, RedisModule_CallReplyArrayElement(r, (size_t)i));
+        break;
+    default:
+        tag = REPLY_NULL;
+        shard_put(b, &tag, 1);
+        break;
+    }
+}
+
+// Decode one reply from p[0..end); returns the end of it, NULL if malformed
+static const unsigned char *shard_decode(const unsigned char *p, const unsigned char *end, ShardValue *v, int depth) {
+    memset(v, 0, sizeof(*v));
+    if (p >= end) return NULL;
+    v->type = *p++;
+    if (v->type == REPLY_INT || v->type == REPLY_ARRAY) {
+        if (end - p < (ptrdiff_t)sizeof(v->n)) return NULL;
+        memcpy(&v->n, p, sizeof(v->n));
+        p += sizeof(v->n);
+        if (v->type == REPLY_INT) return p;
+        // Each element takes a byte at least
+        if (v->n < 0 || v->n > end - p || depth == SHARD_REPLY_DEPTH) return NULL;
+        v->elems = RedisModule_Calloc(v->n ? (size_t)v->n : 1, sizeof(ShardValue));
+        for (int64_t i = 0; i < v->n && p; i++) p = shard_decode(p, end, &v->elems[i], depth + 1);
+        return p;
+    }
+    if (v->type == REPLY_NULL) return p;
+    if (v->type != REPLY_BULK && v->type != REPLY_ERROR) return NULL;
+    if (end - p < (ptrdiff_t)sizeof(v->len)) return NULL;
+    memcpy(&v->len, p, sizeof(v->len));
+    p += sizeof(v->len);
+    if (v->len > (size_t)(end - p)) return NULL;
+    v->s = (const char *)p;
+    return p + v->len;
+}
+
+static void shard_value_free(ShardValue *v) {
+    for (int64_t i = 0; v->elems && i < v->n; i++) shard_value_free(&v->elems[i]);
+    if (v->elems) RedisModule_Free(v->elems);
+    v->elems = NULL;
+}
+
+// Record the reply of a call, encoded in buf (taken over)
+static void shard_call_done(ShardCall *c, ShardBuf *b) {
+    shard_value_free(&c->reply);
+    if (c->buf) RedisModule_Free(c->buf);
+    c->buf = b->p;
+    if (shard_decode(b->p, b->p + b->len, &c->reply, 0) != NULL) return;
+    static const char *malformed = "ERR malformed reply of a shard";
+    shard_value_free(&c->reply);
+    c->reply.type = REPLY_ERROR;
+    c->reply.s = malformed;
+    c->reply.len = (uint32_t)strlen(malformed);
+}
+
+static void shard_call_error(ShardCall *c, const char *err) {
+    ShardBuf b = { NULL, 0, 0 };
+    shard_put_tagged(&b, REPLY_ERROR, err, strlen(err));
+    shard_call_done(c, &b);
+}
+
+// Name of shard k of a sharded table
+static RedisModuleString *shard_table(RedisModuleCtx *ctx, RedisModuleString *table, int k) {
+    return RedisModule_CreateStringPrintf(ctx, "%s#%d", RedisModule_StringPtrLen(table, NULL), k);
+}
+
+// Shard of a row given its primary key
+static int shard_of_key(RedisModuleString *key, int shards) {
+    size_t len; const char *s = RedisModule_StringPtrLen(key, &len);
+    uint64_t h = 1469598103934665603ULL;   // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return (int)(h % (uint64_t)shards);
+}
+
+// Schema of the sharded table a command is to be run on the shards of; NULL if the table
+// is not sharded, or the command is to run on the table itself
+static TableSchema *shard_parent(RedisModuleCtx *ctx, RedisModuleString *table) {
+    if (g_shard_direct ||
+        (RedisModule_GetContextFlags(ctx) & (REDISMODULE_CTX_FLAGS_REPLICATED | REDISMODULE_CTX_FLAGS_LOADING)))
+        return NULL;
+    TableSchema *sch = schema_get(ctx, table);
+    return sch && sch->shards ? sch : NULL;
+}
+
+static ShardRequest *shard_request_new(RedisModuleString **argv, int argc,
+                                       int (*reply)(RedisModuleCtx *ctx, ShardRequest *r)) {
+    ShardRequest *r = RedisModule_Calloc(1, sizeof(ShardRequest));
+    r->argv = RedisModule_Alloc(sizeof(RedisModuleString*) * argc);
+    for (int i = 0; i < argc; i++) {
+        RedisModule_RetainString(NULL, argv[i]);
+        r->argv[i] = argv[i];
+    }
+    r->argc = argc;
+    r->reply = reply;
+    return r;
+}
+
+// Add the command argv for a shard, argv[1] naming the shard table
+static void shard_request_add(ShardRequest *r, RedisModuleString **argv, int argc) {
+    if (r->ncalls == r->cap) {
+        r->cap = r->cap ? r->cap * 2 : 8;
+        r->calls = RedisModule_Realloc(r->calls, sizeof(ShardCall) * (size_t)r->cap);
+    }
+    ShardCall *c = &r->calls[r->ncalls++];
+    memset(c, 0, sizeof(*c));
+    c->argv = RedisModule_Alloc(sizeof(RedisModuleString*) * argc);
+    for (int i = 0; i < argc; i++) {
+        RedisModule_RetainString(NULL, argv[i]);
+        c->argv[i] = argv[i];
+    }
+    c->argc = argc;
+}
+
+// Add the command argv for every shard of the table argv[1]
+static void shard_request_add_all(RedisModuleCtx *ctx, ShardRequest *r, RedisModuleString **argv, int argc, int shards) {
+    RedisModuleString **sv = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleString*) * (size_t)argc);
+    memcpy(sv, argv, sizeof(RedisModuleString*) * (size_t)argc);
+    for (int k = 0; k < shards; k++) {
+        sv[1] = shard_table(ctx, argv[1], k);
+        shard_request_add(r, sv, argc);
+    }
+}
+
+static void shard_request_free(ShardRequest *r) {
+    for (int i = 0; i < r->ncalls; i++) {
+        ShardCall *c = &r->calls[i];
+        for (int j = 0; j < c->argc; j++) RedisModule_FreeString(NULL, c->argv[j]);
+        RedisModule_Free(c->argv);
+        shard_value_free(&c->reply);
+        if (c->buf) RedisModule_Free(c->buf);
+    }
+    if (r->calls) RedisModule_Free(r->calls);
+    for (int i = 0; i < r->argc; i++) RedisModule_FreeString(NULL, r->argv[i]);
+    RedisModule_Free(r->argv);
+    RedisModule_Free(r);
+}
+
+// Run a call on a shard served here; the statistics of the command calling it are kept
+static void shard_run_local(RedisModuleCtx *ctx, ShardCall *c) {
+    uint64_t started = g_stats_start;
+    int deferred = g_stats_deferred;
+    g_shard_call++;
+    RedisModuleCallReply *reply = RedisModule_Call(ctx, RedisModule_StringPtrLen(c->argv[0], NULL), "v",
+                                                   c->argv + 1, (size_t)(c->argc - 1));
+    g_shard_call--;
+    g_stats_start = started;
+    g_stats_deferred = deferred;
+    ShardBuf b = { NULL, 0, 0 };
+    shard_encode(&b, reply);
+    if (reply) RedisModule_FreeCallReply(reply);
+    shard_call_done(c, &b);
+}
+
+// Slot of a key
+static long long shard_slot(RedisModuleCtx *ctx, RedisModuleString *key) {
+    if (RedisModule_ClusterKeySlot) return RedisModule_ClusterKeySlot(key);
+    RedisModuleCallReply *r = RedisModule_Call(ctx, "CLUSTER", "cs", "KEYSLOT", key);
+    return r && RedisModule_CallReplyType(r) == REDISMODULE_REPLY_INTEGER ? RedisModule_CallReplyInteger(r) : -1;
+}
+
+// Set the node serving the shard of each call from CLUSTER SLOTS; returns the number of
+// calls for other nodes. A shard table has the slot of its name ({ns.t#k}).
+static int shard_nodes(RedisModuleCtx *ctx, ShardRequest *r) {
+    RedisModuleCallReply *slots = RedisModule_Call(ctx, "CLUSTER", "c", "SLOTS");
+    size_t nranges = slots && RedisModule_CallReplyType(slots) == REDISMODULE_REPLY_ARRAY ?
+                     RedisModule_CallReplyLength(slots) : 0;
+    const char *me = RedisModule_GetMyClusterID();
+    int remote = 0;
+    for (int i = 0; i < r->ncalls; i++) {
+        ShardCall *c = &r->calls[i];
+        long long slot = shard_slot(ctx, c->argv[1]);
+        for (size_t j = 0; j < nranges; j++) {
+            // [start, end, [ip, port, id, ...] of the master, replicas ...]
+            RedisModuleCallReply *range = RedisModule_CallReplyArrayElement(slots, j);
+            if (RedisModule_CallReplyLength(range) < 3) continue;
+            if (slot < RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(range, 0)) ||
+                slot > RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(range, 1))) continue;
+            RedisModuleCallReply *master = RedisModule_CallReplyArrayElement(range, 2);
+            size_t idl = 0;
+            const char *id = RedisModule_CallReplyLength(master) >= 3 ?
+                RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(master, 2), &idl) : NULL;
+            if (id && idl == REDISMODULE_NODE_ID_LEN && (!me || memcmp(id, me, idl) != 0)) {
+                memcpy(c->node, id, idl);
+                c->node[idl] = '\0';
+                remote++;
+            }
+            break;
+        }
+    }
+    return remote;
+}
+
+// Send a call to the node serving its shard: request ID, call, argc, then each argument
+// as its length and bytes
+static void shard_send(RedisModuleCtx *ctx, ShardRequest *r, int i) {
+    ShardCall *c = &r->calls[i];
+    ShardBuf b = { NULL, 0, 0 };
+    uint32_t call = (uint32_t)i, argc = (uint32_t)c->argc;
+    shard_put(&b, &r->id, sizeof(r->id));
+    shard_put(&b, &call, sizeof(call));
+    shard_put(&b, &argc, sizeof(argc));
+    for (int j = 0; j < c->argc; j++) {
+        size_t len; const char *s = RedisModule_StringPtrLen(c->argv[j], &len);
+        shard_put_tagged(&b, REPLY_BULK, s, len);
+    }
+    int sent = RedisModule_SendClusterMessage(ctx, c->node, SHARD_MSG_REQUEST, (const char *)b.p, (uint32_t)b.len);
+    RedisModule_Free(b.p);
+    if (sent != REDISMODULE_OK && !c->buf) {
+        shard_call_error(c, "ERR cannot reach the node serving a shard");
+        r->pending--;
+    }
+}
+
+// One more call of a request is answered: the client is unblocked after the last one
+static void shard_request_answered(ShardRequest *r) {
+    if (--r->pending > 0) return;
+    RedisModule_DictDelC(g_shard_requests, &r->id, sizeof(r->id), NULL);
+    RedisModule_UnblockClient(r->bc, r);
+}
+
+static int shard_blocked_reply(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    (void)argv; (void)argc;
+    ShardRequest *r = RedisModule_GetBlockedClientPrivateData(ctx);
+    RedisModule_AutoMemory(ctx);
+    return r->reply(ctx, r);
+}
+
+// The waiting request of a blocked client, taken out of g_shard_requests; NULL if none
+static ShardRequest *shard_request_take(RedisModuleBlockedClient *bc) {
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(g_shard_requests, "^", NULL, 0);
+    ShardRequest *r, *found = NULL;
+    while (!found && RedisModule_DictNextC(it, NULL, (void **)&r) != NULL)
+        if (r->bc == bc) found = r;
+    RedisModule_DictIteratorStop(it);
+    if (found) RedisModule_DictDelC(g_shard_requests, &found->id, sizeof(found->id), NULL);
+    return found;
+}
+
+// A node did not answer in time: the request is freed here, whatever the server version,
+// and taken back from the blocked client so that free_privdata finds nothing to free.
+// Late replies find no request and are ignored
+static int shard_blocked_timeout(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    (void)argv; (void)argc;
+    RedisModuleBlockedClient *bc = RedisModule_GetBlockedClientHandle(ctx);
+    ShardRequest *r = shard_request_take(bc);
+    if (r) {
+        if (RedisModule_BlockClientSetPrivateData) RedisModule_BlockClientSetPrivateData(bc, NULL);
+        shard_request_free(r);
+    }
+    return RedisModule_ReplyWithError(ctx, "ERR a shard did not answer in time, a write may have reached some shards only");
+}
+
+// The client went away while waiting: stop waiting, the request is freed on unblocking
+static void shard_blocked_disconnect(RedisModuleCtx *ctx, RedisModuleBlockedClient *bc) {
+    (void)ctx;
+    ShardRequest *r = shard_request_take(bc);
+    if (r) RedisModule_UnblockClient(bc, r);
+}
+
+static void shard_blocked_free(RedisModuleCtx *ctx, void *privdata) {
+    (void)ctx;
+    if (privdata) shard_request_free(privdata);
+}
+
+// Run the calls of a request and reply with their merge: at once when every shard is
+// served here, else once the other nodes answered, blocking the client meanwhile
+static int shard_request_run(RedisModuleCtx *ctx, ShardRequest *r) {
+    int flags = RedisModule_GetContextFlags(ctx);
+    int remote = flags & REDISMODULE_CTX_FLAGS_CLUSTER ? shard_nodes(ctx, r) : 0;
+    if (remote && (flags & (REDISMODULE_CTX_FLAGS_MULTI | REDISMODULE_CTX_FLAGS_LUA | REDISMODULE_CTX_FLAGS_DENY_BLOCKING))) {
+        shard_request_free(r);
+        return RedisModule_ReplyWithError(ctx, "ERR the shards of this table are on other nodes, it cannot be used within MULTI or scripts");
+    }
+    for (int i = 0; i < r->ncalls; i++)
+        if (!r->calls[i].node[0]) shard_run_local(ctx, &r->calls[i]);
+    if (!remote) {
+        int rc = r->reply(ctx, r);
+        shard_request_free(r);
+        return rc;
+    }
+
+    r->id = ++g_shard_seq;
+    r->pending = remote + 1;    // until every call is sent
+    r->bc = RedisModule_BlockClient(ctx, shard_blocked_reply, shard_blocked_timeout, shard_blocked_free, SHARD_TIMEOUT_MS);
+    // The blocked client owns the request from now on, however it ends
+    if (RedisModule_BlockClientSetPrivateData) RedisModule_BlockClientSetPrivateData(r->bc, r);
+    RedisModule_SetDisconnectCallback(r->bc, shard_blocked_disconnect);
+    RedisModule_DictSetC(g_shard_requests, &r->id, sizeof(r->id), r);
+    for (int i = 0; i < r->ncalls; i++)
+        if (r->calls[i].node[0]) shard_send(ctx, r, i);
+    shard_request_answered(r);
+    return REDISMODULE_OK;
+}
+
+// A call from the node of a sharded table: run it, send the reply back. Only TABLE.*
+// commands are run.
+static void shard_request_receiver(RedisModuleCtx *ctx, const char *sender_id, uint8_t type,
+                                   const unsigned char *payload, uint32_t len) {
+    (void)type;
+    const unsigned char *p = payload, *end = payload + len;
+    uint64_t id;
+    uint32_t call, argc;
+    if (len < sizeof(id) + sizeof(call) + sizeof(argc)) return;
+    memcpy(&id, p, sizeof(id)); p += sizeof(id);
+    memcpy(&call, p, sizeof(call)); p += sizeof(call);
+    memcpy(&argc, p, sizeof(argc)); p += sizeof(argc);
+
+    RedisModuleString **argv = NULL;
+    uint32_t n = 0;
+    // Each argument takes 5 bytes at least
+    if (argc >= 2 && argc <= (uint32_t)(end - p) / 5) {
+        argv = RedisModule_Alloc(sizeof(RedisModuleString*) * argc);
+        for (; n < argc; n++) {
+            ShardValue v;
+            const unsigned char *next = shard_decode(p, end, &v, SHARD_REPLY_DEPTH);
+            if (!next || v.type != REPLY_BULK) break;
+            argv[n] = RedisModule_CreateString(ctx, v.s, v.len);
+            p = next;
+        }
+    }
+    ShardBuf b = { NULL, 0, 0 };
+    shard_put(&b, &id, sizeof(id));
+    shard_put(&b, &call, sizeof(call));
+    size_t cl; const char *cmd = n ? RedisModule_StringPtrLen(argv[0], &cl) : NULL;
+    if (n == argc && cmd && cl > 6 && strncasecmp(cmd, "TABLE.", 6) == 0) {
+        g_shard_call++;
+        RedisModuleCallReply *reply = RedisModule_Call(ctx, cmd, "v", argv + 1, (size_t)(argc - 1));
+        g_shard_call--;
+        shard_encode(&b, reply);
+        if (reply) RedisModule_FreeCallReply(reply);
+    } else {
+        const char *err = "ERR malformed shard request";
+        shard_put_tagged(&b, REPLY_ERROR, err, strlen(err));
+    }
+    for (uint32_t i = 0; i < n; i++) RedisModule_FreeString(ctx, argv[i]);
+    if (argv) RedisModule_Free(argv);
+
+    char node[REDISMODULE_NODE_ID_LEN + 1];
+    memcpy(node, sender_id, REDISMODULE_NODE_ID_LEN);
+    node[REDISMODULE_NODE_ID_LEN] = '\0';
+    RedisModule_SendClusterMessage(ctx, node, SHARD_MSG_REPLY, (const char *)b.p, (uint32_t)b.len);
+    RedisModule_Free(b.p);
+}
+
+// The reply of a shard to a call: request ID, call, then the encoded reply
+static void shard_reply_receiver(RedisModuleCtx *ctx, const char *sender_id, uint8_t type,
+                                 const unsigned char *payload, uint32_t len) {
+    (void)ctx; (void)type;
+    uint64_t id;
+    uint32_t call;
+    if (len < sizeof(id) + sizeof(call)) return;
+    memcpy(&id, payload, sizeof(id));
+    memcpy(&call, payload + sizeof(id), sizeof(call));
+    ShardRequest *r = RedisModule_DictGetC(g_shard_requests, &id, sizeof(id), NULL);
+    if (!r || call >= (uint32_t)r->ncalls) return;
+    ShardCall *c = &r->calls[call];
+    if (c->buf || memcmp(c->node, sender_id, REDISMODULE_NODE_ID_LEN) != 0) return;
+    ShardBuf b = { NULL, 0, 0 };
+    shard_put(&b, payload + sizeof(id) + sizeof(call), len - sizeof(id) - sizeof(call));
+    shard_call_done(c, &b);
+    shard_request_answered(r);
+}
+
+// The first error replied by a shard, NULL if none
+static ShardValue *shard_error(ShardRequest *r) {
+    for (int i = 0; i < r->ncalls; i++)
+        if (r->calls[i].reply.type == REPLY_ERROR) return &r->calls[i].reply;
+    return NULL;
+}
+
+static int shard_reply_error(RedisModuleCtx *ctx, ShardValue *err) {
+    RedisModuleString *s = RedisModule_CreateString(ctx, err->s, err->len);
+    return RedisModule_ReplyWithError(ctx, RedisModule_StringPtrLen(s, NULL));
+}
+
+// Reply with a value replied by a shard
+static void shard_reply_value(RedisModuleCtx *ctx, ShardValue *v) {
+    switch (v->type) {
+    case REPLY_INT: out_longlong(ctx, v->n); break;
+    case REPLY_BULK: out_buffer(ctx, v->s, v->len); break;
+    case REPLY_ERROR: shard_reply_error(ctx, v); break;
+    case REPLY_ARRAY:
+        out_array(ctx, (long)v->n);
+        for (int64_t i = 0; i < v->n; i++) shard_reply_value(ctx, &v->elems[i]);
+        break;
+    default: out_null(ctx); break;
+    }
+}
+
+// Reply with a row replied by a shard: a map of its column/value pairs if n is 0, else
+// its first n values
+static void shard_reply_row(RedisModuleCtx *ctx, ShardValue *row, int n) {
+    if (row->type != REPLY_ARRAY) {
+        shard_reply_value(ctx, row);
+        return;
+    }
+    if (n == 0) {
+        out_map(ctx, (long)(row->n / 2));
+        for (int64_t i = 0; i < row->n / 2 * 2; i++) shard_reply_value(ctx, &row->elems[i]);
+        return;
+    }
+    out_array(ctx, n);
+    for (int c = 0; c < n; c++) {
+        if (c < row->n) shard_reply_value(ctx, &row->elems[c]);
+        else out_null(ctx);
+    }
+}
+
+// Merged reply: OK once every shard replied
+static int shard_merge_ok(RedisModuleCtx *ctx, ShardRequest *r) {
+    ShardValue *err = shard_error(r);
+    return err ? shard_reply_error(ctx, err) : RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+// Merged reply: the sum of the counts replied by the shards
+static int shard_merge_sum(RedisModuleCtx *ctx, ShardRequest *r) {
+    ShardValue *err = shard_error(r);
+    if (err) return shard_reply_error(ctx, err);
+    long long sum = 0;
+    for (int i = 0; i < r->ncalls; i++)
+        if (r->calls[i].reply.type == REPLY_INT) sum += r->calls[i].reply.n;
+    return RedisModule_ReplyWithLongLong(ctx, sum);
+}
+
+// Merged reply: the reply of the only shard called
+static int shard_merge_one(RedisModuleCtx *ctx, ShardRequest *r) {
+    shard_reply_value(ctx, &r->calls[0].reply);
+    return REDISMODULE_OK;
+}
+
+// Run a schema change on the sharded table argv[1] itself, which checks it, then on its
+// shards, without the arguments argv[skip..skip+nskip)
+static int shard_schema_change(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, int shards,
+                               int skip, int nskip) {
+    g_shard_direct++;
+    RedisModuleCallReply *own = RedisModule_Call(ctx, RedisModule_StringPtrLen(argv[0], NULL), "v", argv + 1,
+                                                 (size_t)(argc - 1));
+    g_shard_direct--;
+    if (!own) return RedisModule_ReplyWithError(ctx, "ERR cannot run the command");
+    if (RedisModule_CallReplyType(own) == REDISMODULE_REPLY_ERROR) return RedisModule_ReplyWithCallReply(ctx, own);
+
+    RedisModuleString **sv = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleString*) * (size_t)argc);
+    int n = 0;
+    for (int i = 0; i < argc; i++)
+        if (i < skip || i >= skip + nskip) sv[n++] = argv[i];
+    ShardRequest *r = shard_request_new(argv, argc, shard_merge_ok);
+    shard_request_add_all(ctx, r, sv, n, shards);
+    return shard_request_run(ctx, r);
+}
+
+// Classify the token joining two WHERE conditions: 1 = AND, 2 = OR, 0 = neither
+static int where_joiner(RedisModuleString *tok) {
+    size_t l; const char *s = RedisModule_StringPtrLen(tok, &l);
+    if (l == 3 && strncasecmp(s, "AND", 3) == 0) return 1;
+    if (l == 2 && strncasecmp(s, "OR", 2) == 0) return 2;
+    return 0;
+}
+
+static int TableNamespaceCreateCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc != 2) return RedisModule_WrongArity(ctx);
+    RedisModule_AutoMemory(ctx);
+
+    // Validate namespace length (max 64 characters)
+    if (validate_string_length(ctx, argv[1], "namespace") != REDISMODULE_OK) {
+        return REDISMODULE_ERR;
+    }
+
+    RedisModuleKey *k = RedisModule_OpenKey(ctx, fmt(ctx, "schema:{%s}", argv[1]), REDISMODULE_WRITE);
+    if (RedisModule_KeyType(k) != REDISMODULE_KEYTYPE_EMPTY)
+        return RedisModule_ReplyWithError(ctx, "ERR namespace already exists");
+    RedisModule_StringSet(k, RedisModule_CreateString(ctx, "1", 1));
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+// List every table of the keyspace in the catalog by a SCAN of the schema keys of each
+// database. Only needed when the keyspace was not seen filling up: the module was loaded
+// into a server holding data, a load failed and the previous dataset is back, or the
+// server (before 7.0) does not report the keys it loads
+static void catalog_scan(RedisModuleCtx *ctx) {
+    RedisModule_AutoMemory(ctx);
+    int selected = RedisModule_GetSelectedDb(ctx);
+    for (int db = 0; RedisModule_SelectDb(ctx, db) == REDISMODULE_OK; db++) {
+        if (RedisModule_DbSize(ctx) == 0) continue;
+        unsigned long long cursor = 0;
+        do {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%llu", cursor);
+            RedisModuleCallReply *r = RedisModule_Call(ctx, "SCAN", "cccc", buf, "MATCH", "schema:{*.*}", "COUNT", "1000");
+            RedisModuleCallReply *keys = index_job_scan_reply(r, &cursor);
+            size_t n = keys ? RedisModule_CallReplyLength(keys) : 0;
+            for (size_t i = 0; i < n; i++) {
+                size_t kl; const char *k = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(keys, i), &kl);
+                if (k && kl > 9 && memcmp(k, "schema:{", 8) == 0 && k[kl-1] == '}') catalog_set(db, k + 8, kl - 9, 1);
+            }
+        } while (cursor != 0);
+    }
+    RedisModule_SelectDb(ctx, selected);
+}
+
+/* ================== TABLE.NAMESPACE.VIEW [<namespace>] ================== */
+// Tables in namespace then table order, as "namespace:table", from the catalog
+static int TableNamespaceViewCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc != 1 && argc != 2) return RedisModule_WrongArity(ctx);
+    RedisModule_AutoMemory(ctx);
+
+    // Catalog keys "<db>:<ns>\0<t>" from "<db>:" on, or "<db>:<ns>\0" with a namespace
+    char prefix[256];
+    int plen = snprintf(prefix, sizeof(prefix), "%d:", RedisModule_GetSelectedDb(ctx));
+    if (argc == 2) {
+        size_t flen; const char *filter = RedisModule_StringPtrLen(argv[1], &flen);
+        if ((size_t)plen + flen + 1 >= sizeof(prefix)) return RedisModule_ReplyWithArray(ctx, 0);
+        memcpy(prefix + plen, filter, flen);
+        plen += (int)flen;
+        prefix[plen++] = '\0';
+    }
+
+    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_LEN);
+    long count = 0;
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(g_catalog, ">=", prefix, (size_t)plen);
+    size_t kl; const char *k;
+    while ((k = RedisModule_DictNextC(it, &kl, NULL)) != NULL) {
+        if (kl < (size_t)plen || memcmp(k, prefix, (size_t)plen) != 0) break;
+        const char *ns = memchr(k, ':', kl) + 1;
+        size_t nlen = kl - (size_t)(ns - k);
+        size_t slen = strnlen(ns, nlen);
+        if (memchr(ns + slen, '#', nlen - slen)) continue;
+        RedisModule_ReplyWithString(ctx, RedisModule_CreateStringPrintf(ctx, "%.*s:%.*s", (int)slen, ns,
+                                                                        (int)(nlen - slen - 1), ns + slen + 1));
+        count++;
+    }
+    RedisModule_DictIteratorStop(it);
+    RedisModule_ReplySetArrayLength(ctx, count);
+    return REDISMODULE_OK;
+}
+
+/* ================== TABLE.SCHEMA.VIEW <namespace.table> ================== */
+static int TableSchemaViewCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc != 2) return RedisModule_WrongArity(ctx);
+    RedisModule_AutoMemory(ctx);
+    
+    if (ensure_table_exists(ctx, argv[1]) != REDISMODULE_OK)
+        return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
+    
+    // Get all columns from table schema
+    RedisModuleCallReply *fields = RedisModule_Call(ctx, "HGETALL", "s", fmt(ctx, "schema:{%s}", argv[1]));
+    if (!fields || RedisModule_CallReplyType(fields) != REDISMODULE_REPLY_ARRAY) {
+        return RedisModule_ReplyWithArray(ctx, 0);
+    }
+    
+    size_t n = RedisModule_CallReplyLength(fields);
+    size_t numCols = n / 2;
+    
+    // Reply format: array of [column, type, indexed]
+    RedisModule_ReplyWithArray(ctx, numCols);
+    
+    for (size_t i = 0; i < n; i += 2) {
+        RedisModuleCallReply *colReply = RedisModule_CallReplyArrayElement(fields, i);
+        RedisModuleCallReply *typeReply = RedisModule_CallReplyArrayElement(fields, i + 1);
+        
+        RedisModuleString *col = RedisModule_CreateStringFromCallReply(colReply);
+        RedisModuleString *type = RedisModule_CreateStringFromCallReply(typeReply);
+        
+        // Check if indexed
+        int indexed = is_column_indexed(ctx, argv[1], col);
+        
+        // Reply with array: [column, type, indexed]
+        RedisModule_ReplyWithArray(ctx, 3);
+        RedisModule_ReplyWithString(ctx, col);
+        RedisModule_ReplyWithString(ctx, type);
+        RedisModule_ReplyWithSimpleString(ctx, indexed ? "true" : "false");
+    }
+    
+    return REDISMODULE_OK;
+}
+
+// Parse a composite index "c1,c2,...[:hash|btree]", the column list optionally in
+// parentheses, into its name "c1,c2,..." and kind (hash by default)
+// Returns NULL or an error message
+static const char *composite_parse(RedisModuleCtx *ctx, RedisModuleString *arg, RedisModuleString **name, int *kind) {
+    size_t len; const char *s = RedisModule_StringPtrLen(arg, &len);
+    const char *colon = memchr(s, ':', len);
+    size_t nlen = colon ? (size_t)(colon - s) : len;
+    *kind = INDEX_HASH;
+    if (colon) {
+        *kind = parse_index_type(colon + 1, len - nlen - 1);
+        if (*kind != INDEX_HASH && *kind != INDEX_BTREE) return "ERR index must be 'hash' or 'btree'";
+    }
+    if (nlen >= 2 && s[0] == '(' && s[nlen - 1] == ')') { s++; nlen -= 2; }
+    int ncols = 1;
+    for (size_t i = 0; i < nlen; i++) {
+        if (s[i] != ',') continue;
+        if (i == 0 || i == nlen - 1 || s[i + 1] == ',') return "ERR composite index columns must be c1,c2,...";
+        ncols++;
+    }
+    if (ncols < 2 || ncols > COMPOSITE_MAX_COLUMNS)
+        return "ERR composite index needs 2 to 8 columns";
+    // The same column twice
+    for (size_t a = 0; a < nlen; ) {
+        const char *ca = memchr(s + a, ',', nlen - a);
+        size_t ae = ca ? (size_t)(ca - s) : nlen;
+        for (size_t b = ae + 1; b < nlen; ) {
+            const char *cb = memchr(s + b, ',', nlen - b);
+            size_t be = cb ? (size_t)(cb - s) : nlen;
+            if (be - b == ae - a && memcmp(s + a, s + b, ae - a) == 0) return "ERR duplicate column";
+            b = be + 1;
+        }
+        a = ae + 1;
+    }
+    *name = RedisModule_CreateString(ctx, s, nlen);
+    return NULL;
+}
+
+// Whether argv[i] of TABLE.SCHEMA.CREATE belongs to its ENGINE, PARTITION BY or SHARDS option
+static int create_option_arg(int i, int enginePos, int partPos, int partEnd, int shardsPos) {
+    return (enginePos != -1 && (i == enginePos || i == enginePos + 1)) || (i >= partPos && i < partEnd) ||
+           (shardsPos != -1 && (i == shardsPos || i == shardsPos + 1));
+}
+
+/* ================== TABLE.SCHEMA.CREATE <namespace.table> <col:type:index> ... [INDEX <c1,c2,...[:index]>] ... [PARTITION BY <col> [RETENTION <days>]] [SHARDS <n>] ================== */
+static int TableSchemaCreateCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc < 3) return RedisModule_WrongArity(ctx);
+    RedisModule_AutoMemory(ctx);
+
+    RedisModuleString *schema = extract_schema(ctx, argv[1]);
+    if (!schema) return RedisModule_ReplyWithError(ctx, "ERR table name must be namespace.table");
+
+    // Validate namespace length (max 64 characters)
+    if (validate_string_length(ctx, schema, "namespace") != REDISMODULE_OK) {
+        return REDISMODULE_ERR;
+    }
+
+    // Validate table name length (max 64 characters)
+    RedisModuleString *table = extract_table(ctx, argv[1]);
+    if (!table) return RedisModule_ReplyWithError(ctx, "ERR table name must be namespace.table");
+    // '#' names the shards of a sharded table, created by it: the namespace may be on
+    // another node
+    int shardTable = strchr(RedisModule_StringPtrLen(table, NULL), '#') != NULL;
+    if (shardTable && !g_shard_call &&
+        !(RedisModule_GetContextFlags(ctx) & (REDISMODULE_CTX_FLAGS_REPLICATED | REDISMODULE_CTX_FLAGS_LOADING)))
+        return RedisModule_ReplyWithError(ctx, "ERR '#' is reserved for the shards of sharded tables");
+    if (!shardTable && validate_string_length(ctx, table, "table") != REDISMODULE_OK) {
+        return REDISMODULE_ERR;
+    }
+
+    if (!shardTable && ensure_schema_exists(ctx, schema) != REDISMODULE_OK)
+        return RedisModule_ReplyWithError(ctx, "ERR namespace does not exist");
+
+    // Optional storage engine: ENGINE hash|native (default hash)
+    int engine = ENGINE_HASH;
+    int enginePos = -1;
+    for (int i = 2; i < argc; i++) {
+        size_t l; const char *w = RedisModule_StringPtrLen(argv[i], &l);
+        if (l != 6 || strncasecmp(w, "ENGINE", 6) != 0) continue;
+        size_t el; const char *e = i + 1 < argc ? RedisModule_StringPtrLen(argv[i + 1], &el) : NULL;
+        if (e && el == 4 && strncasecmp(e, "hash", 4) == 0) engine = ENGINE_HASH;
+        else if (e && el == 6 && strncasecmp(e, "native", 6) == 0) engine = ENGINE_NATIVE;
+        else return RedisModule_ReplyWithError(ctx, "ERR engine must be 'hash' or 'native'");
+        enginePos = i;
+        break;
+    }
+
+    // Optional time partitions: PARTITION BY <date column> [RETENTION <days>], tokens
+    // argv[partPos..partEnd)
+    int partPos = -1, partEnd = -1;
+    long long retention = 0;
+    for (int i = 2; i < argc; i++) {
+        if (i == enginePos + 1 || !is_word(argv[i], "PARTITION")) continue;
+        if (i + 2 >= argc || !is_word(argv[i + 1], "BY"))
+            return RedisModule_ReplyWithError(ctx, "ERR syntax: PARTITION BY <date column> [RETENTION <days>]");
+        if (engine == ENGINE_NATIVE) return RedisModule_ReplyWithError(ctx, "ERR partitions need ENGINE hash");
+        partPos = i;
+        partEnd = i + 3;
+        if (partEnd < argc && is_word(argv[partEnd], "RETENTION")) {
+            if (partEnd + 1 >= argc || RedisModule_StringToLongLong(argv[partEnd + 1], &retention) != REDISMODULE_OK ||
+                retention < 1)
+                return RedisModule_ReplyWithError(ctx, "ERR RETENTION must be a positive number of days");
+            partEnd += 2;
+        }
+        break;
+    }
+    // Optional sharding: SHARDS <n>, the rows spread over n shard tables
+    int shardsPos = -1;
+    long long shards = 0;
+    for (int i = 2; i < argc; i++) {
+        if (!is_word(argv[i], "SHARDS") || create_option_arg(i, enginePos, partPos, partEnd, -1) ||
+            is_word(argv[i - 1], "INDEX")) continue;
+        if (i + 1 >= argc || RedisModule_StringToLongLong(argv[i + 1], &shards) != REDISMODULE_OK ||
+            shards < 2 || shards > SHARD_MAX)
+            return RedisModule_ReplyWithError(ctx, "ERR SHARDS must be between 2 and 64");
+        if (shardTable) return RedisModule_ReplyWithError(ctx, "ERR a shard cannot be sharded");
+        shardsPos = i;
+        break;
+    }
+    if (shardsPos != -1 && !g_shard_direct &&
+        !(RedisModule_GetContextFlags(ctx) & (REDISMODULE_CTX_FLAGS_REPLICATED | REDISMODULE_CTX_FLAGS_LOADING)))
+        return shard_schema_change(ctx, argv, argc, (int)shards, shardsPos, 2);
+    int options = (enginePos != -1 ? 2 : 0) + (partPos != -1 ? partEnd - partPos : 0) + (shardsPos != -1 ? 2 : 0);
+    if (options && argc - 2 - options < 1) return RedisModule_WrongArity(ctx);
+
+    // Composite indexes INDEX c1,c2,...[:index], over columns of the table, checked first
+    RedisModuleString **composites = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleString*) * (size_t)argc);
+    int *compositeKinds = RedisModule_PoolAlloc(ctx, sizeof(int) * (size_t)argc);
+    int ncomposites = 0;
+    for (int i = 2; i < argc; i++) {
+        if (create_option_arg(i, enginePos, partPos, partEnd, shardsPos) || !is_word(argv[i], "INDEX")) continue;
+        if (i + 1 >= argc) return RedisModule_ReplyWithError(ctx, "ERR INDEX requires c1,c2,...[:index]");
+        if (engine == ENGINE_NATIVE) return RedisModule_ReplyWithError(ctx, "ERR composite indexes need ENGINE hash");
+        const char *err = composite_parse(ctx, argv[i + 1], &composites[ncomposites], &compositeKinds[ncomposites]);
+        if (err) return RedisModule_ReplyWithError(ctx, err);
+        size_t nlen; const char *nm = RedisModule_StringPtrLen(composites[ncomposites], &nlen);
+        for (size_t at = 0; at < nlen; ) {
+            const char *comma = memchr(nm + at, ',', nlen - at);
+            size_t end = comma ? (size_t)(comma - nm) : nlen;
+            int found = 0;
+            for (int j = 2; j < argc && !found; j++) {
+                if (create_option_arg(j, enginePos, partPos, partEnd, shardsPos) || is_word(argv[j], "INDEX")) continue;
+                if (j > 2 && is_word(argv[j - 1], "INDEX")) continue;
+                size_t cl; const char *c = RedisModule_StringPtrLen(argv[j], &cl);
+                found = cl > end - at && c[end - at] == ':' && memcmp(c, nm + at, end - at) == 0;
+            }
+            if (!found) return RedisModule_ReplyWithError(ctx, "ERR composite index column does not exist");
+            at = end + 1;
+        }
+        ncomposites++;
+        i++;
+    }
+
+    // Unique indexes, and the primary key, checked first too
+    int primaries = 0;
+    int partFound = partPos == -1;
+    for (int i = 2; i < argc; i++) {
+        if (create_option_arg(i, enginePos, partPos, partEnd, shardsPos)) continue;
+        if (is_word(argv[i], "INDEX")) { i++; continue; }
+        size_t len; const char *s = RedisModule_StringPtrLen(argv[i], &len);
+        const char *colon1 = memchr(s, ':', len);
+        const char *colon2 = colon1 ? memchr(colon1 + 1, ':', len - (size_t)(colon1 - s) - 1) : NULL;
+        if (!partFound && colon1) {
+            size_t pl; const char *p = RedisModule_StringPtrLen(argv[partPos + 2], &pl);
+            size_t tl = colon2 ? (size_t)(colon2 - colon1 - 1) : len - (size_t)(colon1 - s) - 1;
+            partFound = pl == (size_t)(colon1 - s) && memcmp(s, p, pl) == 0 &&
+                        parse_column_type(colon1 + 1, tl) == COLTYPE_DATE;
+        }
+        int kind = colon2 ? parse_index_type(colon2 + 1, len - (size_t)(colon2 - s) - 1) : INDEX_NONE;
+        if (kind != INDEX_UNIQUE && kind != INDEX_PRIMARY) continue;
+        if (engine == ENGINE_NATIVE) return RedisModule_ReplyWithError(ctx, "ERR unique indexes need ENGINE hash");
+        if (kind == INDEX_UNIQUE && shardsPos != -1) return RedisModule_ReplyWithError(ctx, SHARD_UNIQUE_ERROR);
+        if (kind == INDEX_PRIMARY && ++primaries > 1)
+            return RedisModule_ReplyWithError(ctx, "ERR a table has one primary key at most");
+    }
+    if (!partFound) return RedisModule_ReplyWithError(ctx, "ERR PARTITION BY needs a date column of the table");
+
+    RedisModuleKey *schemaKey = RedisModule_OpenKey(ctx, fmt(ctx, "schema:{%s}", argv[1]), REDISMODULE_WRITE);
+    if (RedisModule_KeyType(schemaKey) != REDISMODULE_KEYTYPE_EMPTY)
+        return RedisModule_ReplyWithError(ctx, "ERR table schema already exists");
+    // The keys of a dropped table of the same name go first
+    purge_finish(ctx, argv[1]);
+
+    RedisModuleString *metaKey = fmt(ctx, "{%s}:idx:meta", argv[1]);
+
+    // Parse col:type:index (index is optional, defaults to none)
+    for (int i = 2; i < argc; i++) {
+        if (create_option_arg(i, enginePos, partPos, partEnd, shardsPos)) continue;
+        if (is_word(argv[i], "INDEX")) { i++; continue; }
+        size_t len; const char *s = RedisModule_StringPtrLen(argv[i], &len);
         const char *colon1 = memchr(s, ':', len);
         if (!colon1 || colon1 == s) 
             return RedisModule_ReplyWithError(ctx, "ERR format: <col:type> or <col:type:index>");
@@ -447,591 +4565,3556 @@ static int TableSchemaCreateCommand(RedisModuleCtx *ctx, RedisModuleString **arg
             int idx_type = parse_index_type(idx_str, idx_len);
             if (idx_type == -1) {
                 return RedisModule_ReplyWithError(ctx, 
-                    "ERR index must be 'hash', 'btree', 'none' (or deprecated 'true'/'false')");
+                    "ERR index must be 'hash', 'btree', 'unique', 'primary', 'none' (or deprecated 'true'/'false')");
+            }
+            indexed = idx_type;
+        } else {
+            // col:type format - defaults to none (no index)
+            typ = RedisModule_CreateString(ctx, colon1 + 1, len - col_len - 1);
+        }
+        
+        RedisModule_HashSet(schemaKey, REDISMODULE_HASH_NONE, col, typ, NULL);
+        if (indexed) {
+            RedisModule_Call(ctx, "SADD", "ss", metaKey, col);
+        }
+        if (indexed == INDEX_BTREE) {
+            RedisModule_Call(ctx, "SADD", "ss", fmt(ctx, "{%s}:idx:btree", argv[1]), col);
+        } else if (indexed == INDEX_UNIQUE || indexed == INDEX_PRIMARY) {
+            RedisModule_Call(ctx, "HSET", "ssc", fmt(ctx, "{%s}:idx:unique", argv[1]), col, index_type_name(indexed));
+        }
+    }
+    for (int i = 0; i < ncomposites; i++)
+        RedisModule_Call(ctx, "HSET", "ssc", fmt(ctx, "{%s}:idx:composite", argv[1]), composites[i],
+                         index_type_name(compositeKinds[i]));
+    if (partPos != -1) {
+        RedisModuleString *optionsKey = fmt(ctx, "{%s}:options", argv[1]);
+        RedisModule_Call(ctx, "HSET", "scs", optionsKey, "partition", argv[partPos + 2]);
+        if (retention) RedisModule_Call(ctx, "HSET", "scl", optionsKey, "retention", retention);
+    }
+    if (shardsPos != -1) RedisModule_Call(ctx, "HSET", "scl", fmt(ctx, "{%s}:options", argv[1]), "shards", shards);
+    if (engine == ENGINE_NATIVE) {
+        RedisModuleKey *dataKey = RedisModule_OpenKey(ctx, fmt(ctx, "{%s}:data", argv[1]), REDISMODULE_WRITE);
+        if (RedisModule_KeyType(dataKey) == REDISMODULE_KEYTYPE_EMPTY)
+            RedisModule_ModuleTypeSetValue(dataKey, NativeTableType, native_new());
+    }
+    schema_invalidate(ctx, argv[1]);
+    catalog_table(ctx, argv[1], 1);
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+// ALTER ADD INDEX c1,c2,...[:index]: the index is recorded at once, the existing rows are
+// indexed inline, or by an index job on tables of more than INDEX_JOB_ROWS rows
+static int composite_alter_add(RedisModuleCtx *ctx, RedisModuleString *table, TableSchema *sch, RedisModuleString *arg) {
+    if (sch->engine == ENGINE_NATIVE) return RedisModule_ReplyWithError(ctx, "ERR composite indexes need ENGINE hash");
+    RedisModuleString *name;
+    int kind;
+    const char *err = composite_parse(ctx, arg, &name, &kind);
+    if (err) return RedisModule_ReplyWithError(ctx, err);
+    size_t nlen; const char *nm = RedisModule_StringPtrLen(name, &nlen);
+    for (size_t at = 0; at < nlen; ) {
+        const char *comma = memchr(nm + at, ',', nlen - at);
+        size_t end = comma ? (size_t)(comma - nm) : nlen;
+        if (!RedisModule_DictGetC(sch->byName, (void*)(nm + at), end - at, NULL))
+            return RedisModule_ReplyWithError(ctx, "ERR composite index column does not exist");
+        at = end + 1;
+    }
+    CompositeIndex *current = schema_composite(sch, name);
+    if (current && current->kind != kind)
+        return RedisModule_ReplyWithError(ctx, "ERR composite index has a different index type, DROP INDEX first");
+    if (current) {
+        RedisModule_ReplicateVerbatim(ctx);
+        return RedisModule_ReplyWithSimpleString(ctx, "OK");
+    }
+
+    // The keys of a dropped index still being deleted go first
+    if (index_job_state(ctx, table, name) == INDEX_NONE && index_job_finish(ctx, table, name) != 0)
+        return RedisModule_ReplyWithError(ctx, "ERR this index is being dropped, see TABLE.INDEX.STATUS");
+
+    RedisModule_Call(ctx, "HSET", "ssc", fmt(ctx, "{%s}:idx:composite", table), name, index_type_name(kind));
+    RedisModuleString *rowsSet = fmt(ctx, "{%s}:rows", table);
+    RedisModuleCallReply *card = RedisModule_Call(ctx, "SCARD", "s", rowsSet);
+    if (card && RedisModule_CallReplyType(card) == REDISMODULE_REPLY_INTEGER &&
+        RedisModule_CallReplyInteger(card) > INDEX_JOB_ROWS) {
+        RedisModule_Call(ctx, "HSET", "ssc", fmt(ctx, "{%s}:idx:jobs", table), name, index_type_name(kind));
+        schema_invalidate(ctx, table);
+        if (jobs_run_here(ctx)) index_job_start(ctx, table, name, kind);
+    } else {
+        schema_invalidate(ctx, table);
+        index_rows(ctx, table, name, kind, idset_from_reply(ctx, RedisModule_Call(ctx, "SMEMBERS", "s", rowsSet), 0));
+    }
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+// ALTER DROP INDEX c1,c2,...: queries stop using the index at once; a hash composite index
+// is unlinked, the keys of a btree one are deleted by a job
+static int composite_alter_drop(RedisModuleCtx *ctx, RedisModuleString *table, TableSchema *sch, RedisModuleString *arg) {
+    RedisModuleString *name;
+    int kind;
+    const char *err = composite_parse(ctx, arg, &name, &kind);
+    if (err) return RedisModule_ReplyWithError(ctx, err);
+    CompositeIndex *ci = schema_composite(sch, name);
+    if (!ci) return RedisModule_ReplyWithError(ctx, "ERR composite index does not exist");
+    RedisModule_Call(ctx, "HDEL", "ss", fmt(ctx, "{%s}:idx:composite", table), name);
+    if (ci->kind == INDEX_HASH) {
+        // Abandons the job of an index being built
+        RedisModule_Call(ctx, "HDEL", "ss", fmt(ctx, "{%s}:idx:jobs", table), name);
+        RedisModule_Call(ctx, "UNLINK", "s", fmt2(ctx, "{%s}:hash:%s", table, name));
+        schema_invalidate(ctx, table);
+        RedisModule_ReplicateVerbatim(ctx);
+        return RedisModule_ReplyWithSimpleString(ctx, "OK");
+    }
+    // Replaces the job of an index being built, which then stops
+    RedisModule_Call(ctx, "HSET", "ssc", fmt(ctx, "{%s}:idx:jobs", table), name, "drop");
+    schema_invalidate(ctx, table);
+    if (jobs_run_here(ctx)) index_job_start(ctx, table, name, INDEX_NONE);
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+/* ================== TABLE.SCHEMA.ALTER <namespace.table> ADD/DROP COLUMN/INDEX ... ================== */
+static int TableSchemaAlterCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc < 4) return RedisModule_WrongArity(ctx);
+    RedisModule_AutoMemory(ctx);
+    
+    TableSchema *sch = schema_get(ctx, argv[1]);
+    if (!sch)
+        return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
+    if (shard_parent(ctx, argv[1])) return shard_schema_change(ctx, argv, argc, sch->shards, argc, 0);
+    int engine = sch->engine;
+    
+    size_t oplen; const char *op = RedisModule_StringPtrLen(argv[2], &oplen);
+    size_t targetlen; const char *target = RedisModule_StringPtrLen(argv[3], &targetlen);
+    
+    RedisModuleKey *schemaKey = RedisModule_OpenKey(ctx, fmt(ctx, "schema:{%s}", argv[1]), REDISMODULE_WRITE);
+    RedisModuleString *metaKey = fmt(ctx, "{%s}:idx:meta", argv[1]);
+    RedisModuleString *btreeSet = fmt(ctx, "{%s}:idx:btree", argv[1]);
+    
+    if (oplen == 3 && strncasecmp(op, "ADD", 3) == 0) {
+        if (targetlen == 6 && strncasecmp(target, "COLUMN", 6) == 0) {
+            // ADD COLUMN col:type[:index]
+            if (argc != 5) return RedisModule_ReplyWithError(ctx, "ERR ADD COLUMN requires col:type[:index]");
+            size_t len; const char *s = RedisModule_StringPtrLen(argv[4], &len);
+            const char *colon1 = memchr(s, ':', len);
+            if (!colon1) return RedisModule_ReplyWithError(ctx, "ERR format: col:type[:index]");
+            
+            RedisModuleString *col = RedisModule_CreateString(ctx, s, (size_t)(colon1 - s));
+            const char *colon2 = memchr(colon1 + 1, ':', len - (size_t)(colon1 - s) - 1);
+            RedisModuleString *typ;
+            int indexed = 0; // default none
+            
+            if (colon2) {
+                typ = RedisModule_CreateString(ctx, colon1 + 1, (size_t)(colon2 - colon1 - 1));
+                const char *idx_str = colon2 + 1;
+                size_t idx_len = len - (size_t)(colon2 - s) - 1;
+                
+                int idx_type = parse_index_type(idx_str, idx_len);
+                if (idx_type == -1) {
+                    return RedisModule_ReplyWithError(ctx,
+                        "ERR index must be 'hash', 'btree', 'unique', 'none' (or deprecated 'true'/'false')");
+                }
+                indexed = idx_type;
+            } else {
+                typ = RedisModule_CreateString(ctx, colon1 + 1, len - (size_t)(colon1 - s) - 1);
+            }
+            if (indexed == INDEX_PRIMARY)
+                return RedisModule_ReplyWithError(ctx, "ERR the primary key is declared by TABLE.SCHEMA.CREATE");
+            if (indexed == INDEX_UNIQUE && engine == ENGINE_NATIVE)
+                return RedisModule_ReplyWithError(ctx, "ERR unique indexes need ENGINE hash");
+            if (indexed == INDEX_UNIQUE && sch->shards) return RedisModule_ReplyWithError(ctx, SHARD_UNIQUE_ERROR);
+            
+            RedisModule_HashSet(schemaKey, REDISMODULE_HASH_NONE, col, typ, NULL);
+            if (indexed) RedisModule_Call(ctx, "SADD", "ss", metaKey, col);
+            if (indexed == INDEX_BTREE) RedisModule_Call(ctx, "SADD", "ss", btreeSet, col);
+            if (indexed == INDEX_UNIQUE)
+                RedisModule_Call(ctx, "HSET", "ssc", fmt(ctx, "{%s}:idx:unique", argv[1]), col, "unique");
+            schema_invalidate(ctx, argv[1]);
+            RedisModule_ReplicateVerbatim(ctx);
+            return RedisModule_ReplyWithSimpleString(ctx, "OK");
+            
+        } else if (targetlen == 5 && strncasecmp(target, "INDEX", 5) == 0) {
+            // ADD INDEX col[:index] - build index for existing data (index defaults to hash)
+            if (argc != 5) return RedisModule_ReplyWithError(ctx, "ERR ADD INDEX requires column name");
+            RedisModuleString *col = argv[4];
+            int kind = INDEX_HASH;
+            size_t clen; const char *cs = RedisModule_StringPtrLen(argv[4], &clen);
+            if (memchr(cs, ',', clen)) return composite_alter_add(ctx, argv[1], sch, argv[4]);
+            const char *colon = memchr(cs, ':', clen);
+            if (colon) {
+                col = RedisModule_CreateString(ctx, cs, (size_t)(colon - cs));
+                kind = parse_index_type(colon + 1, clen - (size_t)(colon - cs) - 1);
+                if (kind == INDEX_PRIMARY)
+                    return RedisModule_ReplyWithError(ctx, "ERR the primary key is declared by TABLE.SCHEMA.CREATE");
+                if (kind != INDEX_HASH && kind != INDEX_BTREE && kind != INDEX_UNIQUE)
+                    return RedisModule_ReplyWithError(ctx, "ERR index must be 'hash', 'btree' or 'unique'");
+                if (kind == INDEX_UNIQUE && engine == ENGINE_NATIVE)
+                    return RedisModule_ReplyWithError(ctx, "ERR unique indexes need ENGINE hash");
+                if (kind == INDEX_UNIQUE && sch->shards) return RedisModule_ReplyWithError(ctx, SHARD_UNIQUE_ERROR);
+            }
+            
+            // Verify column exists in table schema
+            RedisModuleString *typeStr = NULL;
+            if (RedisModule_HashGet(schemaKey, REDISMODULE_HASH_NONE, col, &typeStr, NULL) != REDISMODULE_OK || !typeStr)
+                return RedisModule_ReplyWithError(ctx, "ERR column does not exist");
+            ColumnSchema *colSchema = schema_column(sch, col);
+            int current = colSchema ? column_write_index(colSchema) : INDEX_NONE;
+            if (current != INDEX_NONE && current != kind)
+                return RedisModule_ReplyWithError(ctx, "ERR column has a different index type, DROP INDEX first");
+            
+            // Native tables index their own column storage, in memory
+            if (engine == ENGINE_NATIVE) {
+                RedisModule_Call(ctx, "SADD", "ss", metaKey, col);
+                if (kind == INDEX_BTREE) RedisModule_Call(ctx, "SADD", "ss", btreeSet, col);
+                schema_invalidate(ctx, argv[1]);
+                NativeTable *nt = native_open(ctx, argv[1], REDISMODULE_WRITE);
+                ColumnSchema *cs = schema_column(schema_get(ctx, argv[1]), col);
+                if (nt && cs) native_column(nt, cs, 0);
+                RedisModule_ReplicateVerbatim(ctx);
+                return RedisModule_ReplyWithSimpleString(ctx, "OK");
+            }
+            
+            // The keys of a dropped index still being deleted go first
+            if (index_job_state(ctx, argv[1], col) == INDEX_NONE && index_job_finish(ctx, argv[1], col) != 0)
+                return RedisModule_ReplyWithError(ctx, "ERR the index of this column is being dropped, see TABLE.INDEX.STATUS");
+            
+            // Larger tables are indexed by a job, the index is used once complete
+            RedisModuleString *rowsSet = fmt(ctx, "{%s}:rows", argv[1]);
+            RedisModuleCallReply *card = RedisModule_Call(ctx, "SCARD", "s", rowsSet);
+            if (card && RedisModule_CallReplyType(card) == REDISMODULE_REPLY_INTEGER &&
+                RedisModule_CallReplyInteger(card) > INDEX_JOB_ROWS) {
+                RedisModule_Call(ctx, "HSET", "ssc", fmt(ctx, "{%s}:idx:jobs", argv[1]), col, index_type_name(kind));
+                schema_invalidate(ctx, argv[1]);
+                if (jobs_run_here(ctx)) index_job_start(ctx, argv[1], col, kind);
+                RedisModule_ReplicateVerbatim(ctx);
+                return RedisModule_ReplyWithSimpleString(ctx, "OK");
+            }
+            
+            // A unique index is built first, it is only recorded if no value is held twice
+            if (kind == INDEX_UNIQUE && current == INDEX_NONE) {
+                IdSet ids = idset_from_reply(ctx, RedisModule_Call(ctx, "SMEMBERS", "s", rowsSet), 0);
+                if (index_rows(ctx, argv[1], col, kind, ids) > 0) {
+                    RedisModule_Call(ctx, "DEL", "s", fmt2(ctx, "{%s}:unique:%s", argv[1], col));
+                    return RedisModule_ReplyWithError(ctx, "ERR column holds duplicate values");
+                }
+                RedisModule_Call(ctx, "SADD", "ss", metaKey, col);
+                RedisModule_Call(ctx, "HSET", "ssc", fmt(ctx, "{%s}:idx:unique", argv[1]), col, "unique");
+                schema_invalidate(ctx, argv[1]);
+                RedisModule_ReplicateVerbatim(ctx);
+                return RedisModule_ReplyWithSimpleString(ctx, "OK");
+            }
+            
+            // Add to index metadata
+            RedisModule_Call(ctx, "SADD", "ss", metaKey, col);
+            if (kind == INDEX_BTREE) RedisModule_Call(ctx, "SADD", "ss", btreeSet, col);
+            schema_invalidate(ctx, argv[1]);
+            
+            // Build index for all existing rows
+            RedisModuleCallReply *rows = RedisModule_Call(ctx, "SMEMBERS", "s", rowsSet);
+            if (rows && RedisModule_CallReplyType(rows) == REDISMODULE_REPLY_ARRAY) {
+                size_t n = RedisModule_CallReplyLength(rows);
+                for (size_t i = 0; i < n; i++) {
+                    RedisModuleCallReply *e = RedisModule_CallReplyArrayElement(rows, i);
+                    RedisModuleString *rowId = RedisModule_CreateStringFromCallReply(e);
+                    RedisModuleString *rowKey = fmt2(ctx, "{%s}:%s", argv[1], rowId);
+                    
+                    // Get column value from row
+                    RedisModuleCallReply *valReply = RedisModule_Call(ctx, "HGET", "ss", rowKey, col);
+                    if (valReply && RedisModule_CallReplyType(valReply) == REDISMODULE_REPLY_STRING) {
+                        RedisModuleString *val = RedisModule_CreateStringFromCallReply(valReply);
+                        index_add(ctx, NULL, argv[1], col, kind, val, rowId);
+                    }
+                }
+            }
+            RedisModule_ReplicateVerbatim(ctx);
+            return RedisModule_ReplyWithSimpleString(ctx, "OK");
+        }
+    } else if (oplen == 4 && strncasecmp(op, "DROP", 4) == 0) {
+        if (targetlen == 5 && strncasecmp(target, "INDEX", 5) == 0) {
+            // DROP INDEX col - remove index metadata and unlink the index key
+            if (argc != 5) return RedisModule_ReplyWithError(ctx, "ERR DROP INDEX requires column name");
+            RedisModuleString *col = argv[4];
+            size_t clen; const char *cs = RedisModule_StringPtrLen(argv[4], &clen);
+            if (memchr(cs, ',', clen)) return composite_alter_drop(ctx, argv[1], sch, argv[4]);
+            ColumnSchema *colSchema = schema_column(sch, col);
+            int kind = colSchema ? column_write_index(colSchema) : INDEX_NONE;
+            int building = colSchema && colSchema->building != INDEX_NONE;
+            
+            // Queries stop using the index at once
+            RedisModule_Call(ctx, "SREM", "ss", metaKey, col);
+            schema_invalidate(ctx, argv[1]);
+            
+            if (engine == ENGINE_NATIVE) {
+                RedisModule_Call(ctx, "SREM", "ss", btreeSet, col);
+                NativeTable *nt = native_open(ctx, argv[1], REDISMODULE_WRITE);
+                size_t clen; const char *c = RedisModule_StringPtrLen(col, &clen);
+                NativeColumn *ncol = nt ? native_find_column(nt, c, clen) : NULL;
+                if (ncol) native_drop_index(ncol);
+                RedisModule_ReplicateVerbatim(ctx);
+                return RedisModule_ReplyWithSimpleString(ctx, "OK");
+            }
+            
+            // An index being built is abandoned with its job
+            RedisModuleString *jobsKey = fmt(ctx, "{%s}:idx:jobs", argv[1]);
+            if (building) RedisModule_Call(ctx, "HDEL", "ss", jobsKey, col);
+            
+            // Every index of a column is a single key, freed off the main thread by UNLINK
+            if (kind == INDEX_BTREE) RedisModule_Call(ctx, "SREM", "ss", btreeSet, col);
+            if (kind == INDEX_UNIQUE) RedisModule_Call(ctx, "HDEL", "ss", fmt(ctx, "{%s}:idx:unique", argv[1]), col);
+            const char *keyFmt = kind == INDEX_BTREE ? "{%s}:btree:%s" : (kind == INDEX_UNIQUE ? "{%s}:unique:%s" : "{%s}:hash:%s");
+            RedisModule_Call(ctx, "UNLINK", "s", fmt2(ctx, keyFmt, argv[1], col));
+            RedisModule_ReplicateVerbatim(ctx);
+            return RedisModule_ReplyWithSimpleString(ctx, "OK");
+        }
+    }
+    
+    return RedisModule_ReplyWithError(ctx, "ERR syntax: ADD COLUMN col:type[:index] | ADD INDEX col[:index] | "
+                                           "ADD INDEX c1,c2,...[:index] | DROP INDEX col | DROP INDEX c1,c2,...");
+}
+
+// TABLE.INSERT into a native table
+static int native_insert(RedisModuleCtx *ctx, RedisModuleString *table, Assignments *a) {
+    NativeTable *nt = native_open(ctx, table, REDISMODULE_WRITE);
+    if (!nt) return RedisModule_ReplyWithError(ctx, "ERR table data does not exist");
+    uint64_t id = nt->last_id + 1;
+    size_t slot = native_insert_slot(nt, id);
+    for (int i = 0; i < a->n; i++) {
+        size_t vlen; const char *v = RedisModule_StringPtrLen(a->vals[i], &vlen);
+        native_set_text(nt, slot, native_column(nt, a->cols[i], 1), v, vlen);
+    }
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithString(ctx, RedisModule_CreateStringFromULongLong(ctx, id));
+}
+
+// Shard of a new row of a sharded table: by the hash of its primary key, else by the next
+// row ID of the sharded table; -1 if no row ID can be handed out
+static int shard_of_row(RedisModuleCtx *ctx, RedisModuleString *table, TableSchema *sch, Assignments *a) {
+    for (int i = 0; i < a->n; i++)
+        if (a->cols[i] == sch->primary) return shard_of_key(a->vals[i], sch->shards);
+    RedisModuleCallReply *id = RedisModule_Call(ctx, "INCR", "!s", fmt(ctx, "{%s}:id", table));
+    if (!id || RedisModule_CallReplyType(id) != REDISMODULE_REPLY_INTEGER) return -1;
+    return (int)((RedisModule_CallReplyInteger(id) - 1) % sch->shards);
+}
+
+// INSERT into a sharded table: the row is inserted into its shard, which replies with its
+// row ID there
+static int shard_insert(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, TableSchema *sch, Assignments *a) {
+    int k = shard_of_row(ctx, argv[1], sch, a);
+    if (k < 0) return RedisModule_ReplyWithError(ctx, "ERR cannot allocate row IDs");
+    RedisModuleString **sv = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleString*) * (size_t)argc);
+    memcpy(sv, argv, sizeof(RedisModuleString*) * (size_t)argc);
+    sv[1] = shard_table(ctx, argv[1], k);
+    ShardRequest *r = shard_request_new(argv, argc, shard_merge_one);
+    shard_request_add(r, sv, argc);
+    return shard_request_run(ctx, r);
+}
+
+/* ================== TABLE.INSERT <namespace.table> <col>=<value> ... [TTL <seconds>] ================== */
+// Every field is validated before the row ID is taken, then the row, its index entries
+// and its rows set membership are written in one pass.
+// A row with a TTL gets a shadow key {ns.t}:ttl:<id> expiring with it: the row itself
+// keeps no expiry, so that its values are still there to remove it from the indexes once
+// the shadow key expires (see "Row TTL"). The shadow key is written by the master and
+// replicated with its absolute expiry.
+static int insert_run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    TableSchema *sch = schema_get(ctx, argv[1]);
+    if (!sch)
+        return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
+    long long ttl = 0;
+    int fullArgc = argc;
+    if (argc > 4 && is_word(argv[argc - 2], "TTL")) {
+        if (RedisModule_StringToLongLong(argv[argc - 1], &ttl) != REDISMODULE_OK || ttl < 1)
+            return RedisModule_ReplyWithError(ctx, "ERR TTL must be a positive number of seconds");
+        if (sch->engine == ENGINE_NATIVE) return RedisModule_ReplyWithError(ctx, "ERR row TTL needs ENGINE hash");
+        argc -= 2;
+    }
+    Assignments a;
+    const char *err = parse_assignments(ctx, sch, argv + 2, argc - 2, "ERR each field must be <col>=<value>", &a);
+    if (err) return RedisModule_ReplyWithError(ctx, err);
+    if (sch->shards && shard_parent(ctx, argv[1])) return shard_insert(ctx, argv, fullArgc, sch, &a);
+    if (sch->engine == ENGINE_NATIVE) return native_insert(ctx, argv[1], &a);
+    if ((err = unique_check(ctx, argv[1], sch, a.cols, a.vals, a.n, NULL)) != NULL)
+        return RedisModule_ReplyWithError(ctx, err);
+    partition_expire(ctx, argv[1], sch);
+
+    RedisModuleString *idKey = fmt(ctx, "{%s}:id", argv[1]);
+    RedisModuleCallReply *idReply = RedisModule_Call(ctx, "INCR", "s", idKey);
+    if (!idReply || RedisModule_CallReplyType(idReply) != REDISMODULE_REPLY_INTEGER)
+        return RedisModule_ReplyWithError(ctx, "ERR cannot allocate row IDs");
+    RedisModuleString *rowId = RedisModule_CreateStringFromLongLong(ctx, RedisModule_CallReplyInteger(idReply));
+
+    RedisModuleKey *row = RedisModule_OpenKey(ctx, fmt2(ctx, "{%s}:%s", argv[1], rowId), REDISMODULE_WRITE);
+    for (int i = 0; i < a.n; i++) {
+        RedisModule_HashSet(row, REDISMODULE_HASH_NONE, a.cols[i]->name, a.vals[i], NULL);
+        int kind = column_write_index(a.cols[i]);
+        if (kind != INDEX_NONE) index_add(ctx, NULL, argv[1], a.cols[i]->name, kind, a.vals[i], rowId);
+    }
+    if (sch->ncomposites) composite_index_row(ctx, NULL, argv[1], sch, row, rowId, 1, NULL, 0);
+    partition_row(ctx, NULL, argv[1], sch, row, rowId, 1, NULL, 0);
+    RedisModule_CloseKey(row);
+    RedisModule_Call(ctx, "SADD", "ss", fmt(ctx, "{%s}:rows", argv[1]), rowId);
+    if (ttl && jobs_run_here(ctx)) {
+        RedisModuleString *shadow = fmt2(ctx, "{%s}:ttl:%s", argv[1], rowId);
+        RedisModule_Call(ctx, "SET", "!sc", shadow, "1");
+        long long at = (long long)RedisModule_Milliseconds() + ttl * 1000;
+        RedisModule_Call(ctx, "PEXPIREAT", "!sl", shadow, at);
+        RedisModule_Call(ctx, "ZADD", "!sls", fmt(ctx, "{%s}:ttl", argv[1]), at, rowId);
+        if (!sch->ttl) RedisModule_Call(ctx, "HSET", "!scc", fmt(ctx, "{%s}:options", argv[1]), "ttl", "1");
+    }
+
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithString(ctx, rowId);
+}
+
+static int TableInsertCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc < 3) return RedisModule_WrongArity(ctx);
+    RedisModule_AutoMemory(ctx);
+    stats_begin();
+    int rc = insert_run(ctx, argv, argc);
+    stats_end(ctx, STATS_INSERT, argv[1]);
+    result_cache_forget_table(ctx, argv[1]);
+    return rc;
+}
+
+/* ================== TABLE.INSERTMANY <namespace.table> COLUMNS <col> ... VALUES <value> ... ================== */
+
+// Native tables: the rows go straight into the data key, IDs last_id+1 .. last_id+nrows
+static int native_insert_many(RedisModuleCtx *ctx, RedisModuleString *table, ColumnSchema **cols, int ncols,
+                              RedisModuleString **vals, long long nrows) {
+    NativeTable *nt = native_open(ctx, table, REDISMODULE_WRITE);
+    if (!nt) return RedisModule_ReplyWithError(ctx, "ERR table data does not exist");
+
+    // Create the storage of every column first: adding a column moves the others
+    for (int c = 0; c < ncols; c++) native_column(nt, cols[c], 1);
+    NativeColumn **ncol = RedisModule_Alloc(sizeof(NativeColumn*) * ncols);
+    for (int c = 0; c < ncols; c++) ncol[c] = native_column(nt, cols[c], 0);
+
+    uint64_t first = nt->last_id + 1;
+    for (long long r = 0; r < nrows; r++) {
+        size_t slot = native_insert_slot(nt, first + (uint64_t)r);
+        for (int c = 0; c < ncols; c++) {
+            size_t vlen; const char *v = RedisModule_StringPtrLen(vals[r * ncols + c], &vlen);
+            native_set_text(nt, slot, ncol[c], v, vlen);
+        }
+    }
+    RedisModule_Free(ncol);
+
+    RedisModule_ReplicateVerbatim(ctx);
+    RedisModule_ReplyWithArray(ctx, 2);
+    RedisModule_ReplyWithString(ctx, RedisModule_CreateStringFromULongLong(ctx, first));
+    return RedisModule_ReplyWithString(ctx, RedisModule_CreateStringFromULongLong(ctx, nt->last_id));
+}
+
+// Merged reply of INSERTMANY into a sharded table: the number of rows inserted, from the
+// first and last row ID replied by each shard
+static int shard_merge_rows(RedisModuleCtx *ctx, ShardRequest *r) {
+    ShardValue *err = shard_error(r);
+    if (err) return shard_reply_error(ctx, err);
+    long long rows = 0;
+    for (int i = 0; i < r->ncalls; i++) {
+        ShardValue *v = &r->calls[i].reply;
+        if (v->type != REPLY_ARRAY || v->n != 2 || v->elems[0].type != REPLY_BULK || v->elems[1].type != REPLY_BULK)
+            continue;
+        rows += (long long)(idset_parse_id(v->elems[1].s, v->elems[1].len) -
+                            idset_parse_id(v->elems[0].s, v->elems[0].len)) + 1;
+    }
+    return RedisModule_ReplyWithLongLong(ctx, rows);
+}
+
+// INSERTMANY into a sharded table: each shard inserts its rows as one INSERTMANY
+static int shard_insert_many(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, TableSchema *sch, ColumnSchema **cols,
+                             int ncols, RedisModuleString **vals, long long nrows) {
+    int pk = -1;
+    for (int c = 0; c < ncols; c++) if (cols[c] == sch->primary) pk = c;
+    long long first = 0;
+    if (pk == -1) {
+        RedisModuleCallReply *id = RedisModule_Call(ctx, "INCRBY", "!sl", fmt(ctx, "{%s}:id", argv[1]), nrows);
+        if (!id || RedisModule_CallReplyType(id) != REDISMODULE_REPLY_INTEGER)
+            return RedisModule_ReplyWithError(ctx, "ERR cannot allocate row IDs");
+        first = RedisModule_CallReplyInteger(id) - nrows + 1;
+    }
+    int *shardOf = RedisModule_PoolAlloc(ctx, sizeof(int) * (size_t)nrows);
+    long long counts[SHARD_MAX] = { 0 };
+    for (long long r = 0; r < nrows; r++) {
+        shardOf[r] = pk != -1 ? shard_of_key(vals[r * ncols + pk], sch->shards) : (int)((first + r - 1) % sch->shards);
+        counts[shardOf[r]]++;
+    }
+
+    ShardRequest *req = shard_request_new(argv, argc, shard_merge_rows);
+    RedisModuleString **sv = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleString*) * (size_t)(4 + ncols + nrows * ncols));
+    for (int k = 0; k < sch->shards; k++) {
+        if (!counts[k]) continue;
+        int n = 0;
+        sv[n++] = argv[0];
+        sv[n++] = shard_table(ctx, argv[1], k);
+        for (int c = 0; c < ncols + 2; c++) sv[n++] = argv[2 + c];   // COLUMNS <col> ... VALUES
+        for (long long r = 0; r < nrows; r++)
+            if (shardOf[r] == k) for (int c = 0; c < ncols; c++) sv[n++] = vals[r * ncols + c];
+        shard_request_add(req, sv, n);
+    }
+    return shard_request_run(ctx, req);
+}
+
+// Insert many rows at once: one ID range reservation, schema checked once for the batch,
+// every value validated before anything is written, each index opened once for the batch.
+// Replies with the first and last row ID assigned.
+static int insertmany_run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    TableSchema *sch = schema_get(ctx, argv[1]);
+    if (!sch)
+        return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
+
+    size_t kl; const char *kw = RedisModule_StringPtrLen(argv[2], &kl);
+    if (kl != 7 || strncasecmp(kw, "COLUMNS", 7) != 0)
+        return RedisModule_ReplyWithError(ctx, "ERR syntax: COLUMNS <col> [<col> ...] VALUES <value> [<value> ...]");
+    int valuesAt = 0;
+    for (int i = 3; i < argc; i++) {
+        kw = RedisModule_StringPtrLen(argv[i], &kl);
+        if (kl == 6 && strncasecmp(kw, "VALUES", 6) == 0) { valuesAt = i; break; }
+    }
+    int ncols = valuesAt - 3;
+    int nvals = argc - valuesAt - 1;
+    if (!valuesAt || ncols == 0 || nvals == 0)
+        return RedisModule_ReplyWithError(ctx, "ERR syntax: COLUMNS <col> [<col> ...] VALUES <value> [<value> ...]");
+    if (nvals % ncols != 0)
+        return RedisModule_ReplyWithError(ctx, "ERR number of values must be a multiple of the number of columns");
+    long long nrows = nvals / ncols;
+
+    // Columns are resolved and every value validated before anything is written
+    ColumnSchema **cols = RedisModule_PoolAlloc(ctx, sizeof(ColumnSchema*) * (size_t)ncols);
+    RedisModuleString **vals = argv + valuesAt + 1;
+    const char *err = NULL;
+    for (int c = 0; c < ncols && !err; c++) {
+        cols[c] = schema_column(sch, argv[3 + c]);
+        if (!cols[c]) err = "ERR invalid column or type";
+        for (int p = 0; p < c && !err; p++)
+            if (cols[p] == cols[c]) err = "ERR duplicate column";
+    }
+    for (int i = 0; i < nvals && !err; i++)
+        if (validate_value(cols[i % ncols]->type, vals[i]) != REDISMODULE_OK) err = "ERR invalid column or type";
+    if (err) return RedisModule_ReplyWithError(ctx, err);
+
+    if (sch->shards && shard_parent(ctx, argv[1]))
+        return shard_insert_many(ctx, argv, argc, sch, cols, ncols, vals, nrows);
+    if (sch->engine == ENGINE_NATIVE) {
+        native_insert_many(ctx, argv[1], cols, ncols, vals, nrows);
+        return REDISMODULE_OK;
+    }
+
+    // Unique values are neither held by a row already nor given twice in the batch
+    if (sch->primary) {
+        err = PRIMARY_MISSING_ERROR;
+        for (int c = 0; c < ncols; c++) if (cols[c] == sch->primary) err = NULL;
+    }
+    for (int c = 0; c < ncols && !err; c++) {
+        if (column_write_index(cols[c]) != INDEX_UNIQUE) continue;
+        RedisModuleString **batch = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleString*) * (size_t)nrows);
+        RedisModuleDict *seen = RedisModule_CreateDict(ctx);
+        for (long long r = 0; r < nrows && !err; r++) {
+            batch[r] = vals[r * ncols + c];
+            if (RedisModule_DictSet(seen, batch[r], NULL) != REDISMODULE_OK) err = UNIQUE_TAKEN_ERROR;
+        }
+        RedisModuleCallReply *held = err ? NULL : RedisModule_Call(ctx, "HMGET", "sv",
+            fmt2(ctx, "{%s}:unique:%s", argv[1], cols[c]->name), batch, (size_t)nrows);
+        size_t m = held && RedisModule_CallReplyType(held) == REDISMODULE_REPLY_ARRAY ? RedisModule_CallReplyLength(held) : 0;
+        for (size_t i = 0; i < m && !err; i++)
+            if (RedisModule_CallReplyType(RedisModule_CallReplyArrayElement(held, i)) == REDISMODULE_REPLY_STRING)
+                err = UNIQUE_TAKEN_ERROR;
+    }
+    if (err) return RedisModule_ReplyWithError(ctx, err);
+
+    partition_expire(ctx, argv[1], sch);
+    RedisModuleCallReply *idReply = RedisModule_Call(ctx, "INCRBY", "sl", fmt(ctx, "{%s}:id", argv[1]), nrows);
+    if (!idReply || RedisModule_CallReplyType(idReply) != REDISMODULE_REPLY_INTEGER)
+        return RedisModule_ReplyWithError(ctx, "ERR cannot allocate row IDs");
+    long long first = RedisModule_CallReplyInteger(idReply) - nrows + 1;
+    IndexBatch parts;
+    index_batch_init(&parts, argv[1]);
+
+    // btree and unique columns are written directly to their sorted set or hash, hash
+    // indexes to their posting lists; new row IDs are the highest, each one is appended
+    RedisModuleKey **idxKeys = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleKey*) * (size_t)ncols);
+    HashIndex **hashIdx = RedisModule_PoolAlloc(ctx, sizeof(HashIndex*) * (size_t)(ncols + sch->ncomposites));
+    for (int c = 0; c < ncols; c++) {
+        int kind = column_write_index(cols[c]);
+        idxKeys[c] = kind == INDEX_BTREE || kind == INDEX_UNIQUE
+            ? RedisModule_OpenKey(ctx, fmt2(ctx, kind == INDEX_BTREE ? "{%s}:btree:%s" : "{%s}:unique:%s", argv[1],
+                                            cols[c]->name), REDISMODULE_WRITE)
+            : NULL;
+        hashIdx[c] = kind == INDEX_HASH ? hash_index_open(ctx, argv[1], cols[c]->name, 1) : NULL;
+    }
+    RedisModuleString **rowIds = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleString*) * (size_t)nrows);
+    // Composite indexes whose columns are all inserted, by position of each column in cols
+    int *compositePos = RedisModule_PoolAlloc(ctx, sizeof(int) * (size_t)(sch->ncomposites * COMPOSITE_MAX_COLUMNS + 1));
+    for (int k = 0; k < sch->ncomposites; k++) {
+        int *pos = compositePos + k * COMPOSITE_MAX_COLUMNS;
+        for (int i = 0; i < sch->composites[k].ncols; i++) {
+            pos[i] = -1;
+            for (int c = 0; c < ncols; c++) if (cols[c] == sch->composites[k].cols[i]) pos[i] = c;
+            if (pos[i] == -1) { pos[0] = -1; break; }
+        }
+        hashIdx[ncols + k] = pos[0] != -1 && sch->composites[k].kind == INDEX_HASH
+            ? hash_index_open(ctx, argv[1], sch->composites[k].name, 1) : NULL;
+    }
+
+    for (long long r = 0; r < nrows; r++) {
+        RedisModuleString *rowId = RedisModule_CreateStringFromLongLong(ctx, first + r);
+        rowIds[r] = rowId;
+        RedisModuleKey *row = RedisModule_OpenKey(ctx, fmt2(ctx, "{%s}:%s", argv[1], rowId), REDISMODULE_WRITE);
+        for (int c = 0; c < ncols; c++) {
+            RedisModuleString *val = vals[r * ncols + c];
+            RedisModule_HashSet(row, REDISMODULE_HASH_NONE, cols[c]->name, val, NULL);
+            if (hashIdx[c]) {
+                size_t vlen; const char *v = RedisModule_StringPtrLen(val, &vlen);
+                hashIdx[c]->nids += (size_t)posting_add(hashIdx[c]->postings, v, vlen, (uint64_t)(first + r));
+            } else if (column_write_index(cols[c]) == INDEX_BTREE) {
+                if (cols[c]->type == COLTYPE_STRING) {
+                    RedisModule_ZsetAdd(idxKeys[c], 0, btree_string_member(ctx, val, rowId), NULL);
+                } else {
+                    char score[64];
+                    size_t vlen; const char *v = RedisModule_StringPtrLen(val, &vlen);
+                    if (btree_score(cols[c]->type, v, vlen, score, sizeof(score)) == 0)
+                        RedisModule_ZsetAdd(idxKeys[c], strtod(score, NULL), rowId, NULL);
+                }
+            } else if (column_write_index(cols[c]) == INDEX_UNIQUE) {
+                RedisModule_HashSet(idxKeys[c], REDISMODULE_HASH_NONE, val, rowId, NULL);
+            }
+            if (cols[c] == sch->partition) partition_add(ctx, &parts, argv[1], val, rowId);
+        }
+        RedisModule_CloseKey(row);
+        for (int c = 0; c < sch->ncomposites; c++) {
+            CompositeIndex *ci = &sch->composites[c];
+            int *pos = compositePos + c * COMPOSITE_MAX_COLUMNS;
+            if (pos[0] == -1) continue;
+            RedisModuleString *tuple[COMPOSITE_MAX_COLUMNS];
+            for (int i = 0; i < ci->ncols; i++) tuple[i] = vals[r * ncols + pos[i]];
+            HashIndex *hi = hashIdx[ncols + c];
+            if (!hi) {
+                composite_entry(ctx, NULL, argv[1], ci, tuple, rowId, 1);
+                continue;
+            }
+            size_t tlen; const char *t = RedisModule_StringPtrLen(composite_tuple(ctx, ci, tuple), &tlen);
+            hi->nids += (size_t)posting_add(hi->postings, t, tlen, (uint64_t)(first + r));
+        }
+    }
+    index_batch_free(ctx, &parts);
+    RedisModule_Call(ctx, "SADD", "sv", fmt(ctx, "{%s}:rows", argv[1]), rowIds, (size_t)nrows);
+
+    RedisModule_ReplicateVerbatim(ctx);
+    RedisModule_ReplyWithArray(ctx, 2);
+    RedisModule_ReplyWithString(ctx, rowIds[0]);
+    RedisModule_ReplyWithString(ctx, rowIds[nrows - 1]);
+    return REDISMODULE_OK;
+}
+
+static int TableInsertManyCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc < 6) return RedisModule_WrongArity(ctx);
+    RedisModule_AutoMemory(ctx);
+    stats_begin();
+    int rc = insertmany_run(ctx, argv, argc);
+    stats_end(ctx, STATS_INSERT, argv[1]);
+    result_cache_forget_table(ctx, argv[1]);
+    return rc;
+}
+
+// IDs of all rows of a table
+static IdSet idset_all_rows(RedisModuleCtx *ctx, RedisModuleString *table) {
+    TableSchema *sch = schema_get(ctx, table);
+    if (sch && sch->engine == ENGINE_NATIVE) {
+        NativeTable *nt = native_open(ctx, table, REDISMODULE_READ);
+        if (!nt) return idset_alloc(ctx, 0);
+        IdSet s = idset_alloc(ctx, nt->nrows);
+        for (size_t i = 0; i < nt->len; i++)
+            if (nt->live[i]) s.ids[s.len++] = nt->ids[i];
+        return s;
+    }
+    return idset_from_reply(ctx, RedisModule_Call(ctx, "SMEMBERS", "s", fmt(ctx, "{%s}:rows", table)), 0);
+}
+
+// Index entry of col=val, the index of a native table column or a hash index of a hash table
+// (col may then name a composite index, val being its tuple). Returns NULL if no row matches
+static NativePosting *index_posting(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *col,
+                                    RedisModuleString *val) {
+    TableSchema *sch = schema_get(ctx, table);
+    if (!sch || sch->engine != ENGINE_NATIVE) return hash_index_posting(ctx, table, col, val);
+    NativeTable *nt = native_open(ctx, table, REDISMODULE_READ);
+    ColumnSchema *cs = schema_column(sch, col);
+    NativeColumn *ncol = (nt && cs) ? native_column(nt, cs, 0) : NULL;
+    if (!ncol || !ncol->index) return NULL;
+    unsigned char buf[8]; const unsigned char *key;
+    size_t vlen; const char *v = RedisModule_StringPtrLen(val, &vlen);
+    size_t klen = native_index_key_text(ncol->type, v, vlen, buf, &key);
+    return klen ? RedisModule_DictGetC(ncol->index, (void*)key, klen, NULL) : NULL;
+}
+
+// IDs of rows whose indexed column equals val
+static IdSet idset_index_eq(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *col,
+                            RedisModuleString *val) {
+    NativePosting *p = index_posting(ctx, table, col, val);
+    IdSet s = { p ? p->ids : NULL, p ? p->len : 0 };
+    return idset_copy(ctx, s);
+}
+
+// ID of the row whose unique column equals val, none if no row holds it
+static IdSet idset_unique_eq(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *col,
+                             RedisModuleString *val) {
+    IdSet s = idset_alloc(ctx, 1);
+    uint64_t id = unique_owner(ctx, table, col, val);
+    if (id) s.ids[s.len++] = id;
+    return s;
+}
+
+// Let other clients run between two chunks of a background query
+// Returns 0 if the table still exists once the lock is taken back
+static int query_yield(RedisModuleCtx *ctx, RedisModuleString *table) {
+    RedisModule_ThreadSafeContextUnlock(ctx);
+    RedisModule_ThreadSafeContextLock(ctx);
+    return schema_get(ctx, table) ? 0 : -1;
+}
+
+// Storage of a column in a native table, NULL for hash tables
+static NativeColumn *native_query_column(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *col,
+                                         NativeTable **nt) {
+    TableSchema *sch = schema_get(ctx, table);
+    *nt = (sch && sch->engine == ENGINE_NATIVE) ? native_open(ctx, table, REDISMODULE_READ) : NULL;
+    ColumnSchema *cs = *nt ? schema_column(sch, col) : NULL;
+    return cs ? native_column(*nt, cs, 0) : NULL;
+}
+
+// Keep only the rows of the set matching a comparison
+// In the background the lock is released between chunks of rows and the scan limit
+// does not apply. Returns 0 on success, -1 if scan limit exceeded, -2 if the table was dropped
+static int idset_filter_condition(RedisModuleCtx *ctx, IdSet *set, RedisModuleString *table,
+                                  RedisModuleString *col, const char *op, RedisModuleString *val, int background) {
+    // Check scan limit to prevent blocking Redis on large datasets
+    if (!background && set->len > (size_t)g_max_rows_scan_limit) return -1;
+    stats_table(table)->rowsScanned += (long long)set->len;
+
+    // Get column type
+    int type = get_column_type(ctx, table, col);
+
+    // Resolve the operator and parse the constant once for the whole scan
+    Predicate pred;
+    predicate_init(&pred, type, op, RedisModule_StringPtrLen(val, NULL));
+
+    // Native tables read the stored values directly
+    NativeTable *nt;
+    NativeColumn *ncol = native_query_column(ctx, table, col, &nt);
+    const char *tname = RedisModule_StringPtrLen(table, NULL);
+
+    // Background queries release the lock between chunks, others run in one chunk
+    size_t chunk = !background ? set->len : nt ? ASYNC_NATIVE_CHUNK_ROWS : ASYNC_CHUNK_ROWS;
+    uint64_t *keep = nt ? RedisModule_PoolAlloc(ctx, sizeof(uint64_t) * ((chunk < set->len ? chunk : set->len) / 64 + 1))
+                        : NULL;
+
+    // Matching IDs are compacted to the front, keeping their order
+    size_t kept = 0;
+    for (size_t start = 0; start < set->len; start += chunk) {
+        if (start) {
+            if (query_yield(ctx, table) != 0) return -2;
+            ncol = native_query_column(ctx, table, col, &nt);
+        }
+        size_t end = start + chunk < set->len ? start + chunk : set->len;
+        if (nt) {
+            if (!ncol || !keep) continue;  // no stored values, nothing matches
+            FilterJob job = { &pred, predicate_kernel(&pred, ncol->type), nt, ncol, set->ids + start, end - start, keep };
+            if (job.len >= PARALLEL_MIN_ROWS && g_worker_threads > 1) pool_run(native_filter_part, &job, g_worker_threads);
+            else native_filter_rows(&job, 0, job.len);
+            for (size_t i = 0; i < job.len; i++)
+                if ((keep[i >> 6] >> (i & 63)) & 1) set->ids[kept++] = job.ids[i];
+            continue;
+        }
+        for (size_t i = start; i < end; i++) {
+            int match = 0;
+            RedisModuleString *rowKey = RedisModule_CreateStringPrintf(ctx, "{%s}:%llu", tname,
+                                                                       (unsigned long long)set->ids[i]);
+            RedisModuleCallReply *v = RedisModule_Call(ctx, "HGET", "ss", rowKey, col);
+            if (v && RedisModule_CallReplyType(v) == REDISMODULE_REPLY_STRING) {
+                RedisModuleString *cur = RedisModule_CreateStringFromCallReply(v);
+                match = predicate_match_text(&pred, RedisModule_StringPtrLen(cur, NULL));
+            }
+            if (match) set->ids[kept++] = set->ids[i];
+        }
+    }
+    set->len = kept;
+    return 0; // Success
+}
+
+/* ================== WHERE planner ================== */
+
+// WHERE clauses are parsed into a tree of conditions joined by AND/OR, AND binding
+// tighter than OR. Every node gets a row estimate from the index sizes; AND nodes start
+// from their most selective index, then intersect with the other indexes that are smaller
+// than the rows left, and only then check the remaining conditions row by row.
+// Hash index equalities under the same AND (OR) are combined into one set intersection
+// (union) done on their posting lists. Conditions of an AND matching a composite
+// index are served by one read of its entry. An equality on a unique column reads one
+// field and is left out of composite indexes. A range on the partition column of a table
+// reads the partitions of the days it covers only.
+// SELECT, UPDATE, DELETE and EXPLAIN all go through where_plan()/where_collect().
+// where_parse() splits the conditions once, prepared statements keep its result.
+
+#define PLAN_SCAN  0   // condition checked row by row
+#define PLAN_HASH  1   // equality served by the hash index
+#define PLAN_RANGE 2   // range of one or more merged conditions served by the btree index
+#define PLAN_UNIQUE 3  // equality served by the unique index, one row at most
+#define PLAN_AND   4
+#define PLAN_OR    5
+#define PLAN_INTER 6   // intersection of hash index equalities (kids are PLAN_HASH)
+#define PLAN_UNION 7   // union of hash index equalities (kids are PLAN_HASH)
+#define PLAN_COMPOSITE 8   // conditions (kids) served by one composite index entry
+#define PLAN_PARTITION 9   // range of one or more merged conditions on the partition column, served
+                           // by the partitions of the days it covers
+
+typedef struct PlanNode {
+    int kind;                   // PLAN_*
+    RedisModuleString *col;     // leaf condition
+    char op[3];
+    RedisModuleString *val;
+    int type;                   // COLTYPE_* of col
+    BtreeRange range;           // PLAN_RANGE, PLAN_PARTITION, PLAN_COMPOSITE of a btree composite
+    long long est;              // estimated matching rows
+    struct PlanNode **kids;     // PLAN_AND / PLAN_OR, the conditions of a PLAN_COMPOSITE
+    int nkids;
+    RedisModuleString *key;     // PLAN_COMPOSITE of a btree composite: the ZSET read (col is the index name,
+                                // val the tuple of a hash composite)
+    int index;                  // PLAN_COMPOSITE: INDEX_HASH or INDEX_BTREE
+} PlanNode;
+
+typedef struct {
+    RedisModuleString *table;
+    TableSchema *sch;
+    long long rows;             // rows in the table
+    int nconds;                 // leaf conditions, bounds the children of a node
+    PlanNode *root;
+    int background;             // executed by a background thread, see query_thread()
+} QueryPlan;
+
+// One condition of a WHERE clause
+typedef struct {
+    RedisModuleString *col;
+    char op[3];
+    RedisModuleString *val;
+    int joiner;                 // with the previous condition: 1 = AND, 2 = OR, 0 for the first
+    int arg;                    // position of the condition in the command arguments
+} WhereCond;
+
+typedef struct {
+    WhereCond *conds;
+    int n;
+} WhereClause;
+
+#define SCAN_LIMIT_ERROR "ERR query scan limit exceeded (max 100000 rows). Use indexed columns or add more specific conditions."
+#define TABLE_DROPPED_ERROR "ERR table dropped while the query was running"
+
+static long long table_row_count(RedisModuleCtx *ctx, RedisModuleString *table, TableSchema *sch) {
+    if (sch->engine == ENGINE_NATIVE) {
+        NativeTable *nt = native_open(ctx, table, REDISMODULE_READ);
+        return nt ? (long long)nt->nrows : 0;
+    }
+    RedisModuleCallReply *r = RedisModule_Call(ctx, "SCARD", "s", fmt(ctx, "{%s}:rows", table));
+    return (r && RedisModule_CallReplyType(r) == REDISMODULE_REPLY_INTEGER) ? RedisModule_CallReplyInteger(r) : 0;
+}
+
+// Number of rows in the hash index entry of col=val
+static long long hash_index_count(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *col,
+                                  RedisModuleString *val) {
+    NativePosting *p = index_posting(ctx, table, col, val);
+    return p ? (long long)p->len : 0;
+}
+
+static PlanNode *plan_node(RedisModuleCtx *ctx, QueryPlan *plan, int kind) {
+    PlanNode *n = RedisModule_PoolAlloc(ctx, sizeof(PlanNode));
+    memset(n, 0, sizeof(*n));
+    n->kind = kind;
+    if (kind >= PLAN_AND)
+        n->kids = RedisModule_PoolAlloc(ctx, sizeof(PlanNode*) * plan->nconds);
+    return n;
+}
+
+// Split the conditions argv[start..end) of a WHERE clause
+// Returns NULL or an error message
+static const char *where_parse(RedisModuleCtx *ctx, RedisModuleString **argv, int start, int end, WhereClause *w) {
+    w->conds = RedisModule_PoolAlloc(ctx, sizeof(WhereCond) * (size_t)((end - start + 1) / 2 + 1));
+    w->n = 0;
+    for (int i = start; i < end; i++) {
+        WhereCond *c = &w->conds[w->n];
+        c->joiner = 0;
+        if (w->n > 0) {
+            if (!(c->joiner = where_joiner(argv[i]))) return "ERR expected AND/OR between conditions";
+            if (++i >= end) return "ERR dangling operator";
+        }
+        if (split_condition(ctx, argv[i], &c->col, c->op, &c->val) != REDISMODULE_OK)
+            return "ERR condition must be <col><op><value>";
+        c->arg = i;
+        w->n++;
+    }
+    return NULL;
+}
+
+// Classify one condition by the index of its column
+static PlanNode *plan_leaf(RedisModuleCtx *ctx, QueryPlan *plan, const WhereCond *c) {
+    PlanNode *n = plan_node(ctx, plan, PLAN_SCAN);
+    n->col = c->col;
+    memcpy(n->op, c->op, sizeof(n->op));
+    n->val = c->val;
+    ColumnSchema *cs = schema_column(plan->sch, n->col);
+    int kind = cs ? cs->index : INDEX_NONE;
+    n->type = cs ? cs->type : COLTYPE_STRING;
+    if (kind == INDEX_BTREE && btree_range_apply(n->type, &n->range, n->op, n->val) == 0) {
+        n->kind = PLAN_RANGE;
+    } else if (kind == INDEX_HASH && strcmp(n->op, "=") == 0) {
+        n->kind = PLAN_HASH;
+    } else if (kind == INDEX_UNIQUE && strcmp(n->op, "=") == 0) {
+        n->kind = PLAN_UNIQUE;
+    } else if (kind == INDEX_NONE && cs && cs == plan->sch->partition &&
+               btree_range_apply(COLTYPE_DATE, &n->range, n->op, n->val) == 0) {
+        n->kind = PLAN_PARTITION;
+    }
+    return n;
+}
+
+// Join two expressions with AND/OR, flattening into an existing node of that kind
+static PlanNode *plan_join(RedisModuleCtx *ctx, QueryPlan *plan, PlanNode *left, int kind, PlanNode *right) {
+    if (left->kind != kind) {
+        PlanNode *n = plan_node(ctx, plan, kind);
+        n->kids[n->nkids++] = left;
+        left = n;
+    }
+    left->kids[left->nkids++] = right;
+    return left;
+}
+
+// Whether a leaf condition may be served by a composite index: not by a unique index
+static inline int plan_is_range_leaf(PlanNode *n) {
+    return n->kind <= PLAN_RANGE || n->kind == PLAN_PARTITION;
+}
+
+// Mark in take the conditions among kids a composite index serves: an equality on each of
+// its columns (hash), or on each but the last and at least one range on the last (btree)
+// Returns their number, 0 if the index cannot serve the conditions
+static int plan_composite_match(CompositeIndex *ci, PlanNode **kids, int n, char *take) {
+    memset(take, 0, (size_t)n);
+    int taken = 0;
+    int eqs = ci->kind == INDEX_BTREE ? ci->ncols - 1 : ci->ncols;
+    for (int c = 0; c < eqs; c++) {
+        int found = -1;
+        for (int i = 0; i < n && found < 0; i++)
+            if (plan_is_range_leaf(kids[i]) && strcmp(kids[i]->op, "=") == 0 &&
+                RedisModule_StringCompare(kids[i]->col, ci->cols[c]->name) == 0) found = i;
+        if (found < 0) return 0;
+        take[found] = 1;
+        taken++;
+    }
+    if (ci->kind == INDEX_HASH) return taken;
+    ColumnSchema *last = ci->cols[ci->ncols - 1];
+    BtreeRange r = { NULL, NULL, 0, 0 };
+    int ranges = 0;
+    for (int i = 0; i < n; i++) {
+        if (!plan_is_range_leaf(kids[i]) || RedisModule_StringCompare(kids[i]->col, last->name) != 0) continue;
+        if (btree_range_apply(last->type, &r, kids[i]->op, kids[i]->val) != 0) continue;
+        take[i] = 1;
+        ranges++;
+    }
+    return ranges ? taken + ranges : 0;
+}
+
+// Serve the conditions of an AND by the composite indexes, the one covering the most
+// conditions first; returns the term, or the node replacing it
+static PlanNode *plan_composite(RedisModuleCtx *ctx, QueryPlan *plan, PlanNode *term) {
+    TableSchema *sch = plan->sch;
+    if (term->kind != PLAN_AND || !sch || !sch->ncomposites) return term;
+    char *take = RedisModule_PoolAlloc(ctx, (size_t)term->nkids);
+    char *best = RedisModule_PoolAlloc(ctx, (size_t)term->nkids);
+    for (;;) {
+        CompositeIndex *ci = NULL;
+        int cover = 1;
+        for (int k = 0; k < sch->ncomposites; k++) {
+            if (sch->composites[k].building) continue;
+            int t = plan_composite_match(&sch->composites[k], term->kids, term->nkids, take);
+            if (t > cover) {
+                cover = t;
+                ci = &sch->composites[k];
+                memcpy(best, take, (size_t)term->nkids);
+            }
+        }
+        if (!ci) break;
+
+        // The node keeps what it needs: the schema may be reloaded during a background query
+        PlanNode *n = plan_node(ctx, plan, PLAN_COMPOSITE);
+        n->col = RedisModule_CreateStringFromString(ctx, ci->name);
+        strcpy(n->op, "=");
+        n->index = ci->kind;
+        n->type = ci->cols[ci->ncols - 1]->type;
+        int out = 0;
+        for (int i = 0; i < term->nkids; i++) {
+            if (best[i]) n->kids[n->nkids++] = term->kids[i];
+            else term->kids[out++] = term->kids[i];
+        }
+        RedisModuleString *vals[COMPOSITE_MAX_COLUMNS];
+        for (int c = 0; c < ci->ncols; c++) {
+            vals[c] = NULL;
+            for (int i = 0; i < n->nkids; i++) {
+                PlanNode *k = n->kids[i];
+                if (RedisModule_StringCompare(k->col, ci->cols[c]->name) != 0) continue;
+                if (ci->kind == INDEX_BTREE && c == ci->ncols - 1) btree_range_apply(n->type, &n->range, k->op, k->val);
+                else if (!vals[c]) vals[c] = k->val;
+            }
+        }
+        if (ci->kind == INDEX_BTREE) n->key = composite_key(ctx, plan->table, ci, vals);
+        else n->val = composite_tuple(ctx, ci, vals);
+        term->kids[out++] = n;
+        term->nkids = out;
+    }
+    return term->nkids == 1 ? term->kids[0] : term;
+}
+
+// Finish an AND term: composite indexes, then for SELECT (strict) an equality left on a
+// column without index is an error
+static const char *plan_term(RedisModuleCtx *ctx, QueryPlan *plan, PlanNode **term, int strict) {
+    *term = plan_composite(ctx, plan, *term);
+    if (!strict) return NULL;
+    PlanNode **leaves = (*term)->kind == PLAN_AND ? (*term)->kids : term;
+    int n = (*term)->kind == PLAN_AND ? (*term)->nkids : 1;
+    for (int i = 0; i < n; i++) {
+        ColumnSchema *cs = schema_column(plan->sch, leaves[i]->col);
+        if (leaves[i]->kind == PLAN_SCAN && strcmp(leaves[i]->op, "=") == 0 && (!cs || cs->index == INDEX_NONE))
+            return "ERR search cannot be done on non-indexed column";
+    }
+    return NULL;
+}
+
+// Merge the ranges on the same btree (partition) column of an AND into one range read
+static void plan_merge_ranges(PlanNode *n) {
+    for (int i = 0; i < n->nkids; i++) {
+        PlanNode *a = n->kids[i];
+        if (a->kind != PLAN_RANGE && a->kind != PLAN_PARTITION) continue;
+        for (int j = i + 1; j < n->nkids; j++) {
+            PlanNode *b = n->kids[j];
+            if (b->kind != a->kind || RedisModule_StringCompare(a->col, b->col) != 0) continue;
+            if (btree_range_apply(a->type, &a->range, b->op, b->val) != 0) continue;
+            memmove(n->kids + j, n->kids + j + 1, sizeof(PlanNode*) * (n->nkids - j - 1));
+            n->nkids--;
+            j--;
+        }
+    }
+}
+
+// Move the hash index equalities of an AND (OR) node into one PLAN_INTER (PLAN_UNION) child
+static void plan_group_hash(RedisModuleCtx *ctx, QueryPlan *plan, PlanNode *n) {
+    int nhash = 0;
+    for (int i = 0; i < n->nkids; i++) if (n->kids[i]->kind == PLAN_HASH) nhash++;
+    if (nhash < 2) return;
+    PlanNode *g = plan_node(ctx, plan, n->kind == PLAN_AND ? PLAN_INTER : PLAN_UNION);
+    int out = 0;
+    for (int i = 0; i < n->nkids; i++) {
+        if (n->kids[i]->kind == PLAN_HASH) g->kids[g->nkids++] = n->kids[i];
+        else n->kids[out++] = n->kids[i];
+    }
+    n->kids[out++] = g;
+    n->nkids = out;
+}
+
+// Sort children by increasing estimate, row by row checks last
+static void plan_sort_kids(PlanNode *n) {
+    for (int i = 1; i < n->nkids; i++) {
+        PlanNode *k = n->kids[i];
+        int j = i;
+        while (j > 0) {
+            PlanNode *p = n->kids[j - 1];
+            int kscan = k->kind == PLAN_SCAN, pscan = p->kind == PLAN_SCAN;
+            if (pscan < kscan || (pscan == kscan && p->est <= k->est)) break;
+            n->kids[j] = p;
+            j--;
+        }
+        n->kids[j] = k;
+    }
+}
+
+// Estimate matching rows bottom up and order the children of AND and intersection nodes
+static void plan_estimate(RedisModuleCtx *ctx, QueryPlan *plan, PlanNode *n) {
+    if (n->kind == PLAN_SCAN) { n->est = plan->rows; return; }
+    if (n->kind == PLAN_HASH) { n->est = hash_index_count(ctx, plan->table, n->col, n->val); return; }
+    if (n->kind == PLAN_RANGE) { n->est = btree_range_count(ctx, plan->table, n->col, n->type, &n->range); return; }
+    if (n->kind == PLAN_PARTITION) { n->est = partition_range_count(ctx, plan->table, &n->range); return; }
+    if (n->kind == PLAN_UNIQUE) { n->est = unique_owner(ctx, plan->table, n->col, n->val) ? 1 : 0; return; }
+    if (n->kind == PLAN_COMPOSITE) {
+        if (n->index == INDEX_BTREE) {
+            n->est = btree_key_count(ctx, n->key, n->type, &n->range);
+        } else {
+            NativePosting *p = hash_index_posting(ctx, plan->table, n->col, n->val);
+            n->est = p ? (long long)p->len : 0;
+        }
+        return;
+    }
+
+    if (n->kind == PLAN_AND) plan_merge_ranges(n);
+    if (n->kind == PLAN_AND || n->kind == PLAN_OR) plan_group_hash(ctx, plan, n);
+    if (n->nkids == 1) {
+        *n = *n->kids[0];
+        plan_estimate(ctx, plan, n);
+        return;
+    }
+    int isAnd = n->kind == PLAN_AND || n->kind == PLAN_INTER;
+    long long est = isAnd ? plan->rows : 0;
+    for (int i = 0; i < n->nkids; i++) {
+        plan_estimate(ctx, plan, n->kids[i]);
+        if (isAnd) { if (n->kids[i]->est < est) est = n->kids[i]->est; }
+        else est += n->kids[i]->est;
+    }
+    n->est = est < plan->rows ? est : plan->rows;
+    if (isAnd) plan_sort_kids(n);
+}
+
+// Plan a parsed WHERE clause
+// Returns NULL or an error message
+static const char *where_plan_clause(RedisModuleCtx *ctx, RedisModuleString *table, const WhereClause *w,
+                                     int strict, QueryPlan *plan) {
+    plan->table = table;
+    plan->sch = schema_get(ctx, table);
+    plan->rows = table_row_count(ctx, table, plan->sch);
+    plan->nconds = w->n;
+    plan->root = NULL;
+    plan->background = 0;
+    if (w->n == 0) return NULL;     // WHERE without conditions matches nothing
+
+    // The expression is an OR of AND terms
+    PlanNode *term = plan_leaf(ctx, plan, &w->conds[0]), *expr = NULL;
+    const char *err;
+    for (int i = 1; i < w->n; i++) {
+        int joiner = w->conds[i].joiner;
+        PlanNode *leaf = plan_leaf(ctx, plan, &w->conds[i]);
+        if (joiner == 1) {
+            term = plan_join(ctx, plan, term, PLAN_AND, leaf);
+        } else {
+            if ((err = plan_term(ctx, plan, &term, strict)) != NULL) return err;
+            expr = expr ? plan_join(ctx, plan, expr, PLAN_OR, term) : term;
+            term = leaf;
+        }
+    }
+    if ((err = plan_term(ctx, plan, &term, strict)) != NULL) return err;
+    plan->root = expr ? plan_join(ctx, plan, expr, PLAN_OR, term) : term;
+    plan_estimate(ctx, plan, plan->root);
+    return NULL;
+}
+
+// Parse the conditions argv[start..end) into a plan
+// Returns NULL or an error message
+static const char *where_plan(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString **argv,
+                              int start, int end, int strict, QueryPlan *plan) {
+    WhereClause w;
+    const char *err = where_parse(ctx, argv, start, end, &w);
+    return err ? err : where_plan_clause(ctx, table, &w, strict, plan);
+}
+
+// An index served condition is checked row by row when the index holds more rows
+// than the candidates left
+static inline int plan_is_filter(PlanNode *n, int hasCand, long long candEst) {
+    return n->kind == PLAN_SCAN || (hasCand && n->est > candEst);
+}
+
+// Check a leaf condition row by row
+// Returns -1 if the scan limit is exceeded, -2 if the table was dropped by another client
+static int plan_filter(RedisModuleCtx *ctx, QueryPlan *plan, PlanNode *n, IdSet *ids) {
+    int rc = 0;
+    if (n->kind == PLAN_COMPOSITE) {
+        for (int i = 0; i < n->nkids && rc == 0; i++) rc = plan_filter(ctx, plan, n->kids[i], ids);
+        return rc;
+    }
+    if (n->kind != PLAN_RANGE && n->kind != PLAN_PARTITION) {
+        rc = idset_filter_condition(ctx, ids, plan->table, n->col, n->op, n->val, plan->background);
+    } else {
+        if (n->range.min)
+            rc = idset_filter_condition(ctx, ids, plan->table, n->col, n->range.minIncl ? ">=" : ">", n->range.min,
+                                        plan->background);
+        if (rc == 0 && n->range.max)
+            rc = idset_filter_condition(ctx, ids, plan->table, n->col, n->range.maxIncl ? "<=" : "<", n->range.max,
+                                        plan->background);
+    }
+    // The schema may have been reloaded while the lock was released
+    if (plan->background) plan->sch = schema_get(ctx, plan->table);
+    return rc;
+}
+
+// A btree range read of a hash table with a bound beyond ±2^53 (see btree_range_bounds()):
+// its rows are checked row by row, and its estimate is not a count
+static int plan_range_inexact(QueryPlan *plan, PlanNode *n) {
+    return (n->kind == PLAN_RANGE || (n->kind == PLAN_COMPOSITE && n->index == INDEX_BTREE)) &&
+           plan->sch && plan->sch->engine == ENGINE_HASH && btree_range_inexact(n->type, &n->range);
+}
+
+// Rows matching all (isAnd) or any of the hash index equalities in kids, computed on the
+// posting lists of the indexes, intersections starting from the smallest one
+static IdSet plan_hash_sets(RedisModuleCtx *ctx, QueryPlan *plan, PlanNode **kids, int n, int isAnd) {
+    // kids are sorted by estimate, the first list is the smallest
+    IdSet out = { NULL, 0 };
+    for (int i = 0; i < n; i++) {
+        NativePosting *p = index_posting(ctx, plan->table, kids[i]->col, kids[i]->val);
+        IdSet list = { p ? p->ids : NULL, p ? p->len : 0 };
+        if (i == 0) out = idset_copy(ctx, list);
+        else out = isAnd ? idset_intersect(ctx, out, list) : idset_union(ctx, out, list);
+        if (isAnd && out.len == 0) break;
+    }
+    return out;
+}
+
+// Rows of cand (NULL = the whole table, candEst rows) matching a node, stored in *out
+// Returns 0, or the error of plan_filter()
+static int plan_exec(RedisModuleCtx *ctx, QueryPlan *plan, PlanNode *n,
+                     const IdSet *cand, long long candEst, IdSet *out) {
+    int rc;
+    if (n->kind == PLAN_AND) {
+        IdSet cur = { NULL, 0 }, next;
+        for (int i = 0; i < n->nkids; i++) {
+            // The rows so far are the candidates of the next condition, not overwritten by it
+            if ((rc = plan_exec(ctx, plan, n->kids[i], i ? &cur : cand, candEst, &next)) != 0) return rc;
+            cur = next;
+            if (n->kids[i]->est < candEst) candEst = n->kids[i]->est;
+            if (cur.len == 0) break;
+        }
+        *out = cur;
+        return 0;
+    }
+    if (n->kind == PLAN_UNION || (n->kind == PLAN_INTER && !plan_is_filter(n, cand != NULL, candEst))) {
+        stats_table(plan->table)->indexReads += n->nkids;
+        *out = plan_hash_sets(ctx, plan, n->kids, n->nkids, n->kind == PLAN_INTER);
+        if (cand) *out = idset_intersect(ctx, *out, *cand);
+        return 0;
+    }
+    if (n->kind == PLAN_INTER) {
+        // Fewer candidates than the smallest posting list: check each equality row by row
+        *out = idset_copy(ctx, *cand);
+        for (int i = 0; i < n->nkids; i++)
+            if ((rc = plan_filter(ctx, plan, n->kids[i], out)) != 0) return rc;
+        return 0;
+    }
+    if (n->kind == PLAN_OR) {
+        *out = idset_alloc(ctx, 0);
+        for (int i = 0; i < n->nkids; i++) {
+            IdSet part;
+            if ((rc = plan_exec(ctx, plan, n->kids[i], cand, candEst, &part)) != 0) return rc;
+            *out = idset_union(ctx, *out, part);
+        }
+        return 0;
+    }
+    if (plan_is_filter(n, cand != NULL, candEst)) {
+        if (!cand) stats_table(plan->table)->fullScans++;
+        *out = cand ? idset_copy(ctx, *cand) : idset_all_rows(ctx, plan->table);
+        return plan_filter(ctx, plan, n, out);
+    }
+    stats_table(plan->table)->indexReads++;
+    if (n->kind == PLAN_HASH) *out = idset_index_eq(ctx, plan->table, n->col, n->val);
+    else if (n->kind == PLAN_UNIQUE) *out = idset_unique_eq(ctx, plan->table, n->col, n->val);
+    else if (n->kind == PLAN_COMPOSITE && n->index == INDEX_HASH)
+        *out = idset_index_eq(ctx, plan->table, n->col, n->val);
+    else if (n->kind == PLAN_COMPOSITE) *out = btree_key_range(ctx, n->key, n->type, &n->range);
+    else if (n->kind == PLAN_PARTITION) *out = idset_partition_range(ctx, plan->table, &n->range);
+    else *out = idset_btree_range(ctx, plan->table, n->col, n->type, &n->range);
+    if (cand) *out = idset_intersect(ctx, *out, *cand);
+    if (plan_range_inexact(plan, n)) return plan_filter(ctx, plan, n, out);
+    return 0;
+}
+
+// Collect the IDs of the rows matching a planned WHERE clause
+// Returns NULL or an error message
+static const char *where_exec(RedisModuleCtx *ctx, QueryPlan *plan, IdSet *ids) {
+    if (!plan->root) {
+        *ids = idset_alloc(ctx, 0);
+        return NULL;
+    }
+    int rc = plan_exec(ctx, plan, plan->root, NULL, plan->rows, ids);
+    if (rc == -1) stats_table(plan->table)->scanLimit++;
+    if (rc != 0) return rc == -2 ? TABLE_DROPPED_ERROR : SCAN_LIMIT_ERROR;
+
+    // Index entries of rows being purged stay until the purge reaches them
+    TableSchema *sch = schema_get(ctx, plan->table);
+    if (sch && sch->purged) {
+        size_t kept = 0;
+        for (size_t i = 0; i < ids->len; i++)
+            if (ids->ids[i] > sch->purged) ids->ids[kept++] = ids->ids[i];
+        ids->len = kept;
+    }
+    return NULL;
+}
+
+// Describe a condition for EXPLAIN
+static RedisModuleString *plan_describe(RedisModuleCtx *ctx, PlanNode *n) {
+    if (n->kind == PLAN_COMPOSITE) {
+        RedisModuleString *d = RedisModule_CreateStringPrintf(ctx, "(%s)", RedisModule_StringPtrLen(n->col, NULL));
+        for (int i = 0; i < n->nkids; i++) {
+            size_t l; const char *k = RedisModule_StringPtrLen(plan_describe(ctx, n->kids[i]), &l);
+            RedisModule_StringAppendBuffer(ctx, d, i ? " AND " : " ", i ? 5 : 1);
+            RedisModule_StringAppendBuffer(ctx, d, k, l);
+        }
+        return d;
+    }
+    if (n->kind != PLAN_RANGE && n->kind != PLAN_PARTITION)
+        return RedisModule_CreateStringPrintf(ctx, "%s%s%s", RedisModule_StringPtrLen(n->col, NULL), n->op,
+                                              RedisModule_StringPtrLen(n->val, NULL));
+    return RedisModule_CreateStringPrintf(ctx, "%s in %s%s, %s%s", RedisModule_StringPtrLen(n->col, NULL),
+                                          n->range.min && n->range.minIncl ? "[" : "(",
+                                          n->range.min ? RedisModule_StringPtrLen(n->range.min, NULL) : "-inf",
+                                          n->range.max ? RedisModule_StringPtrLen(n->range.max, NULL) : "+inf",
+                                          n->range.max && n->range.maxIncl ? "]" : ")");
+}
+
+// Reply with one line per plan step, following the decisions of plan_exec()
+// Returns the number of lines
+static long plan_explain(RedisModuleCtx *ctx, QueryPlan *plan, PlanNode *n, int depth, int hasCand, long long candEst) {
+    int ind = depth * 2;
+    if (n->kind == PLAN_INTER || n->kind == PLAN_UNION) {
+        int filter = n->kind == PLAN_INTER && plan_is_filter(n, hasCand, candEst);
+        const char *step = filter ? "FILTER" : n->kind == PLAN_UNION ? "hash index union" : "hash index intersection";
+        RedisModule_ReplyWithString(ctx, RedisModule_CreateStringPrintf(ctx, "%*s%s%s (est %lld)", ind, "",
+                                    hasCand && !filter ? "INTERSECT " : "", step, n->est));
+        for (int i = 0; i < n->nkids; i++)
+            RedisModule_ReplyWithString(ctx, RedisModule_CreateStringPrintf(ctx, "%*s%s (est %lld)", ind + 2, "",
+                                        RedisModule_StringPtrLen(plan_describe(ctx, n->kids[i]), NULL), n->kids[i]->est));
+        return 1 + n->nkids;
+    }
+    if (n->kind == PLAN_AND || n->kind == PLAN_OR) {
+        RedisModule_ReplyWithString(ctx, RedisModule_CreateStringPrintf(ctx, "%*s%s (est %lld)", ind, "",
+                                    n->kind == PLAN_AND ? "AND" : "OR", n->est));
+        long lines = 1;
+        for (int i = 0; i < n->nkids; i++) {
+            lines += plan_explain(ctx, plan, n->kids[i], depth + 1, hasCand, candEst);
+            if (n->kind == PLAN_AND) {
+                hasCand = 1;
+                if (n->kids[i]->est < candEst) candEst = n->kids[i]->est;
+            }
+        }
+        return lines;
+    }
+    const char *step;
+    if (plan_is_filter(n, hasCand, candEst)) step = hasCand ? "FILTER" : "SCAN";
+    else if (n->kind == PLAN_HASH) step = hasCand ? "INTERSECT hash index" : "hash index";
+    else if (n->kind == PLAN_UNIQUE) step = hasCand ? "INTERSECT unique index" : "unique index";
+    else if (n->kind == PLAN_COMPOSITE) step = hasCand ? "INTERSECT composite index" : "composite index";
+    else if (n->kind == PLAN_PARTITION) step = hasCand ? "INTERSECT partitions" : "partitions";
+    else step = hasCand ? "INTERSECT btree index" : "btree index";
+    RedisModule_ReplyWithString(ctx, RedisModule_CreateStringPrintf(ctx, "%*s%s %s (est %lld)", ind, "", step,
+                                RedisModule_StringPtrLen(plan_describe(ctx, n), NULL), n->est));
+    return 1;
+}
+
+/* ================== Background queries ================== */
+
+// A SELECT, UPDATE or DELETE whose plan checks more than async_scan_rows rows one by one
+// blocks its client and runs in a thread of its own. The thread works under the global
+// lock and releases it every ASYNC_CHUNK_ROWS rows, so other clients are served while the
+// scan proceeds; the reply is sent from the main thread once the thread is done.
+// Background queries are not subject to max_scan_limit.
+
+typedef struct BackgroundQuery {
+    RedisModuleBlockedClient *bc;
+    RedisModuleString **argv;       // command arguments, retained until the reply
+    int argc;
+    int start, end, strict;         // WHERE conditions argv[start..end), see where_plan()
+    WhereClause where;              // prepared conditions used instead (retained), conds NULL if none
+    int setPos;                     // UPDATE: position of SET
+    // Work done on the matching rows by the thread (UPDATE, DELETE): NULL or an error
+    const char *(*apply)(RedisModuleCtx *ctx, struct BackgroundQuery *q, IdSet ids);
+    // Reply built on the main thread (SELECT), NULL replies with count
+    int (*reply)(RedisModuleCtx *ctx, struct BackgroundQuery *q);
+    const char *err;
+    uint64_t *ids;                  // matching rows when there is no apply
+    size_t len;
+    long long count;                // rows changed by apply
+    int stat;                       // STATS_SELECT, STATS_UPDATE, STATS_DELETE or STATS_NONE
+    uint64_t started;               // start of the command, see stats_begin()
+    CachedQuery cache;              // SELECT, AGGREGATE: key retained, NULL if the reply is not cached
+} BackgroundQuery;
+
+// Rows a plan checks one by one, following the decisions of plan_exec()
+static long long plan_scan_rows(PlanNode *n, int hasCand, long long candEst) {
+    if (n->kind == PLAN_INTER || n->kind == PLAN_UNION)
+        return n->kind == PLAN_INTER && plan_is_filter(n, hasCand, candEst) ? candEst : 0;
+    if (n->kind == PLAN_AND || n->kind == PLAN_OR) {
+        long long rows = 0;
+        for (int i = 0; i < n->nkids; i++) {
+            rows += plan_scan_rows(n->kids[i], hasCand, candEst);
+            if (n->kind == PLAN_AND) {
+                hasCand = 1;
+                if (n->kids[i]->est < candEst) candEst = n->kids[i]->est;
+            }
+        }
+        return rows;
+    }
+    return plan_is_filter(n, hasCand, candEst) ? candEst : 0;
+}
+
+// Whether a planned query runs in the background. Clients cannot be blocked inside
+// MULTI or scripts, nor while replicating or loading.
+static int query_in_background(RedisModuleCtx *ctx, QueryPlan *plan) {
+    if (g_async_scan_rows <= 0 || !plan->root) return 0;
+    if (RedisModule_GetContextFlags(ctx) & (REDISMODULE_CTX_FLAGS_MULTI | REDISMODULE_CTX_FLAGS_LUA |
+            REDISMODULE_CTX_FLAGS_DENY_BLOCKING | REDISMODULE_CTX_FLAGS_REPLICATED | REDISMODULE_CTX_FLAGS_LOADING))
+        return 0;
+    return plan_scan_rows(plan->root, 0, plan->rows) > g_async_scan_rows;
+}
+
+static void *query_thread(void *arg) {
+    BackgroundQuery *q = arg;
+    // The lock is held through a context of its own, so that the work context and its
+    // auto memory are released before the lock is
+    RedisModuleCtx *lock = RedisModule_GetThreadSafeContext(NULL);
+    RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(q->bc);
+    RedisModule_ThreadSafeContextLock(lock);
+    RedisModule_AutoMemory(ctx);
+
+    QueryPlan plan;
+    IdSet ids;
+    if (!schema_get(ctx, q->argv[1])) q->err = "ERR table schema does not exist";
+    else if (q->where.conds) q->err = where_plan_clause(ctx, q->argv[1], &q->where, q->strict, &plan);
+    else q->err = where_plan(ctx, q->argv[1], q->argv, q->start, q->end, q->strict, &plan);
+    if (!q->err) {
+        plan.background = 1;
+        q->err = where_exec(ctx, &plan, &ids);
+    }
+    if (!q->err && q->apply) {
+        q->err = q->apply(ctx, q, ids);
+    } else if (!q->err) {
+        q->ids = RedisModule_Alloc(sizeof(uint64_t) * (ids.len ? ids.len : 1));
+        memcpy(q->ids, ids.ids, sizeof(uint64_t) * ids.len);
+        q->len = ids.len;
+    }
+
+    RedisModule_FreeThreadSafeContext(ctx);
+    RedisModule_ThreadSafeContextUnlock(lock);
+    RedisModule_FreeThreadSafeContext(lock);
+    RedisModule_UnblockClient(q->bc, q);
+    return NULL;
+}
+
+static int query_reply(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    BackgroundQuery *q = RedisModule_GetBlockedClientPrivateData(ctx);
+    RedisModule_AutoMemory(ctx);
+    if (!q->err) result_cache_capture(&q->cache);
+    int rc = q->err ? RedisModule_ReplyWithError(ctx, q->err)
+           : q->reply ? q->reply(ctx, q) : RedisModule_ReplyWithLongLong(ctx, q->count);
+    result_cache_store(&q->cache);
+    // The rows changed by UPDATE or DELETE replace the replies cached while they ran
+    if (q->apply) result_cache_forget_table(ctx, q->argv[1]);
+    if (q->stat != STATS_NONE) stats_record(ctx, q->stat, q->argv[1], q->started);
+    return rc;
+}
+
+static void query_free(RedisModuleCtx *ctx, void *privdata) {
+    BackgroundQuery *q = privdata;
+    for (int i = 0; i < q->argc; i++) RedisModule_FreeString(NULL, q->argv[i]);
+    RedisModule_Free(q->argv);
+    for (int i = 0; q->where.conds && i < q->where.n; i++) {
+        RedisModule_FreeString(NULL, q->where.conds[i].col);
+        RedisModule_FreeString(NULL, q->where.conds[i].val);
+    }
+    if (q->where.conds) RedisModule_Free(q->where.conds);
+    if (q->ids) RedisModule_Free(q->ids);
+    if (q->cache.key) RedisModule_FreeString(NULL, q->cache.key);
+    RedisModule_Free(q);
+}
+
+static BackgroundQuery *query_new(RedisModuleString **argv, int argc, int start, int end, int strict) {
+    BackgroundQuery *q = RedisModule_Calloc(1, sizeof(BackgroundQuery));
+    q->argv = RedisModule_Alloc(sizeof(RedisModuleString*) * argc);
+    for (int i = 0; i < argc; i++) {
+        RedisModule_RetainString(NULL, argv[i]);
+        q->argv[i] = argv[i];
+    }
+    q->argc = argc;
+    q->start = start; q->end = end; q->strict = strict;
+    q->stat = STATS_NONE;
+    q->started = g_stats_start;
+    return q;
+}
+
+// Cache the reply of a background query
+static void query_set_cache(BackgroundQuery *q, const CachedQuery *cq) {
+    q->cache = *cq;
+    if (cq->key) RedisModule_RetainString(NULL, cq->key);
+}
+
+// Run a background query on prepared conditions rather than on its arguments
+static void query_set_where(BackgroundQuery *q, const WhereClause *w) {
+    q->where.conds = RedisModule_Calloc(w->n ? w->n : 1, sizeof(WhereCond));
+    q->where.n = w->n;
+    for (int i = 0; i < w->n; i++) {
+        q->where.conds[i] = w->conds[i];
+        RedisModule_RetainString(NULL, w->conds[i].col);
+        RedisModule_RetainString(NULL, w->conds[i].val);
+    }
+}
+
+// Block the client and run the query in a new thread
+static int query_start(RedisModuleCtx *ctx, BackgroundQuery *q) {
+    q->bc = RedisModule_BlockClient(ctx, query_reply, NULL, query_free, 0);
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, query_thread, q) != 0) {
+        RedisModule_AbortBlock(q->bc);
+        query_free(ctx, q);
+        return RedisModule_ReplyWithError(ctx, "ERR cannot start background query");
+    }
+    pthread_detach(tid);
+    g_stats_deferred = 1;
+    return REDISMODULE_OK;
+}
+
+/* ================== TABLE.SELECT <namespace.table> [COLUMNS a,b] [WHERE col op val (AND|OR col op val ...)] [ORDER BY col [ASC|DESC]] [LIMIT n] [OFFSET n] [CURSOR c] ================== */
+// Paging and ordering options of SELECT: ORDER BY <col> [ASC|DESC], LIMIT <n>, OFFSET <n>, CURSOR <cursor>
+typedef struct {
+    long long limit;            // -1 = no limit
+    long long offset;
+    RedisModuleString *cursor;  // NULL = not paged, "0" = first page
+    RedisModuleString *orderBy; // NULL = row ID order
+    int desc;
+} SelectPage;
+
+#define SELECT_PAGE_SYNTAX_ERROR "ERR syntax: ORDER BY <col> [ASC|DESC] | LIMIT <count> | OFFSET <count> | CURSOR <cursor>"
+
+// Parse the paging options at the end of a SELECT, looking from argument first on
+// Sets *end to the first argument after the WHERE clause; returns NULL or an error message
+static const char *parse_select_page(RedisModuleString **argv, int argc, int first, int *end, SelectPage *pg) {
+    pg->limit = -1; pg->offset = 0; pg->cursor = NULL;
+    pg->orderBy = NULL; pg->desc = 0;
+    *end = argc;
+    for (int i = first; i < argc; i++) {
+        if (is_word(argv[i], "LIMIT") || is_word(argv[i], "OFFSET") || is_word(argv[i], "CURSOR") ||
+            is_word(argv[i], "ORDER")) { *end = i; break; }
+    }
+    int i = *end;
+    while (i < argc) {
+        if (is_word(argv[i], "ORDER")) {
+            if (i + 2 >= argc || !is_word(argv[i+1], "BY")) return SELECT_PAGE_SYNTAX_ERROR;
+            pg->orderBy = argv[i+2];
+            i += 3;
+            if (i < argc && (is_word(argv[i], "ASC") || is_word(argv[i], "DESC"))) pg->desc = is_word(argv[i++], "DESC");
+            continue;
+        }
+        if (i + 1 >= argc) return SELECT_PAGE_SYNTAX_ERROR;
+        long long n;
+        if (RedisModule_StringToLongLong(argv[i+1], &n) != REDISMODULE_OK) n = -1;
+        if (is_word(argv[i], "LIMIT")) {
+            if (n <= 0) return "ERR LIMIT must be a positive integer";
+            pg->limit = n;
+        } else if (is_word(argv[i], "OFFSET")) {
+            if (n < 0) return "ERR OFFSET must be a non-negative integer";
+            pg->offset = n;
+        } else if (is_word(argv[i], "CURSOR")) {
+            if (n < 0) return "ERR invalid cursor";
+            pg->cursor = argv[i+1];
+        } else {
+            return SELECT_PAGE_SYNTAX_ERROR;
+        }
+        i += 2;
+    }
+    // Cursors are row IDs, pages only follow each other in row ID order
+    if (pg->cursor && pg->orderBy) return "ERR CURSOR cannot be used with ORDER BY";
+    if (pg->cursor && pg->limit < 0) pg->limit = SELECT_DEFAULT_PAGE_SIZE;
+    return NULL;
+}
+
+// Projection of a SELECT ... COLUMNS a,b,c
+typedef struct {
+    int n;                      // 0 = every column, as column/value pairs
+    ColumnSchema **cols;
+    NativeColumn **ncols;       // storage of each column in a native table
+} Projection;
+
+// Parse the comma separated column list of COLUMNS; returns NULL or an error message
+static const char *parse_projection(RedisModuleCtx *ctx, TableSchema *sch, RedisModuleString *list, Projection *proj) {
+    size_t len; const char *s = RedisModule_StringPtrLen(list, &len);
+    int n = 1;
+    for (size_t i = 0; i < len; i++) if (s[i] == ',') n++;
+    proj->cols = RedisModule_PoolAlloc(ctx, sizeof(ColumnSchema*) * n);
+    proj->ncols = NULL;
+    proj->n = 0;
+    const char *p = s, *end = s + len;
+    while (p <= end) {
+        const char *comma = memchr(p, ',', (size_t)(end - p));
+        if (!comma) comma = end;
+        RedisModuleString *name = RedisModule_CreateString(ctx, p, (size_t)(comma - p));
+        ColumnSchema *cs = schema_column(sch, name);
+        if (!cs) return "ERR unknown column in COLUMNS";
+        proj->cols[proj->n++] = cs;
+        p = comma + 1;
+    }
+    return NULL;
+}
+
+// Reply with each field of a row hash as it is scanned, counting the pairs
+static void reply_row_field(RedisModuleKey *key, RedisModuleString *field, RedisModuleString *value, void *privdata) {
+    RedisModuleCtx *ctx = ((void**)privdata)[0];
+    long *pairs = ((void**)privdata)[1];
+    (void)key;
+    out_string(ctx, field);
+    out_string(ctx, value);
+    (*pairs)++;
+}
+
+// Reply with one row: a map of column/value pairs, or only the projected values in order.
+// Fields are read from the open row hash and replied from there, without copies.
+// Returns 0 if the row no longer exists (nothing is replied)
+static int reply_row(RedisModuleCtx *ctx, RedisModuleString *table, NativeTable *nt, uint64_t id,
+                     Projection *proj) {
+    if (nt) {
+        long long slot = native_slot(nt, id);
+        if (slot < 0) return 0;
+        if (proj->n) native_reply_values(ctx, nt, (size_t)slot, proj->ncols, proj->n);
+        else native_reply_row(ctx, nt, (size_t)slot);
+        return 1;
+    }
+    RedisModuleString *rowKey = RedisModule_CreateStringPrintf(ctx, "{%s}:%llu", RedisModule_StringPtrLen(table, NULL),
+                                                               (unsigned long long)id);
+    if (proj->n) {
+        // Read just the projected fields from the open row hash
+        RedisModuleKey *row = RedisModule_OpenKey(ctx, rowKey, REDISMODULE_READ);
+        if (RedisModule_KeyType(row) != REDISMODULE_KEYTYPE_HASH) return 0;
+        out_array(ctx, proj->n);
+        for (int c = 0; c < proj->n; c++) {
+            RedisModuleString *v = NULL;
+            RedisModule_HashGet(row, REDISMODULE_HASH_NONE, proj->cols[c]->name, &v, NULL);
+            if (v) out_string(ctx, v);
+            else out_null(ctx);
+        }
+        RedisModule_CloseKey(row);
+        return 1;
+    }
+    if (!RedisModule_ScanKey) {
+        // Servers before 6.0.6 cannot scan a key: the values are replied from HGETALL
+        RedisModuleCallReply *all = RedisModule_Call(ctx, "HGETALL", "s", rowKey);
+        if (!all || RedisModule_CallReplyType(all) != REDISMODULE_REPLY_ARRAY) return 0;
+        size_t n = RedisModule_CallReplyLength(all);
+        if (n == 0) return 0;
+        out_map(ctx, (long)(n / 2));
+        for (size_t j = 0; j < n; j++) {
+            size_t len; const char *v = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(all, j), &len);
+            out_buffer(ctx, v, len);
+        }
+        return 1;
+    }
+    RedisModuleKey *row = RedisModule_OpenKey(ctx, rowKey, REDISMODULE_READ);
+    if (RedisModule_KeyType(row) != REDISMODULE_KEYTYPE_HASH) {
+        RedisModule_CloseKey(row);
+        return 0;
+    }
+    long pairs = 0;
+    void *privdata[2] = { ctx, &pairs };
+    RedisModuleScanCursor *cursor = RedisModule_ScanCursorCreate();
+    out_map(ctx, REDISMODULE_POSTPONED_LEN);
+    while (RedisModule_ScanKey(row, cursor, reply_row_field, privdata));
+    out_set_map_length(ctx, pairs);
+    RedisModule_ScanCursorDestroy(cursor);
+    RedisModule_CloseKey(row);
+    return 1;
+}
+
+
+// ORDER BY: the first offset + limit rows of the match set in column order, ties and rows
+// without a value (always last) in row ID order. A btree index is walked in order when
+// it reaches those rows sooner than reading every match; otherwise the matches go through
+// a heap holding the best rows seen so far, so only offset + limit sort keys are kept.
+
+// Sort key of a row
+typedef struct {
+    uint64_t id;
+    int has;                    // 0 = no value
+    TypedValue v;               // numeric columns
+    const char *s;              // string columns
+    size_t slen;
+    RedisModuleString *hold;    // hash tables: the value s points into
+} OrderKey;
+
+typedef struct {
+    int type;                   // COLTYPE_* of the column
+    int desc;
+    OrderKey *keys;             // binary heap, the root comes last in the order
+    size_t len, cap;
+} OrderHeap;
+
+// Batch of btree entries read per ZRANGE when walking the index of a hash table
+#define ORDER_BTREE_BATCH 1000
+
+// Whether row a comes before row b
+static int order_before(const OrderHeap *h, const OrderKey *a, const OrderKey *b) {
+    if (a->has != b->has) return a->has;
+    if (a->has) {
+        int cmp;
+        if (h->type == COLTYPE_STRING) {
+            cmp = memcmp(a->s, b->s, a->slen < b->slen ? a->slen : b->slen);
+            if (cmp == 0) cmp = a->slen < b->slen ? -1 : a->slen > b->slen;
+        } else if (h->type == COLTYPE_FLOAT) {
+            cmp = a->v.d < b->v.d ? -1 : a->v.d > b->v.d;
+        } else {
+            cmp = a->v.i < b->v.i ? -1 : a->v.i > b->v.i;
+        }
+        if (cmp) return h->desc ? cmp > 0 : cmp < 0;
+    }
+    return a->id < b->id;
+}
+
+static inline void order_swap(OrderKey *a, OrderKey *b) {
+    OrderKey t = *a; *a = *b; *b = t;
+}
+
+// Move keys[i] down to its place in the heap keys[0..len)
+static void order_sift(OrderHeap *h, size_t i, size_t len) {
+    for (;;) {
+        size_t l = 2 * i + 1, r = l + 1, last = i;
+        if (l < len && order_before(h, &h->keys[last], &h->keys[l])) last = l;
+        if (r < len && order_before(h, &h->keys[last], &h->keys[r])) last = r;
+        if (last == i) return;
+        order_swap(&h->keys[i], &h->keys[last]);
+        i = last;
+    }
+}
+
+// Offer a row to the heap, which keeps the cap rows coming first
+static void order_push(RedisModuleCtx *ctx, OrderHeap *h, OrderKey *k) {
+    if (h->len < h->cap) {
+        size_t i = h->len++;
+        h->keys[i] = *k;
+        while (i > 0 && order_before(h, &h->keys[(i - 1) / 2], &h->keys[i])) {
+            order_swap(&h->keys[(i - 1) / 2], &h->keys[i]);
+            i = (i - 1) / 2;
+        }
+        return;
+    }
+    if (h->cap && order_before(h, k, &h->keys[0])) {
+        order_swap(k, &h->keys[0]);     // k is now the row pushed out
+        order_sift(h, 0, h->len);
+    }
+    if (k->hold) RedisModule_FreeString(ctx, k->hold);
+}
+
+// Sort the heap in place, first row first
+static void order_sort(OrderHeap *h) {
+    // Heap sort: the root, coming last, goes to the end
+    for (size_t n = h->len; n > 1; n--) {
+        order_swap(&h->keys[0], &h->keys[n - 1]);
+        order_sift(h, 0, n - 1);
+    }
+}
+
+// The first want rows of ids in order, through the heap
+static IdSet order_heap(RedisModuleCtx *ctx, RedisModuleString *table, TableSchema *sch, ColumnSchema *cs,
+                        int desc, IdSet ids, size_t want) {
+    OrderHeap h = { cs->type, desc, RedisModule_PoolAlloc(ctx, sizeof(OrderKey) * (want ? want : 1)), 0, want };
+    if (sch->engine == ENGINE_NATIVE) {
+        NativeTable *nt = native_open(ctx, table, REDISMODULE_READ);
+        NativeColumn *col = nt ? native_column(nt, cs, 0) : NULL;
+        size_t pos = 0;
+        for (size_t i = 0; nt && i < ids.len; i++) {
+            // Rows and slots are both in ID order: gallop from the previous slot
+            pos = idset_seek(nt->ids, nt->len, pos, ids.ids[i]);
+            if (pos >= nt->len || nt->ids[pos] != ids.ids[i] || !nt->live[pos]) continue;
+            OrderKey k = { ids.ids[i], col && col->present[pos], { 0 }, NULL, 0, NULL };
+            if (k.has) k.v = col->vals[pos];
+            if (k.has && cs->type == COLTYPE_STRING) { k.s = native_str_ptr(k.v.s); k.slen = native_str_len(k.v.s); }
+            order_push(ctx, &h, &k);
+        }
+    } else {
+        const char *tname = RedisModule_StringPtrLen(table, NULL);
+        for (size_t i = 0; i < ids.len; i++) {
+            RedisModuleString *rowKey = RedisModule_CreateStringPrintf(ctx, "{%s}:%llu", tname,
+                                                                       (unsigned long long)ids.ids[i]);
+            RedisModuleKey *row = RedisModule_OpenKey(ctx, rowKey, REDISMODULE_READ);
+            int exists = RedisModule_KeyType(row) == REDISMODULE_KEYTYPE_HASH;
+            RedisModuleString *v = NULL;
+            if (exists) RedisModule_HashGet(row, REDISMODULE_HASH_NONE, cs->name, &v, NULL);
+            RedisModule_CloseKey(row);
+            RedisModule_FreeString(ctx, rowKey);
+            if (!exists) continue;
+            OrderKey k = { ids.ids[i], v != NULL, { 0 }, NULL, 0, NULL };
+            if (v) {
+                k.s = RedisModule_StringPtrLen(v, &k.slen);
+                if (cs->type == COLTYPE_STRING) k.hold = v;
+                else {
+                    k.has = typed_parse(cs->type, k.s, k.slen, &k.v) == 0;
+                    RedisModule_FreeString(ctx, v);
+                }
+            }
+            order_push(ctx, &h, &k);
+        }
+    }
+    order_sort(&h);
+    IdSet out = idset_alloc(ctx, h.len);
+    for (size_t i = 0; i < h.len; i++) out.ids[out.len++] = h.keys[i].id;
+    return out;
+}
+
+// Emit the rows of run (IDs sharing one value) that are in ids and not yet emitted
+static void order_emit_run(uint64_t *run, size_t nrun, IdSet ids, uint8_t *seen, IdSet *out, size_t want) {
+    qsort(run, nrun, sizeof(uint64_t), idset_cmp);
+    for (size_t i = 0; i < nrun && out->len < want; i++) {
+        size_t pos = idset_seek(ids.ids, ids.len, 0, run[i]);
+        if (pos < ids.len && ids.ids[pos] == run[i] && !seen[pos]) {
+            seen[pos] = 1;
+            out->ids[out->len++] = run[i];
+        }
+    }
+}
+
+// The first want rows of ids in order, walking the btree index of the column
+static IdSet order_btree(RedisModuleCtx *ctx, RedisModuleString *table, TableSchema *sch, ColumnSchema *cs,
+                         int desc, IdSet ids, size_t want) {
+    IdSet out = idset_alloc(ctx, want);
+    uint8_t *seen = RedisModule_PoolAlloc(ctx, ids.len ? ids.len : 1);
+    memset(seen, 0, ids.len);
+
+    if (sch->engine == ENGINE_NATIVE) {
+        // Posting lists are sorted by row ID, each one is a run
+        NativeTable *nt = native_open(ctx, table, REDISMODULE_READ);
+        NativeColumn *col = nt ? native_column(nt, cs, 0) : NULL;
+        if (col && col->index) {
+            RedisModuleDictIter *it = RedisModule_DictIteratorStartC(col->index, desc ? "$" : "^", NULL, 0);
+            NativePosting *p;
+            while (out.len < want && (desc ? RedisModule_DictPrevC(it, NULL, (void**)&p)
+                                           : RedisModule_DictNextC(it, NULL, (void**)&p)) != NULL)
+                order_emit_run(p->ids, p->len, ids, seen, &out, want);
+            RedisModule_DictIteratorStop(it);
+        }
+    } else {
+        // Entries sharing a value come out in member order, which is not row ID order:
+        // collect each run of equal values before emitting it
+        RedisModuleString *key = fmt2(ctx, "{%s}:btree:%s", table, cs->name);
+        size_t runCap = 64, nrun = 0, runKeyLen = 0;
+        uint64_t *run = RedisModule_Alloc(sizeof(uint64_t) * runCap);
+        char *runKey = NULL;
+        for (long long start = 0; out.len < want; start += ORDER_BTREE_BATCH) {
+            RedisModuleCallReply *r = RedisModule_Call(ctx, desc ? "ZREVRANGE" : "ZRANGE", "sllc", key, start,
+                                                       start + ORDER_BTREE_BATCH - 1, "WITHSCORES");
+            size_t n = r && RedisModule_CallReplyType(r) == REDISMODULE_REPLY_ARRAY ? RedisModule_CallReplyLength(r) : 0;
+            for (size_t j = 0; j + 1 < n && out.len < want; j += 2) {
+                size_t ml, sl;
+                const char *m = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(r, j), &ml);
+                const char *sc = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(r, j + 1), &sl);
+                // String members are "<value>\0<rowId>", numeric members the row ID with the value as score
+                const char *v = sc, *id = m;
+                size_t vl = sl;
+                if (cs->type == COLTYPE_STRING) {
+                    const char *nul = m + ml;
+                    while (nul > m && nul[-1] != '\0') nul--;
+                    if (nul == m) continue;
+                    v = m; vl = (size_t)(nul - 1 - m); id = nul;
+                }
+                uint64_t rowId = idset_parse_id(id, (size_t)(m + ml - id));
+                if (!rowId) continue;
+                if (nrun && (vl != runKeyLen || memcmp(v, runKey, vl) != 0)) {
+                    order_emit_run(run, nrun, ids, seen, &out, want);
+                    nrun = 0;
+                }
+                if (nrun == 0) {
+                    RedisModule_Free(runKey);
+                    runKey = RedisModule_Alloc(vl + 1);
+                    memcpy(runKey, v, vl);
+                    runKeyLen = vl;
+                }
+                if (nrun == runCap) run = RedisModule_Realloc(run, sizeof(uint64_t) * (runCap *= 2));
+                run[nrun++] = rowId;
+            }
+            if (n < 2 * ORDER_BTREE_BATCH) break;
+        }
+        order_emit_run(run, nrun, ids, seen, &out, want);
+        RedisModule_Free(run);
+        RedisModule_Free(runKey);
+    }
+
+    // Rows without a value in the index come last
+    for (size_t i = 0; i < ids.len && out.len < want; i++)
+        if (!seen[i]) out.ids[out.len++] = ids.ids[i];
+    return out;
+}
+
+// Whether ORDER BY walks the btree index: it visits about want * rows / matches entries
+// before finding want matching rows, the heap reads every match
+static int order_uses_btree(ColumnSchema *cs, long long want, long long rows, long long matches) {
+    return cs->index == INDEX_BTREE && (double)want * (double)rows <= (double)matches * (double)matches;
+}
+
+// The first want rows of ids in ORDER BY order
+static IdSet order_rows(RedisModuleCtx *ctx, RedisModuleString *table, TableSchema *sch, ColumnSchema *cs,
+                        int desc, IdSet ids, size_t want) {
+    if (want > ids.len) want = ids.len;
+    if (order_uses_btree(cs, (long long)want, table_row_count(ctx, table, sch), (long long)ids.len))
+        return order_btree(ctx, table, sch, cs, desc, ids, want);
+    return order_heap(ctx, table, sch, cs, desc, ids, want);
+}
+
+// Options of a SELECT
+typedef struct {
+    Projection proj;
+    SelectPage page;
+    ColumnSchema *order;        // ORDER BY column, NULL = row ID order
+    int wherePos;               // -1 = no WHERE
+    int end;                    // first argument after the WHERE clause
+} SelectOptions;
+
+// Returns NULL or an error message
+static const char *parse_select(RedisModuleCtx *ctx, TableSchema *sch, RedisModuleString **argv, int argc,
+                                SelectOptions *o) {
+    o->proj.n = 0; o->proj.cols = NULL; o->proj.ncols = NULL;
+    int first = 2;
+    size_t kl; const char *kw = argc > 3 ? RedisModule_StringPtrLen(argv[2], &kl) : NULL;
+    if (kw && kl == 7 && strncasecmp(kw, "COLUMNS", 7) == 0) {
+        const char *projErr = parse_projection(ctx, sch, argv[3], &o->proj);
+        if (projErr) return projErr;
+        first = 4;
+    }
+
+    const char *pageErr = parse_select_page(argv, argc, first, &o->end, &o->page);
+    if (pageErr) return pageErr;
+    o->order = o->page.orderBy ? schema_column(sch, o->page.orderBy) : NULL;
+    if (o->page.orderBy && !o->order) return "ERR unknown column in ORDER BY";
+
+    o->wherePos = -1;
+    for (int i = first; i < o->end; i++) {
+        size_t l; const char *w = RedisModule_StringPtrLen(argv[i], &l);
+        if (l == 5 && strncasecmp(w, "WHERE", 5) == 0) { o->wherePos = i; break; }
+    }
+    return NULL;
+}
+
+// Reply with the page of ids selected by the options
+static int select_reply(RedisModuleCtx *ctx, RedisModuleString *table, TableSchema *sch, SelectOptions *o, IdSet ids) {
+    Projection *proj = &o->proj;
+    SelectPage *page = &o->page;
+
+    // Build reply: rows are streamed in row ID or ORDER BY order, the array length is set
+    // once the page is complete
+    NativeTable *nt = sch->engine == ENGINE_NATIVE ? native_open(ctx, table, REDISMODULE_READ) : NULL;
+    if (nt && proj->n) {
+        proj->ncols = RedisModule_PoolAlloc(ctx, sizeof(NativeColumn*) * proj->n);
+        for (int c = 0; c < proj->n; c++) proj->ncols[c] = native_column(nt, proj->cols[c], 0);
+    }
+    // Ordered: only the rows up to the end of the page are sorted
+    if (o->order) {
+        size_t want = ids.len;
+        if ((size_t)page->offset >= ids.len) want = 0;
+        else if (page->limit >= 0 && (size_t)page->limit < ids.len - (size_t)page->offset)
+            want = (size_t)(page->offset + page->limit);
+        ids = order_rows(ctx, table, sch, o->order, page->desc, ids, want);
+    }
+    size_t pos = 0;
+    long long after;
+    if (page->cursor && RedisModule_StringToLongLong(page->cursor, &after) == REDISMODULE_OK && after > 0)
+        pos = idset_seek(ids.ids, ids.len, 0, (uint64_t)after + 1);
+    pos = (size_t)page->offset < ids.len - pos ? pos + (size_t)page->offset : ids.len;
+    size_t stop = page->limit >= 0 && (size_t)page->limit < ids.len - pos ? pos + (size_t)page->limit : ids.len;
+
+    if (!page->cursor) {
+        long rowCount = 0;
+        out_array(ctx, REDISMODULE_POSTPONED_LEN);
+        for (size_t i = pos; i < stop; i++) rowCount += reply_row(ctx, table, nt, ids.ids[i], proj);
+        out_set_array_length(ctx, rowCount);
+        stats_table(table)->rowsReturned += rowCount;
+        return REDISMODULE_OK;
+    }
+
+    // Paged: reply [next cursor, rows], the cursor is the last row ID of the page, "0" when done
+    out_array(ctx, 2);
+    if (stop < ids.len) {
+        char next[24];
+        int nl = snprintf(next, sizeof(next), "%llu", (unsigned long long)ids.ids[stop - 1]);
+        out_buffer(ctx, next, (size_t)nl);
+    } else {
+        out_simple(ctx, "0");
+    }
+    long rowCount = 0;
+    out_array(ctx, REDISMODULE_POSTPONED_LEN);
+    for (size_t i = pos; i < stop; i++) rowCount += reply_row(ctx, table, nt, ids.ids[i], proj);
+    out_set_array_length(ctx, rowCount);
+    stats_table(table)->rowsReturned += rowCount;
+    return REDISMODULE_OK;
+}
+
+// Reply of a SELECT run in the background: the options are parsed again on the main thread
+static int select_background_reply(RedisModuleCtx *ctx, BackgroundQuery *q) {
+    TableSchema *sch = schema_get(ctx, q->argv[1]);
+    SelectOptions o;
+    const char *err = sch ? parse_select(ctx, sch, q->argv, q->argc, &o) : "ERR table schema does not exist";
+    if (err) return RedisModule_ReplyWithError(ctx, err);
+    IdSet ids = { q->ids, q->len };
+    return select_reply(ctx, q->argv[1], sch, &o, ids);
+}
+
+// Normalised WHERE clause of a cached query: column, operator and value of each condition,
+// after the AND / OR joining it to the previous one. The query is not cached if the
+// clause is invalid: its error is replied by the planner.
+static void cached_query_where(RedisModuleCtx *ctx, CachedQuery *cq, RedisModuleString **argv, int start, int end,
+                               const WhereClause *prepared) {
+    if (!cq->key) return;
+    WhereClause parsed;
+    if (!prepared) {
+        if (where_parse(ctx, argv, start, end, &parsed) != NULL) {
+            cq->key = NULL;
+            return;
+        }
+        prepared = &parsed;
+    }
+    cached_query_add(ctx, cq, "WHERE", 5);
+    for (int i = 0; i < prepared->n; i++) {
+        const WhereCond *c = &prepared->conds[i];
+        if (i) cached_query_add(ctx, cq, c->joiner == 2 ? "OR" : "AND", c->joiner == 2 ? 2 : 3);
+        cached_query_add_string(ctx, cq, c->col);
+        cached_query_add(ctx, cq, c->op, strlen(c->op));
+        cached_query_add_string(ctx, cq, c->val);
+    }
+}
+
+// Cache key of a SELECT: its projection, WHERE clause, order and page as parsed, so that
+// the spelling of keywords and numbers does not matter
+static void select_cache_key(RedisModuleCtx *ctx, RedisModuleString **argv, SelectOptions *o,
+                             const WhereClause *prepared, CachedQuery *cq) {
+    cached_query_init(ctx, argv[1], "SELECT", cq);
+    if (!cq->key) return;
+    cached_query_add_number(ctx, cq, o->proj.n);
+    for (int c = 0; c < o->proj.n; c++) cached_query_add_string(ctx, cq, o->proj.cols[c]->name);
+    cached_query_add_string(ctx, cq, o->order ? o->order->name : NULL);
+    cached_query_add_number(ctx, cq, o->page.desc);
+    cached_query_add_number(ctx, cq, o->page.limit);
+    cached_query_add_number(ctx, cq, o->page.offset);
+    long long after = -1;
+    if (o->page.cursor) RedisModule_StringToLongLong(o->page.cursor, &after);
+    cached_query_add_number(ctx, cq, after);
+    if (o->wherePos >= 0) cached_query_where(ctx, cq, argv, o->wherePos + 1, o->end, prepared);
+}
+
+// Reply from the result cache if the query is there, counting the hit or miss
+static int result_cache_lookup(RedisModuleCtx *ctx, RedisModuleString *table, CachedQuery *cq) {
+    if (!cq->key) return 0;
+    TableStats *ts = stats_table(table);
+    if (result_cache_reply(ctx, cq)) {
+        ts->cacheHits++;
+        return 1;
+    }
+    ts->cacheMisses++;
+    return 0;
+}
+
+// Merged reply of SELECT on a sharded table: the rows of the shards, in ORDER BY order or
+// shard after shard, then the page is cut
+static int shard_merge_select(RedisModuleCtx *ctx, ShardRequest *r) {
+    ShardValue *err = shard_error(r);
+    if (err) return shard_reply_error(ctx, err);
+    TableSchema *sch = schema_get(ctx, r->argv[1]);
+    SelectOptions o;
+    const char *perr = sch ? parse_select(ctx, sch, r->argv, r->argc, &o) : "ERR table schema does not exist";
+    if (perr) return RedisModule_ReplyWithError(ctx, perr);
+
+    size_t total = 0;
+    for (int i = 0; i < r->ncalls; i++)
+        if (r->calls[i].reply.type == REPLY_ARRAY) total += (size_t)r->calls[i].reply.n;
+    size_t want = o.page.limit >= 0 && (size_t)(o.page.offset + o.page.limit) < total ?
+                  (size_t)(o.page.offset + o.page.limit) : total;
+    // Rows by their place in the replies of the shards, for their order then
+    ShardValue **rows = RedisModule_PoolAlloc(ctx, sizeof(ShardValue*) * (total ? total : 1));
+    OrderHeap h = { o.order ? o.order->type : COLTYPE_STRING, o.page.desc,
+                    RedisModule_PoolAlloc(ctx, sizeof(OrderKey) * (want ? want : 1)), 0, want };
+    // Position of the ORDER BY value in a projected row, appended if not projected
+    int at = o.proj.n;
+    for (int c = 0; c < o.proj.n; c++) if (o.proj.cols[c] == o.order) at = c;
+    size_t len; const char *name = o.order ? RedisModule_StringPtrLen(o.order->name, &len) : NULL;
+    size_t n = 0;
+    for (int i = 0; i < r->ncalls; i++) {
+        ShardValue *reply = &r->calls[i].reply;
+        for (int64_t j = 0; reply->type == REPLY_ARRAY && j < reply->n; j++, n++) {
+            rows[n] = &reply->elems[j];
+            if (!o.order) continue;
+            ShardValue *row = rows[n], *v = NULL;
+            if (row->type == REPLY_ARRAY && o.proj.n && at < row->n) v = &row->elems[at];
+            for (int64_t f = 0; row->type == REPLY_ARRAY && !o.proj.n && !v && f + 1 < row->n; f += 2)
+                if (row->elems[f].len == len && memcmp(row->elems[f].s, name, len) == 0) v = &row->elems[f + 1];
+            OrderKey k = { n, v && v->type == REPLY_BULK, { 0 }, NULL, 0, NULL };
+            if (k.has) {
+                k.s = v->s;
+                k.slen = v->len;
+                if (h.type != COLTYPE_STRING) k.has = typed_parse(h.type, k.s, k.slen, &k.v) == 0;
+            }
+            order_push(ctx, &h, &k);
+        }
+    }
+    if (o.order) order_sort(&h);
+
+    size_t stop = o.order ? h.len : want;
+    size_t pos = (size_t)o.page.offset < stop ? (size_t)o.page.offset : stop;
+    out_array(ctx, (long)(stop - pos));
+    for (size_t i = pos; i < stop; i++) shard_reply_row(ctx, rows[o.order ? h.keys[i].id : i], o.proj.n);
+    stats_table(r->argv[1])->rowsReturned += (long long)(stop - pos);
+    return REDISMODULE_OK;
+}
+
+// SELECT on a sharded table: each shard replies with the first offset + limit rows of its
+// own, in order
+static int shard_select(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, TableSchema *sch, SelectOptions *o) {
+    if (o->page.cursor) return RedisModule_ReplyWithError(ctx, "ERR CURSOR cannot be used on sharded tables, page with OFFSET");
+    RedisModuleString **sv = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleString*) * (size_t)(o->end + 6));
+    int n = 0;
+    for (int i = 0; i < o->end; i++) sv[n++] = argv[i];
+    int projected = !o->proj.n;
+    for (int c = 0; c < o->proj.n; c++) if (o->proj.cols[c] == o->order) projected = 1;
+    if (o->order && !projected) sv[3] = fmt2(ctx, "%s,%s", argv[3], o->order->name);
+    if (o->order) {
+        sv[n++] = RedisModule_CreateString(ctx, "ORDER", 5);
+        sv[n++] = RedisModule_CreateString(ctx, "BY", 2);
+        sv[n++] = o->order->name;
+        if (o->page.desc) sv[n++] = RedisModule_CreateString(ctx, "DESC", 4);
+    }
+    if (o->page.limit >= 0) {
+        sv[n++] = RedisModule_CreateString(ctx, "LIMIT", 5);
+        sv[n++] = RedisModule_CreateStringFromLongLong(ctx, o->page.offset + o->page.limit);
+    }
+    ShardRequest *r = shard_request_new(argv, argc, shard_merge_select);
+    shard_request_add_all(ctx, r, sv, n, sch->shards);
+    return shard_request_run(ctx, r);
+}
+
+// Run a SELECT; prepared holds its parsed WHERE conditions when run by TABLE.EXEC
+static int select_run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, const WhereClause *prepared) {
+    if (ensure_table_exists(ctx, argv[1]) != REDISMODULE_OK)
+        return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
+
+    TableSchema *sch = schema_get(ctx, argv[1]);
+    SelectOptions o;
+    const char *err = parse_select(ctx, sch, argv, argc, &o);
+    if (err) return RedisModule_ReplyWithError(ctx, err);
+    if (sch->shards && shard_parent(ctx, argv[1])) return shard_select(ctx, argv, argc, sch, &o);
+    CachedQuery cq;
+    select_cache_key(ctx, argv, &o, prepared, &cq);
+    if (result_cache_lookup(ctx, argv[1], &cq)) return REDISMODULE_OK;
+
+    IdSet ids;
+    if (o.wherePos == -1) {
+        ids = idset_all_rows(ctx, argv[1]);
+    } else {
+        QueryPlan plan;
+        err = prepared ? where_plan_clause(ctx, argv[1], prepared, 1, &plan)
+                       : where_plan(ctx, argv[1], argv, o.wherePos + 1, o.end, 1, &plan);
+        if (err) return RedisModule_ReplyWithError(ctx, err);
+        if (query_in_background(ctx, &plan)) {
+            BackgroundQuery *q = query_new(argv, argc, o.wherePos + 1, o.end, 1);
+            if (prepared) query_set_where(q, prepared);
+            q->reply = select_background_reply;
+            q->stat = STATS_SELECT;
+            query_set_cache(q, &cq);
+            return query_start(ctx, q);
+        }
+        if ((err = where_exec(ctx, &plan, &ids)) != NULL) return RedisModule_ReplyWithError(ctx, err);
+    }
+    result_cache_capture(&cq);
+    int rc = select_reply(ctx, argv[1], sch, &o, ids);
+    result_cache_store(&cq);
+    return rc;
+}
+
+static int TableSelectCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc < 2) return RedisModule_WrongArity(ctx);
+    RedisModule_AutoMemory(ctx);
+    stats_begin();
+    int rc = select_run(ctx, argv, argc, NULL);
+    stats_end(ctx, STATS_SELECT, argv[1]);
+    return rc;
+}
+
+/* ================== TABLE.GET <namespace.table> <key> [COLUMNS a,b] ================== */
+// The row whose primary key is key, found by one read of the primary key index: its
+// column/value pairs, or its projected values; nil if no row has this key
+#define GET_SYNTAX_ERROR "ERR syntax: TABLE.GET <namespace.table> <key> [COLUMNS <col>[,<col> ...]]"
+
+// Merged reply of GET on a sharded table: the row of the shard holding the key
+static int shard_merge_get(RedisModuleCtx *ctx, ShardRequest *r) {
+    ShardValue *row = &r->calls[0].reply;
+    int n = 0;
+    if (r->argc == 5) {
+        size_t len; const char *s = RedisModule_StringPtrLen(r->argv[4], &len);
+        for (n = 1; len--; s++) n += *s == ',';
+    }
+    if (row->type == REPLY_ARRAY) stats_table(r->argv[1])->rowsReturned++;
+    shard_reply_row(ctx, row, n);
+    return REDISMODULE_OK;
+}
+
+static int get_run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    TableSchema *sch = schema_get(ctx, argv[1]);
+    if (!sch)
+        return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
+    if (!sch->primary)
+        return RedisModule_ReplyWithError(ctx, "ERR table has no primary key");
+    Projection proj = { 0, NULL, NULL };
+    if (argc == 5 && is_word(argv[3], "COLUMNS")) {
+        const char *err = parse_projection(ctx, sch, argv[4], &proj);
+        if (err) return RedisModule_ReplyWithError(ctx, err);
+    } else if (argc != 3) {
+        return RedisModule_ReplyWithError(ctx, GET_SYNTAX_ERROR);
+    }
+    if (sch->shards && shard_parent(ctx, argv[1])) {
+        RedisModuleString **sv = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleString*) * (size_t)argc);
+        memcpy(sv, argv, sizeof(RedisModuleString*) * (size_t)argc);
+        sv[1] = shard_table(ctx, argv[1], shard_of_key(argv[2], sch->shards));
+        ShardRequest *r = shard_request_new(argv, argc, shard_merge_get);
+        shard_request_add(r, sv, argc);
+        return shard_request_run(ctx, r);
+    }
+
+    TableStats *st = stats_table(argv[1]);
+    st->indexReads++;
+    uint64_t id = unique_owner(ctx, argv[1], sch->primary->name, argv[2]);
+    if (!id || id <= sch->purged || !reply_row(ctx, argv[1], NULL, id, &proj))
+        return RedisModule_ReplyWithNull(ctx);
+    st->rowsReturned++;
+    return REDISMODULE_OK;
+}
+
+static int TableGetCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc < 3) return RedisModule_WrongArity(ctx);
+    RedisModule_AutoMemory(ctx);
+    stats_begin();
+    int rc = get_run(ctx, argv, argc);
+    stats_end(ctx, STATS_SELECT, argv[1]);
+    return rc;
+}
+
+
+/* ================== TABLE.AGGREGATE <namespace.table> COUNT [<col>] | SUM|MIN|MAX|AVG <col> [GROUP BY <col>] [WHERE ...] ================== */
+
+// Aggregate functions
+#define AGG_COUNT 0
+#define AGG_SUM   1
+#define AGG_MIN   2
+#define AGG_MAX   3
+#define AGG_AVG   4
+
+#define AGGREGATE_SYNTAX_ERROR "ERR syntax: TABLE.AGGREGATE <namespace.table> COUNT [<col>] | SUM|MIN|MAX|AVG <col> [GROUP BY <col>] [WHERE ...]"
+
+typedef struct {
+    int fn;                     // AGG_*
+    ColumnSchema *col;          // aggregated column, NULL for COUNT of the rows
+    ColumnSchema *group;        // GROUP BY column, NULL = a single group
+    int wherePos;               // -1 = no WHERE
+} AggregateOptions;
+
+// Running aggregate of a group
+typedef struct {
+    RedisModuleString *label;   // value of the GROUP BY column, NULL = rows without one
+    long long rows;             // rows of the group (COUNT of the rows)
+    long long nvals;            // rows with a value in the aggregated column
+    int64_t isum;               // SUM of an integer column while it fits
+    int overflow;               // isum overflowed, dsum holds the sum
+    double dsum;
+    TypedValue best;            // MIN / MAX of a numeric column
+    const char *str;            // MIN / MAX of a string column
+    size_t strlen;
+} AggGroup;
+
+// Returns NULL or an error message
+static const char *parse_aggregate(RedisModuleCtx *ctx, TableSchema *sch, RedisModuleString **argv, int argc,
+                                   AggregateOptions *o) {
+    static const char *names[] = { "COUNT", "SUM", "MIN", "MAX", "AVG" };
+    size_t l; const char *w = RedisModule_StringPtrLen(argv[2], &l);
+    o->fn = -1;
+    for (int f = 0; f <= AGG_AVG; f++)
+        if (l == strlen(names[f]) && strncasecmp(w, names[f], l) == 0) o->fn = f;
+    if (o->fn < 0) return AGGREGATE_SYNTAX_ERROR;
+
+    int i = 3;
+    o->col = NULL;
+    // COUNT <col> counts the rows with a value in col
+    if (o->fn != AGG_COUNT || (i < argc && !is_word(argv[i], "GROUP") && !is_word(argv[i], "WHERE"))) {
+        if (i >= argc) return AGGREGATE_SYNTAX_ERROR;
+        if (!(o->col = schema_column(sch, argv[i++]))) return "ERR unknown column in AGGREGATE";
+        if ((o->fn == AGG_SUM || o->fn == AGG_AVG) && o->col->type != COLTYPE_INTEGER && o->col->type != COLTYPE_FLOAT)
+            return "ERR SUM and AVG need an integer or float column";
+    }
+
+    o->group = NULL;
+    w = i < argc ? RedisModule_StringPtrLen(argv[i], &l) : NULL;
+    if (w && l == 5 && strncasecmp(w, "GROUP", 5) == 0) {
+        if (i + 2 >= argc) return AGGREGATE_SYNTAX_ERROR;
+        w = RedisModule_StringPtrLen(argv[i + 1], &l);
+        if (l != 2 || strncasecmp(w, "BY", 2) != 0) return AGGREGATE_SYNTAX_ERROR;
+        if (!(o->group = schema_column(sch, argv[i + 2]))) return "ERR unknown column in GROUP BY";
+        i += 3;
+    }
+
+    o->wherePos = -1;
+    if (i < argc) {
+        w = RedisModule_StringPtrLen(argv[i], &l);
+        if (l != 5 || strncasecmp(w, "WHERE", 5) != 0) return AGGREGATE_SYNTAX_ERROR;
+        o->wherePos = i;
+    }
+    return NULL;
+}
+
+// Group of a row given its GROUP BY value (NULL = none), created on first use
+// Groups are keyed by the order-preserving encoding of their value, after a 0 (no value)
+// or 1 byte, so iterating the dictionary visits them in value order
+static AggGroup *agg_group(RedisModuleCtx *ctx, RedisModuleDict *groups, const unsigned char *key, size_t klen,
+                           const char *label, size_t labellen) {
+    unsigned char local[256];
+    unsigned char *gk = klen + 1 <= sizeof(local) ? local : RedisModule_PoolAlloc(ctx, klen + 1);
+    gk[0] = key != NULL;
+    if (key) memcpy(gk + 1, key, klen);
+    int nokey;
+    AggGroup *g = RedisModule_DictGetC(groups, gk, key ? klen + 1 : 1, &nokey);
+    if (!nokey) return g;
+    g = RedisModule_PoolAlloc(ctx, sizeof(AggGroup));
+    memset(g, 0, sizeof(*g));
+    if (key) g->label = RedisModule_CreateString(ctx, label, labellen);
+    RedisModule_DictSetC(groups, gk, key ? klen + 1 : 1, g);
+    return g;
+}
+
+// Add a value of the aggregated column to a group: v for numeric columns, s for strings
+static void agg_add(AggGroup *g, int fn, int type, TypedValue v, const char *s, size_t slen) {
+    int first = g->nvals++ == 0;
+    if (fn == AGG_SUM || fn == AGG_AVG) {
+        g->dsum += type == COLTYPE_INTEGER ? (double)v.i : v.d;
+        if (type == COLTYPE_INTEGER && !g->overflow && __builtin_add_overflow(g->isum, v.i, &g->isum)) g->overflow = 1;
+    } else if (fn == AGG_MIN || fn == AGG_MAX) {
+        int cmp;
+        if (first) cmp = fn == AGG_MIN ? -1 : 1;
+        else if (type == COLTYPE_STRING) {
+            cmp = memcmp(s, g->str, slen < g->strlen ? slen : g->strlen);
+            if (cmp == 0) cmp = slen < g->strlen ? -1 : slen > g->strlen;
+        } else if (type == COLTYPE_FLOAT) cmp = v.d < g->best.d ? -1 : v.d > g->best.d;
+        else cmp = v.i < g->best.i ? -1 : v.i > g->best.i;
+        if ((fn == AGG_MIN && cmp < 0) || (fn == AGG_MAX && cmp > 0)) { g->best = v; g->str = s; g->strlen = slen; }
+    }
+}
+
+// Fold the rows ids into groups
+static void aggregate_rows(RedisModuleCtx *ctx, RedisModuleString *table, TableSchema *sch, AggregateOptions *o,
+                           IdSet ids, AggGroup *single, RedisModuleDict *groups) {
+    int vtype = o->col ? o->col->type : COLTYPE_STRING;
+    int gtype = o->group ? o->group->type : COLTYPE_STRING;
+    AggGroup *g = single;
+
+    if (sch->engine == ENGINE_NATIVE) {
+        NativeTable *nt = native_open(ctx, table, REDISMODULE_READ);
+        if (!nt) return;
+        NativeColumn *vcol = o->col ? native_column(nt, o->col, 0) : NULL;
+        NativeColumn *gcol = o->group ? native_column(nt, o->group, 0) : NULL;
+        size_t pos = 0;
+        for (size_t i = 0; i < ids.len; i++) {
+            // Rows and slots are both in ID order: gallop from the previous slot
+            pos = idset_seek(nt->ids, nt->len, pos, ids.ids[i]);
+            if (pos >= nt->len || nt->ids[pos] != ids.ids[i] || !nt->live[pos]) continue;
+            if (groups) {
+                unsigned char kbuf[8], tbuf[32];
+                const unsigned char *key = NULL;
+                const char *label = NULL;
+                size_t klen = 0, labellen = 0;
+                if (gcol && gcol->present[pos]) {
+                    klen = native_index_key(gtype, gcol->vals[pos], kbuf, &key);
+                    label = native_value_text(gcol, gcol->vals[pos], (char *)tbuf, &labellen);
+                }
+                g = agg_group(ctx, groups, key, klen, label, labellen);
             }
-            indexed = idx_type;
+            g->rows++;
+            if (vcol && vcol->present[pos]) {
+                TypedValue v = vcol->vals[pos];
+                if (vtype == COLTYPE_STRING) agg_add(g, o->fn, vtype, v, native_str_ptr(v.s), native_str_len(v.s));
+                else agg_add(g, o->fn, vtype, v, NULL, 0);
+            }
+        }
+        return;
+    }
+
+    const char *tname = RedisModule_StringPtrLen(table, NULL);
+    for (size_t i = 0; i < ids.len; i++) {
+        RedisModuleString *rowKey = RedisModule_CreateStringPrintf(ctx, "{%s}:%llu", tname, (unsigned long long)ids.ids[i]);
+        RedisModuleKey *row = RedisModule_OpenKey(ctx, rowKey, REDISMODULE_READ);
+        if (RedisModule_KeyType(row) != REDISMODULE_KEYTYPE_HASH) continue;
+        if (groups) {
+            RedisModuleString *gv = NULL;
+            RedisModule_HashGet(row, REDISMODULE_HASH_NONE, o->group->name, &gv, NULL);
+            unsigned char kbuf[8];
+            const unsigned char *key = NULL;
+            size_t klen = 0, labellen = 0;
+            const char *label = gv ? RedisModule_StringPtrLen(gv, &labellen) : NULL;
+            // Values not valid for the column type are grouped with the rows without one
+            if (gv) klen = native_index_key_text(gtype, label, labellen, kbuf, &key);
+            g = agg_group(ctx, groups, key, klen, label, labellen);
+        }
+        g->rows++;
+        RedisModuleString *vv = NULL;
+        if (o->col) RedisModule_HashGet(row, REDISMODULE_HASH_NONE, o->col->name, &vv, NULL);
+        RedisModule_CloseKey(row);
+        if (!vv) continue;
+        size_t vlen; const char *vs = RedisModule_StringPtrLen(vv, &vlen);
+        TypedValue v = { 0 };
+        if (vtype != COLTYPE_STRING && typed_parse(vtype, vs, vlen, &v) != 0) continue;
+        agg_add(g, o->fn, vtype, v, vs, vlen);
+    }
+}
+
+// Reply with the aggregate of a group
+static void agg_reply_value(RedisModuleCtx *ctx, AggregateOptions *o, AggGroup *g) {
+    if (o->fn == AGG_COUNT) {
+        out_longlong(ctx, o->col ? g->nvals : g->rows);
+        return;
+    }
+    if (g->nvals == 0) {
+        out_null(ctx);
+        return;
+    }
+    int type = o->col->type;
+    if (o->fn == AGG_SUM && type == COLTYPE_INTEGER && !g->overflow) {
+        out_longlong(ctx, g->isum);
+        return;
+    }
+    if ((o->fn == AGG_MIN || o->fn == AGG_MAX) && type == COLTYPE_STRING) {
+        out_buffer(ctx, g->str, g->strlen);
+        return;
+    }
+    TypedValue v = g->best;
+    if (o->fn == AGG_SUM) { v.d = g->dsum; type = COLTYPE_FLOAT; }
+    if (o->fn == AGG_AVG) { v.d = g->dsum / (double)g->nvals; type = COLTYPE_FLOAT; }
+    char buf[32];
+    size_t len = typed_format(type, v, buf, sizeof(buf));
+    out_buffer(ctx, buf, len);
+}
+
+// Reply with the aggregate of single, or of each group in groups (freed) if not NULL
+static int agg_reply_groups(RedisModuleCtx *ctx, AggregateOptions *o, AggGroup *single, RedisModuleDict *groups) {
+    if (!groups) {
+        agg_reply_value(ctx, o, single);
+        return REDISMODULE_OK;
+    }
+    out_array(ctx, (long)RedisModule_DictSize(groups) * 2);
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(groups, "^", NULL, 0);
+    AggGroup *g;
+    while (RedisModule_DictNextC(it, NULL, (void **)&g) != NULL) {
+        if (g->label) out_string(ctx, g->label);
+        else out_null(ctx);
+        agg_reply_value(ctx, o, g);
+    }
+    RedisModule_DictIteratorStop(it);
+    RedisModule_FreeDict(ctx, groups);
+    return REDISMODULE_OK;
+}
+
+// Reply with the aggregate of the rows ids: one value, or group/value pairs in group order
+static int aggregate_reply(RedisModuleCtx *ctx, RedisModuleString *table, TableSchema *sch, AggregateOptions *o,
+                           IdSet ids) {
+    AggGroup single;
+    memset(&single, 0, sizeof(single));
+    RedisModuleDict *groups = o->group ? RedisModule_CreateDict(ctx) : NULL;
+    aggregate_rows(ctx, table, sch, o, ids, &single, groups);
+    return agg_reply_groups(ctx, o, &single, groups);
+}
+
+// Reply of an AGGREGATE run in the background: the rows are folded on the main thread
+static int aggregate_background_reply(RedisModuleCtx *ctx, BackgroundQuery *q) {
+    TableSchema *sch = schema_get(ctx, q->argv[1]);
+    AggregateOptions o;
+    const char *err = sch ? parse_aggregate(ctx, sch, q->argv, q->argc, &o) : "ERR table schema does not exist";
+    if (err) return RedisModule_ReplyWithError(ctx, err);
+    IdSet ids = { q->ids, q->len };
+    return aggregate_reply(ctx, q->argv[1], sch, &o, ids);
+}
+
+// Fold a value replied by a shard into a group; count is set for the COUNT <col> half of
+// a sharded AVG
+static void shard_agg_add(AggGroup *g, AggregateOptions *o, ShardValue *v, int count) {
+    if (o->fn == AGG_COUNT || count) {
+        long long n = v->type == REPLY_INT ? v->n : 0;
+        if (o->fn == AGG_COUNT && !o->col) g->rows += n;
+        else g->nvals += n;
+        return;
+    }
+    if (v->type != REPLY_INT && v->type != REPLY_BULK) return;    // no value in the shard
+    if (o->fn == AGG_SUM || o->fn == AGG_AVG) {
+        if (o->fn == AGG_SUM) g->nvals++;
+        if (v->type == REPLY_INT) {
+            g->dsum += (double)v->n;
+            if (!g->overflow && __builtin_add_overflow(g->isum, v->n, &g->isum)) g->overflow = 1;
         } else {
-            // col:type format - defaults to none (no index)
-            typ = RedisModule_CreateString(ctx, colon1 + 1, len - col_len - 1);
+            char buf[64];
+            size_t l = v->len < sizeof(buf) - 1 ? v->len : sizeof(buf) - 1;
+            memcpy(buf, v->s, l);
+            buf[l] = '\0';
+            g->dsum += strtod(buf, NULL);
+            // An integer SUM is replied as a float once it overflows
+            if (o->col->type == COLTYPE_INTEGER) g->overflow = 1;
         }
-        
-        RedisModule_HashSet(schemaKey, REDISMODULE_HASH_NONE, col, typ, NULL);
-        if (indexed) {
-            RedisModule_Call(ctx, "SADD", "ss", metaKey, col);
+        return;
+    }
+    TypedValue tv = { 0 };
+    if (o->col->type != COLTYPE_STRING && typed_parse(o->col->type, v->s, v->len, &tv) != 0) return;
+    agg_add(g, o->fn, o->col->type, tv, v->s, v->len);
+}
+
+// Merged reply of AGGREGATE on a sharded table: the aggregates of the shards folded, by
+// group. AVG is folded from the SUM and COUNT of each shard.
+static int shard_merge_aggregate(RedisModuleCtx *ctx, ShardRequest *r) {
+    ShardValue *err = shard_error(r);
+    if (err) return shard_reply_error(ctx, err);
+    TableSchema *sch = schema_get(ctx, r->argv[1]);
+    AggregateOptions o;
+    const char *perr = sch ? parse_aggregate(ctx, sch, r->argv, r->argc, &o) : "ERR table schema does not exist";
+    if (perr) return RedisModule_ReplyWithError(ctx, perr);
+    AggGroup single;
+    memset(&single, 0, sizeof(single));
+    RedisModuleDict *groups = o.group ? RedisModule_CreateDict(ctx) : NULL;
+    int gtype = o.group ? o.group->type : COLTYPE_STRING;
+    for (int i = 0; i < r->ncalls; i++) {
+        ShardValue *v = &r->calls[i].reply;
+        int count = o.fn == AGG_AVG && i >= r->ncalls / 2;
+        if (!groups) {
+            shard_agg_add(&single, &o, v, count);
+            continue;
+        }
+        for (int64_t j = 0; v->type == REPLY_ARRAY && j + 1 < v->n; j += 2) {
+            ShardValue *label = &v->elems[j];
+            unsigned char kbuf[8];
+            const unsigned char *key = NULL;
+            size_t klen = label->type == REPLY_BULK ?
+                          native_index_key_text(gtype, label->s, label->len, kbuf, &key) : 0;
+            AggGroup *g = agg_group(ctx, groups, key, klen, key ? label->s : NULL, key ? label->len : 0);
+            shard_agg_add(g, &o, &v->elems[j + 1], count);
         }
     }
-    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+    return agg_reply_groups(ctx, &o, &single, groups);
 }
 
-/* ================== TABLE.SCHEMA.ALTER <namespace.table> ADD/DROP COLUMN/INDEX ... ================== */
-static int TableSchemaAlterCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-    if (argc < 4) return RedisModule_WrongArity(ctx);
+// AGGREGATE on a sharded table: each shard aggregates its rows, AVG as SUM and COUNT
+static int shard_aggregate(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, TableSchema *sch,
+                           AggregateOptions *o) {
+    ShardRequest *r = shard_request_new(argv, argc, shard_merge_aggregate);
+    if (o->fn != AGG_AVG) {
+        shard_request_add_all(ctx, r, argv, argc, sch->shards);
+        return shard_request_run(ctx, r);
+    }
+    RedisModuleString **sv = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleString*) * (size_t)argc);
+    memcpy(sv, argv, sizeof(RedisModuleString*) * (size_t)argc);
+    sv[2] = RedisModule_CreateString(ctx, "SUM", 3);
+    shard_request_add_all(ctx, r, sv, argc, sch->shards);
+    sv[2] = RedisModule_CreateString(ctx, "COUNT", 5);
+    shard_request_add_all(ctx, r, sv, argc, sch->shards);
+    return shard_request_run(ctx, r);
+}
+
+static int TableAggregateCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc < 3) return RedisModule_WrongArity(ctx);
     RedisModule_AutoMemory(ctx);
-    
     if (ensure_table_exists(ctx, argv[1]) != REDISMODULE_OK)
         return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
-    
-    size_t oplen; const char *op = RedisModule_StringPtrLen(argv[2], &oplen);
-    size_t targetlen; const char *target = RedisModule_StringPtrLen(argv[3], &targetlen);
-    
-    RedisModuleKey *schemaKey = RedisModule_OpenKey(ctx, fmt(ctx, "schema:{%s}", argv[1]), REDISMODULE_WRITE);
-    RedisModuleString *metaKey = fmt(ctx, "{%s}:idx:meta", argv[1]);
-    
-    if (oplen == 3 && strncasecmp(op, "ADD", 3) == 0) {
-        if (targetlen == 6 && strncasecmp(target, "COLUMN", 6) == 0) {
-            // ADD COLUMN col:type[:index]
-            if (argc != 5) return RedisModule_ReplyWithError(ctx, "ERR ADD COLUMN requires col:type[:index]");
-            size_t len; const char *s = RedisModule_StringPtrLen(argv[4], &len);
-            const char *colon1 = memchr(s, ':', len);
-            if (!colon1) return RedisModule_ReplyWithError(ctx, "ERR format: col:type[:index]");
-            
-            RedisModuleString *col = RedisModule_CreateString(ctx, s, (size_t)(colon1 - s));
-            const char *colon2 = memchr(colon1 + 1, ':', len - (size_t)(colon1 - s) - 1);
-            RedisModuleString *typ;
-            int indexed = 0; // default none
-            
-            if (colon2) {
-                typ = RedisModule_CreateString(ctx, colon1 + 1, (size_t)(colon2 - colon1 - 1));
-                const char *idx_str = colon2 + 1;
-                size_t idx_len = len - (size_t)(colon2 - s) - 1;
-                
-                int idx_type = parse_index_type(idx_str, idx_len);
-                if (idx_type == -1) {
-                    return RedisModule_ReplyWithError(ctx,
-                        "ERR index must be 'hash', 'btree', 'none' (or deprecated 'true'/'false')");
-                }
-                indexed = idx_type;
-            } else {
-                typ = RedisModule_CreateString(ctx, colon1 + 1, len - (size_t)(colon1 - s) - 1);
-            }
-            
-            RedisModule_HashSet(schemaKey, REDISMODULE_HASH_NONE, col, typ, NULL);
-            if (indexed) RedisModule_Call(ctx, "SADD", "ss", metaKey, col);
-            return RedisModule_ReplyWithSimpleString(ctx, "OK");
-            
-        } else if (targetlen == 5 && strncasecmp(target, "INDEX", 5) == 0) {
-            // ADD INDEX col - build index for existing data
-            if (argc != 5) return RedisModule_ReplyWithError(ctx, "ERR ADD INDEX requires column name");
-            RedisModuleString *col = argv[4];
-            
-            // Verify column exists in table schema
-            RedisModuleString *typeStr = NULL;
-            if (RedisModule_HashGet(schemaKey, REDISMODULE_HASH_NONE, col, &typeStr, NULL) != REDISMODULE_OK || !typeStr)
-                return RedisModule_ReplyWithError(ctx, "ERR column does not exist");
-            
-            // Add to index metadata
-            RedisModule_Call(ctx, "SADD", "ss", metaKey, col);
-            
-            // Build index for all existing rows
-            RedisModuleString *rowsSet = fmt(ctx, "{%s}:rows", argv[1]);
-            RedisModuleCallReply *rows = RedisModule_Call(ctx, "SMEMBERS", "s", rowsSet);
-            if (rows && RedisModule_CallReplyType(rows) == REDISMODULE_REPLY_ARRAY) {
-                size_t n = RedisModule_CallReplyLength(rows);
-                for (size_t i = 0; i < n; i++) {
-                    RedisModuleCallReply *e = RedisModule_CallReplyArrayElement(rows, i);
-                    RedisModuleString *rowId = RedisModule_CreateStringFromCallReply(e);
-                    RedisModuleString *rowKey = fmt2(ctx, "{%s}:%s", argv[1], rowId);
-                    
-                    // Get column value from row
-                    RedisModuleCallReply *valReply = RedisModule_Call(ctx, "HGET", "ss", rowKey, col);
-                    if (valReply && RedisModule_CallReplyType(valReply) == REDISMODULE_REPLY_STRING) {
-                        RedisModuleString *val = RedisModule_CreateStringFromCallReply(valReply);
-                        RedisModuleString *idxKey = fmt3(ctx, "{%s}:idx:%s:%s", argv[1], col, val);
-                        RedisModule_Call(ctx, "SADD", "ss", idxKey, rowId);
-                    }
-                }
-            }
-            return RedisModule_ReplyWithSimpleString(ctx, "OK");
+
+    TableSchema *sch = schema_get(ctx, argv[1]);
+    AggregateOptions o;
+    const char *err = parse_aggregate(ctx, sch, argv, argc, &o);
+    if (err) return RedisModule_ReplyWithError(ctx, err);
+    if (sch->shards && shard_parent(ctx, argv[1])) return shard_aggregate(ctx, argv, argc, sch, &o);
+
+    // A COUNT the table size or a single index answers exactly reads no row, the index only
+    // while no rows are being purged: their entries stay in it until the purge reaches them
+    int countOnly = o.fn == AGG_COUNT && !o.col && !o.group;
+    if (o.wherePos == -1 && countOnly) return RedisModule_ReplyWithLongLong(ctx, table_row_count(ctx, argv[1], sch));
+    CachedQuery cq;
+    cached_query_init(ctx, argv[1], "AGGREGATE", &cq);
+    cached_query_add_number(ctx, &cq, o.fn);
+    cached_query_add_string(ctx, &cq, o.col ? o.col->name : NULL);
+    cached_query_add_string(ctx, &cq, o.group ? o.group->name : NULL);
+    if (o.wherePos >= 0) cached_query_where(ctx, &cq, argv, o.wherePos + 1, argc, NULL);
+    if (result_cache_lookup(ctx, argv[1], &cq)) return REDISMODULE_OK;
+
+    IdSet ids;
+    if (o.wherePos == -1) {
+        ids = idset_all_rows(ctx, argv[1]);
+    } else {
+        QueryPlan plan;
+        if ((err = where_plan(ctx, argv[1], argv, o.wherePos + 1, argc, 1, &plan)) != NULL)
+            return RedisModule_ReplyWithError(ctx, err);
+        if (countOnly && !sch->purged && plan.root && !plan_range_inexact(&plan, plan.root) && (plan.root->kind == PLAN_HASH || plan.root->kind == PLAN_RANGE ||
+                                                       plan.root->kind == PLAN_UNIQUE || plan.root->kind == PLAN_COMPOSITE ||
+                                                       plan.root->kind == PLAN_PARTITION)) {
+            result_cache_capture(&cq);
+            out_longlong(ctx, plan.root->est);
+            result_cache_store(&cq);
+            return REDISMODULE_OK;
         }
-    } else if (oplen == 4 && strncasecmp(op, "DROP", 4) == 0) {
-        if (targetlen == 5 && strncasecmp(target, "INDEX", 5) == 0) {
-            // DROP INDEX col - remove index metadata and delete all index keys
-            // WARNING: Known race condition - metadata removed before keys deleted
-            // Concurrent queries may return empty results during deletion
-            // TODO: Reverse order or implement soft-delete tombstone (future release)
-            if (argc != 5) return RedisModule_ReplyWithError(ctx, "ERR DROP INDEX requires column name");
-            RedisModuleString *col = argv[4];
-            
-            // Remove from index metadata (ATOMIC - fast)
-            // RACE CONDITION: Queries checking after this point will think index doesn't exist
-            RedisModule_Call(ctx, "SREM", "ss", metaKey, col);
-            
-            // Delete all index keys for this column using SCAN (NON-ATOMIC - slow)
-            // RACE CONDITION: Keys being deleted while queries might try to use them
-            // Build pattern: {table}:idx:col:*
-            RedisModuleString *pattern = fmt2(ctx, "{%s}:idx:%s:*", argv[1], col);
-            size_t patternLen;
-            const char *patternStr = RedisModule_StringPtrLen(pattern, &patternLen);
-            
-            // Use SCAN to find and delete index keys
-            unsigned long long cursor = 0;
-            do {
-                // Convert cursor to string for SCAN command
-                char cursorBuf[32];
-                snprintf(cursorBuf, sizeof(cursorBuf), "%llu", cursor);
-                
-                RedisModuleCallReply *scanReply = RedisModule_Call(ctx, "SCAN", "ccc",
-                                                                    cursorBuf,
-                                                                    "MATCH", patternStr);
-                if (!scanReply || RedisModule_CallReplyType(scanReply) != REDISMODULE_REPLY_ARRAY) {
-                    break;
-                }
-                
-                // Extract new cursor from reply[0]
-                RedisModuleCallReply *cursorReply = RedisModule_CallReplyArrayElement(scanReply, 0);
-                if (!cursorReply) break;
-                
-                size_t cursorStrLen;
-                const char *cursorStr = RedisModule_CallReplyStringPtr(cursorReply, &cursorStrLen);
-                if (!cursorStr) break;
-                
-                cursor = strtoull(cursorStr, NULL, 10);
-                
-                // Extract and delete keys from reply[1]
-                RedisModuleCallReply *keysReply = RedisModule_CallReplyArrayElement(scanReply, 1);
-                if (keysReply && RedisModule_CallReplyType(keysReply) == REDISMODULE_REPLY_ARRAY) {
-                    size_t n = RedisModule_CallReplyLength(keysReply);
-                    for (size_t i = 0; i < n; i++) {
-                        RedisModuleCallReply *keyReply = RedisModule_CallReplyArrayElement(keysReply, i);
-                        RedisModuleString *key = RedisModule_CreateStringFromCallReply(keyReply);
-                        RedisModule_Call(ctx, "DEL", "s", key);
-                    }
-                }
-            } while (cursor != 0);
-            
-            return RedisModule_ReplyWithSimpleString(ctx, "OK");
+        if (query_in_background(ctx, &plan)) {
+            BackgroundQuery *q = query_new(argv, argc, o.wherePos + 1, argc, 1);
+            q->reply = aggregate_background_reply;
+            query_set_cache(q, &cq);
+            return query_start(ctx, q);
+        }
+        if ((err = where_exec(ctx, &plan, &ids)) != NULL) return RedisModule_ReplyWithError(ctx, err);
+    }
+    result_cache_capture(&cq);
+    if (countOnly) out_longlong(ctx, (long long)ids.len);
+    else aggregate_reply(ctx, argv[1], sch, &o, ids);
+    result_cache_store(&cq);
+    return REDISMODULE_OK;
+}
+
+
+/* ================== TABLE.EXPLAIN <namespace.table> [WHERE ...] ================== */
+// Merged reply of EXPLAIN on a sharded table: the lines of each shard after one of its own
+static int shard_merge_explain(RedisModuleCtx *ctx, ShardRequest *r) {
+    ShardValue *err = shard_error(r);
+    if (err) return shard_reply_error(ctx, err);
+    long lines = 1;
+    for (int i = 0; i < r->ncalls; i++)
+        if (r->calls[i].reply.type == REPLY_ARRAY) lines += (long)r->calls[i].reply.n;
+    RedisModule_ReplyWithArray(ctx, lines);
+    RedisModule_ReplyWithString(ctx, RedisModule_CreateStringPrintf(ctx, "TABLE %s sharded over %d tables",
+                                RedisModule_StringPtrLen(r->argv[1], NULL), r->ncalls));
+    for (int i = 0; i < r->ncalls; i++)
+        for (int64_t j = 0; r->calls[i].reply.type == REPLY_ARRAY && j < r->calls[i].reply.n; j++)
+            shard_reply_value(ctx, &r->calls[i].reply.elems[j]);
+    return REDISMODULE_OK;
+}
+
+// Show how a WHERE clause would be executed: one line per step, nested by indentation
+static int TableExplainCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc < 2) return RedisModule_WrongArity(ctx);
+    RedisModule_AutoMemory(ctx);
+    if (ensure_table_exists(ctx, argv[1]) != REDISMODULE_OK)
+        return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
+    TableSchema *sch = shard_parent(ctx, argv[1]);
+    if (sch) {
+        ShardRequest *r = shard_request_new(argv, argc, shard_merge_explain);
+        shard_request_add_all(ctx, r, argv, argc, sch->shards);
+        return shard_request_run(ctx, r);
+    }
+
+    SelectPage page;
+    int end;
+    const char *err = parse_select_page(argv, argc, 2, &end, &page);
+    if (err) return RedisModule_ReplyWithError(ctx, err);
+    if (page.orderBy && !schema_column(schema_get(ctx, argv[1]), page.orderBy))
+        return RedisModule_ReplyWithError(ctx, "ERR unknown column in ORDER BY");
+    int wherePos = -1;
+    for (int i = 2; i < end; i++) {
+        size_t l; const char *w = RedisModule_StringPtrLen(argv[i], &l);
+        if (l == 5 && strncasecmp(w, "WHERE", 5) == 0) { wherePos = i; break; }
+    }
+
+    QueryPlan plan;
+    if (wherePos != -1 && (err = where_plan(ctx, argv[1], argv, wherePos + 1, end, 1, &plan)) != NULL)
+        return RedisModule_ReplyWithError(ctx, err);
+    if (wherePos == -1) {
+        plan.sch = schema_get(ctx, argv[1]);
+        plan.rows = table_row_count(ctx, argv[1], plan.sch);
+        plan.root = NULL;
+    }
+
+    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_LEN);
+    RedisModule_ReplyWithString(ctx, RedisModule_CreateStringPrintf(ctx, "TABLE %s engine %s (rows %lld)",
+                                RedisModule_StringPtrLen(argv[1], NULL),
+                                plan.sch->engine == ENGINE_NATIVE ? "native" : "hash", plan.rows));
+    long lines = 1;
+    if (plan.root) {
+        lines += plan_explain(ctx, &plan, plan.root, 1, 0, plan.rows);
+        if (query_in_background(ctx, &plan)) {
+            RedisModule_ReplyWithString(ctx, RedisModule_CreateStringPrintf(ctx,
+                                        "  runs in background (%lld rows checked one by one)",
+                                        plan_scan_rows(plan.root, 0, plan.rows)));
+            lines++;
+        }
+    } else if (wherePos != -1) {
+        RedisModule_ReplyWithSimpleString(ctx, "  WHERE without conditions, no rows");
+        lines++;
+    } else {
+        RedisModule_ReplyWithString(ctx, RedisModule_CreateStringPrintf(ctx, "  SCAN all rows (est %lld)", plan.rows));
+        lines++;
+    }
+    ColumnSchema *order = page.orderBy ? schema_column(plan.sch, page.orderBy) : NULL;
+    if (order) {
+        long long matches = plan.root ? plan.root->est : wherePos != -1 ? 0 : plan.rows;
+        long long want = page.limit >= 0 && page.offset + page.limit < matches ? page.offset + page.limit : matches;
+        const char *name = RedisModule_StringPtrLen(order->name, NULL), *dir = page.desc ? "DESC" : "ASC";
+        if (order_uses_btree(order, want, plan.rows, matches))
+            RedisModule_ReplyWithString(ctx, RedisModule_CreateStringPrintf(ctx, "  ORDER BY %s %s: btree index walk",
+                                        name, dir));
+        else
+            RedisModule_ReplyWithString(ctx, RedisModule_CreateStringPrintf(ctx, "  ORDER BY %s %s: heap of the first %lld rows",
+                                        name, dir, want));
+        lines++;
+    }
+    RedisModule_ReplySetArrayLength(ctx, lines);
+    return REDISMODULE_OK;
+}
+
+/* ================== TABLE.INDEX.STATUS <namespace.table> ================== */
+// One entry per index: [column, index, state, done, total], composite indexes named by
+// their columns "c1,c2,...". A ready index counts the rows of the table; an index being
+// built the rows indexed so far and the rows when the build started; a dropped index the
+// keys deleted so far. Progress is nil on servers not running the job (replicas).
+static void index_status_entry(RedisModuleCtx *ctx, RedisModuleString *name, int kind, int dropping, int building,
+                               IndexJob *job, long long rows) {
+    RedisModule_ReplyWithArray(ctx, 5);
+    RedisModule_ReplyWithString(ctx, name);
+    RedisModule_ReplyWithSimpleString(ctx, index_type_name(kind));
+    if (dropping) {
+        RedisModule_ReplyWithSimpleString(ctx, "dropping");
+        if (job) RedisModule_ReplyWithLongLong(ctx, job->done);
+        else RedisModule_ReplyWithNull(ctx);
+        RedisModule_ReplyWithNull(ctx);
+    } else if (building) {
+        RedisModule_ReplyWithSimpleString(ctx, "building");
+        if (job) {
+            RedisModule_ReplyWithLongLong(ctx, job->done < job->total ? job->done : job->total);
+            RedisModule_ReplyWithLongLong(ctx, job->total);
+        } else {
+            RedisModule_ReplyWithNull(ctx);
+            RedisModule_ReplyWithNull(ctx);
+        }
+    } else {
+        RedisModule_ReplyWithSimpleString(ctx, "ready");
+        RedisModule_ReplyWithLongLong(ctx, rows);
+        RedisModule_ReplyWithLongLong(ctx, rows);
+    }
+}
+
+static int TableIndexStatusCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc != 2) return RedisModule_WrongArity(ctx);
+    RedisModule_AutoMemory(ctx);
+    TableSchema *sch = schema_get(ctx, argv[1]);
+    if (!sch)
+        return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
+
+    long long rows = table_row_count(ctx, argv[1], sch);
+    int db = RedisModule_GetSelectedDb(ctx);
+    long n = 0;
+    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_LEN);
+    for (int c = 0; c < sch->ncols; c++) {
+        ColumnSchema *cs = &sch->cols[c];
+        int kind = column_write_index(cs);
+        int dropping = sch->engine == ENGINE_HASH && index_job_state(ctx, argv[1], cs->name) == INDEX_NONE;
+        if (kind == INDEX_NONE && !dropping) continue;
+        index_status_entry(ctx, cs->name, cs == sch->primary ? INDEX_PRIMARY : kind, dropping,
+                           cs->building != INDEX_NONE, index_job_find(db, argv[1], cs->name), rows);
+        n++;
+    }
+    for (int c = 0; c < sch->ncomposites; c++) {
+        CompositeIndex *ci = &sch->composites[c];
+        index_status_entry(ctx, ci->name, ci->kind, 0, ci->building, index_job_find(db, argv[1], ci->name), rows);
+        n++;
+    }
+    // Dropped composite indexes are only left in {ns.t}:idx:jobs
+    RedisModuleCallReply *jobs = sch->engine == ENGINE_HASH
+        ? RedisModule_Call(ctx, "HKEYS", "s", fmt(ctx, "{%s}:idx:jobs", argv[1])) : NULL;
+    size_t m = jobs && RedisModule_CallReplyType(jobs) == REDISMODULE_REPLY_ARRAY ? RedisModule_CallReplyLength(jobs) : 0;
+    for (size_t j = 0; j < m; j++) {
+        RedisModuleString *name = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(jobs, j));
+        size_t nl; const char *nm = RedisModule_StringPtrLen(name, &nl);
+        if (!memchr(nm, ',', nl) || schema_composite(sch, name) || index_job_state(ctx, argv[1], name) != INDEX_NONE)
+            continue;
+        index_status_entry(ctx, name, INDEX_HASH, 1, 0, index_job_find(db, argv[1], name), rows);
+        n++;
+    }
+    RedisModule_ReplySetArrayLength(ctx, n);
+    return REDISMODULE_OK;
+}
+
+// Update the index of a column (kind, as column_write_index() gives it) when its value changes
+static void update_index_for_change(RedisModuleCtx *ctx, IndexBatch *b, RedisModuleString *table, ColumnSchema *cs,
+                                    int kind, RedisModuleString *oldv, RedisModuleString *newv, RedisModuleString *rowId) {
+    if (kind == INDEX_NONE) return;
+    if (oldv && RedisModule_StringCompare(oldv, newv) == 0) return;
+    if (oldv) index_rem(ctx, b, table, cs->name, kind, oldv, rowId);
+    index_add(ctx, b, table, cs->name, kind, newv, rowId);
+}
+
+// Replicate the rows ids[from..to) a background UPDATE (set) or DELETE (no set) went
+// through as one TABLE._APPLY, so that replicas change the same rows at the same point
+// of the replication stream whatever the WHERE clause matches there
+static void replicate_rows(RedisModuleCtx *ctx, RedisModuleString *table, IdSet ids, size_t from, size_t to,
+                           Assignments *set) {
+    if (from >= to) return;
+    RedisModuleString *list = idset_format(ctx, ids, from, to);
+    if (set)
+        RedisModule_Replicate(ctx, "TABLE._APPLY", "scscv", table, "UPDATE", list, "SET", set->argv, (size_t)set->n);
+    else
+        RedisModule_Replicate(ctx, "TABLE._APPLY", "scs", table, "DELETE", list);
+}
+
+/* ================== TABLE.STATS [<namespace.table> | RESET] ================== */
+// Without arguments: one entry per command [command, calls, usec, p50, p99, p99.9, max],
+// latencies in microseconds. With a table: its counters as field/value pairs.
+static int TableStatsCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc > 2) return RedisModule_WrongArity(ctx);
+    RedisModule_AutoMemory(ctx);
+    if (argc == 1) {
+        RedisModule_ReplyWithArray(ctx, STATS_NCMDS);
+        for (int c = 0; c < STATS_NCMDS; c++) {
+            LatencyStats *l = &g_cmd_stats[c];
+            RedisModule_ReplyWithArray(ctx, 7);
+            RedisModule_ReplyWithSimpleString(ctx, g_stats_names[c]);
+            RedisModule_ReplyWithLongLong(ctx, l->calls);
+            RedisModule_ReplyWithLongLong(ctx, l->usec);
+            RedisModule_ReplyWithLongLong(ctx, stats_percentile(l, 0.5));
+            RedisModule_ReplyWithLongLong(ctx, stats_percentile(l, 0.99));
+            RedisModule_ReplyWithLongLong(ctx, stats_percentile(l, 0.999));
+            RedisModule_ReplyWithLongLong(ctx, l->max);
+        }
+        return REDISMODULE_OK;
+    }
+    if (is_word(argv[1], "RESET")) {
+        stats_reset();
+        return RedisModule_ReplyWithSimpleString(ctx, "OK");
+    }
+    if (!schema_get(ctx, argv[1])) return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
+
+    TableStats *ts = stats_table(argv[1]);
+    char field[64];
+    RedisModule_ReplyWithArray(ctx, STATS_NCMDS * 4 + 14);
+    for (int c = 0; c < STATS_NCMDS; c++) {
+        snprintf(field, sizeof(field), "%s_calls", g_stats_names[c]);
+        RedisModule_ReplyWithSimpleString(ctx, field);
+        RedisModule_ReplyWithLongLong(ctx, ts->calls[c]);
+        snprintf(field, sizeof(field), "%s_usec", g_stats_names[c]);
+        RedisModule_ReplyWithSimpleString(ctx, field);
+        RedisModule_ReplyWithLongLong(ctx, ts->usec[c]);
+    }
+    RedisModule_ReplyWithSimpleString(ctx, "rows_scanned");
+    RedisModule_ReplyWithLongLong(ctx, ts->rowsScanned);
+    RedisModule_ReplyWithSimpleString(ctx, "rows_returned");
+    RedisModule_ReplyWithLongLong(ctx, ts->rowsReturned);
+    RedisModule_ReplyWithSimpleString(ctx, "index_reads");
+    RedisModule_ReplyWithLongLong(ctx, ts->indexReads);
+    RedisModule_ReplyWithSimpleString(ctx, "full_scans");
+    RedisModule_ReplyWithLongLong(ctx, ts->fullScans);
+    RedisModule_ReplyWithSimpleString(ctx, "scan_limit_errors");
+    RedisModule_ReplyWithLongLong(ctx, ts->scanLimit);
+    RedisModule_ReplyWithSimpleString(ctx, "cache_hits");
+    RedisModule_ReplyWithLongLong(ctx, ts->cacheHits);
+    RedisModule_ReplyWithSimpleString(ctx, "cache_misses");
+    RedisModule_ReplyWithLongLong(ctx, ts->cacheMisses);
+    return REDISMODULE_OK;
+}
+
+// INFO table: command latencies, the query counters summed over all tables and the size
+// of the result cache
+static void stats_info(RedisModuleInfoCtx *ctx, int for_crash_report) {
+    RedisModule_InfoAddSection(ctx, "stats");
+    char field[64];
+    for (int c = 0; c < STATS_NCMDS; c++) {
+        LatencyStats *l = &g_cmd_stats[c];
+        const char *n = g_stats_names[c];
+        snprintf(field, sizeof(field), "%s_calls", n);
+        RedisModule_InfoAddFieldLongLong(ctx, field, l->calls);
+        snprintf(field, sizeof(field), "%s_usec", n);
+        RedisModule_InfoAddFieldLongLong(ctx, field, l->usec);
+        snprintf(field, sizeof(field), "%s_p50_usec", n);
+        RedisModule_InfoAddFieldLongLong(ctx, field, stats_percentile(l, 0.5));
+        snprintf(field, sizeof(field), "%s_p99_usec", n);
+        RedisModule_InfoAddFieldLongLong(ctx, field, stats_percentile(l, 0.99));
+        snprintf(field, sizeof(field), "%s_p999_usec", n);
+        RedisModule_InfoAddFieldLongLong(ctx, field, stats_percentile(l, 0.999));
+        snprintf(field, sizeof(field), "%s_max_usec", n);
+        RedisModule_InfoAddFieldLongLong(ctx, field, l->max);
+    }
+    TableStats sum;
+    memset(&sum, 0, sizeof(sum));
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(g_table_stats, "^", NULL, 0);
+    TableStats *ts;
+    while (RedisModule_DictNextC(it, NULL, (void**)&ts)) {
+        sum.rowsScanned += ts->rowsScanned;
+        sum.rowsReturned += ts->rowsReturned;
+        sum.indexReads += ts->indexReads;
+        sum.fullScans += ts->fullScans;
+        sum.scanLimit += ts->scanLimit;
+        sum.cacheHits += ts->cacheHits;
+        sum.cacheMisses += ts->cacheMisses;
+    }
+    RedisModule_DictIteratorStop(it);
+    RedisModule_InfoAddFieldLongLong(ctx, "rows_scanned", sum.rowsScanned);
+    RedisModule_InfoAddFieldLongLong(ctx, "rows_returned", sum.rowsReturned);
+    RedisModule_InfoAddFieldLongLong(ctx, "index_reads", sum.indexReads);
+    RedisModule_InfoAddFieldLongLong(ctx, "full_scans", sum.fullScans);
+    RedisModule_InfoAddFieldLongLong(ctx, "scan_limit_errors", sum.scanLimit);
+    RedisModule_InfoAddFieldLongLong(ctx, "cache_hits", sum.cacheHits);
+    RedisModule_InfoAddFieldLongLong(ctx, "cache_misses", sum.cacheMisses);
+    RedisModule_InfoAddFieldLongLong(ctx, "cache_entries", g_result_cache ? (long long)RedisModule_DictSize(g_result_cache) : 0);
+    RedisModule_InfoAddFieldLongLong(ctx, "cache_bytes", (long long)g_cache_used);
+    RedisModule_InfoAddFieldLongLong(ctx, "cache_max_bytes", g_result_cache_mb * 1024 * 1024);
+}
+
+/* ================== TABLE.UPDATE <namespace.table> WHERE ... SET col=val ... ================== */
+#define UPDATE_SET_ERROR "ERR SET expects <col>=<value>"
+
+// Apply the assignments to the rows in ids. Rows deleted since they matched are skipped.
+// Returns NULL or an error message; *updated counts the rows changed until then
+static const char *update_rows(RedisModuleCtx *ctx, RedisModuleString *table, Assignments *set, IdSet ids,
+                               int background, long long *updated) {
+    *updated = 0;
+    TableSchema *sch = schema_get(ctx, table);
+    NativeTable *nt = sch->engine == ENGINE_NATIVE ? native_open(ctx, table, REDISMODULE_WRITE) : NULL;
+    const char *err = nt ? NULL : unique_check(ctx, table, sch, set->cols, set->vals, set->n, &ids);
+    if (err) return err;
+    int kinds[set->n ? set->n : 1];     // index of each assigned column
+    for (int j = 0; j < set->n; j++) kinds[j] = column_write_index(set->cols[j]);
+    IndexBatch b;
+    index_batch_init(&b, table);
+    size_t done = 0;                // rows replicated so far (background)
+    for (size_t i = 0; i < ids.len; i++) {
+        if (i && i % INDEX_BATCH_ROWS == 0) index_batch_flush(ctx, &b);
+        if (background && i && i % ASYNC_CHUNK_ROWS == 0) {
+            index_batch_flush(ctx, &b);
+            replicate_rows(ctx, table, ids, done, i, set);
+            done = i;
+            if (query_yield(ctx, table) != 0) err = TABLE_DROPPED_ERROR;
+            // The schema may have been altered meanwhile
+            else sch = schema_get(ctx, table);
+            if (!err) err = parse_assignments(ctx, sch, set->argv, set->n, UPDATE_SET_ERROR, set);
+            if (err) {
+                index_batch_free(ctx, &b);
+                return err;
+            }
+            for (int j = 0; j < set->n; j++) kinds[j] = column_write_index(set->cols[j]);
+            nt = sch->engine == ENGINE_NATIVE ? native_open(ctx, table, REDISMODULE_WRITE) : NULL;
         }
+        if (nt) {
+            long long slot = native_slot(nt, ids.ids[i]);
+            if (slot < 0) continue;
+            for (int j = 0; j < set->n; j++) {
+                size_t vlen; const char *v = RedisModule_StringPtrLen(set->vals[j], &vlen);
+                native_set_text(nt, (size_t)slot, native_column(nt, set->cols[j], 1), v, vlen);
+            }
+            (*updated)++;
+            continue;
+        }
+        RedisModuleString *id = RedisModule_CreateStringFromLongLong(ctx, (long long)ids.ids[i]);
+        RedisModuleKey *row = RedisModule_OpenKey(ctx, fmt2(ctx, "{%s}:%s", table, id), REDISMODULE_READ | REDISMODULE_WRITE);
+        if (RedisModule_KeyType(row) != REDISMODULE_KEYTYPE_HASH) {
+            RedisModule_CloseKey(row);
+            continue;
+        }
+        // Composite entries move from the old tuple to the new one
+        if (sch->ncomposites) composite_index_row(ctx, &b, table, sch, row, id, 0, set->cols, set->n);
+        partition_row(ctx, &b, table, sch, row, id, 0, set->cols, set->n);
+        for (int j = 0; j < set->n; j++) {
+            RedisModuleString *oldv = NULL;
+            RedisModule_HashGet(row, REDISMODULE_HASH_NONE, set->cols[j]->name, &oldv, NULL);
+            RedisModule_HashSet(row, REDISMODULE_HASH_NONE, set->cols[j]->name, set->vals[j], NULL);
+            update_index_for_change(ctx, &b, table, set->cols[j], kinds[j], oldv, set->vals[j], id);
+        }
+        if (sch->ncomposites) composite_index_row(ctx, &b, table, sch, row, id, 1, set->cols, set->n);
+        partition_row(ctx, &b, table, sch, row, id, 1, set->cols, set->n);
+        RedisModule_CloseKey(row);
+        (*updated)++;
     }
-    
-    return RedisModule_ReplyWithError(ctx, "ERR syntax: ADD COLUMN col:type[:index] | ADD INDEX col | DROP INDEX col");
+    index_batch_free(ctx, &b);
+    if (background) replicate_rows(ctx, table, ids, done, ids.len, set);
+    return NULL;
 }
 
-/* ================== TABLE.INSERT <namespace.table> <col>=<value> ... ================== */
-static int TableInsertCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-    if (argc < 3) return RedisModule_WrongArity(ctx);
-    RedisModule_AutoMemory(ctx);
+static const char *update_background(RedisModuleCtx *ctx, BackgroundQuery *q, IdSet ids) {
+    Assignments set;
+    const char *err = parse_assignments(ctx, schema_get(ctx, q->argv[1]), q->argv + q->setPos + 1,
+                                        q->argc - q->setPos - 1, UPDATE_SET_ERROR, &set);
+    return err ? err : update_rows(ctx, q->argv[1], &set, ids, 1, &q->count);
+}
+
+// Position of SET in an UPDATE, -1 if missing; *whereStart is set to the first condition
+static int update_clauses(RedisModuleString **argv, int argc, int *whereStart) {
+    int setPos = -1;
+    for (int i = 2; i < argc; i++) {
+        size_t l; const char *w = RedisModule_StringPtrLen(argv[i], &l);
+        if (l==3 && strncasecmp(w, "SET",3)==0) { setPos = i; break; }
+    }
+    *whereStart = 2;
+    if (setPos > 2) {
+        size_t l; const char *w = RedisModule_StringPtrLen(argv[2], &l);
+        if (l == 5 && strncasecmp(w, "WHERE", 5) == 0) *whereStart = 3;
+    }
+    return setPos;
+}
 
+// Run an UPDATE; prepared holds its parsed WHERE conditions when run by TABLE.EXEC, the
+// rows they matched are then replicated by ID.
+// The SET list is validated before any row is looked at: an UPDATE changes every
+// matching row or none
+static int update_run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, const WhereClause *prepared) {
     if (ensure_table_exists(ctx, argv[1]) != REDISMODULE_OK)
         return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
 
-    RedisModuleString *idKey = fmt(ctx, "{%s}:id", argv[1]);
-    RedisModuleCallReply *idReply = RedisModule_Call(ctx, "INCR", "s", idKey);
-    long long idNum = idReply ? RedisModule_CallReplyInteger(idReply) : 0;
-    RedisModuleString *rowId = RedisModule_CreateStringFromLongLong(ctx, idNum);
-
-    RedisModuleString *rowKey = fmt2(ctx, "{%s}:%s", argv[1], rowId);
-    RedisModuleKey *row = RedisModule_OpenKey(ctx, rowKey, REDISMODULE_WRITE);
-    RedisModuleString *rowsSet = fmt(ctx, "{%s}:rows", argv[1]);
+    int whereStart;
+    int setPos = update_clauses(argv, argc, &whereStart);
+    if (setPos == -1) return RedisModule_ReplyWithError(ctx, "ERR missing SET");
 
-    for (int i = 2; i < argc; i++) {
-        RedisModuleString *col=NULL, *val=NULL;
-        char op[3];
-        if (split_condition(ctx, argv[i], &col, op, &val) != REDISMODULE_OK || strcmp(op, "=") != 0)
-            return RedisModule_ReplyWithError(ctx, "ERR each field must be <col>=<value>");
-        if (validate_and_typecheck(ctx, argv[1], col, val) != REDISMODULE_OK)
-            return RedisModule_ReplyWithError(ctx, "ERR invalid column or type");
-        RedisModule_HashSet(row, REDISMODULE_HASH_NONE, col, val, NULL);
-        
-        // Only create index if column is indexed
-        if (is_column_indexed(ctx, argv[1], col)) {
-            RedisModuleString *idxKey = fmt3(ctx, "{%s}:idx:%s:%s", argv[1], col, val);
-            RedisModule_Call(ctx, "SADD", "ss", idxKey, rowId);
+    Assignments set;
+    TableSchema *sch = schema_get(ctx, argv[1]);
+    const char *err = parse_assignments(ctx, sch, argv + setPos + 1, argc - setPos - 1, UPDATE_SET_ERROR, &set);
+    if (err) return RedisModule_ReplyWithError(ctx, err);
+    if (sch->shards && shard_parent(ctx, argv[1])) {
+        // A row stays in the shard of its primary key
+        for (int i = 0; i < set.n; i++)
+            if (set.cols[i] == sch->primary)
+                return RedisModule_ReplyWithError(ctx, "ERR the primary key of a sharded table cannot be updated");
+        ShardRequest *r = shard_request_new(argv, argc, shard_merge_sum);
+        shard_request_add_all(ctx, r, argv, argc, sch->shards);
+        return shard_request_run(ctx, r);
+    }
+    
+    IdSet ids;
+    if (whereStart >= setPos) {
+        ids = idset_all_rows(ctx, argv[1]);
+    } else {
+        QueryPlan plan;
+        err = prepared ? where_plan_clause(ctx, argv[1], prepared, 0, &plan)
+                       : where_plan(ctx, argv[1], argv, whereStart, setPos, 0, &plan);
+        if (err) return RedisModule_ReplyWithError(ctx, err);
+        if (query_in_background(ctx, &plan)) {
+            BackgroundQuery *q = query_new(argv, argc, whereStart, setPos, 0);
+            if (prepared) query_set_where(q, prepared);
+            q->setPos = setPos;
+            q->apply = update_background;
+            q->stat = STATS_UPDATE;
+            return query_start(ctx, q);
         }
+        if ((err = where_exec(ctx, &plan, &ids)) != NULL) return RedisModule_ReplyWithError(ctx, err);
     }
 
-    RedisModule_Call(ctx, "SADD", "ss", rowsSet, rowId);
-    return RedisModule_ReplyWithString(ctx, rowId);
+    long long updated;
+    if ((err = update_rows(ctx, argv[1], &set, ids, 0, &updated)) != NULL)
+        return RedisModule_ReplyWithError(ctx, err);
+    if (updated && prepared && whereStart < setPos) replicate_rows(ctx, argv[1], ids, 0, ids.len, &set);
+    else if (updated && prepared) RedisModule_Replicate(ctx, "TABLE.UPDATE", "v", argv + 1, (size_t)(argc - 1));
+    else if (updated) RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithLongLong(ctx, updated);
 }
 
-// Collect members of an index set into a dictionary
-static void dict_add_set_members(RedisModuleCtx *ctx, RedisModuleDict *dict, RedisModuleString *setKey) {
-    RedisModuleCallReply *r = RedisModule_Call(ctx, "SMEMBERS", "s", setKey);
-    if (!r || RedisModule_CallReplyType(r) != REDISMODULE_REPLY_ARRAY) return;
-    size_t n = RedisModule_CallReplyLength(r);
-    for (size_t i = 0; i < n; i++) {
-        RedisModuleCallReply *e = RedisModule_CallReplyArrayElement(r, i);
-        RedisModuleString *id = RedisModule_CreateStringFromCallReply(e);
-        RedisModule_DictSet(dict, id, NULL);
+static int TableUpdateCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc < 5) return RedisModule_WrongArity(ctx);
+    RedisModule_AutoMemory(ctx);
+    stats_begin();
+    int rc = update_run(ctx, argv, argc, NULL);
+    stats_end(ctx, STATS_UPDATE, argv[1]);
+    result_cache_forget_table(ctx, argv[1]);
+    return rc;
+}
+
+/* ================== TABLE.DELETE <namespace.table> WHERE ... ================== */
+// Rows of a hash table deleted so far by delete_rows(), not yet removed
+typedef struct {
+    IndexBatch index;
+    RedisModuleString *rowKeys[INDEX_BATCH_ROWS];
+    RedisModuleString *ids[INDEX_BATCH_ROWS];
+    size_t n;
+    int ttl;                        // the TTL shadow keys of the rows go too
+} DeleteBatch;
+
+// Apply the index edits of the rows of a batch, then delete them by one DEL and one SREM
+static void delete_flush(RedisModuleCtx *ctx, DeleteBatch *d, RedisModuleString *rowsSet, long long *deleted) {
+    index_batch_flush(ctx, &d->index);
+    if (!d->n) return;
+    RedisModuleCallReply *r = RedisModule_Call(ctx, "DEL", "v", d->rowKeys, d->n);
+    if (r && RedisModule_CallReplyType(r) == REDISMODULE_REPLY_INTEGER) *deleted += RedisModule_CallReplyInteger(r);
+    RedisModule_Call(ctx, "SREM", "sv", rowsSet, d->ids, d->n);
+    if (d->ttl) {
+        for (size_t i = 0; i < d->n; i++) d->rowKeys[i] = fmt2(ctx, "{%s}:ttl:%s", d->index.table, d->ids[i]);
+        RedisModule_Call(ctx, "UNLINK", "v", d->rowKeys, d->n);
+        RedisModule_Call(ctx, "ZREM", "sv", fmt(ctx, "{%s}:ttl", d->index.table), d->ids, d->n);
     }
+    d->n = 0;
 }
 
-// Filter dictionary based on comparison operator
-// Returns 0 on success, -1 if scan limit exceeded
-static int dict_filter_condition(RedisModuleCtx *ctx, RedisModuleDict *dict, RedisModuleString *table,
-                                  RedisModuleString *col, const char *op, RedisModuleString *val) {
-    // Get column type
-    RedisModuleKey *schemaKey = RedisModule_OpenKey(ctx, fmt(ctx, "schema:{%s}", table), REDISMODULE_READ);
-    RedisModuleString *typeStr = NULL;
-    RedisModule_HashGet(schemaKey, REDISMODULE_HASH_NONE, col, &typeStr, NULL);
-    const char *type = "string";
-    if (typeStr) {
-        size_t tlen; const char *t = RedisModule_StringPtrLen(typeStr, &tlen);
-        if (tlen == 7 && strncasecmp(t, "integer", 7) == 0) type = "integer";
-        else if (tlen == 5 && strncasecmp(t, "float", 5) == 0) type = "float";
-        else if (tlen == 4 && strncasecmp(t, "date", 4) == 0) type = "date";
-    }
-
-    size_t vlen; const char *vstr = RedisModule_StringPtrLen(val, &vlen);
-
-    // First pass: collect keys to remove (using dynamic allocation to avoid arbitrary limits)
-    size_t toRemoveCapacity = INITIAL_FILTER_CAPACITY;
-    size_t removeCount = 0;
-    RedisModuleString **toRemove = RedisModule_Alloc(sizeof(RedisModuleString*) * toRemoveCapacity);
-    if (toRemove == NULL) {
-        // Out of memory - cannot filter, return without modifying dict
-        return -1;
-    }
-
-    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(dict, "^", NULL, 0);
-    RedisModuleString *key; void *dummy;
-    size_t rowsScanned = 0;
-    while ((key = RedisModule_DictNext(ctx, it, &dummy)) != NULL) {
-        // Check scan limit to prevent blocking Redis on large datasets
-        if (++rowsScanned > (size_t)g_max_rows_scan_limit) {
-            RedisModule_DictIteratorStop(it);
-            RedisModule_Free(toRemove);
-            return -1; // Scan limit exceeded
-        }
-        
-        RedisModuleString *rowKey = fmt2(ctx, "{%s}:%s", table, key);
-        RedisModuleCallReply *v = RedisModule_Call(ctx, "HGET", "ss", rowKey, col);
-        int keep = 0;
-        if (v && RedisModule_CallReplyType(v) == REDISMODULE_REPLY_STRING) {
-            RedisModuleString *cur = RedisModule_CreateStringFromCallReply(v);
-            size_t clen; const char *cstr = RedisModule_StringPtrLen(cur, &clen);
-            keep = compare_values(cstr, vstr, op, type);
-        }
-        if (!keep) {
-            // Resize array if needed (doubles capacity each time)
-            if (removeCount >= toRemoveCapacity) {
-                toRemoveCapacity *= 2;
-                RedisModuleString **newToRemove = RedisModule_Realloc(toRemove, sizeof(RedisModuleString*) * toRemoveCapacity);
-                if (newToRemove == NULL) {
-                    // Out of memory during realloc - stop collecting, work with what we have
-                    break;
-                }
-                toRemove = newToRemove;
+// Delete the rows in ids; returns NULL or an error message
+static const char *delete_rows(RedisModuleCtx *ctx, RedisModuleString *table, IdSet ids, int background,
+                               long long *deleted) {
+    *deleted = 0;
+    TableSchema *sch = schema_get(ctx, table);
+    RedisModuleString *rowsSet = fmt(ctx, "{%s}:rows", table);
+    NativeTable *nt = sch->engine == ENGINE_NATIVE ? native_open(ctx, table, REDISMODULE_WRITE) : NULL;
+    DeleteBatch *d = RedisModule_PoolAlloc(ctx, sizeof(DeleteBatch));
+    index_batch_init(&d->index, table);
+    d->n = 0;
+    d->ttl = sch->ttl;
+    size_t done = 0;                // rows replicated so far (background)
+
+    for (size_t i = 0; i < ids.len; i++) {
+        if (d->n == INDEX_BATCH_ROWS) delete_flush(ctx, d, rowsSet, deleted);
+        if (background && i && i % ASYNC_CHUNK_ROWS == 0) {
+            delete_flush(ctx, d, rowsSet, deleted);
+            replicate_rows(ctx, table, ids, done, i, NULL);
+            done = i;
+            if (query_yield(ctx, table) != 0) {
+                index_batch_free(ctx, &d->index);
+                return TABLE_DROPPED_ERROR;
             }
-            toRemove[removeCount++] = key;
+            sch = schema_get(ctx, table);
+            nt = sch->engine == ENGINE_NATIVE ? native_open(ctx, table, REDISMODULE_WRITE) : NULL;
+            d->ttl = sch->ttl;
+        }
+        if (nt) {
+            long long slot = native_slot(nt, ids.ids[i]);
+            if (slot < 0) continue;
+            native_delete_slot(nt, (size_t)slot);
+            (*deleted)++;
+            continue;
         }
+        RedisModuleString *id = RedisModule_CreateStringFromLongLong(ctx, (long long)ids.ids[i]);
+        RedisModuleString *rowKey = fmt2(ctx, "{%s}:%s", table, id);
+        index_rem_row(ctx, &d->index, table, sch, rowKey, id);
+        d->rowKeys[d->n] = rowKey;
+        d->ids[d->n++] = id;
     }
-    RedisModule_DictIteratorStop(it);
+    delete_flush(ctx, d, rowsSet, deleted);
+    index_batch_free(ctx, &d->index);
+    if (background) replicate_rows(ctx, table, ids, done, ids.len, NULL);
+    return NULL;
+}
+static const char *delete_background(RedisModuleCtx *ctx, BackgroundQuery *q, IdSet ids) {
+    return delete_rows(ctx, q->argv[1], ids, 1, &q->count);
+}
 
-    // Second pass: remove the collected keys
-    for (size_t i = 0; i < removeCount; i++) {
-        RedisModule_DictDel(dict, toRemove[i], NULL);
-    }
+/* ================== Row TTL ================== */
+// A row inserted with a TTL has a shadow key {ns.t}:ttl:<id> expiring with it, and an
+// entry in the ZSET {ns.t}:ttl scored by its expiry time in ms. The expiry of a shadow
+// key on the master queues the row, deleted from a timer with its index entries as any
+// other row and replicated as TABLE._APPLY <ns.t> DELETE <ids>. Shadow keys expired while
+// no notification could be sent (before a restart, a failover) are found in {ns.t}:ttl
+// by ttl_resume().
 
-    RedisModule_Free(toRemove);
-    return 0; // Success
-}
+typedef struct {
+    RedisModuleString *table;   // retained
+    int db;
+    uint64_t *ids;
+    size_t len, cap;
+} TtlExpired;
 
-/* ================== TABLE.SELECT <namespace.table> [WHERE col op val (AND|OR col op val ...)] ================== */
-static int TableSelectCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-    if (argc < 2) return RedisModule_WrongArity(ctx);
-    RedisModule_AutoMemory(ctx);
-    if (ensure_table_exists(ctx, argv[1]) != REDISMODULE_OK)
-        return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
+// "<db>:<ns.t>" -> TtlExpired*, rows waiting for the timer
+static RedisModuleDict *g_ttl_expired = NULL;
+static int g_ttl_tick_pending = 0;
 
-    int wherePos = -1;
-    for (int i = 2; i < argc; i++) {
-        size_t l; const char *w = RedisModule_StringPtrLen(argv[i], &l);
-        if (l == 5 && strncasecmp(w, "WHERE", 5) == 0) { wherePos = i; break; }
+static void ttl_expire_tick(RedisModuleCtx *ctx, void *data) {
+    (void)data;
+    RedisModule_AutoMemory(ctx);
+    g_ttl_tick_pending = 0;
+    RedisModuleDict *expired = g_ttl_expired;
+    g_ttl_expired = RedisModule_CreateDict(NULL);
+    int selected = RedisModule_GetSelectedDb(ctx);
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(expired, "^", NULL, 0);
+    TtlExpired *e;
+    while (RedisModule_DictNextC(it, NULL, (void**)&e)) {
+        RedisModule_SelectDb(ctx, e->db);
+        TableSchema *sch = schema_get(ctx, e->table);
+        IdSet ids = { e->ids, e->len };
+        idset_normalize(&ids);
+        long long deleted = 0;
+        if (sch && sch->engine == ENGINE_HASH && jobs_run_here(ctx)) {
+            delete_rows(ctx, e->table, ids, 0, &deleted);
+            replicate_rows(ctx, e->table, ids, 0, ids.len, NULL);
+            result_cache_forget_table(ctx, e->table);
+        }
+        RedisModule_FreeString(NULL, e->table);
+        RedisModule_Free(e->ids);
+        RedisModule_Free(e);
     }
+    RedisModule_DictIteratorStop(it);
+    RedisModule_FreeDict(NULL, expired);
+    RedisModule_SelectDb(ctx, selected);
+}
 
-    RedisModuleDict *ids = RedisModule_CreateDict(ctx);
-    if (wherePos == -1) {
-        dict_add_set_members(ctx, ids, fmt(ctx, "{%s}:rows", argv[1]));
-    } else {
-        int i = wherePos + 1;
-        int haveSeed = 0;
-        while (i < argc) {
-            RedisModuleString *col=NULL, *val=NULL;
-            char op[3];
-            if (split_condition(ctx, argv[i], &col, op, &val) != REDISMODULE_OK)
-                return RedisModule_ReplyWithError(ctx, "ERR condition must be <col><op><value>");
-            
-            // Check if column is indexed (only for = operator, others need full scan)
-            if (strcmp(op, "=") != 0 || !is_column_indexed(ctx, argv[1], col)) {
-                if (strcmp(op, "=") == 0) {
-                    return RedisModule_ReplyWithError(ctx, "ERR search cannot be done on non-indexed column");
-                }
-                // For comparison operators, we need to scan all rows
-                if (!haveSeed) {
-                    dict_add_set_members(ctx, ids, fmt(ctx, "{%s}:rows", argv[1]));
-                    haveSeed = 1;
-                }
-                if (dict_filter_condition(ctx, ids, argv[1], col, op, val) != 0) {
-                    return RedisModule_ReplyWithError(ctx, "ERR query scan limit exceeded (max 100000 rows). Use indexed columns or add more specific conditions.");
-                }
-                i++;
-            } else {
-                // Indexed equality search
-                if (!haveSeed) {
-                    dict_add_set_members(ctx, ids, fmt3(ctx, "{%s}:idx:%s:%s", argv[1], col, val));
-                    haveSeed = 1; i++;
-                } else {
-                    size_t opl; const char *ops = RedisModule_StringPtrLen(argv[i-1], &opl);
-                    if (opl==3 && strncasecmp(ops, "AND",3)==0) {
-                        if (dict_filter_condition(ctx, ids, argv[1], col, op, val) != 0) {
-                            return RedisModule_ReplyWithError(ctx, "ERR query scan limit exceeded (max 100000 rows). Use indexed columns or add more specific conditions.");
-                        }
-                        i++;
-                    } else if (opl==2 && strncasecmp(ops, "OR",2)==0) {
-                        dict_add_set_members(ctx, ids, fmt3(ctx, "{%s}:idx:%s:%s", argv[1], col, val));
-                        i++;
-                    } else {
-                        return RedisModule_ReplyWithError(ctx, "ERR expected AND/OR between conditions");
-                    }
-                }
-            }
-            
-            if (i < argc) {
-                size_t tl; const char *ts = RedisModule_StringPtrLen(argv[i], &tl);
-                if ((tl==3 && strncasecmp(ts, "AND",3)==0) || (tl==2 && strncasecmp(ts, "OR",2)==0)) {
-                    i++;
-                    if (i >= argc) return RedisModule_ReplyWithError(ctx, "ERR dangling operator");
-                }
-            }
-        }
+// Queue the row id of the table name[0..nlen) of the selected database for deletion
+static void ttl_queue(RedisModuleCtx *ctx, const char *name, size_t nlen, uint64_t id) {
+    char key[512];
+    int db = RedisModule_GetSelectedDb(ctx);
+    size_t klen = schema_cache_key(key, sizeof(key), db, name, nlen);
+    if (!klen) return;
+    TtlExpired *e = RedisModule_DictGetC(g_ttl_expired, key, klen, NULL);
+    if (!e) {
+        e = RedisModule_Calloc(1, sizeof(TtlExpired));
+        e->table = RedisModule_CreateString(NULL, name, nlen);
+        e->db = db;
+        RedisModule_DictSetC(g_ttl_expired, key, klen, e);
+    }
+    if (e->len == e->cap) {
+        e->cap = e->cap ? e->cap * 2 : 16;
+        e->ids = RedisModule_Realloc(e->ids, sizeof(uint64_t) * e->cap);
+    }
+    e->ids[e->len++] = id;
+    if (!g_ttl_tick_pending) {
+        g_ttl_tick_pending = 1;
+        RedisModule_CreateTimer(ctx, 0, ttl_expire_tick, NULL);
     }
+}
 
-    // Build reply
-    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(ids, "^", NULL, 0);
-    RedisModuleString *id; void *dummy;
-    size_t rowCount = 0;
-    while (RedisModule_DictNext(ctx, it, &dummy)) rowCount++;
-    RedisModule_DictIteratorStop(it);
+// Expiry of a shadow key {ns.t}:ttl:<id>
+static int ttl_keyspace_event(RedisModuleCtx *ctx, int type, const char *event, RedisModuleString *key) {
+    (void)type; (void)event;
+    size_t len; const char *k = RedisModule_StringPtrLen(key, &len);
+    const char *close = len > 1 && k[0] == '{' ? memchr(k, '}', len) : NULL;
+    size_t at = close ? (size_t)(close - k) + 6 : len;
+    if (at >= len || memcmp(close, "}:ttl:", 6) != 0 || !jobs_run_here(ctx)) return REDISMODULE_OK;
+    uint64_t id = idset_parse_id(k + at, len - at);
+    if (id) ttl_queue(ctx, k + 1, (size_t)(close - k) - 1, id);
+    return REDISMODULE_OK;
+}
 
-    RedisModule_ReplyWithArray(ctx, rowCount);
-    it = RedisModule_DictIteratorStartC(ids, "^", NULL, 0);
-    while ((id = RedisModule_DictNext(ctx, it, &dummy)) != NULL) {
-        RedisModuleString *rowKey = fmt2(ctx, "{%s}:%s", argv[1], id);
-        RedisModuleCallReply *all = RedisModule_Call(ctx, "HGETALL", "s", rowKey);
-        if (!all || RedisModule_CallReplyType(all) != REDISMODULE_REPLY_ARRAY) {
-            RedisModule_ReplyWithNull(ctx);
-            continue;
-        }
-        size_t n = RedisModule_CallReplyLength(all);
-        RedisModule_ReplyWithArray(ctx, n);
-        for (size_t j = 0; j < n; j++) {
-            RedisModuleCallReply *e = RedisModule_CallReplyArrayElement(all, j);
-            RedisModule_ReplyWithString(ctx, RedisModule_CreateStringFromCallReply(e));
+// Queue the rows of every table whose TTL has passed, once the master has loaded its
+// dataset or a replica has become the master. The tables are those of the catalog with
+// the ttl option, set by their first row with a TTL
+static void ttl_resume(RedisModuleCtx *ctx) {
+    if (!(RedisModule_GetContextFlags(ctx) & REDISMODULE_CTX_FLAGS_MASTER)) return;
+    RedisModule_AutoMemory(ctx);
+    int selected = RedisModule_GetSelectedDb(ctx);
+    RedisModuleString *now = RedisModule_CreateStringFromLongLong(ctx, (long long)RedisModule_Milliseconds());
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(g_catalog, "^", NULL, 0);
+    size_t kl; const char *k;
+    while ((k = RedisModule_DictNextC(it, &kl, NULL)) != NULL) {
+        // "<db>:<ns>\0<t>" to the table "ns.t" of database db
+        const char *ns = memchr(k, ':', kl) + 1;
+        char name[256];
+        size_t nlen = kl - (size_t)(ns - k);
+        memcpy(name, ns, nlen);
+        name[strnlen(name, nlen)] = '.';
+        RedisModuleString *table = RedisModule_CreateString(ctx, name, nlen);
+        RedisModule_SelectDb(ctx, atoi(k));
+        TableSchema *sch = schema_get(ctx, table);
+        if (!sch || !sch->ttl) continue;
+        RedisModuleCallReply *ids = RedisModule_Call(ctx, "ZRANGEBYSCORE", "scs", fmt(ctx, "{%s}:ttl", table), "-inf", now);
+        size_t m = ids && RedisModule_CallReplyType(ids) == REDISMODULE_REPLY_ARRAY ? RedisModule_CallReplyLength(ids) : 0;
+        for (size_t j = 0; j < m; j++) {
+            size_t il; const char *id = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(ids, j), &il);
+            uint64_t rowId = id ? idset_parse_id(id, il) : 0;
+            if (rowId) ttl_queue(ctx, name, nlen, rowId);
         }
     }
     RedisModule_DictIteratorStop(it);
-    return REDISMODULE_OK;
+    RedisModule_SelectDb(ctx, selected);
 }
 
-// Update indices for a single column when value changes
-static void update_index_for_change(RedisModuleCtx *ctx, RedisModuleString *table, RedisModuleString *col,
-                                    RedisModuleString *oldv, RedisModuleString *newv, RedisModuleString *rowId) {
-    if (!is_column_indexed(ctx, table, col)) return;
-    if (oldv && RedisModule_StringCompare(oldv, newv) == 0) return;
-    if (oldv) {
-        RedisModuleString *oldIdx = fmt3(ctx, "{%s}:idx:%s:%s", table, col, oldv);
-        RedisModule_Call(ctx, "SREM", "ss", oldIdx, rowId);
+static void jobs_server_event(RedisModuleCtx *ctx, RedisModuleEvent e, uint64_t subevent, void *data) {
+    if (e.id == REDISMODULE_EVENT_LOADING) {
+        schema_invalidate_all(ctx);
+        // The loaded dataset replaces the current one
+        if (subevent == REDISMODULE_SUBEVENT_LOADING_RDB_START || subevent == REDISMODULE_SUBEVENT_LOADING_AOF_START ||
+            subevent == REDISMODULE_SUBEVENT_LOADING_REPL_START) catalog_clear(-1);
+        else if (subevent == REDISMODULE_SUBEVENT_LOADING_FAILED) catalog_scan(ctx);
+        if (subevent == REDISMODULE_SUBEVENT_LOADING_ENDED) {
+            if (!catalog_loaded_events()) catalog_scan(ctx);
+            index_jobs_resume(ctx);
+            purge_jobs_resume(ctx);
+            ttl_resume(ctx);
+        }
+    } else if (e.id == REDISMODULE_EVENT_REPLICATION_ROLE_CHANGED &&
+               subevent == REDISMODULE_EVENT_REPLROLECHANGED_NOW_MASTER) {
+        index_jobs_resume(ctx);
+        purge_jobs_resume(ctx);
+        ttl_resume(ctx);
     }
-    RedisModuleString *newIdx = fmt3(ctx, "{%s}:idx:%s:%s", table, col, newv);
-    RedisModule_Call(ctx, "SADD", "ss", newIdx, rowId);
 }
 
-/* ================== TABLE.UPDATE <namespace.table> WHERE ... SET col=val ... ================== */
-static int TableUpdateCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-    if (argc < 5) return RedisModule_WrongArity(ctx);
-    RedisModule_AutoMemory(ctx);
-    if (ensure_table_exists(ctx, argv[1]) != REDISMODULE_OK)
-        return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
+// Replace a native table by an empty one keeping its row IDs, the old one is freed by
+// UNLINK off the main thread; returns the number of rows deleted
+static long long native_truncate(RedisModuleCtx *ctx, RedisModuleString *table) {
+    NativeTable *nt = native_open(ctx, table, REDISMODULE_READ);
+    if (!nt || !nt->nrows) return 0;
+    long long rows = (long long)nt->nrows;
+    NativeTable *empty = native_new();
+    empty->last_id = nt->last_id;
+    RedisModuleString *dataKey = fmt(ctx, "{%s}:data", table);
+    RedisModule_Call(ctx, "UNLINK", "s", dataKey);
+    RedisModuleKey *k = RedisModule_OpenKey(ctx, dataKey, REDISMODULE_WRITE);
+    RedisModule_ModuleTypeSetValue(k, NativeTableType, empty);
+    RedisModule_CloseKey(k);
+    return rows;
+}
 
-    int setPos = -1;
+// Position of WHERE in a DELETE, -1 if none
+static int delete_where(RedisModuleString **argv, int argc) {
     for (int i = 2; i < argc; i++) {
         size_t l; const char *w = RedisModule_StringPtrLen(argv[i], &l);
-        if (l==3 && strncasecmp(w, "SET",3)==0) { setPos = i; break; }
+        if (l==5 && strncasecmp(w, "WHERE",5)==0) return i;
     }
-    if (setPos == -1) return RedisModule_ReplyWithError(ctx, "ERR missing SET");
+    return -1;
+}
 
-    int whereStart = 2;
-    if (setPos > 2) {
-        size_t l; const char *w = RedisModule_StringPtrLen(argv[2], &l);
-        if (l == 5 && strncasecmp(w, "WHERE", 5) == 0) whereStart = 3;
+// Run a DELETE; prepared holds its parsed WHERE conditions when run by TABLE.EXEC, the
+// rows they matched are then replicated by ID
+static int delete_run(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, const WhereClause *prepared) {
+    TableSchema *sch = schema_get(ctx, argv[1]);
+    if (!sch)
+        return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
+
+    if (sch->shards && shard_parent(ctx, argv[1])) {
+        ShardRequest *r = shard_request_new(argv, argc, shard_merge_sum);
+        shard_request_add_all(ctx, r, argv, argc, sch->shards);
+        return shard_request_run(ctx, r);
     }
-    
-    RedisModuleDict *ids = RedisModule_CreateDict(ctx);
-    if (whereStart >= setPos) {
-        dict_add_set_members(ctx, ids, fmt(ctx, "{%s}:rows", argv[1]));
-    } else {
-        int i = whereStart;
-        int haveSeed = 0;
-        while (i < setPos) {
-            RedisModuleString *col=NULL,*val=NULL;
-            char op[3];
-            if (split_condition(ctx, argv[i], &col, op, &val) != REDISMODULE_OK)
-                return RedisModule_ReplyWithError(ctx, "ERR condition must be <col><op><value>");
-            
-            if (strcmp(op, "=") == 0 && is_column_indexed(ctx, argv[1], col)) {
-                if (!haveSeed) {
-                    dict_add_set_members(ctx, ids, fmt3(ctx, "{%s}:idx:%s:%s", argv[1], col, val));
-                    haveSeed = 1; i++;
-                } else {
-                    size_t opl; const char *ops = RedisModule_StringPtrLen(argv[i-1], &opl);
-                    if (opl==3 && strncasecmp(ops, "AND",3)==0) {
-                        if (dict_filter_condition(ctx, ids, argv[1], col, op, val) != 0) {
-                            return RedisModule_ReplyWithError(ctx, "ERR query scan limit exceeded (max 100000 rows). Use indexed columns or add more specific conditions.");
-                        }
-                        i++;
-                    } else if (opl==2 && strncasecmp(ops, "OR",2)==0) {
-                        dict_add_set_members(ctx, ids, fmt3(ctx, "{%s}:idx:%s:%s", argv[1], col, val));
-                        i++;
-                    } else return RedisModule_ReplyWithError(ctx, "ERR expected AND/OR between conditions");
-                }
-            } else {
-                if (!haveSeed) {
-                    dict_add_set_members(ctx, ids, fmt(ctx, "{%s}:rows", argv[1]));
-                    haveSeed = 1;
-                }
-                if (dict_filter_condition(ctx, ids, argv[1], col, op, val) != 0) {
-                    return RedisModule_ReplyWithError(ctx, "ERR query scan limit exceeded (max 100000 rows). Use indexed columns or add more specific conditions.");
-                }
-                i++;
-            }
-            
-            if (i < setPos) {
-                size_t tl; const char *ts = RedisModule_StringPtrLen(argv[i], &tl);
-                if ((tl==3 && strncasecmp(ts, "AND",3)==0) || (tl==2 && strncasecmp(ts, "OR",2)==0)) {
-                    i++; if (i>=setPos) return RedisModule_ReplyWithError(ctx, "ERR dangling operator");
-                }
-            }
-        }
+
+    int wherePos = delete_where(argv, argc);
+
+    // Deleting every row of a native table, or of a large hash table, returns at once
+    if (wherePos == -1 && (sch->engine == ENGINE_NATIVE || table_row_count(ctx, argv[1], sch) > PURGE_JOB_ROWS)) {
+        long long deleted = sch->engine == ENGINE_NATIVE ? native_truncate(ctx, argv[1]) : purge_table(ctx, argv[1], 0);
+        if (deleted && prepared) RedisModule_Replicate(ctx, "TABLE.DELETE", "s", argv[1]);
+        else if (deleted) RedisModule_ReplicateVerbatim(ctx);
+        return RedisModule_ReplyWithLongLong(ctx, deleted);
     }
 
-    long long updated = 0;
-    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(ids, "^", NULL, 0);
-    RedisModuleString *id; void *dummy;
-    while ((id = RedisModule_DictNext(ctx, it, &dummy)) != NULL) {
-        RedisModuleString *rowKey = fmt2(ctx, "{%s}:%s", argv[1], id);
-        for (int j = setPos + 1; j < argc; j++) {
-            RedisModuleString *col=NULL,*val=NULL;
-            char op[3];
-            if (split_condition(ctx, argv[j], &col, op, &val) != REDISMODULE_OK || strcmp(op, "=") != 0)
-                return RedisModule_ReplyWithError(ctx, "ERR SET expects <col>=<value>");
-            if (validate_and_typecheck(ctx, argv[1], col, val) != REDISMODULE_OK)
-                return RedisModule_ReplyWithError(ctx, "ERR invalid column or type");
-            
-            RedisModuleCallReply *oldr = RedisModule_Call(ctx, "HGET", "ss", rowKey, col);
-            RedisModuleString *oldv = NULL;
-            if (oldr && RedisModule_CallReplyType(oldr) == REDISMODULE_REPLY_STRING)
-                oldv = RedisModule_CreateStringFromCallReply(oldr);
-            
-            RedisModule_Call(ctx, "HSET", "sss", rowKey, col, val);
-            update_index_for_change(ctx, argv[1], col, oldv, val, id);
+    IdSet ids;
+    const char *err;
+    if (wherePos == -1) {
+        ids = idset_all_rows(ctx, argv[1]);
+    } else {
+        QueryPlan plan;
+        err = prepared ? where_plan_clause(ctx, argv[1], prepared, 0, &plan)
+                       : where_plan(ctx, argv[1], argv, wherePos + 1, argc, 0, &plan);
+        if (err) return RedisModule_ReplyWithError(ctx, err);
+        if (query_in_background(ctx, &plan)) {
+            BackgroundQuery *q = query_new(argv, argc, wherePos + 1, argc, 0);
+            if (prepared) query_set_where(q, prepared);
+            q->apply = delete_background;
+            q->stat = STATS_DELETE;
+            return query_start(ctx, q);
         }
-        updated++;
+        if ((err = where_exec(ctx, &plan, &ids)) != NULL) return RedisModule_ReplyWithError(ctx, err);
     }
-    RedisModule_DictIteratorStop(it);
-    return RedisModule_ReplyWithLongLong(ctx, updated);
+
+    long long deleted;
+    if ((err = delete_rows(ctx, argv[1], ids, 0, &deleted)) != NULL) return RedisModule_ReplyWithError(ctx, err);
+    if (deleted && prepared && wherePos != -1) replicate_rows(ctx, argv[1], ids, 0, ids.len, NULL);
+    else if (deleted && prepared) RedisModule_Replicate(ctx, "TABLE.DELETE", "s", argv[1]);
+    else if (deleted) RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithLongLong(ctx, deleted);
 }
 
-/* ================== TABLE.DELETE <namespace.table> WHERE ... ================== */
 static int TableDeleteCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     if (argc < 2) return RedisModule_WrongArity(ctx);
     RedisModule_AutoMemory(ctx);
-    if (ensure_table_exists(ctx, argv[1]) != REDISMODULE_OK)
-        return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
+    stats_begin();
+    int rc = delete_run(ctx, argv, argc, NULL);
+    stats_end(ctx, STATS_DELETE, argv[1]);
+    result_cache_forget_table(ctx, argv[1]);
+    return rc;
+}
 
-    RedisModuleDict *ids = RedisModule_CreateDict(ctx);
-    int hasWhere = 0;
-    for (int i = 2; i < argc; i++) {
-        size_t l; const char *w = RedisModule_StringPtrLen(argv[i], &l);
-        if (l==5 && strncasecmp(w, "WHERE",5)==0) { hasWhere=1; break; }
+/* ================== TABLE.PREPARE / TABLE.EXEC / TABLE.DEALLOCATE ================== */
+// A prepared statement is a SELECT, UPDATE or DELETE whose values are ? placeholders:
+// the value of a WHERE condition (age>?), of a SET field (city=?), or of LIMIT, OFFSET and
+// CURSOR. TABLE.PREPARE checks the statement and splits its WHERE clause once,
+// TABLE.EXEC binds the values in order and runs it. The plan is chosen again on each run,
+// since it depends on the index sizes and on the bound values.
+// A bound value never changes the statement: WHERE values are not split and written
+// UPDATEs and DELETEs are replicated by the rows they changed.
+// Statements are kept in memory by each server, they are not replicated or persisted.
+// TABLE.EXEC names the table of the statement too, so that it is the command's key for
+// cluster routing and ACLs; TABLE.EXEC_RO runs prepared SELECTs only, on replicas too.
+
+#define STMT_SELECT 0
+#define STMT_UPDATE 1
+#define STMT_DELETE 2
+
+typedef struct {
+    int arg;                    // argument holding the placeholder
+    int cond;                   // WHERE condition taking the value, -1 for another argument
+} StmtParam;
+
+typedef struct {
+    int cmd;                    // STMT_SELECT, STMT_UPDATE or STMT_DELETE
+    RedisModuleString **argv;   // the command as prepared, argv[1] is the table
+    int argc;
+    WhereClause where;          // its conditions, conds NULL if none
+    StmtParam *params;
+    int nparams;
+} Statement;
+
+static RedisModuleDict *g_statements = NULL;   // name -> Statement
+
+static inline int is_placeholder(RedisModuleString *s) {
+    size_t l; const char *p = RedisModule_StringPtrLen(s, &l);
+    return l == 1 && p[0] == '?';
+}
+
+static void statement_free(Statement *st) {
+    for (int i = 0; i < st->argc; i++) RedisModule_FreeString(NULL, st->argv[i]);
+    for (int i = 0; i < st->where.n; i++) {
+        RedisModule_FreeString(NULL, st->where.conds[i].col);
+        RedisModule_FreeString(NULL, st->where.conds[i].val);
     }
+    RedisModule_Free(st->argv);
+    RedisModule_Free(st->where.conds);
+    RedisModule_Free(st->params);
+    RedisModule_Free(st);
+}
 
-    if (!hasWhere) {
-        dict_add_set_members(ctx, ids, fmt(ctx, "{%s}:rows", argv[1]));
+// Check the statement argv[0..argc) and find its parameters, in argument order
+// Returns NULL or an error message
+static const char *statement_parse(RedisModuleCtx *ctx, Statement *st) {
+    RedisModuleString **argv = st->argv;
+    int argc = st->argc;
+    TableSchema *sch = schema_get(ctx, argv[1]);
+    if (!sch) return "ERR table schema does not exist";
+    if (sch->shards) return "ERR statements on sharded tables cannot be prepared";
+
+    int start = -1, end = -1;       // WHERE clause
+    int setPos = argc;
+    const char *err;
+    if (st->cmd == STMT_SELECT) {
+        // Placeholders stand for counts or cursors here, check the syntax with one
+        RedisModuleString **check = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleString*) * (size_t)argc);
+        for (int i = 0; i < argc; i++)
+            check[i] = is_placeholder(argv[i]) ? RedisModule_CreateString(ctx, "1", 1) : argv[i];
+        SelectOptions o;
+        if ((err = parse_select(ctx, sch, check, argc, &o)) != NULL) return err;
+        if (o.wherePos != -1) { start = o.wherePos + 1; end = o.end; }
+    } else if (st->cmd == STMT_UPDATE) {
+        int whereStart;
+        if (argc < 5) return "ERR wrong number of arguments for 'TABLE.UPDATE' command";
+        if ((setPos = update_clauses(argv, argc, &whereStart)) == -1) return "ERR missing SET";
+        if (whereStart < setPos) { start = whereStart; end = setPos; }
     } else {
-        int i = 3;
-        int haveSeed = 0;
-        while (i < argc) {
-            RedisModuleString *col=NULL,*val=NULL;
-            char op[3];
-            if (split_condition(ctx, argv[i], &col, op, &val) != REDISMODULE_OK)
-                return RedisModule_ReplyWithError(ctx, "ERR condition must be <col><op><value>");
-            
-            if (strcmp(op, "=") == 0 && is_column_indexed(ctx, argv[1], col)) {
-                if (!haveSeed) {
-                    dict_add_set_members(ctx, ids, fmt3(ctx, "{%s}:idx:%s:%s", argv[1], col, val));
-                    haveSeed=1; i++;
-                } else {
-                    size_t opl; const char *ops = RedisModule_StringPtrLen(argv[i-1], &opl);
-                    if (opl==3 && strncasecmp(ops, "AND",3)==0) {
-                        if (dict_filter_condition(ctx, ids, argv[1], col, op, val) != 0) {
-                            return RedisModule_ReplyWithError(ctx, "ERR query scan limit exceeded (max 100000 rows). Use indexed columns or add more specific conditions.");
-                        }
-                        i++;
-                    } else if (opl==2 && strncasecmp(ops, "OR",2)==0) {
-                        dict_add_set_members(ctx, ids, fmt3(ctx, "{%s}:idx:%s:%s", argv[1], col, val));
-                        i++;
-                    } else return RedisModule_ReplyWithError(ctx, "ERR expected AND/OR between conditions");
-                }
-            } else {
-                if (!haveSeed) {
-                    dict_add_set_members(ctx, ids, fmt(ctx, "{%s}:rows", argv[1]));
-                    haveSeed = 1;
-                }
-                if (dict_filter_condition(ctx, ids, argv[1], col, op, val) != 0) {
-                    return RedisModule_ReplyWithError(ctx, "ERR query scan limit exceeded (max 100000 rows). Use indexed columns or add more specific conditions.");
-                }
-                i++;
-            }
-            
-            if (i < argc) {
-                size_t tl; const char *ts = RedisModule_StringPtrLen(argv[i], &tl);
-                if ((tl==3 && strncasecmp(ts, "AND",3)==0) || (tl==2 && strncasecmp(ts, "OR",2)==0)) {
-                    i++; if (i>=argc) return RedisModule_ReplyWithError(ctx, "ERR dangling operator");
-                }
-            }
+        int wherePos = delete_where(argv, argc);
+        if (wherePos != -1) { start = wherePos + 1; end = argc; }
+    }
+
+    if (start != -1) {
+        WhereClause w;
+        QueryPlan plan;
+        if ((err = where_parse(ctx, argv, start, end, &w)) != NULL ||
+            (err = where_plan_clause(ctx, argv[1], &w, st->cmd == STMT_SELECT, &plan)) != NULL) return err;
+        st->where.n = w.n;
+        st->where.conds = RedisModule_Calloc(w.n ? w.n : 1, sizeof(WhereCond));
+        for (int i = 0; i < w.n; i++) {
+            st->where.conds[i] = w.conds[i];
+            st->where.conds[i].col = RedisModule_CreateStringFromString(NULL, w.conds[i].col);
+            st->where.conds[i].val = RedisModule_CreateStringFromString(NULL, w.conds[i].val);
+        }
+    }
+
+    st->params = RedisModule_Calloc((size_t)argc, sizeof(StmtParam));
+    int c = 0;                      // next WHERE condition
+    for (int i = 2; i < argc; i++) {
+        StmtParam *p = &st->params[st->nparams];
+        p->arg = i;
+        p->cond = -1;
+        if (start != -1 && i >= start && i < end) {
+            while (c < st->where.n && st->where.conds[c].arg < i) c++;
+            if (c == st->where.n || st->where.conds[c].arg != i) continue;      // AND / OR
+            if (is_placeholder(st->where.conds[c].val)) { p->cond = c; st->nparams++; }
+        } else if (i > setPos) {
+            // SET <col>=?, its column is checked now and its value on each run
+            size_t l; const char *s = RedisModule_StringPtrLen(argv[i], &l);
+            if (l < 3 || s[l-2] != '=' || s[l-1] != '?') continue;
+            if (!schema_column(sch, RedisModule_CreateString(ctx, s, l - 2))) return "ERR invalid column or type";
+            st->nparams++;
+        } else if (is_placeholder(argv[i])) {
+            if (st->cmd != STMT_SELECT) return "ERR ? can only stand for a value";
+            st->nparams++;
         }
     }
+    return NULL;
+}
+
+// TABLE.PREPARE <name> [SELECT|UPDATE|DELETE] <namespace.table> ...
+static int TablePrepareCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    int cmd = STMT_SELECT, first = 2;
+    if (argc >= 3) {
+        if (is_word(argv[2], "SELECT")) first = 3;
+        else if (is_word(argv[2], "UPDATE")) { cmd = STMT_UPDATE; first = 3; }
+        else if (is_word(argv[2], "DELETE")) { cmd = STMT_DELETE; first = 3; }
+    }
+    // The table is the key, after the optional command word
+    if (RedisModule_IsKeysPositionRequest(ctx)) {
+        if (first < argc && RedisModule_KeyAtPosWithFlags)
+            RedisModule_KeyAtPosWithFlags(ctx, first, REDISMODULE_CMD_KEY_RO | REDISMODULE_CMD_KEY_ACCESS);
+        else if (first < argc) RedisModule_KeyAtPos(ctx, first);
+        return REDISMODULE_OK;
+    }
+    if (argc < 3 || first >= argc) return RedisModule_WrongArity(ctx);
+    RedisModule_AutoMemory(ctx);
 
-    long long deleted = 0;
-    RedisModuleString *rowsSet = fmt(ctx, "{%s}:rows", argv[1]);
+    static const char *names[] = { "TABLE.SELECT", "TABLE.UPDATE", "TABLE.DELETE" };
 
-    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(ids, "^", NULL, 0);
-    RedisModuleString *id; void *dummy;
-    while ((id = RedisModule_DictNext(ctx, it, &dummy)) != NULL) {
-        RedisModuleString *rowKey = fmt2(ctx, "{%s}:%s", argv[1], id);
+    Statement *st = RedisModule_Calloc(1, sizeof(Statement));
+    st->cmd = cmd;
+    st->argc = argc - first + 1;
+    st->argv = RedisModule_Calloc((size_t)st->argc, sizeof(RedisModuleString*));
+    st->argv[0] = RedisModule_CreateString(NULL, names[cmd], strlen(names[cmd]));
+    for (int i = first; i < argc; i++) st->argv[i - first + 1] = RedisModule_CreateStringFromString(NULL, argv[i]);
 
-        RedisModuleCallReply *fields = RedisModule_Call(ctx, "HKEYS", "s", fmt(ctx, "schema:{%s}", argv[1]));
-        if (fields && RedisModule_CallReplyType(fields) == REDISMODULE_REPLY_ARRAY) {
-            size_t n = RedisModule_CallReplyLength(fields);
-            for (size_t i = 0; i < n; i++) {
-                RedisModuleCallReply *fc = RedisModule_CallReplyArrayElement(fields, i);
-                RedisModuleString *col = RedisModule_CreateStringFromCallReply(fc);
-                
-                if (is_column_indexed(ctx, argv[1], col)) {
-                    RedisModuleCallReply *oldr = RedisModule_Call(ctx, "HGET", "ss", rowKey, col);
-                    if (oldr && RedisModule_CallReplyType(oldr) == REDISMODULE_REPLY_STRING) {
-                        RedisModuleString *oldv = RedisModule_CreateStringFromCallReply(oldr);
-                        RedisModuleString *idxKey = fmt3(ctx, "{%s}:idx:%s:%s", argv[1], col, oldv);
-                        RedisModule_Call(ctx, "SREM", "ss", idxKey, id);
-                    }
-                }
-            }
-        }
+    const char *err = statement_parse(ctx, st);
+    if (err) {
+        statement_free(st);
+        return RedisModule_ReplyWithError(ctx, err);
+    }
+    Statement *old = NULL;
+    if (RedisModule_DictDel(g_statements, argv[1], &old) == REDISMODULE_OK) statement_free(old);
+    RedisModule_DictSet(g_statements, argv[1], st);
+    return RedisModule_ReplyWithLongLong(ctx, st->nparams);
+}
+
+// TABLE.EXEC[_RO] <name> <namespace.table> [<value> ...]
+static int statement_exec(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, int readonly) {
+    if (argc < 3) return RedisModule_WrongArity(ctx);
+    RedisModule_AutoMemory(ctx);
+    Statement *st = RedisModule_DictGet(g_statements, argv[1], NULL);
+    if (!st) return RedisModule_ReplyWithError(ctx, "ERR no such prepared statement");
+    if (RedisModule_StringCompare(argv[2], st->argv[1]) != 0)
+        return RedisModule_ReplyWithError(ctx, "ERR the prepared statement is on another table");
+    if (readonly && st->cmd != STMT_SELECT)
+        return RedisModule_ReplyWithError(ctx, "ERR TABLE.EXEC_RO runs prepared SELECTs only");
+    // TABLE.EXEC is not deny-oom so that DELETEs still free memory; UPDATEs are refused as TABLE.UPDATE is
+    if (st->cmd == STMT_UPDATE && (RedisModule_GetContextFlags(ctx) & REDISMODULE_CTX_FLAGS_OOM))
+        return RedisModule_ReplyWithError(ctx, "OOM command not allowed when used memory > 'maxmemory'.");
+    if (argc - 3 != st->nparams)
+        return RedisModule_ReplyWithError(ctx, "ERR wrong number of values for the prepared statement");
 
-        RedisModule_Call(ctx, "DEL", "s", rowKey);
-        RedisModule_Call(ctx, "SREM", "ss", rowsSet, id);
-        deleted++;
+    // Bind the values into a copy of the statement
+    RedisModuleString **args = RedisModule_PoolAlloc(ctx, sizeof(RedisModuleString*) * (size_t)st->argc);
+    memcpy(args, st->argv, sizeof(RedisModuleString*) * (size_t)st->argc);
+    WhereClause w = { NULL, st->where.n };
+    if (st->where.conds) {
+        w.conds = RedisModule_PoolAlloc(ctx, sizeof(WhereCond) * (size_t)(st->where.n ? st->where.n : 1));
+        memcpy(w.conds, st->where.conds, sizeof(WhereCond) * (size_t)st->where.n);
     }
-    RedisModule_DictIteratorStop(it);
-    return RedisModule_ReplyWithLongLong(ctx, deleted);
+    for (int i = 0; i < st->nparams; i++) {
+        StmtParam *p = &st->params[i];
+        RedisModuleString *v = argv[i + 3];
+        if (p->cond >= 0) {
+            size_t vl; RedisModule_StringPtrLen(v, &vl);
+            if (!vl) return RedisModule_ReplyWithError(ctx, "ERR condition must be <col><op><value>");
+            w.conds[p->cond].val = v;
+        } else if (is_placeholder(st->argv[p->arg])) {
+            args[p->arg] = v;
+        } else {
+            size_t l; const char *s = RedisModule_StringPtrLen(st->argv[p->arg], &l);
+            args[p->arg] = RedisModule_CreateString(ctx, s, l - 1);
+            size_t vl; const char *vs = RedisModule_StringPtrLen(v, &vl);
+            RedisModule_StringAppendBuffer(ctx, args[p->arg], vs, vl);
+        }
+    }
+
+    static const int stats[] = { STATS_SELECT, STATS_UPDATE, STATS_DELETE };
+    stats_begin();
+    int rc = st->cmd == STMT_UPDATE ? update_run(ctx, args, st->argc, &w)
+           : st->cmd == STMT_DELETE ? delete_run(ctx, args, st->argc, &w)
+           : select_run(ctx, args, st->argc, &w);
+    stats_end(ctx, stats[st->cmd], args[1]);
+    if (st->cmd != STMT_SELECT) result_cache_forget_table(ctx, args[1]);
+    return rc;
+}
+
+static int TableExecCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    return statement_exec(ctx, argv, argc, 0);
+}
+
+static int TableExecRoCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    return statement_exec(ctx, argv, argc, 1);
+}
+
+// TABLE.DEALLOCATE <name>
+static int TableDeallocateCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc != 2) return RedisModule_WrongArity(ctx);
+    Statement *st = NULL;
+    if (RedisModule_DictDel(g_statements, argv[1], &st) != REDISMODULE_OK)
+        return RedisModule_ReplyWithError(ctx, "ERR no such prepared statement");
+    statement_free(st);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
 }
 
 /* ================== TABLE.DROP <namespace.table> [FORCE] ================== */
 static int TableDropCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     if (argc != 2 && argc != 3) return RedisModule_WrongArity(ctx);
     RedisModule_AutoMemory(ctx);
-    if (ensure_table_exists(ctx, argv[1]) != REDISMODULE_OK)
+    TableSchema *sch = schema_get(ctx, argv[1]);
+    if (!sch)
         return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
+    if (shard_parent(ctx, argv[1])) return shard_schema_change(ctx, argv, argc, sch->shards, argc, 0);
     
     // Check for FORCE parameter
     if (argc == 2) {
@@ -1044,42 +8127,159 @@ static int TableDropCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int a
         return RedisModule_ReplyWithError(ctx, "ERR Invalid parameter. Use FORCE to confirm table removal");
     }
 
-    RedisModuleString *rowsSet = fmt(ctx, "{%s}:rows", argv[1]);
-    RedisModuleCallReply *rows = RedisModule_Call(ctx, "SMEMBERS", "s", rowsSet);
-    if (rows && RedisModule_CallReplyType(rows) == REDISMODULE_REPLY_ARRAY) {
-        size_t n = RedisModule_CallReplyLength(rows);
-        for (size_t i = 0; i < n; i++) {
-            RedisModuleCallReply *e = RedisModule_CallReplyArrayElement(rows, i);
-            RedisModuleString *id = RedisModule_CreateStringFromCallReply(e);
-            RedisModuleString *rowKey = fmt2(ctx, "{%s}:%s", argv[1], id);
-
-            RedisModuleCallReply *fields = RedisModule_Call(ctx, "HKEYS", "s", fmt(ctx, "schema:{%s}", argv[1]));
-            if (fields && RedisModule_CallReplyType(fields) == REDISMODULE_REPLY_ARRAY) {
-                size_t fn = RedisModule_CallReplyLength(fields);
-                for (size_t j = 0; j < fn; j++) {
-                    RedisModuleCallReply *fc = RedisModule_CallReplyArrayElement(fields, j);
-                    RedisModuleString *col = RedisModule_CreateStringFromCallReply(fc);
-                    
-                    if (is_column_indexed(ctx, argv[1], col)) {
-                        RedisModuleCallReply *oldr = RedisModule_Call(ctx, "HGET", "ss", rowKey, col);
-                        if (oldr && RedisModule_CallReplyType(oldr) == REDISMODULE_REPLY_STRING) {
-                            RedisModuleString *oldv = RedisModule_CreateStringFromCallReply(oldr);
-                            RedisModuleString *idxKey = fmt3(ctx, "{%s}:idx:%s:%s", argv[1], col, oldv);
-                            RedisModule_Call(ctx, "SREM", "ss", idxKey, id);
-                        }
-                    }
-                }
-            }
+    // The table disappears at once: rows, indexes and index jobs of a hash table are left
+    // to a purge, a native table is freed off the main thread
+    if (sch->engine == ENGINE_HASH) purge_table(ctx, argv[1], 1);
+    static const char *keys[] = { "schema:{%s}", "{%s}:id", "{%s}:idx:meta", "{%s}:idx:btree", "{%s}:idx:unique",
+                                  "{%s}:idx:composite", "{%s}:idx:jobs", "{%s}:options", "{%s}:data" };
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+        RedisModule_Call(ctx, "UNLINK", "s", fmt(ctx, keys[i], argv[1]));
+    schema_invalidate(ctx, argv[1]);
+    stats_forget(argv[1]);
+    catalog_table(ctx, argv[1], 0);
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
 
-            RedisModule_Call(ctx, "DEL", "s", rowKey);
-            RedisModule_Call(ctx, "SREM", "ss", rowsSet, id);
-        }
+/* ================== TABLE._APPLY <namespace.table> UPDATE <id,...> SET <col>=<value> ... | DELETE <id,...> | INDEX <col> <id,...> | PURGE <n> <id,...> ================== */
+// Internal command replaying on replicas the rows changed by a background UPDATE or DELETE
+// (see replicate_rows), indexed by a batch of an index job, or unlinked by a purge
+static int TableApplyCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc < 4) return RedisModule_WrongArity(ctx);
+    RedisModule_AutoMemory(ctx);
+    size_t kl; const char *kw = RedisModule_StringPtrLen(argv[2], &kl);
+    int isIndex = kl == 5 && strncasecmp(kw, "INDEX", 5) == 0;
+    int isPurge = kl == 5 && strncasecmp(kw, "PURGE", 5) == 0;
+    // The table of a purge may be dropped already
+    TableSchema *sch = schema_get(ctx, argv[1]);
+    if (!sch && !isPurge)
+        return RedisModule_ReplyWithError(ctx, "ERR table schema does not exist");
+
+    if ((isIndex || isPurge) && argc != 5) return RedisModule_WrongArity(ctx);
+    size_t ll; const char *list = RedisModule_StringPtrLen(argv[isIndex || isPurge ? 4 : 3], &ll);
+    IdSet ids = idset_alloc(ctx, ll / 2 + 1);
+    for (size_t at = 0; at < ll; ) {
+        const char *comma = memchr(list + at, ',', ll - at);
+        size_t end = comma ? (size_t)(comma - list) : ll;
+        uint64_t id = idset_parse_id(list + at, end - at);
+        if (!id) return RedisModule_ReplyWithError(ctx, "ERR invalid row id");
+        ids.ids[ids.len++] = id;
+        at = end + 1;
+    }
+    idset_normalize(&ids);
+
+    size_t sl; const char *sw = argc > 4 ? RedisModule_StringPtrLen(argv[4], &sl) : NULL;
+    long long changed;
+    const char *err;
+    if (isIndex) {
+        ColumnSchema *cs = schema_column(sch, argv[3]);
+        CompositeIndex *ci = schema_composite(sch, argv[3]);
+        if ((!cs || cs->building == INDEX_NONE) && (!ci || !ci->building))
+            return RedisModule_ReplyWithError(ctx, "ERR no index is being built on this column");
+        index_rows(ctx, argv[1], argv[3], cs ? cs->building : ci->kind, ids);
+        changed = (long long)ids.len;
+        err = NULL;
+    } else if (isPurge) {
+        size_t nl; const char *n = RedisModule_StringPtrLen(argv[3], &nl);
+        int partition = purge_is_partition(argv[3]);
+        if (!idset_parse_id(n, nl) && !partition) return RedisModule_ReplyWithError(ctx, "ERR invalid purge worklist");
+        purge_rows(ctx, argv[1], fmt2(ctx, "{%s}:purge:%s", argv[1], argv[3]), ids, partition);
+        changed = (long long)ids.len;
+        err = NULL;
+    } else if (kl == 6 && strncasecmp(kw, "UPDATE", 6) == 0 && argc > 5 && sl == 3 && strncasecmp(sw, "SET", 3) == 0) {
+        Assignments set;
+        err = parse_assignments(ctx, sch, argv + 5, argc - 5, UPDATE_SET_ERROR, &set);
+        if (!err) err = update_rows(ctx, argv[1], &set, ids, 0, &changed);
+    } else if (kl == 6 && strncasecmp(kw, "DELETE", 6) == 0 && argc == 4) {
+        err = delete_rows(ctx, argv[1], ids, 0, &changed);
+    } else {
+        return RedisModule_ReplyWithError(ctx, "ERR syntax: UPDATE <id,...> SET <col>=<value> ... | DELETE <id,...> | INDEX <col> <id,...> | PURGE <n> <id,...>");
+    }
+    result_cache_forget_table(ctx, argv[1]);
+    if (err) return RedisModule_ReplyWithError(ctx, err);
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithLongLong(ctx, changed);
+}
+
+// TABLE._RESTORE <{namespace.table}:hash:<index>> POSTING <value> <id,...>
+static int hash_index_restore(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc != 5) return RedisModule_WrongArity(ctx);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+    HashIndex *hi;
+    if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY) {
+        hi = hash_index_new();
+        RedisModule_ModuleTypeSetValue(key, HashIndexType, hi);
+    } else if (RedisModule_ModuleTypeGetType(key) == HashIndexType) {
+        hi = RedisModule_ModuleTypeGetValue(key);
+    } else {
+        return RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+    }
+    size_t vlen; const char *v = RedisModule_StringPtrLen(argv[3], &vlen);
+    size_t ll; const char *list = RedisModule_StringPtrLen(argv[4], &ll);
+    for (size_t at = 0; at < ll; ) {
+        const char *comma = memchr(list + at, ',', ll - at);
+        size_t end = comma ? (size_t)(comma - list) : ll;
+        uint64_t id = idset_parse_id(list + at, end - at);
+        if (!id) return RedisModule_ReplyWithError(ctx, "ERR invalid row id");
+        hi->nids += (size_t)posting_add(hi->postings, v, vlen, id);
+        at = end + 1;
+    }
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+/* ================== TABLE._RESTORE <{namespace.table}:data> COLUMN|LASTID|ROW ... | <{namespace.table}:hash:<index>> POSTING ... ================== */
+// Internal command replaying the AOF rewrite of a native table (see native_aof_rewrite) or
+// of a hash index (see hash_index_aof_rewrite)
+static int TableRestoreCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc < 4) return RedisModule_WrongArity(ctx);
+    RedisModule_AutoMemory(ctx);
+
+    size_t sl; const char *sub = RedisModule_StringPtrLen(argv[2], &sl);
+    if (sl == 7 && strncasecmp(sub, "POSTING", 7) == 0) return hash_index_restore(ctx, argv, argc);
+
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+    NativeTable *nt;
+    if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY) {
+        nt = native_new();
+        RedisModule_ModuleTypeSetValue(key, NativeTableType, nt);
+        schema_keyspace_event(ctx, REDISMODULE_NOTIFY_MODULE, "table._restore", argv[1]);
+    } else if (RedisModule_ModuleTypeGetType(key) == NativeTableType) {
+        nt = RedisModule_ModuleTypeGetValue(key);
+    } else {
+        return RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
     }
 
-    RedisModule_Call(ctx, "DEL", "s", fmt(ctx, "schema:{%s}", argv[1]));
-    RedisModule_Call(ctx, "DEL", "s", fmt(ctx, "{%s}:id", argv[1]));
-    RedisModule_Call(ctx, "DEL", "s", fmt(ctx, "{%s}:idx:meta", argv[1]));
-    RedisModule_Call(ctx, "DEL", "s", rowsSet);
+    if (sl == 6 && strncasecmp(sub, "COLUMN", 6) == 0 && argc == 6) {
+        long long type, indexed;
+        if (RedisModule_StringToLongLong(argv[4], &type) != REDISMODULE_OK || type < COLTYPE_STRING || type > COLTYPE_DATE ||
+            RedisModule_StringToLongLong(argv[5], &indexed) != REDISMODULE_OK)
+            return RedisModule_ReplyWithError(ctx, "ERR invalid column definition");
+        size_t nl; const char *name = RedisModule_StringPtrLen(argv[3], &nl);
+        NativeColumn *col = native_find_column(nt, name, nl);
+        if (!col) col = native_add_column(nt, name, nl, (int)type);
+        if (indexed) native_build_index(nt, col);
+    } else if (sl == 6 && strncasecmp(sub, "LASTID", 6) == 0 && argc == 4) {
+        long long id;
+        if (RedisModule_StringToLongLong(argv[3], &id) != REDISMODULE_OK || id < 0)
+            return RedisModule_ReplyWithError(ctx, "ERR invalid row id");
+        if ((uint64_t)id > nt->last_id) nt->last_id = (uint64_t)id;
+    } else if (sl == 3 && strncasecmp(sub, "ROW", 3) == 0) {
+        long long id;
+        if (RedisModule_StringToLongLong(argv[3], &id) != REDISMODULE_OK || id <= 0)
+            return RedisModule_ReplyWithError(ctx, "ERR invalid row id");
+        size_t slot = native_insert_slot(nt, (uint64_t)id);
+        for (int i = 4; i < argc; i++) {
+            size_t fl; const char *f = RedisModule_StringPtrLen(argv[i], &fl);
+            const char *eq = memchr(f, '=', fl);
+            if (!eq || eq == f) return RedisModule_ReplyWithError(ctx, "ERR each field must be <col>=<value>");
+            NativeColumn *col = native_find_column(nt, f, (size_t)(eq - f));
+            if (!col) col = native_add_column(nt, f, (size_t)(eq - f), COLTYPE_STRING);
+            if (native_set_text(nt, slot, col, eq + 1, fl - (size_t)(eq - f) - 1) != 0)
+                return RedisModule_ReplyWithError(ctx, "ERR invalid value for column type");
+        }
+    } else {
+        return RedisModule_ReplyWithError(ctx, "ERR syntax: COLUMN <name> <type> <indexed> | LASTID <id> | ROW <id> <col>=<value> ... | POSTING <value> <id,...>");
+    }
     return RedisModule_ReplyWithSimpleString(ctx, "OK");
 }
 
@@ -1090,19 +8290,48 @@ static int TableHelpCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int a
         "TABLE.NAMESPACE.CREATE <namespace>",
         "TABLE.NAMESPACE.VIEW [<namespace>] - Display all namespace:table pairs, optionally filtered by namespace",
         "TABLE.SCHEMA.VIEW <namespace.table> - Display columns, types, and index status",
-        "TABLE.SCHEMA.CREATE <namespace.table> <col:type[:index]> [<col:type[:index]> ...]",
+        "TABLE.SCHEMA.CREATE <namespace.table> <col:type[:index]> [<col:type[:index]> ...] [INDEX <c1,c2,...[:index]>] [ENGINE hash|native] [PARTITION BY <col> [RETENTION <days>]] [SHARDS <n>]",
         "  Types: string, integer, float, date (YYYY-MM-DD)",
-        "  Index: hash, btree, none (default: none)",
+        "  Index: hash, btree, unique, primary, none (default: none)",
+        "  btree: ordered index, serves = > < >= <= with a range read",
+        "  unique: one row per value, duplicates are rejected; primary: the unique key of TABLE.GET, required in every row",
         "  Deprecated: true (=hash), false (=none)",
-        "TABLE.SCHEMA.ALTER <namespace.table> ADD COLUMN <col:type[:index]> | ADD INDEX <col> | DROP INDEX <col>",
-        "  ADD INDEX builds index for existing data",
-        "TABLE.INSERT <namespace.table> <col>=<value> [<col>=<value> ...]",
-        "TABLE.SELECT <namespace.table> [WHERE <col><op><value> (AND|OR <col><op><value> ...)]",
+        "  ENGINE hash: one Redis hash per row (default)",
+        "  ENGINE native: rows and indexes stored in a single key {namespace.table}:data",
+        "  PARTITION BY: rows kept per day of a date column, ranges on it read only the days they cover",
+        "  RETENTION: partitions older than this many days are purged in the background",
+        "  SHARDS: rows spread over n tables <namespace.table>#0..#n-1 (2 to 64), on the nodes of a cluster serving them",
+        "TABLE.SCHEMA.ALTER <namespace.table> ADD COLUMN <col:type[:index]> | ADD INDEX <col[:index]> | ADD INDEX <c1,c2,...[:index]> | DROP INDEX <col|c1,c2,...>",
+        "  ADD INDEX builds index for existing data (index: hash, btree or unique, default: hash)",
+        "  Hash tables over 1000 rows are indexed in the background, DROP INDEX deletes hash index keys in the background",
+        "TABLE.STATS [<namespace.table> | RESET] - Command latencies [command, calls, usec, p50, p99, p99.9, max], or the counters of a table",
+        "TABLE.INDEX.STATUS <namespace.table> - Show each index: [column or c1,c2,..., index, ready|building|dropping, done, total]",
+        "TABLE.INSERT <namespace.table> <col>=<value> [<col>=<value> ...] [TTL <seconds>]",
+        "  TTL: the row and its index entries are deleted once it expires (hash tables)",
+        "TABLE.INSERTMANY <namespace.table> COLUMNS <col> [<col> ...] VALUES <value> [<value> ...]",
+        "  Inserts one row per group of values, replies with the first and last row ID",
+        "  Sharded tables reply with the number of rows inserted",
+        "TABLE.SELECT <namespace.table> [COLUMNS <col>[,<col> ...]] [WHERE <col><op><value> (AND|OR <col><op><value> ...)] [ORDER BY <col> [ASC|DESC]] [LIMIT <n>] [OFFSET <n>] [CURSOR <cursor>]",
+        "  COLUMNS: return only these values per row, in this order (nil when a row has no value)",
         "  Operators: = > < >= <=",
         "  Note: Only indexed columns can use = in WHERE",
+        "  Note: > < >= <= scan the table unless the column has a btree index",
+        "  LIMIT <n> [OFFSET <n>]: return at most n rows, after skipping OFFSET rows",
+        "  CURSOR <cursor> [LIMIT <n>]: reply [next cursor, rows], start with 0, done when 0 is returned",
+        "  ORDER BY <col> [ASC|DESC]: sort on a column, rows without a value last (not with CURSOR)",
+        "TABLE.GET <namespace.table> <key> [COLUMNS <col>[,<col> ...]] - The row with this primary key, nil if none",
+        "TABLE.AGGREGATE <namespace.table> COUNT [<col>] | SUM|MIN|MAX|AVG <col> [GROUP BY <col>] [WHERE <cond> (AND|OR <cond> ...)]",
+        "  Replies with one value, or group/value pairs in group order with GROUP BY",
+        "  COUNT counts rows, COUNT <col> the rows with a value, the other functions skip rows without a value (nil when none has one)",
+        "TABLE.EXPLAIN <namespace.table> [WHERE <cond> (AND|OR <cond> ...)] - Show the plan chosen for a WHERE clause",
         "TABLE.UPDATE <namespace.table> WHERE <cond> (AND|OR <cond> ...) SET <col>=<value> [<col>=<value> ...]",
         "TABLE.DELETE <namespace.table> [WHERE <cond> (AND|OR <cond> ...)]",
-        "TABLE.DROP <namespace.table> FORCE",
+        "TABLE.PREPARE <name> [SELECT|UPDATE|DELETE] <namespace.table> ... - Prepare a statement, replies with its number of ? values",
+        "  ? stands for a WHERE value (<col><op>?), a SET value (<col>=?) or a LIMIT, OFFSET or CURSOR value",
+        "TABLE.EXEC <name> <namespace.table> [<value> ...] - Run a prepared statement on its table with these values, in order",
+        "TABLE.EXEC_RO <name> <namespace.table> [<value> ...] - Run a prepared SELECT, read-only (replicas)",
+        "TABLE.DEALLOCATE <name> - Forget a prepared statement",
+        "TABLE.DROP <namespace.table> FORCE - The table is gone at once, its keys are unlinked in the background",
         "  FORCE parameter is required to confirm irreversible deletion",
         "TABLE.HELP"
     };
@@ -1118,35 +8347,130 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
         return REDISMODULE_ERR;
 
     // Parse module load-time arguments
-    // Usage: --loadmodule redis_table.so max_scan_limit <value>
-    // Example: --loadmodule redis_table.so max_scan_limit 200000
-    if (argc >= 2) {
+    // Usage: --loadmodule redis_table.so [max_scan_limit <value>] [async_scan_rows <value>] [worker_threads <value>]
+    //                                     [result_cache_mb <value>]
+    // Example: --loadmodule redis_table.so max_scan_limit 200000 async_scan_rows 50000 worker_threads 8 result_cache_mb 64
+    for (int i = 0; i + 1 < argc; i += 2) {
         size_t keyLen;
-        const char *key = RedisModule_StringPtrLen(argv[0], &keyLen);
-        
-        if (strncmp(key, "max_scan_limit", keyLen) == 0 || strncmp(key, "max_scan_limit", 14) == 0) {
-            long long value;
-            if (RedisModule_StringToLongLong(argv[1], &value) == REDISMODULE_OK) {
-                if (value >= 1000 && value <= 10000000) {  // Min 1K, Max 10M
-                    g_max_rows_scan_limit = value;
-                    RedisModule_Log(ctx, "notice", "Table module: max_scan_limit set to %lld", value);
-                } else {
-                    RedisModule_Log(ctx, "warning", "Table module: invalid max_scan_limit value %lld (must be between 1000 and 10000000), using default %lld", value, (long long)DEFAULT_MAX_ROWS_SCAN_LIMIT);
-                }
+        const char *key = RedisModule_StringPtrLen(argv[i], &keyLen);
+        long long value;
+        if (RedisModule_StringToLongLong(argv[i+1], &value) != REDISMODULE_OK) {
+            RedisModule_Log(ctx, "warning", "Table module: invalid value for %s", key);
+            continue;
+        }
+
+        if (keyLen == 14 && strncmp(key, "max_scan_limit", 14) == 0) {
+            if (value >= 1000 && value <= 10000000) {  // Min 1K, Max 10M
+                g_max_rows_scan_limit = value;
+                RedisModule_Log(ctx, "notice", "Table module: max_scan_limit set to %lld", value);
+            } else {
+                RedisModule_Log(ctx, "warning", "Table module: invalid max_scan_limit value %lld (must be between 1000 and 10000000), using default %lld", value, (long long)DEFAULT_MAX_ROWS_SCAN_LIMIT);
+            }
+        } else if (keyLen == 15 && strncmp(key, "async_scan_rows", 15) == 0) {
+            if (value == 0 || (value >= 1000 && value <= 10000000)) {  // 0 disables background queries
+                g_async_scan_rows = value;
+                RedisModule_Log(ctx, "notice", "Table module: async_scan_rows set to %lld", value);
+            } else {
+                RedisModule_Log(ctx, "warning", "Table module: invalid async_scan_rows value %lld (must be 0 or between 1000 and 10000000), using default %lld", value, (long long)DEFAULT_ASYNC_SCAN_ROWS);
+            }
+        } else if (keyLen == 14 && strncmp(key, "worker_threads", 14) == 0) {
+            if (value >= 1 && value <= MAX_WORKER_THREADS) {
+                g_worker_threads = (int)value;
+                RedisModule_Log(ctx, "notice", "Table module: worker_threads set to %lld", value);
+            } else {
+                RedisModule_Log(ctx, "warning", "Table module: invalid worker_threads value %lld (must be between 1 and %d), using default %d", value, MAX_WORKER_THREADS, DEFAULT_WORKER_THREADS);
+            }
+        } else if (keyLen == 15 && strncmp(key, "result_cache_mb", 15) == 0) {
+            if (value >= 0 && value <= MAX_RESULT_CACHE_MB) {  // 0 disables the result cache
+                g_result_cache_mb = value;
+                RedisModule_Log(ctx, "notice", "Table module: result_cache_mb set to %lld", value);
+            } else {
+                RedisModule_Log(ctx, "warning", "Table module: invalid result_cache_mb value %lld (must be between 0 and %d), using default %d", value, MAX_RESULT_CACHE_MB, DEFAULT_RESULT_CACHE_MB);
             }
         }
     }
+    kernels_init();
+    RedisModule_Log(ctx, "notice", "Table module: %s comparison kernels", g_kernels.name);
+
+    int wantedThreads = g_worker_threads;
+    if (pool_start() < wantedThreads)
+        RedisModule_Log(ctx, "warning", "Table module: only %d worker threads could be started", g_worker_threads);
+
+    // Native storage engine
+    RedisModuleTypeMethods tm = {
+        .version = REDISMODULE_TYPE_METHOD_VERSION,
+        .rdb_load = native_rdb_load,
+        .rdb_save = native_rdb_save,
+        .aof_rewrite = native_aof_rewrite,
+        .mem_usage = native_mem_usage,
+        .digest = native_digest,
+        .free = native_free,
+        .free_effort = native_free_effort
+    };
+    NativeTableType = RedisModule_CreateDataType(ctx, "rtable-nt", NATIVE_ENCODING_VERSION, &tm);
+    if (NativeTableType == NULL) return REDISMODULE_ERR;
+
+    // Hash indexes of hash tables
+    RedisModuleTypeMethods him = {
+        .version = REDISMODULE_TYPE_METHOD_VERSION,
+        .rdb_load = hash_index_rdb_load,
+        .rdb_save = hash_index_rdb_save,
+        .aof_rewrite = hash_index_aof_rewrite,
+        .mem_usage = hash_index_mem_usage,
+        .digest = hash_index_digest,
+        .free = hash_index_free,
+        .free_effort = hash_index_free_effort
+    };
+    HashIndexType = RedisModule_CreateDataType(ctx, "rtable-ix", HASH_INDEX_ENCODING_VERSION, &him);
+    if (HashIndexType == NULL) return REDISMODULE_ERR;
+
+    // Parsed table schemas and the table catalog are cached, keep them in sync with the keyspace
+    g_schema_cache = RedisModule_CreateDict(NULL);
+    g_catalog = RedisModule_CreateDict(NULL);
+    if (RedisModule_SubscribeToKeyspaceEvents(ctx, REDISMODULE_NOTIFY_GENERIC | REDISMODULE_NOTIFY_HASH |
+            REDISMODULE_NOTIFY_SET | REDISMODULE_NOTIFY_EXPIRED | REDISMODULE_NOTIFY_EVICTED | REDISMODULE_NOTIFY_LOADED,
+            schema_keyspace_event) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    catalog_scan(ctx);
+    g_index_jobs = RedisModule_CreateDict(NULL);
+    g_purge_jobs = RedisModule_CreateDict(NULL);
+    g_shard_requests = RedisModule_CreateDict(NULL);
+    RedisModule_RegisterClusterMessageReceiver(ctx, SHARD_MSG_REQUEST, shard_request_receiver);
+    RedisModule_RegisterClusterMessageReceiver(ctx, SHARD_MSG_REPLY, shard_reply_receiver);
+    g_ttl_expired = RedisModule_CreateDict(NULL);
+    if (RedisModule_SubscribeToKeyspaceEvents(ctx, REDISMODULE_NOTIFY_EXPIRED, ttl_keyspace_event) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+    g_statements = RedisModule_CreateDict(NULL);
+    g_table_stats = RedisModule_CreateDict(NULL);
+    g_result_cache = RedisModule_CreateDict(NULL);
+    g_cache_tables = RedisModule_CreateDict(NULL);
+    if (RedisModule_RegisterInfoFunc(ctx, stats_info) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    RedisModule_SubscribeToServerEvent(ctx, RedisModuleEvent_FlushDB, schema_server_event);
+    RedisModule_SubscribeToServerEvent(ctx, RedisModuleEvent_SwapDB, schema_server_event);
+    RedisModule_SubscribeToServerEvent(ctx, RedisModuleEvent_Loading, jobs_server_event);
+    RedisModule_SubscribeToServerEvent(ctx, RedisModuleEvent_ReplicationRoleChanged, jobs_server_event);
 
     if (RedisModule_CreateCommand(ctx, "TABLE.NAMESPACE.CREATE", TableNamespaceCreateCommand, "write", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
     if (RedisModule_CreateCommand(ctx, "TABLE.NAMESPACE.VIEW", TableNamespaceViewCommand, "readonly", 0, 0, 0) == REDISMODULE_ERR) return REDISMODULE_ERR;
     if (RedisModule_CreateCommand(ctx, "TABLE.SCHEMA.VIEW", TableSchemaViewCommand, "readonly", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
     if (RedisModule_CreateCommand(ctx, "TABLE.SCHEMA.CREATE", TableSchemaCreateCommand, "write", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
     if (RedisModule_CreateCommand(ctx, "TABLE.SCHEMA.ALTER", TableSchemaAlterCommand, "write", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
-    if (RedisModule_CreateCommand(ctx, "TABLE.INSERT", TableInsertCommand, "write", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx, "TABLE.INSERT", TableInsertCommand, "write deny-oom", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx, "TABLE.INSERTMANY", TableInsertManyCommand, "write deny-oom", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
     if (RedisModule_CreateCommand(ctx, "TABLE.SELECT", TableSelectCommand, "readonly", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
-    if (RedisModule_CreateCommand(ctx, "TABLE.UPDATE", TableUpdateCommand, "write", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx, "TABLE.GET", TableGetCommand, "readonly", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx, "TABLE.AGGREGATE", TableAggregateCommand, "readonly", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx, "TABLE.STATS", TableStatsCommand, "readonly", 0, 0, 0) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx, "TABLE.INDEX.STATUS", TableIndexStatusCommand, "readonly", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx, "TABLE.EXPLAIN", TableExplainCommand, "readonly", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx, "TABLE.UPDATE", TableUpdateCommand, "write deny-oom", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
     if (RedisModule_CreateCommand(ctx, "TABLE.DELETE", TableDeleteCommand, "write", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx, "TABLE.PREPARE", TablePrepareCommand, "readonly getkeys-api", 0, 0, 0) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx, "TABLE.EXEC", TableExecCommand, "write", 2, 2, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx, "TABLE.EXEC_RO", TableExecRoCommand, "readonly", 2, 2, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx, "TABLE.DEALLOCATE", TableDeallocateCommand, "readonly", 0, 0, 0) == REDISMODULE_ERR) return REDISMODULE_ERR;
     if (RedisModule_CreateCommand(ctx, "TABLE.DROP", TableDropCommand, "write", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx, "TABLE._APPLY", TableApplyCommand, "write", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx, "TABLE._RESTORE", TableRestoreCommand, "write deny-oom", 1, 1, 1) == REDISMODULE_ERR) return REDISMODULE_ERR;
     if (RedisModule_CreateCommand(ctx, "TABLE.HELP", TableHelpCommand, "readonly", 0, 0, 0) == REDISMODULE_ERR) return REDISMODULE_ERR;
 
     return REDISMODULE_OK;
@@ -0,0 +1,337 @@
+#!/usr/bin/env python3
+"""
+Redis Table Module - Benchmark Suite
+Loads a table of configurable size and measures the hot paths: INSERT, indexed
+equality SELECT, btree range SELECT, UPDATE fan-out, DELETE and DROP.
+Reports ops/s, p50/p99/p999 latency and used_memory per row as JSON.
+
+Talks RESP over a plain socket, so it needs nothing beyond Python 3.
+"""
+
+import argparse
+import json
+import os
+import random
+import socket
+import subprocess
+import sys
+import time
+
+
+class RedisError(Exception):
+    pass
+
+
+class RespClient:
+    """Minimal RESP2 client with pipelining"""
+
+    def __init__(self, host, port, timeout=60):
+        self.sock = socket.create_connection((host, port), timeout=timeout)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.buf = b''
+
+    @staticmethod
+    def encode(args):
+        out = [b'*%d\r\n' % len(args)]
+        for a in args:
+            a = a if isinstance(a, bytes) else str(a).encode()
+            out.append(b'$%d\r\n%s\r\n' % (len(a), a))
+        return b''.join(out)
+
+    def _line(self):
+        while True:
+            i = self.buf.find(b'\r\n')
+            if i >= 0:
+                line, self.buf = self.buf[:i], self.buf[i + 2:]
+                return line
+            self._fill()
+
+    def _fill(self):
+        data = self.sock.recv(1 << 20)
+        if not data:
+            raise ConnectionError('connection closed by server')
+        self.buf += data
+
+    def _reply(self):
+        line = self._line()
+        kind, rest = line[:1], line[1:]
+        if kind == b'+':
+            return rest.decode()
+        if kind == b'-':
+            return RedisError(rest.decode())
+        if kind == b':':
+            return int(rest)
+        if kind == b'$':
+            n = int(rest)
+            if n < 0:
+                return None
+            while len(self.buf) < n + 2:
+                self._fill()
+            data, self.buf = self.buf[:n], self.buf[n + 2:]
+            return data.decode(errors='replace')
+        if kind == b'*':
+            n = int(rest)
+            return None if n < 0 else [self._reply() for _ in range(n)]
+        raise RedisError('protocol error: %r' % line)
+
+    def pipeline(self, commands):
+        """Send commands at once, return their replies (errors as RedisError values)"""
+        self.sock.sendall(b''.join(self.encode(c) for c in commands))
+        return [self._reply() for _ in commands]
+
+    def call(self, *args):
+        reply = self.pipeline([args])[0]
+        if isinstance(reply, RedisError):
+            raise reply
+        return reply
+
+    def info(self, section):
+        fields = {}
+        for line in self.call('INFO', section).splitlines():
+            if ':' in line and not line.startswith('#'):
+                k, v = line.split(':', 1)
+                fields[k] = v
+        return fields
+
+
+def percentile(sorted_us, p):
+    if not sorted_us:
+        return 0
+    i = min(len(sorted_us) - 1, max(0, int(p * len(sorted_us) + 0.999999) - 1))
+    return sorted_us[i]
+
+
+def run_commands(client, commands, pipeline):
+    """Run commands in batches of pipeline, each command gets its batch round trip as latency"""
+    lat = []
+    errors = 0
+    start = time.perf_counter()
+    for i in range(0, len(commands), pipeline):
+        batch = commands[i:i + pipeline]
+        t0 = time.perf_counter()
+        replies = client.pipeline(batch)
+        us = (time.perf_counter() - t0) * 1e6
+        lat.extend([us] * len(batch))
+        errors += sum(1 for r in replies if isinstance(r, RedisError))
+    elapsed = time.perf_counter() - start
+    lat.sort()
+    return {
+        'ops': len(commands),
+        'errors': errors,
+        'seconds': round(elapsed, 6),
+        'ops_per_sec': round(len(commands) / elapsed, 1) if elapsed > 0 else 0,
+        'p50_us': round(percentile(lat, 0.50), 1),
+        'p99_us': round(percentile(lat, 0.99), 1),
+        'p999_us': round(percentile(lat, 0.999), 1),
+        'max_us': round(lat[-1], 1) if lat else 0,
+    }
+
+
+class Benchmark:
+    TABLE = 'bench.t'
+
+    def __init__(self, client, args):
+        self.r = client
+        self.a = args
+        self.rng = random.Random(args.seed)
+        self.cities = max(1, args.rows // args.fanout)
+
+    def log(self, msg):
+        print(msg, file=sys.stderr, flush=True)
+
+    def row(self, i):
+        return [i, i, 'c%d' % (i % self.cities), 0, 'n%d' % i]
+
+    def setup(self):
+        self.r.pipeline([['TABLE.NAMESPACE.CREATE', 'bench']])     # fails if it exists
+        if self._table_exists():
+            self.r.call('TABLE.DROP', self.TABLE, 'FORCE')
+            self.wait_reclaimed()
+        self.r.call('TABLE.SCHEMA.CREATE', self.TABLE, 'uid:integer:hash', 'age:integer:btree',
+                    'city:string:hash', 'score:integer', 'name:string', 'ENGINE', self.a.engine)
+        self.r.call('TABLE.STATS', 'RESET')
+
+    def _table_exists(self):
+        return self.r.call('EXISTS', 'schema:{%s}' % self.TABLE) == 1
+
+    def wait_reclaimed(self, timeout=600):
+        """Seconds until the background purge of a dropped table is done"""
+        start = time.perf_counter()
+        while self.r.call('EXISTS', '{%s}:purge' % self.TABLE) and time.perf_counter() - start < timeout:
+            time.sleep(0.01)
+        return time.perf_counter() - start
+
+    def load(self):
+        cols = ['uid', 'age', 'city', 'score', 'name']
+        commands = []
+        for first in range(1, self.a.rows + 1, self.a.batch):
+            values = []
+            for i in range(first, min(first + self.a.batch, self.a.rows + 1)):
+                values.extend(self.row(i))
+            commands.append(['TABLE.INSERTMANY', self.TABLE, 'COLUMNS'] + cols + ['VALUES'] + values)
+        res = run_commands(self.r, commands, self.a.pipeline)
+        res['rows_per_sec'] = round(self.a.rows / res['seconds'], 1) if res['seconds'] > 0 else 0
+        return res
+
+    def insert(self):
+        first = self.a.rows + 1
+        commands = [['TABLE.INSERT', self.TABLE] +
+                    ['%s=%s' % (c, v) for c, v in zip(['uid', 'age', 'city', 'score', 'name'], self.row(i))]
+                    for i in range(first, first + self.a.ops)]
+        return run_commands(self.r, commands, self.a.pipeline)
+
+    def select_eq(self):
+        commands = [['TABLE.SELECT', self.TABLE, 'WHERE', 'uid=%d' % self.rng.randint(1, self.a.rows)]
+                    for _ in range(self.a.ops)]
+        return run_commands(self.r, commands, self.a.pipeline)
+
+    def select_range(self):
+        width = self.a.range
+        commands = []
+        for _ in range(self.a.ops):
+            lo = self.rng.randint(1, max(1, self.a.rows - width))
+            commands.append(['TABLE.SELECT', self.TABLE, 'WHERE', 'age>=%d' % lo, 'AND', 'age<%d' % (lo + width)])
+        res = run_commands(self.r, commands, self.a.pipeline)
+        res['rows_per_op'] = width
+        return res
+
+    def update_fanout(self):
+        n = min(self.a.ops, self.cities)
+        commands = [['TABLE.UPDATE', self.TABLE, 'WHERE', 'city=c%d' % (k % self.cities), 'SET', 'score=%d' % k]
+                    for k in range(n)]
+        res = run_commands(self.r, commands, self.a.pipeline)
+        res['rows_per_op'] = self.a.fanout
+        return res
+
+    def delete(self):
+        ids = self.rng.sample(range(1, self.a.rows + 1), min(self.a.ops, self.a.rows))
+        commands = [['TABLE.DELETE', self.TABLE, 'WHERE', 'uid=%d' % i] for i in ids]
+        return run_commands(self.r, commands, self.a.pipeline)
+
+    def drop(self):
+        res = run_commands(self.r, [['TABLE.DROP', self.TABLE, 'FORCE']], 1)
+        res['reclaim_seconds'] = round(self.wait_reclaimed(), 6)
+        return res
+
+    def server_stats(self):
+        """Latencies measured inside the module, see TABLE.STATS"""
+        out = {}
+        for entry in self.r.call('TABLE.STATS'):
+            name, calls, usec, p50, p99, p999, mx = entry
+            out[name] = {'calls': calls, 'usec': usec, 'p50_us': p50, 'p99_us': p99, 'p999_us': p999, 'max_us': mx}
+        return out
+
+    def run(self):
+        scenarios = [s for s in self.a.scenarios.split(',') if s]
+        report = {
+            'module': 'redistable',
+            'engine': self.a.engine,
+            'rows': self.a.rows,
+            'ops': self.a.ops,
+            'pipeline': self.a.pipeline,
+            'fanout': self.a.fanout,
+            'scenarios': {},
+        }
+        before = int(self.r.info('memory').get('used_memory', 0))
+        self.setup()
+        self.log('load: %d rows' % self.a.rows)
+        report['scenarios']['load'] = self.load()
+        after = int(self.r.info('memory').get('used_memory', 0))
+        report['used_memory_per_row'] = round((after - before) / self.a.rows, 1) if self.a.rows else 0
+
+        # Order matters: DROP ends the run, DELETE runs after the reads
+        for name in ['insert', 'select_eq', 'select_range', 'update_fanout', 'delete']:
+            if name in scenarios:
+                self.log(name)
+                report['scenarios'][name] = getattr(self, name)()
+        report['server'] = self.server_stats()
+        if 'drop' in scenarios:
+            self.log('drop')
+            report['scenarios']['drop'] = self.drop()
+        return report
+
+
+def compare(report, baseline, threshold):
+    """Regressions of ops/s and p99 against a baseline report, beyond threshold (fraction)"""
+    regressions = []
+    for name, cur in report['scenarios'].items():
+        base = baseline.get('scenarios', {}).get(name)
+        if not base:
+            continue
+        if base.get('ops_per_sec') and cur['ops_per_sec'] < base['ops_per_sec'] * (1 - threshold):
+            regressions.append('%s: ops/s %.1f -> %.1f' % (name, base['ops_per_sec'], cur['ops_per_sec']))
+        if base.get('p99_us') and cur['p99_us'] > base['p99_us'] * (1 + threshold):
+            regressions.append('%s: p99 %.1fus -> %.1fus' % (name, base['p99_us'], cur['p99_us']))
+    return regressions
+
+
+def start_server(args):
+    script_dir = os.path.dirname(os.path.abspath(__file__))
+    module = os.path.join(script_dir, '..', 'redistable.so')
+    if not os.path.exists(module):
+        sys.exit("ERROR: Module not found at %s, run 'make' first" % module)
+    proc = subprocess.Popen([args.redis_server, '--port', str(args.port), '--loadmodule', module,
+                             '--save', '', '--appendonly', 'no'],
+                            stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    for _ in range(100):
+        try:
+            return proc, RespClient(args.host, args.port)
+        except OSError:
+            time.sleep(0.05)
+    proc.kill()
+    sys.exit('ERROR: cannot start %s' % args.redis_server)
+
+
+def main():
+    p = argparse.ArgumentParser(description='RedisTABLE benchmark')
+    p.add_argument('--host', default='127.0.0.1')
+    p.add_argument('--port', type=int, default=6379)
+    p.add_argument('--start', action='store_true', help='start a redis-server if none is running')
+    p.add_argument('--redis-server', default='redis-server')
+    p.add_argument('--rows', type=int, default=100000, help='rows loaded before the scenarios')
+    p.add_argument('--ops', type=int, default=10000, help='operations per scenario')
+    p.add_argument('--batch', type=int, default=1000, help='rows per TABLE.INSERTMANY while loading')
+    p.add_argument('--pipeline', type=int, default=1, help='commands in flight per round trip')
+    p.add_argument('--fanout', type=int, default=100, help='rows changed by each UPDATE')
+    p.add_argument('--range', type=int, default=100, help='rows matched by each range SELECT')
+    p.add_argument('--engine', choices=['hash', 'native'], default='hash')
+    p.add_argument('--scenarios', default='insert,select_eq,select_range,update_fanout,delete,drop')
+    p.add_argument('--seed', type=int, default=1)
+    p.add_argument('--output', help='write the JSON report here instead of stdout')
+    p.add_argument('--baseline', help='JSON report to compare with, exit 1 on regression')
+    p.add_argument('--threshold', type=float, default=0.10, help='tolerated regression (fraction)')
+    args = p.parse_args()
+
+    proc = None
+    try:
+        client = RespClient(args.host, args.port)
+    except OSError:
+        if not args.start:
+            sys.exit('ERROR: cannot connect to %s:%d (use --start)' % (args.host, args.port))
+        proc, client = start_server(args)
+
+    try:
+        report = Benchmark(client, args).run()
+    finally:
+        if proc:
+            proc.terminate()
+            proc.wait()
+
+    text = json.dumps(report, indent=2)
+    if args.output:
+        with open(args.output, 'w') as f:
+            f.write(text + '\n')
+    else:
+        print(text)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            regressions = compare(report, json.load(f), args.threshold)
+        for r in regressions:
+            print('REGRESSION ' + r, file=sys.stderr)
+        if regressions:
+            sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
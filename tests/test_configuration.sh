@@ -117,6 +117,12 @@ run_test "Unknown parameter" "unknown_param 12345" "Should load and ignore unkno
 # Test 8: Multiple parameters (future-proofing)
 run_test "Multiple parameters" "max_scan_limit 150000" "Should handle multiple params"
 
+# Test 9: Result cache enabled
+run_test "Valid result_cache_mb" "result_cache_mb 64" "Should accept 64"
+
+# Test 10: Result cache too large - should still load with the cache off
+run_test "Invalid result_cache_mb (too high)" "result_cache_mb 100000" "Should load with default (logs warning)"
+
 # Cleanup
 cleanup
 
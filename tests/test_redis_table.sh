@@ -507,15 +507,15 @@ $REDIS_CLI TABLE.SCHEMA.CREATE idxtest.data NAME:string:hash VALUE:integer:hash
 
 test_start "Insert creates index entries"
 $REDIS_CLI TABLE.INSERT idxtest.data NAME=Test VALUE=100 > /dev/null
-result=$($REDIS_CLI SMEMBERS "{idxtest.data}:idx:NAME:Test")
-assert_contains "1" "$result" "Index should contain row ID"
+result=$($REDIS_CLI TABLE.EXPLAIN idxtest.data WHERE NAME=Test | tail -1)
+assert_contains "hash index NAME=Test (est 1)" "$result" "Index should contain row ID"
 
 test_start "Update maintains indexes"
 $REDIS_CLI TABLE.UPDATE idxtest.data WHERE NAME=Test SET NAME=Updated > /dev/null
-result=$($REDIS_CLI SMEMBERS "{idxtest.data}:idx:NAME:Updated")
-assert_contains "1" "$result" "Updated index should contain row ID"
+result=$($REDIS_CLI TABLE.EXPLAIN idxtest.data WHERE NAME=Updated | tail -1)
+assert_contains "hash index NAME=Updated (est 1)" "$result" "Updated index should contain row ID"
 
-old_index=$($REDIS_CLI SMEMBERS "{idxtest.data}:idx:NAME:Test")
+old_index=$($REDIS_CLI TABLE.SELECT idxtest.data WHERE NAME=Test)
 if [[ -z "$old_index" ]] || [[ "$old_index" == *"(empty"* ]]; then
     echo -e "${GREEN}✓ PASS${NC}: Old index entry removed"
     PASSED=$((PASSED + 1))
@@ -526,8 +526,8 @@ fi
 
 test_start "Delete removes index entries"
 $REDIS_CLI TABLE.DELETE idxtest.data WHERE NAME=Updated > /dev/null
-result=$($REDIS_CLI SMEMBERS "{idxtest.data}:idx:NAME:Updated")
-if [[ -z "$result" ]] || [[ "$result" == *"(empty"* ]]; then
+result=$($REDIS_CLI EXISTS "{idxtest.data}:hash:NAME")
+if [[ "$result" == "0" ]]; then
     echo -e "${GREEN}✓ PASS${NC}: Index entry removed after delete"
     PASSED=$((PASSED + 1))
 else
@@ -629,6 +629,1647 @@ $REDIS_CLI TABLE.UPDATE company.employees WHERE EMPID=E001 SET SALARY=52000.75 >
 result=$($REDIS_CLI TABLE.SELECT company.employees WHERE EMPID=E001)
 assert_contains "52000.75" "$result" "Salary should be updated"
 
+# ============================================
+# TEST SUITE 17: BTree Ordered Index
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 17: BTree Ordered Index ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE bt > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE bt.people NAME:string:btree AGE:integer:btree SCORE:float:btree JOINED:date:btree CITY:string:none > /dev/null
+$REDIS_CLI TABLE.INSERT bt.people NAME=Alice AGE=22 SCORE=7.5 JOINED=2021-05-01 CITY=Paris > /dev/null
+$REDIS_CLI TABLE.INSERT bt.people NAME=Bob AGE=30 SCORE=9.25 JOINED=2020-01-15 CITY=Rome > /dev/null
+$REDIS_CLI TABLE.INSERT bt.people NAME=Carol AGE=35 SCORE=6.0 JOINED=2019-11-30 CITY=Paris > /dev/null
+$REDIS_CLI TABLE.INSERT bt.people NAME=Dave AGE=41 SCORE=8.0 JOINED=2022-02-28 CITY=Oslo > /dev/null
+
+test_start "Insert populates ordered index"
+result=$($REDIS_CLI ZCARD "{bt.people}:btree:AGE")
+assert_equals "4" "$result" "AGE btree should hold all rows"
+
+test_start "Range query on btree integer column"
+result=$($REDIS_CLI TABLE.SELECT bt.people WHERE AGE\>30)
+assert_contains "Carol" "$result" "AGE>30 should find Carol"
+assert_contains "Dave" "$result" "AGE>30 should find Dave"
+assert_equals "2" "$(echo "$result" | grep -c "^NAME$")" "AGE>30 should return 2 rows"
+
+test_start "BETWEEN-style range on btree column"
+result=$($REDIS_CLI TABLE.SELECT bt.people WHERE AGE\>=22 AND AGE\<=30)
+assert_contains "Alice" "$result" "Range should include lower bound"
+assert_contains "Bob" "$result" "Range should include upper bound"
+assert_equals "2" "$(echo "$result" | grep -c "^NAME$")" "Range should return 2 rows"
+
+test_start "Equality on btree column"
+result=$($REDIS_CLI TABLE.SELECT bt.people WHERE AGE=35)
+assert_contains "Carol" "$result" "AGE=35 should find Carol"
+assert_equals "1" "$(echo "$result" | grep -c "^NAME$")" "AGE=35 should return 1 row"
+
+test_start "Range on btree float and date columns"
+result=$($REDIS_CLI TABLE.SELECT bt.people WHERE SCORE\>7.5)
+assert_equals "2" "$(echo "$result" | grep -c "^NAME$")" "SCORE>7.5 should return 2 rows"
+result=$($REDIS_CLI TABLE.SELECT bt.people WHERE JOINED\<2020-06-01)
+assert_contains "Bob" "$result" "JOINED<2020-06-01 should find Bob"
+assert_contains "Carol" "$result" "JOINED<2020-06-01 should find Carol"
+assert_equals "2" "$(echo "$result" | grep -c "^NAME$")" "Date range should return 2 rows"
+
+test_start "Range on btree string column"
+result=$($REDIS_CLI TABLE.SELECT bt.people WHERE NAME\>Bob AND NAME\<=Dave)
+assert_contains "Carol" "$result" "NAME range should find Carol"
+assert_contains "Dave" "$result" "NAME range should include upper bound"
+assert_equals "2" "$(echo "$result" | grep -c "^NAME$")" "NAME range should return 2 rows"
+
+test_start "OR and AND with other conditions"
+result=$($REDIS_CLI TABLE.SELECT bt.people WHERE AGE\<25 OR AGE\>40)
+assert_contains "Alice" "$result" "OR should find Alice"
+assert_contains "Dave" "$result" "OR should find Dave"
+assert_equals "2" "$(echo "$result" | grep -c "^NAME$")" "OR should return 2 rows"
+result=$($REDIS_CLI TABLE.SELECT bt.people WHERE AGE\>25 AND CITY\>Oslo)
+assert_equals "2" "$(echo "$result" | grep -c "^NAME$")" "AND with scanned column should return 2 rows"
+
+test_start "Update maintains ordered index"
+$REDIS_CLI TABLE.UPDATE bt.people WHERE NAME=Alice SET AGE=50 > /dev/null
+result=$($REDIS_CLI TABLE.SELECT bt.people WHERE AGE\>45)
+assert_contains "Alice" "$result" "Updated row should be found by new value"
+result=$($REDIS_CLI TABLE.SELECT bt.people WHERE AGE\<25)
+assert_equals "" "$result" "Old value should be gone from index"
+
+test_start "Delete maintains ordered index"
+$REDIS_CLI TABLE.DELETE bt.people WHERE AGE\>=41 > /dev/null
+result=$($REDIS_CLI ZCARD "{bt.people}:btree:AGE")
+assert_equals "2" "$result" "Deleted rows should leave the btree"
+
+test_start "Add and drop btree index on existing column"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER bt.people ADD INDEX CITY:btree)
+assert_equals "OK" "$result" "ADD INDEX CITY:btree should succeed"
+result=$($REDIS_CLI ZCARD "{bt.people}:btree:CITY")
+assert_equals "2" "$result" "ADD INDEX should build btree from existing rows"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER bt.people DROP INDEX CITY)
+assert_equals "OK" "$result" "DROP INDEX CITY should succeed"
+result=$($REDIS_CLI EXISTS "{bt.people}:btree:CITY")
+assert_equals "0" "$result" "DROP INDEX should remove btree key"
+
+test_start "Integers beyond 2^53 on a btree column"
+$REDIS_CLI TABLE.SCHEMA.CREATE bt.big N:integer:btree > /dev/null
+$REDIS_CLI TABLE.INSERTMANY bt.big COLUMNS N VALUES 5 9007199254740992 9007199254740993 9007199254740994 -9007199254740993 > /dev/null
+result=$($REDIS_CLI TABLE.SELECT bt.big COLUMNS N WHERE N\>9007199254740992 | tr '\n' ' ')
+assert_equals "9007199254740993 9007199254740994 " "$result" "Values sharing a score told apart"
+result=$($REDIS_CLI TABLE.SELECT bt.big COLUMNS N WHERE N=9007199254740993)
+assert_equals "9007199254740993" "$result" "Equality is exact"
+result=$($REDIS_CLI TABLE.SELECT bt.big COLUMNS N WHERE N\<9007199254740993 AND N\>-9007199254740992 | tr '\n' ' ')
+assert_equals "5 9007199254740992 " "$result" "Both bounds checked"
+result=$($REDIS_CLI TABLE.AGGREGATE bt.big COUNT WHERE N\>9007199254740992)
+assert_equals "2" "$result" "COUNT is not read from the index"
+$REDIS_CLI TABLE.DROP bt.big FORCE > /dev/null
+
+test_start "Drop table removes ordered indexes"
+$REDIS_CLI TABLE.DROP bt.people FORCE > /dev/null
+result=$($REDIS_CLI EXISTS "{bt.people}:btree:AGE" "{bt.people}:btree:NAME" "{bt.people}:idx:btree")
+assert_equals "0" "$result" "No btree keys should remain"
+
+# ============================================
+# TEST SUITE 18: Schema Cache Consistency
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 18: Schema Cache Consistency ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE sc > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE sc.items SKU:string:hash QTY:integer > /dev/null
+$REDIS_CLI TABLE.INSERT sc.items SKU=A1 QTY=5 > /dev/null
+
+test_start "ALTER is visible to the next command"
+$REDIS_CLI TABLE.SCHEMA.ALTER sc.items ADD COLUMN PRICE:float > /dev/null
+result=$($REDIS_CLI TABLE.INSERT sc.items SKU=B2 QTY=3 PRICE=1.5)
+assert_equals "2" "$result" "Insert should accept the new column"
+
+test_start "External change to schema key is picked up"
+$REDIS_CLI HSET "schema:{sc.items}" COLOR string > /dev/null
+result=$($REDIS_CLI TABLE.INSERT sc.items SKU=C3 COLOR=red)
+assert_equals "3" "$result" "Insert should see column added with HSET"
+$REDIS_CLI SREM "{sc.items}:idx:meta" SKU > /dev/null
+result=$($REDIS_CLI TABLE.SELECT sc.items WHERE SKU=A1 2>&1)
+assert_contains "non-indexed" "$result" "Removing index metadata should disable the index"
+
+test_start "Dropped table is not served from cache"
+$REDIS_CLI TABLE.DROP sc.items FORCE > /dev/null
+result=$($REDIS_CLI TABLE.INSERT sc.items SKU=D4 2>&1)
+assert_contains "does not exist" "$result" "Insert into dropped table should fail"
+$REDIS_CLI DEL "schema:{sc}" > /dev/null
+
+# ============================================
+# TEST SUITE 19: Native Storage Engine
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 19: Native Storage Engine ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE nt > /dev/null 2>&1
+
+test_start "Create native table"
+result=$($REDIS_CLI TABLE.SCHEMA.CREATE nt.emp NAME:string:hash AGE:integer:btree SALARY:float:btree DEPT:string ENGINE native)
+assert_equals "OK" "$result" "Native table creation should succeed"
+result=$($REDIS_CLI TYPE "{nt.emp}:data")
+assert_equals "rtable-nt" "$result" "Rows should live in one module-typed key"
+result=$($REDIS_CLI TABLE.SCHEMA.CREATE nt.bad NAME:string ENGINE columnar 2>&1)
+assert_contains "engine must be" "$result" "Unknown engine should be rejected"
+
+$REDIS_CLI TABLE.INSERT nt.emp NAME=Ann AGE=28 SALARY=-1.5 DEPT=Ops > /dev/null
+$REDIS_CLI TABLE.INSERT nt.emp NAME=Ben AGE=35 SALARY=4200.0 DEPT=Dev > /dev/null
+$REDIS_CLI TABLE.INSERT nt.emp NAME=Cid AGE=-3 SALARY=0 DEPT=Dev > /dev/null
+$REDIS_CLI TABLE.INSERT nt.emp NAME=Dee AGE=42 SALARY=5100.25 DEPT=Ops > /dev/null
+
+test_start "Native insert assigns row IDs without per-row keys"
+result=$($REDIS_CLI TABLE.INSERT nt.emp NAME=Eve AGE=51 SALARY=6000 DEPT=Dev)
+assert_equals "5" "$result" "Fifth row should get ID 5"
+result=$($REDIS_CLI EXISTS "{nt.emp}:1" "{nt.emp}:rows" "{nt.emp}:id" "{nt.emp}:hash:NAME")
+assert_equals "0" "$result" "No row, rows-set, counter or index keys should exist"
+result=$($REDIS_CLI TABLE.INSERT nt.emp NAME=Bad AGE=old 2>&1)
+assert_contains "invalid column or type" "$result" "Type errors should be rejected"
+result=$($REDIS_CLI TABLE.SELECT nt.emp WHERE NAME=Bad)
+assert_equals "" "$result" "Rejected insert should not create a row"
+
+test_start "Native hash index equality"
+result=$($REDIS_CLI TABLE.SELECT nt.emp WHERE NAME=Ben)
+assert_contains "4200" "$result" "NAME=Ben should find Ben"
+assert_equals "1" "$(echo "$result" | grep -c "^NAME$")" "NAME=Ben should return 1 row"
+
+test_start "Native ordered index ranges"
+result=$($REDIS_CLI TABLE.SELECT nt.emp WHERE AGE\>=28 AND AGE\<42)
+assert_contains "Ann" "$result" "Range should include Ann"
+assert_contains "Ben" "$result" "Range should include Ben"
+assert_equals "2" "$(echo "$result" | grep -c "^NAME$")" "Range should return 2 rows"
+result=$($REDIS_CLI TABLE.SELECT nt.emp WHERE AGE\<0)
+assert_contains "Cid" "$result" "Negative integers should order before zero"
+result=$($REDIS_CLI TABLE.SELECT nt.emp WHERE SALARY\<=0)
+assert_equals "2" "$(echo "$result" | grep -c "^NAME$")" "Negative and zero floats should be found"
+
+test_start "Native scan conditions"
+result=$($REDIS_CLI TABLE.SELECT nt.emp WHERE DEPT\>Dev AND AGE\>30)
+assert_contains "Dee" "$result" "Scan plus range should find Dee"
+assert_equals "1" "$(echo "$result" | grep -c "^NAME$")" "Scan plus range should return 1 row"
+
+test_start "Native update maintains indexes"
+result=$($REDIS_CLI TABLE.UPDATE nt.emp WHERE NAME=Ann SET AGE=60 NAME=Amy)
+assert_equals "1" "$result" "Update should change 1 row"
+result=$($REDIS_CLI TABLE.SELECT nt.emp WHERE AGE\>55)
+assert_contains "Amy" "$result" "Updated row should be found by new value"
+result=$($REDIS_CLI TABLE.SELECT nt.emp WHERE NAME=Ann)
+assert_equals "" "$result" "Old value should be gone from index"
+
+test_start "Native delete"
+result=$($REDIS_CLI TABLE.DELETE nt.emp WHERE AGE\>30 AND DEPT=Dev)
+assert_equals "2" "$result" "Delete should remove Ben and Eve"
+result=$($REDIS_CLI TABLE.SELECT nt.emp)
+assert_equals "3" "$(echo "$result" | grep -c "^NAME$")" "3 rows should remain"
+
+test_start "Native ADD INDEX and DROP INDEX"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER nt.emp ADD INDEX DEPT)
+assert_equals "OK" "$result" "ADD INDEX should succeed"
+result=$($REDIS_CLI TABLE.SELECT nt.emp WHERE DEPT=Ops)
+assert_equals "2" "$(echo "$result" | grep -c "^NAME$")" "New index should serve existing rows"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER nt.emp DROP INDEX DEPT)
+assert_equals "OK" "$result" "DROP INDEX should succeed"
+result=$($REDIS_CLI TABLE.SELECT nt.emp WHERE DEPT=Ops 2>&1)
+assert_contains "non-indexed" "$result" "Dropped index should no longer be used"
+
+test_start "Native memory usage is reported"
+result=$($REDIS_CLI MEMORY USAGE "{nt.emp}:data")
+assert_equals "1" "$([ "${result:-0}" -gt 0 ] 2>/dev/null && echo 1 || echo 0)" "MEMORY USAGE should report the table size"
+
+test_start "Drop native table"
+result=$($REDIS_CLI TABLE.DROP nt.emp FORCE)
+assert_equals "OK" "$result" "Drop should succeed"
+result=$($REDIS_CLI EXISTS "{nt.emp}:data" "schema:{nt.emp}")
+assert_equals "0" "$result" "Drop should remove the data key"
+$REDIS_CLI DEL "schema:{nt}" > /dev/null
+
+# ============================================
+# TEST SUITE 20: Typed Values
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 20: Typed Values ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE tv > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE tv.h QTY:integer PRICE:float DAY:date:btree > /dev/null
+$REDIS_CLI TABLE.SCHEMA.CREATE tv.n QTY:integer PRICE:float DAY:date:btree ENGINE native > /dev/null
+
+test_start "Dates must be calendar days"
+result=$($REDIS_CLI TABLE.INSERT tv.h QTY=1 PRICE=1 DAY=2024-02-30 2>&1)
+assert_contains "invalid column or type" "$result" "February 30 should be rejected"
+result=$($REDIS_CLI TABLE.INSERT tv.n QTY=1 PRICE=1 DAY=2023-02-29 2>&1)
+assert_contains "invalid column or type" "$result" "February 29 of a common year should be rejected"
+result=$($REDIS_CLI TABLE.INSERT tv.n QTY=1 PRICE=1 DAY=2024-02-29)
+assert_equals "1" "$result" "February 29 of a leap year should be accepted"
+
+test_start "Integers must fit in 64 bits"
+result=$($REDIS_CLI TABLE.INSERT tv.h QTY=99999999999999999999 PRICE=1 DAY=2024-01-01 2>&1)
+assert_contains "invalid column or type" "$result" "Integer overflow should be rejected"
+
+$REDIS_CLI TABLE.INSERT tv.h QTY=9 PRICE=9.5 DAY=2024-01-15 > /dev/null
+$REDIS_CLI TABLE.INSERT tv.h QTY=10 PRICE=10.25 DAY=2024-03-01 > /dev/null
+$REDIS_CLI TABLE.INSERT tv.n QTY=+10 PRICE=10.50 DAY=2024-03-01 > /dev/null
+$REDIS_CLI TABLE.INSERT tv.n QTY=-2 PRICE=.5 DAY=2023-12-31 > /dev/null
+
+test_start "Numeric comparisons on scanned columns"
+result=$($REDIS_CLI TABLE.SELECT tv.h WHERE QTY\>9)
+assert_equals "1" "$(echo "$result" | grep -c "^QTY$")" "QTY>9 should compare numbers, not text"
+result=$($REDIS_CLI TABLE.SELECT tv.n WHERE PRICE\<=1.0)
+assert_equals "2" "$(echo "$result" | grep -c "^QTY$")" "PRICE<=1.0 should match 1 and 0.5"
+result=$($REDIS_CLI TABLE.SELECT tv.n WHERE DAY\>=2024-01-01 AND QTY\>0)
+assert_equals "2" "$(echo "$result" | grep -c "^QTY$")" "Date range plus integer scan should return 2 rows"
+
+test_start "Native tables return canonical values"
+result=$($REDIS_CLI TABLE.SELECT tv.n WHERE DAY=2024-03-01)
+assert_contains "10.5" "$result" "Float should be returned in shortest form"
+assert_equals "0" "$(echo "$result" | grep -c "^+10$")" "Integer should be returned without sign"
+result=$($REDIS_CLI TABLE.SELECT tv.n WHERE DAY\<2024-01-01)
+assert_contains "0.5" "$result" "Float without leading digit should be normalized"
+
+$REDIS_CLI TABLE.DROP tv.h FORCE > /dev/null
+$REDIS_CLI TABLE.DROP tv.n FORCE > /dev/null
+$REDIS_CLI DEL "schema:{tv}" > /dev/null
+
+# ============================================
+# TEST SUITE 21: Bulk Insert
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 21: Bulk Insert ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE bi > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE bi.h NAME:string:hash AGE:integer:btree CITY:string > /dev/null
+$REDIS_CLI TABLE.SCHEMA.CREATE bi.n NAME:string:hash AGE:integer:btree CITY:string ENGINE native > /dev/null
+
+for t in bi.h bi.n; do
+    test_start "INSERTMANY assigns a contiguous ID range ($t)"
+    $REDIS_CLI TABLE.INSERT $t NAME=Zed AGE=99 CITY=Rome > /dev/null
+    result=$($REDIS_CLI TABLE.INSERTMANY $t COLUMNS NAME AGE CITY VALUES Ann 30 Paris Bob 25 Oslo Ann 41 Lima | tr '\n' ' ')
+    assert_equals "2 4 " "$result" "Three rows should get IDs 2 to 4"
+
+    test_start "INSERTMANY maintains indexes ($t)"
+    result=$($REDIS_CLI TABLE.SELECT $t WHERE NAME=Ann)
+    assert_equals "2" "$(echo "$result" | grep -c "^NAME$")" "Hash index should find both Ann rows"
+    result=$($REDIS_CLI TABLE.SELECT $t WHERE AGE\>=30 AND AGE\<50)
+    assert_equals "2" "$(echo "$result" | grep -c "^NAME$")" "btree index should find ages 30 and 41"
+
+    test_start "INSERTMANY validates the whole batch first ($t)"
+    result=$($REDIS_CLI TABLE.INSERTMANY $t COLUMNS NAME AGE VALUES Cid 20 Dee old 2>&1)
+    assert_contains "invalid column or type" "$result" "A bad value should reject the batch"
+    result=$($REDIS_CLI TABLE.SELECT $t WHERE NAME=Cid)
+    assert_equals "" "$result" "No row of a rejected batch should be written"
+    result=$($REDIS_CLI TABLE.INSERTMANY $t COLUMNS NAME AGE VALUES Cid 20 Dee 2>&1)
+    assert_contains "multiple of the number of columns" "$result" "Incomplete rows should be rejected"
+    result=$($REDIS_CLI TABLE.INSERTMANY $t COLUMNS NAME NAME VALUES a b 2>&1)
+    assert_contains "duplicate column" "$result" "Duplicate columns should be rejected"
+    result=$($REDIS_CLI TABLE.INSERT $t NAME=Eve AGE=50)
+    assert_equals "5" "$result" "Rejected batches should not consume row IDs"
+done
+
+$REDIS_CLI TABLE.DROP bi.h FORCE > /dev/null
+$REDIS_CLI TABLE.DROP bi.n FORCE > /dev/null
+$REDIS_CLI DEL "schema:{bi}" > /dev/null
+
+# ============================================
+# TEST SUITE 22: Paginated SELECT
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 22: Paginated SELECT ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE pg > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE pg.h N:string:hash Q:integer:btree > /dev/null
+$REDIS_CLI TABLE.SCHEMA.CREATE pg.n N:string:hash Q:integer:btree ENGINE native > /dev/null
+
+for t in pg.h pg.n; do
+    $REDIS_CLI TABLE.INSERTMANY $t COLUMNS N Q VALUES a 1 a 2 a 3 b 4 a 5 a 6 a 7 a 8 a 9 a 10 a 11 b 12 > /dev/null
+
+    test_start "LIMIT and OFFSET ($t)"
+    result=$($REDIS_CLI TABLE.SELECT $t WHERE N=a LIMIT 3)
+    assert_equals "3" "$(echo "$result" | grep -c "^N$")" "LIMIT 3 should return 3 rows"
+    result=$($REDIS_CLI TABLE.SELECT $t WHERE N=a LIMIT 5 OFFSET 8)
+    assert_equals "2" "$(echo "$result" | grep -c "^N$")" "OFFSET 8 of 10 rows should leave 2 rows"
+    result=$($REDIS_CLI TABLE.SELECT $t LIMIT 0 2>&1)
+    assert_contains "LIMIT must be a positive integer" "$result" "LIMIT 0 should be rejected"
+
+    test_start "CURSOR walks every row once ($t)"
+    cursor=0; pages=0; seen=""
+    while :; do
+        page=$($REDIS_CLI TABLE.SELECT $t WHERE Q\>=1 CURSOR $cursor LIMIT 5)
+        cursor=$(echo "$page" | head -1)
+        seen="$seen $(echo "$page" | grep -A1 "^Q$" | grep -v "^Q$\|^--$" | tr '\n' ' ')"
+        pages=$((pages + 1))
+        [ "$cursor" = "0" ] || [ $pages -gt 5 ] && break
+    done
+    assert_equals "3" "$pages" "12 rows in pages of 5 should take 3 pages"
+    assert_equals "12" "$(echo $seen | wc -w | tr -d ' ')" "12 rows should be returned in total"
+    assert_equals "12" "$(echo $seen | tr ' ' '\n' | sort -u | wc -l | tr -d ' ')" "Every row should be returned exactly once"
+done
+
+$REDIS_CLI TABLE.DROP pg.h FORCE > /dev/null
+$REDIS_CLI TABLE.DROP pg.n FORCE > /dev/null
+$REDIS_CLI DEL "schema:{pg}" > /dev/null
+
+# ============================================
+# TEST SUITE 23: Column Projection
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 23: Column Projection ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE pj > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE pj.h NAME:string:hash AGE:integer:btree CITY:string NOTE:string > /dev/null
+$REDIS_CLI TABLE.SCHEMA.CREATE pj.n NAME:string:hash AGE:integer:btree CITY:string NOTE:string ENGINE native > /dev/null
+
+for t in pj.h pj.n; do
+    $REDIS_CLI TABLE.INSERT $t NAME=Ann AGE=30 CITY=Paris NOTE=x > /dev/null
+
+    test_start "COLUMNS returns only the projected values ($t)"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS CITY,AGE WHERE NAME=Ann | tr '\n' ' ')
+    assert_equals "Paris 30 " "$result" "Values should come in projection order without column names"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS NAME,NOTE LIMIT 1 | tr '\n' ' ')
+    assert_equals "Ann x " "$result" "Projection should combine with LIMIT"
+
+    test_start "COLUMNS rejects unknown columns ($t)"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS NAME,NOPE 2>&1)
+    assert_contains "unknown column" "$result" "Unknown projected column should be rejected"
+done
+
+$REDIS_CLI TABLE.DROP pj.h FORCE > /dev/null
+$REDIS_CLI TABLE.DROP pj.n FORCE > /dev/null
+$REDIS_CLI DEL "schema:{pj}" > /dev/null
+
+# ============================================
+# TEST SUITE 24: WHERE Planner and EXPLAIN
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 24: WHERE Planner and EXPLAIN ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE qp > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE qp.t NAME:string:hash AGE:integer:btree CITY:string > /dev/null
+$REDIS_CLI TABLE.INSERTMANY qp.t COLUMNS NAME AGE CITY VALUES a 1 x a 2 y b 4 x a 5 x a 6 y a 7 x a 8 z c 9 x > /dev/null
+
+test_start "Most selective index seeds an AND"
+result=$($REDIS_CLI TABLE.EXPLAIN qp.t WHERE CITY\>w AND AGE\>=2 AND AGE\<8 AND NAME=b)
+assert_equals "hash index NAME=b (est 1)" "$(echo "$result" | sed -n 3p | sed 's/^ *//')" "Equality on NAME should be the seed"
+assert_contains "FILTER CITY>w" "$result" "Non-indexed condition should be a residual filter"
+result=$($REDIS_CLI TABLE.SELECT qp.t COLUMNS AGE WHERE CITY\>w AND AGE\>=2 AND AGE\<8 AND NAME=b)
+assert_equals "4" "$result" "Reordered plan should return the same row"
+
+test_start "Ranges on one btree column are merged"
+result=$($REDIS_CLI TABLE.EXPLAIN qp.t WHERE AGE\>2 AND NAME=a AND AGE\<=6)
+assert_contains "AGE in (2, 6]" "$result" "Both bounds should form one range"
+
+test_start "OR returns the union of its conditions"
+result=$($REDIS_CLI TABLE.SELECT qp.t COLUMNS AGE WHERE NAME=c OR CITY\>y | sort -n | tr '\n' ' ')
+assert_equals "8 9 " "$result" "OR with a scanned condition should add its rows"
+result=$($REDIS_CLI TABLE.DELETE qp.t WHERE AGE\>100 OR CITY=z)
+assert_equals "1" "$result" "DELETE should use the same planner"
+
+test_start "EXPLAIN without WHERE"
+result=$($REDIS_CLI TABLE.EXPLAIN qp.t)
+assert_contains "SCAN all rows (est 7)" "$result" "Full scan should report the table size"
+result=$($REDIS_CLI TABLE.EXPLAIN qp.t WHERE CITY=x 2>&1)
+assert_contains "non-indexed column" "$result" "EXPLAIN should apply SELECT rules"
+
+$REDIS_CLI TABLE.DROP qp.t FORCE > /dev/null
+$REDIS_CLI DEL "schema:{qp}" > /dev/null
+
+# ============================================
+# TEST SUITE 25: Index Set Algebra and Precedence
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 25: Index Set Algebra and Precedence ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE sa > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE sa.h NAME:string:hash AGE:integer:btree CITY:string:hash > /dev/null
+$REDIS_CLI TABLE.SCHEMA.CREATE sa.n NAME:string:hash AGE:integer:btree CITY:string:hash ENGINE native > /dev/null
+
+for t in sa.h sa.n; do
+    $REDIS_CLI TABLE.INSERTMANY $t COLUMNS NAME AGE CITY VALUES a 1 x a 2 y b 4 x a 5 x a 6 y a 7 x a 8 z c 9 x > /dev/null
+
+    test_start "AND of indexed equalities intersects the index sets ($t)"
+    result=$($REDIS_CLI TABLE.EXPLAIN $t WHERE NAME=a AND CITY=x)
+    assert_contains "hash index intersection (est 5)" "$result" "Both equalities should form one intersection"
+    assert_equals "CITY=x (est 5)" "$(echo "$result" | sed -n 3p | sed 's/^ *//')" "Smallest set should come first"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS AGE WHERE NAME=a AND CITY=x | sort -n | tr '\n' ' ')
+    assert_equals "1 5 7 " "$result" "Intersection should return rows matching both"
+
+    test_start "OR of indexed equalities unions the index sets ($t)"
+    result=$($REDIS_CLI TABLE.EXPLAIN $t WHERE NAME=b OR CITY=z)
+    assert_contains "hash index union" "$result" "Both equalities should form one union"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS AGE WHERE NAME=b OR CITY=z | sort -n | tr '\n' ' ')
+    assert_equals "4 8 " "$result" "Union should return rows matching either"
+
+    test_start "AND binds tighter than OR ($t)"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS AGE WHERE NAME=c OR NAME=a AND CITY=y | sort -n | tr '\n' ' ')
+    assert_equals "2 6 9 " "$result" "NAME=c OR (NAME=a AND CITY=y)"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS AGE WHERE NAME=a AND CITY=y OR AGE\>8 | sort -n | tr '\n' ' ')
+    assert_equals "2 6 9 " "$result" "(NAME=a AND CITY=y) OR AGE>8"
+done
+
+$REDIS_CLI TABLE.DROP sa.h FORCE > /dev/null
+$REDIS_CLI TABLE.DROP sa.n FORCE > /dev/null
+$REDIS_CLI DEL "schema:{sa}" > /dev/null
+
+# ============================================
+# TEST SUITE 26: Row ID Sets
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 26: Row ID Sets ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE rs > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE rs.h NAME:string:hash AGE:integer:btree CITY:string:hash > /dev/null
+$REDIS_CLI TABLE.SCHEMA.CREATE rs.n NAME:string:hash AGE:integer:btree CITY:string:hash ENGINE native > /dev/null
+
+for t in rs.h rs.n; do
+    values=""
+    for i in $(seq 1 100); do values="$values b $i x"; done
+    $REDIS_CLI TABLE.INSERTMANY $t COLUMNS NAME AGE CITY VALUES $values > /dev/null
+    $REDIS_CLI TABLE.UPDATE $t WHERE AGE=50 SET NAME=a > /dev/null
+    $REDIS_CLI TABLE.UPDATE $t WHERE AGE=60 SET CITY=y > /dev/null
+
+    test_start "Rows are returned in row ID order ($t)"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS AGE WHERE AGE\<13 | tr '\n' ' ')
+    assert_equals "1 2 3 4 5 6 7 8 9 10 11 12 " "$result" "IDs should be ordered numerically"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS AGE WHERE AGE\>98 OR AGE\<3 | tr '\n' ' ')
+    assert_equals "1 2 99 100 " "$result" "Unions should keep row ID order"
+
+    test_start "CURSOR pages follow row ID order ($t)"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS AGE CURSOR 0 LIMIT 9 | tr '\n' ' ')
+    assert_equals "9 1 2 3 4 5 6 7 8 9 " "$result" "First page should be rows 1-9"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS AGE CURSOR 9 LIMIT 3 | tr '\n' ' ')
+    assert_equals "12 10 11 12 " "$result" "Next page should resume after row 9"
+
+    test_start "Intersection of a small and a large set ($t)"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS AGE WHERE NAME=a AND CITY=x)
+    assert_equals "50" "$result" "Only the single shared row"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS AGE WHERE NAME=a AND CITY=y | wc -l)
+    assert_equals "0" "$(echo $result)" "Disjoint sets give no rows"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS AGE WHERE NAME=b AND AGE\>=45 AND AGE\<=55 | tr '\n' ' ')
+    assert_equals "45 46 47 48 49 51 52 53 54 55 " "$result" "Range intersected with a large set"
+done
+
+$REDIS_CLI TABLE.DROP rs.h FORCE > /dev/null
+$REDIS_CLI TABLE.DROP rs.n FORCE > /dev/null
+$REDIS_CLI DEL "schema:{rs}" > /dev/null
+
+# ============================================
+# TEST SUITE 27: Background Queries
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 27: Background Queries ===${NC}"
+
+# Scans of more than async_scan_rows (default 10000) rows run in a background thread
+$REDIS_CLI TABLE.NAMESPACE.CREATE bq > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE bq.h A:integer B:string:hash > /dev/null
+$REDIS_CLI TABLE.SCHEMA.CREATE bq.n A:integer B:string:hash ENGINE native > /dev/null
+
+for t in bq.h bq.n; do
+    for k in 0 1 2; do
+        values=$(seq $((k * 4000 + 1)) $((k * 4000 + 4000)) | awk '{printf "%d %s ", $1, ($1 % 2 ? "odd" : "even")}')
+        $REDIS_CLI TABLE.INSERTMANY $t COLUMNS A B VALUES $values > /dev/null
+    done
+
+    test_start "EXPLAIN reports background execution ($t)"
+    result=$($REDIS_CLI TABLE.EXPLAIN $t WHERE A\>100)
+    assert_contains "runs in background (12000 rows checked one by one)" "$result" "Large scan should run in background"
+    result=$($REDIS_CLI TABLE.EXPLAIN $t WHERE B=odd AND A\<50)
+    assert_equals "0" "$(echo "$result" | grep -c background)" "Scan of the index result stays on the main thread"
+
+    test_start "Background SELECT returns the matching rows ($t)"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS A WHERE A\>11997 | tr '\n' ' ')
+    assert_equals "11998 11999 12000 " "$result" "Rows above 11997"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS A WHERE A\>100 LIMIT 2 OFFSET 1 | tr '\n' ' ')
+    assert_equals "102 103 " "$result" "Paging applies to background results"
+
+    test_start "Background UPDATE and DELETE ($t)"
+    result=$($REDIS_CLI TABLE.UPDATE $t WHERE A\>7000 SET B=big)
+    assert_equals "5000" "$result" "Should update 5000 rows"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS A WHERE B=big | wc -l)
+    assert_equals "5000" "$(echo $result)" "Index should follow the background update"
+    result=$($REDIS_CLI TABLE.DELETE $t WHERE A\<=2000)
+    assert_equals "2000" "$result" "Should delete 2000 rows"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS A WHERE A\>0 | wc -l)
+    assert_equals "10000" "$(echo $result)" "10000 rows should remain"
+done
+
+test_start "Background scans are not bound by the scan limit"
+for k in 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 25; do
+    values=$(seq $((k * 4000 + 1)) $((k * 4000 + 4000)) | awk '{printf "%d x ", $1}')
+    $REDIS_CLI TABLE.INSERTMANY bq.n COLUMNS A B VALUES $values > /dev/null
+done
+result=$($REDIS_CLI TABLE.SELECT bq.n COLUMNS A WHERE A\>103999 | tr '\n' ' ')
+assert_equals "104000 " "$result" "Scan of 102000 rows should succeed"
+
+$REDIS_CLI TABLE.DROP bq.h FORCE > /dev/null
+$REDIS_CLI TABLE.DROP bq.n FORCE > /dev/null
+$REDIS_CLI DEL "schema:{bq}" > /dev/null
+
+# ============================================
+# TEST SUITE 28: Parallel Filters
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 28: Parallel Filters ===${NC}"
+
+# Filters over more than 16384 rows of a native table are split across worker threads
+$REDIS_CLI TABLE.NAMESPACE.CREATE pf > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE pf.n A:integer B:float C:string ENGINE native > /dev/null
+for k in 0 1 2 3 4; do
+    values=$(seq $((k * 4000 + 1)) $((k * 4000 + 4000)) | awk '{printf "%d %d.5 c%d ", $1, $1 % 1000, $1 % 7}')
+    $REDIS_CLI TABLE.INSERTMANY pf.n COLUMNS A B C VALUES $values > /dev/null
+done
+$REDIS_CLI TABLE.DELETE pf.n WHERE A\<=100 > /dev/null
+
+test_start "Parallel range filter counts every matching row"
+result=$($REDIS_CLI TABLE.SELECT pf.n COLUMNS A WHERE B\>=500 AND B\<600 | wc -l)
+assert_equals "2000" "$(echo $result)" "20 rows for each of 100 values"
+
+test_start "Parallel filter keeps row ID order"
+result=$($REDIS_CLI TABLE.SELECT pf.n COLUMNS A WHERE B\<1 LIMIT 3 | tr '\n' ' ')
+assert_equals "1000 2000 3000 " "$result" "First rows with B=0.5"
+result=$($REDIS_CLI TABLE.SELECT pf.n COLUMNS A WHERE C\>c2 AND C\<c4 AND A\>19950 | tr '\n' ' ')
+assert_equals "19953 19960 19967 19974 19981 19988 19995 " "$result" "String range filter across threads"
+
+test_start "Deleted rows are skipped by parallel filters"
+result=$($REDIS_CLI TABLE.SELECT pf.n COLUMNS A WHERE A\<200 | wc -l)
+assert_equals "99" "$(echo $result)" "Rows 101-199 remain"
+
+$REDIS_CLI TABLE.DROP pf.n FORCE > /dev/null
+$REDIS_CLI DEL "schema:{pf}" > /dev/null
+
+# ============================================
+# TEST SUITE 29: Vectorised Comparisons
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 29: Vectorised Comparisons ===${NC}"
+
+# Numeric conditions on native tables compare runs of stored values at once
+$REDIS_CLI TABLE.NAMESPACE.CREATE vk > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE vk.n A:integer F:float D:date ENGINE native > /dev/null
+values=$(seq 1 500 | awk '{printf "%d %.1f 2024-01-%02d ", $1, ($1 % 20) / 2 - 5, $1 % 28 + 1}')
+$REDIS_CLI TABLE.INSERTMANY vk.n COLUMNS A F D VALUES $values > /dev/null
+$REDIS_CLI TABLE.DELETE vk.n WHERE A\>=100 AND A\<150 > /dev/null
+
+test_start "Integer comparisons over stored runs"
+result=$($REDIS_CLI TABLE.SELECT vk.n COLUMNS A WHERE A\>250 | wc -l)
+assert_equals "250" "$(echo $result)" "Rows 251-500"
+result=$($REDIS_CLI TABLE.SELECT vk.n COLUMNS A WHERE A\<=10 | wc -l)
+assert_equals "10" "$(echo $result)" "Rows 1-10"
+result=$($REDIS_CLI TABLE.SELECT vk.n COLUMNS A WHERE A\>=95 AND A\<155 | tr '\n' ' ')
+assert_equals "95 96 97 98 99 150 151 152 153 154 " "$result" "Deleted rows 100-149 are skipped"
+
+test_start "Float comparisons over stored runs"
+result=$($REDIS_CLI TABLE.SELECT vk.n COLUMNS A WHERE F\<0 | wc -l)
+assert_equals "220" "$(echo $result)" "Negative values"
+result=$($REDIS_CLI TABLE.SELECT vk.n COLUMNS A WHERE F\>=2.5 | wc -l)
+assert_equals "115" "$(echo $result)" "Values from 2.5"
+result=$($REDIS_CLI TABLE.DELETE vk.n WHERE F=0.5 AND A\>400)
+assert_equals "5" "$result" "Equality on a float column"
+
+test_start "Date comparisons over stored runs"
+result=$($REDIS_CLI TABLE.SELECT vk.n COLUMNS A WHERE D\>2024-01-20 | wc -l)
+assert_equals "124" "$(echo $result)" "Days 21-28 of the remaining rows"
+result=$($REDIS_CLI TABLE.SELECT vk.n COLUMNS A WHERE D\>2024-01-2 AND A\<=30 | wc -l)
+assert_equals "9" "$(echo $result)" "Constant that is not a date compares as text"
+
+$REDIS_CLI TABLE.DROP vk.n FORCE > /dev/null
+$REDIS_CLI DEL "schema:{vk}" > /dev/null
+
+# ============================================
+# TEST SUITE 30: Aggregates
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 30: Aggregates ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE ag > /dev/null 2>&1
+for engine in hash native; do
+    t=ag.$engine
+    $REDIS_CLI TABLE.SCHEMA.CREATE $t DEPT:string:hash AGE:integer:btree SAL:float HIRED:date ENGINE $engine > /dev/null
+    $REDIS_CLI TABLE.INSERT $t DEPT=Dev AGE=30 SAL=100.5 HIRED=2020-01-01 > /dev/null
+    $REDIS_CLI TABLE.INSERT $t DEPT=Dev AGE=40 SAL=200 HIRED=2021-06-15 > /dev/null
+    $REDIS_CLI TABLE.INSERT $t DEPT=Ops AGE=25 SAL=50.25 HIRED=2019-03-10 > /dev/null
+    $REDIS_CLI TABLE.INSERT $t DEPT=Ops AGE=35 HIRED=2022-02-02 > /dev/null
+    $REDIS_CLI TABLE.INSERT $t DEPT=Sales AGE=105 SAL=300 > /dev/null
+
+    test_start "COUNT ($engine engine)"
+    result=$($REDIS_CLI TABLE.AGGREGATE $t COUNT)
+    assert_equals "5" "$result" "Every row"
+    result=$($REDIS_CLI TABLE.AGGREGATE $t COUNT WHERE DEPT=Dev)
+    assert_equals "2" "$result" "Size of the hash index entry"
+    result=$($REDIS_CLI TABLE.AGGREGATE $t COUNT WHERE AGE\>=35)
+    assert_equals "3" "$result" "Size of the btree range"
+    result=$($REDIS_CLI TABLE.AGGREGATE $t COUNT WHERE AGE\>=30 AND DEPT=Ops)
+    assert_equals "1" "$result" "Rows matching both conditions"
+
+    test_start "SUM, AVG, MIN and MAX ($engine engine)"
+    result=$($REDIS_CLI TABLE.AGGREGATE $t SUM AGE)
+    assert_equals "235" "$result" "Integer sum"
+    result=$($REDIS_CLI TABLE.AGGREGATE $t SUM SAL)
+    assert_equals "650.75" "$result" "Float sum skips rows without a value"
+    result=$($REDIS_CLI TABLE.AGGREGATE $t AVG SAL)
+    assert_equals "162.6875" "$result" "Average of four values"
+    result=$($REDIS_CLI TABLE.AGGREGATE $t MIN HIRED)
+    assert_equals "2019-03-10" "$result" "Earliest date"
+    result=$($REDIS_CLI TABLE.AGGREGATE $t MAX DEPT)
+    assert_equals "Sales" "$result" "Greatest string"
+    result=$($REDIS_CLI TABLE.AGGREGATE $t MAX SAL WHERE DEPT=Ops)
+    assert_equals "50.25" "$result" "Aggregate of the rows matching WHERE"
+    result=$($REDIS_CLI TABLE.AGGREGATE $t SUM SAL WHERE DEPT=Nobody)
+    assert_equals "" "$result" "No matching row gives nil"
+
+    test_start "GROUP BY ($engine engine)"
+    result=$($REDIS_CLI TABLE.AGGREGATE $t AVG AGE GROUP BY DEPT | tr '\n' ' ')
+    assert_equals "Dev 35 Ops 30 Sales 105 " "$result" "One average per department"
+    result=$($REDIS_CLI TABLE.AGGREGATE $t SUM SAL GROUP BY DEPT WHERE AGE\>26 | tr '\n' ' ')
+    assert_equals "Dev 300.5 Ops  Sales 300 " "$result" "Group without values sums to nil"
+    result=$($REDIS_CLI TABLE.AGGREGATE $t COUNT GROUP BY AGE | tr '\n' ' ')
+    assert_equals "25 1 30 1 35 1 40 1 105 1 " "$result" "Groups in numeric order"
+    result=$($REDIS_CLI TABLE.AGGREGATE $t COUNT GROUP BY HIRED | tr '\n' ' ')
+    assert_equals " 1 2019-03-10 1 2020-01-01 1 2021-06-15 1 2022-02-02 1 " "$result" "Rows without a value come first"
+
+    $REDIS_CLI TABLE.DROP $t FORCE > /dev/null
+done
+
+test_start "AGGREGATE errors"
+$REDIS_CLI TABLE.SCHEMA.CREATE ag.e NAME:string AGE:integer > /dev/null
+result=$($REDIS_CLI TABLE.AGGREGATE ag.e SUM NAME 2>&1)
+assert_contains "need an integer or float column" "$result" "SUM of a string column"
+result=$($REDIS_CLI TABLE.AGGREGATE ag.e MEDIAN AGE 2>&1)
+assert_contains "syntax" "$result" "Unknown function"
+result=$($REDIS_CLI TABLE.AGGREGATE ag.e MAX SIZE 2>&1)
+assert_contains "unknown column" "$result" "Unknown column"
+result=$($REDIS_CLI TABLE.AGGREGATE ag.e COUNT GROUP BY SIZE 2>&1)
+assert_contains "unknown column in GROUP BY" "$result" "Unknown GROUP BY column"
+$REDIS_CLI TABLE.DROP ag.e FORCE > /dev/null
+$REDIS_CLI DEL "schema:{ag}" > /dev/null
+
+# ============================================
+# TEST SUITE 31: ORDER BY
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 31: ORDER BY ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE ob > /dev/null 2>&1
+ages=(30 25 30 41 - 25 30 19 41 30 25 30)
+sals=(100 300 200 50 400 - 150 250 75 100 350 125)
+for engine in hash native; do
+    t=ob.$engine
+    $REDIS_CLI TABLE.SCHEMA.CREATE $t NAME:string:btree AGE:integer:btree SAL:float CITY:string:hash ENGINE $engine > /dev/null
+    for i in $(seq 0 11); do
+        row="NAME=n$(printf %02d $((i + 1)))"
+        [ "${ages[$i]}" != "-" ] && row="$row AGE=${ages[$i]}"
+        [ "${sals[$i]}" != "-" ] && row="$row SAL=${sals[$i]}"
+        [ $((i % 2)) -eq 0 ] && row="$row CITY=Paris" || row="$row CITY=Rome"
+        $REDIS_CLI TABLE.INSERT $t $row > /dev/null
+    done
+
+    test_start "ORDER BY a btree column ($engine engine)"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS NAME ORDER BY AGE LIMIT 5 | tr '\n' ' ')
+    assert_equals "n08 n02 n06 n11 n01 " "$result" "Ties in row ID order"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS NAME ORDER BY AGE DESC | tr '\n' ' ')
+    assert_equals "n04 n09 n01 n03 n07 n10 n12 n02 n06 n11 n08 n05 " "$result" "Rows without a value come last"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS NAME ORDER BY NAME DESC LIMIT 3 | tr '\n' ' ')
+    assert_equals "n12 n11 n10 " "$result" "String btree walked backwards"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS NAME WHERE CITY=Paris ORDER BY AGE LIMIT 2 OFFSET 1 | tr '\n' ' ')
+    assert_equals "n01 n03 " "$result" "OFFSET applies to the ordered rows"
+
+    test_start "ORDER BY through a top-K heap ($engine engine)"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS NAME ORDER BY SAL DESC LIMIT 3 | tr '\n' ' ')
+    assert_equals "n05 n11 n02 " "$result" "Column without index"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS NAME ORDER BY SAL | tr '\n' ' ')
+    assert_equals "n04 n09 n01 n10 n12 n07 n03 n08 n02 n11 n05 n06 " "$result" "Every row sorted"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS NAME WHERE CITY=Rome ORDER BY AGE DESC LIMIT 4 | tr '\n' ' ')
+    assert_equals "n04 n10 n12 n02 " "$result" "Few matches are sorted instead of walking the index"
+    result=$($REDIS_CLI TABLE.EXPLAIN $t WHERE CITY=Rome ORDER BY AGE DESC LIMIT 4 | tail -1)
+    assert_equals "  ORDER BY AGE DESC: heap of the first 4 rows" "$result" "EXPLAIN shows the heap"
+    result=$($REDIS_CLI TABLE.EXPLAIN $t ORDER BY AGE LIMIT 5 | tail -1)
+    assert_equals "  ORDER BY AGE ASC: btree index walk" "$result" "EXPLAIN shows the index walk"
+
+    $REDIS_CLI TABLE.DROP $t FORCE > /dev/null
+done
+
+test_start "ORDER BY errors"
+$REDIS_CLI TABLE.SCHEMA.CREATE ob.e NAME:string > /dev/null
+result=$($REDIS_CLI TABLE.SELECT ob.e ORDER BY SIZE 2>&1)
+assert_contains "unknown column in ORDER BY" "$result" "Unknown column"
+result=$($REDIS_CLI TABLE.SELECT ob.e ORDER BY NAME CURSOR 0 2>&1)
+assert_contains "CURSOR cannot be used with ORDER BY" "$result" "Cursor pages follow row IDs"
+result=$($REDIS_CLI TABLE.SELECT ob.e ORDER NAME 2>&1)
+assert_contains "syntax" "$result" "ORDER without BY"
+$REDIS_CLI TABLE.DROP ob.e FORCE > /dev/null
+$REDIS_CLI DEL "schema:{ob}" > /dev/null
+
+# ============================================
+# TEST SUITE 32: Atomic Writes
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 32: Atomic Writes ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE aw > /dev/null 2>&1
+for engine in hash native; do
+    t=aw.$engine
+    $REDIS_CLI TABLE.SCHEMA.CREATE $t NAME:string:hash AGE:integer:btree ENGINE $engine > /dev/null
+    $REDIS_CLI TABLE.INSERT $t NAME=Ann AGE=30 > /dev/null
+
+    test_start "A rejected INSERT writes nothing ($engine engine)"
+    result=$($REDIS_CLI TABLE.INSERT $t NAME=Bob AGE=old 2>&1)
+    assert_error "invalid column or type" "$result" "Bad value in the last field"
+    result=$($REDIS_CLI TABLE.INSERT $t NAME=Bob NAME=Rob 2>&1)
+    assert_error "duplicate column" "$result" "Column assigned twice"
+    result=$($REDIS_CLI TABLE.SELECT $t WHERE NAME=Bob)
+    assert_equals "" "$result" "No index entry for the rejected row"
+    result=$($REDIS_CLI TABLE.AGGREGATE $t COUNT)
+    assert_equals "1" "$result" "No row added"
+    result=$($REDIS_CLI TABLE.INSERT $t NAME=Bob AGE=40)
+    assert_equals "2" "$result" "No row ID consumed"
+
+    test_start "A rejected UPDATE changes no row ($engine engine)"
+    result=$($REDIS_CLI TABLE.UPDATE $t WHERE AGE\>0 SET NAME=Cid AGE=x 2>&1)
+    assert_error "invalid column or type" "$result" "Bad value in the SET list"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS NAME ORDER BY AGE | tr '\n' ' ')
+    assert_equals "Ann Bob " "$result" "Rows unchanged"
+    result=$($REDIS_CLI TABLE.SELECT $t WHERE NAME=Cid)
+    assert_equals "" "$result" "Index unchanged"
+
+    test_start "TABLE._APPLY replays background changes ($engine engine)"
+    result=$($REDIS_CLI TABLE._APPLY $t UPDATE 2,7 SET NAME=Cid)
+    assert_equals "1" "$result" "Missing rows are skipped"
+    result=$($REDIS_CLI TABLE.SELECT $t COLUMNS AGE WHERE NAME=Cid)
+    assert_equals "40" "$result" "Row and index updated"
+    result=$($REDIS_CLI TABLE._APPLY $t DELETE 1,2)
+    assert_equals "2" "$result" "Rows deleted"
+    result=$($REDIS_CLI TABLE._APPLY $t DELETE 1,x 2>&1)
+    assert_error "invalid row id" "$result" "Bad row ID list"
+
+    $REDIS_CLI TABLE.DROP $t FORCE > /dev/null
+done
+$REDIS_CLI DEL "schema:{aw}" > /dev/null
+
+# ============================================
+# TEST SUITE 33: Background Index Builds
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 33: Background Index Builds ===${NC}"
+
+# Wait until TABLE.INDEX.STATUS shows no job running
+wait_index_jobs() {
+    for i in $(seq 1 200); do
+        $REDIS_CLI TABLE.INDEX.STATUS "$1" | grep -q "building\|dropping" || return 0
+        sleep 0.05
+    done
+}
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE ib > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE ib.h NAME:string AGE:integer CITY:string > /dev/null
+values=$(seq 1 2500 | awk '{printf "n%d %d c%d ", $1, $1, $1 % 5}')
+$REDIS_CLI TABLE.INSERTMANY ib.h COLUMNS NAME AGE CITY VALUES $values > /dev/null
+
+test_start "ADD INDEX on a large table builds in the background"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER ib.h ADD INDEX CITY)
+assert_equals "OK" "$result" "ADD INDEX returns at once"
+$REDIS_CLI TABLE.INSERT ib.h NAME=late AGE=1 CITY=c3 > /dev/null
+$REDIS_CLI TABLE.UPDATE ib.h WHERE AGE=2000 SET CITY=moved > /dev/null
+wait_index_jobs ib.h
+result=$($REDIS_CLI TABLE.INDEX.STATUS ib.h | tr '\n' ' ')
+assert_equals "CITY hash ready 2501 2501 " "$result" "Index ready once the job is done"
+result=$($REDIS_CLI TABLE.SELECT ib.h WHERE CITY=c3 | grep -c "^NAME$")
+assert_equals "501" "$result" "Rows written during the build are indexed"
+result=$($REDIS_CLI TABLE.SELECT ib.h COLUMNS AGE WHERE CITY=moved)
+assert_equals "2000" "$result" "Rows updated during the build are indexed"
+result=$($REDIS_CLI TABLE.SELECT ib.h WHERE CITY=c0 | grep -c "^NAME$")
+assert_equals "499" "$result" "Old value of an updated row is not indexed"
+
+test_start "Ordered index built in the background"
+$REDIS_CLI TABLE.SCHEMA.ALTER ib.h ADD INDEX AGE:btree > /dev/null
+wait_index_jobs ib.h
+result=$($REDIS_CLI TABLE.SELECT ib.h COLUMNS NAME WHERE AGE\>2498 | tr '\n' ' ')
+assert_equals "n2499 n2500 " "$result" "Range read on the built index"
+result=$($REDIS_CLI ZCARD "{ib.h}:btree:AGE")
+assert_equals "2501" "$result" "Every row in the ordered index"
+
+test_start "DROP INDEX deletes index keys in the background"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER ib.h DROP INDEX CITY)
+assert_equals "OK" "$result" "DROP INDEX returns at once"
+result=$($REDIS_CLI TABLE.SELECT ib.h WHERE CITY=c3 2>&1)
+assert_error "search cannot be done on non-indexed column" "$result" "Dropped index no longer used"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER ib.h ADD INDEX CITY)
+assert_equals "OK" "$result" "Index added again while its keys are being deleted"
+wait_index_jobs ib.h
+result=$($REDIS_CLI TABLE.SELECT ib.h WHERE CITY=c3 | grep -c "^NAME$")
+assert_equals "501" "$result" "Rebuilt index complete"
+$REDIS_CLI TABLE.SCHEMA.ALTER ib.h DROP INDEX CITY > /dev/null
+wait_index_jobs ib.h
+result=$($REDIS_CLI EXISTS "{ib.h}:hash:CITY")
+assert_equals "0" "$result" "Index key deleted"
+result=$($REDIS_CLI TABLE.INDEX.STATUS ib.h | tr '\n' ' ')
+assert_equals "AGE btree ready 2501 2501 " "$result" "Only the remaining index listed"
+
+test_start "Index status errors and native tables"
+result=$($REDIS_CLI TABLE.INDEX.STATUS ib.none 2>&1)
+assert_error "table schema does not exist" "$result" "Unknown table"
+result=$($REDIS_CLI TABLE._APPLY ib.h INDEX NAME 1,2 2>&1)
+assert_error "no index is being built" "$result" "Index batch without a build"
+$REDIS_CLI TABLE.SCHEMA.CREATE ib.n NAME:string CITY:string ENGINE native > /dev/null
+$REDIS_CLI TABLE.INSERTMANY ib.n COLUMNS NAME CITY VALUES $(seq 1 1500 | awk '{printf "n%d c%d ", $1, $1 % 5}') > /dev/null
+$REDIS_CLI TABLE.SCHEMA.ALTER ib.n ADD INDEX CITY > /dev/null
+result=$($REDIS_CLI TABLE.INDEX.STATUS ib.n | tr '\n' ' ')
+assert_equals "CITY hash ready 1500 1500 " "$result" "Native indexes are built at once"
+
+$REDIS_CLI TABLE.DROP ib.h FORCE > /dev/null
+$REDIS_CLI TABLE.DROP ib.n FORCE > /dev/null
+$REDIS_CLI DEL "schema:{ib}" > /dev/null
+
+# ============================================
+# TEST SUITE 34: Lazy Drop and Delete
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 34: Lazy Drop and Delete ===${NC}"
+
+# Wait until the purge of a table is complete
+wait_purge() {
+    for i in $(seq 1 200); do
+        [ "$($REDIS_CLI EXISTS "{$1}:purge")" = "0" ] && return 0
+        sleep 0.05
+    done
+}
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE lz > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE lz.h NAME:string AGE:integer:btree CITY:string:hash > /dev/null
+values=$(seq 1 2500 | awk '{printf "n%d %d c%d ", $1, $1, $1 % 5}')
+$REDIS_CLI TABLE.INSERTMANY lz.h COLUMNS NAME AGE CITY VALUES $values > /dev/null
+
+test_start "DELETE without WHERE hands the rows to a purge"
+result=$($REDIS_CLI TABLE.DELETE lz.h)
+assert_equals "2500" "$result" "All rows deleted"
+result=$($REDIS_CLI TABLE.SELECT lz.h WHERE CITY=c1)
+assert_equals "" "$result" "Deleted rows hidden from index reads at once"
+result=$($REDIS_CLI TABLE.AGGREGATE lz.h COUNT WHERE CITY=c1)
+assert_equals "0" "$result" "Deleted rows not counted from the index"
+$REDIS_CLI TABLE.INSERT lz.h NAME=new AGE=7 CITY=c1 > /dev/null
+result=$($REDIS_CLI TABLE.SELECT lz.h COLUMNS NAME WHERE CITY=c1)
+assert_equals "new" "$result" "New rows visible during the purge"
+result=$($REDIS_CLI TABLE.SELECT lz.h COLUMNS NAME ORDER BY AGE LIMIT 2)
+assert_equals "new" "$result" "Ordered reads see the new rows only"
+wait_purge lz.h
+result=$($REDIS_CLI EXISTS "{lz.h}:1" "{lz.h}:2500")
+assert_equals "0" "$result" "Rows reclaimed"
+result=$($REDIS_CLI TABLE.EXPLAIN lz.h WHERE CITY=c2 | tail -1)
+assert_contains "(est 0)" "$result" "Index entries of the rows reclaimed"
+result=$($REDIS_CLI TABLE.EXPLAIN lz.h WHERE CITY=c1 | tail -1)
+assert_contains "(est 1)" "$result" "Index keeps the new row only"
+result=$($REDIS_CLI TABLE.SELECT lz.h COLUMNS NAME WHERE AGE\<10)
+assert_equals "new" "$result" "Ordered index keeps the new row only"
+
+test_start "DROP returns at once and reclaims keys in the background"
+$REDIS_CLI TABLE.INSERTMANY lz.h COLUMNS NAME AGE CITY VALUES $values > /dev/null
+result=$($REDIS_CLI TABLE.DROP lz.h FORCE)
+assert_equals "OK" "$result" "Table dropped"
+result=$($REDIS_CLI TABLE.SCHEMA.VIEW lz.h 2>&1)
+assert_error "table schema does not exist" "$result" "Dropped table gone at once"
+wait_purge lz.h
+result=$($REDIS_CLI KEYS "{lz.h}:*" | wc -l | tr -d ' ')
+assert_equals "0" "$result" "Every key of the table reclaimed"
+
+test_start "Table created again while its purge runs"
+$REDIS_CLI TABLE.SCHEMA.CREATE lz.h NAME:string CITY:string:hash > /dev/null
+$REDIS_CLI TABLE.INSERTMANY lz.h COLUMNS NAME CITY VALUES $(seq 1 1500 | awk '{printf "n%d c%d ", $1, $1 % 5}') > /dev/null
+$REDIS_CLI TABLE.DROP lz.h FORCE > /dev/null
+result=$($REDIS_CLI TABLE.SCHEMA.CREATE lz.h NAME:string CITY:string:hash)
+assert_equals "OK" "$result" "Table created again"
+$REDIS_CLI TABLE.INSERT lz.h NAME=a CITY=c1 > /dev/null
+result=$($REDIS_CLI TABLE.SELECT lz.h COLUMNS NAME WHERE CITY=c1)
+assert_equals "a" "$result" "Only the rows of the new table"
+
+test_start "DELETE without WHERE on a native table"
+$REDIS_CLI TABLE.SCHEMA.CREATE lz.n NAME:string CITY:string:hash ENGINE native > /dev/null
+$REDIS_CLI TABLE.INSERTMANY lz.n COLUMNS NAME CITY VALUES a c1 b c2 > /dev/null
+result=$($REDIS_CLI TABLE.DELETE lz.n)
+assert_equals "2" "$result" "All rows deleted"
+result=$($REDIS_CLI TABLE.INSERT lz.n NAME=z CITY=c1)
+assert_equals "3" "$result" "Row IDs continue"
+result=$($REDIS_CLI TABLE.SELECT lz.n COLUMNS NAME WHERE CITY=c1)
+assert_equals "z" "$result" "Index rebuilt for new rows"
+
+$REDIS_CLI TABLE.DROP lz.h FORCE > /dev/null
+$REDIS_CLI TABLE.DROP lz.n FORCE > /dev/null
+$REDIS_CLI DEL "schema:{lz}" > /dev/null
+
+# ============================================
+# TEST SUITE 35: Prepared Statements
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 35: Prepared Statements ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE ps > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE ps.t NAME:string AGE:integer:btree CITY:string:hash > /dev/null
+$REDIS_CLI TABLE.INSERTMANY ps.t COLUMNS NAME AGE CITY VALUES a 10 x b 20 y c 30 x d 40 y > /dev/null
+
+test_start "PREPARE and EXEC a SELECT"
+result=$($REDIS_CLI TABLE.PREPARE q ps.t COLUMNS NAME WHERE CITY=? AND AGE\>? LIMIT ?)
+assert_equals "3" "$result" "Replies with its number of values"
+result=$($REDIS_CLI TABLE.EXEC q ps.t x 5 10 | tr '\n' ' ')
+assert_equals "a c " "$result" "Values bound in order"
+result=$($REDIS_CLI TABLE.EXEC q ps.t y 25 10)
+assert_equals "d" "$result" "Executed again with other values"
+result=$($REDIS_CLI TABLE.EXEC q ps.t x 5 1)
+assert_equals "a" "$result" "LIMIT bound"
+result=$($REDIS_CLI TABLE.EXEC_RO q ps.t x 5 10 | tr '\n' ' ')
+assert_equals "a c " "$result" "EXEC_RO runs a SELECT"
+result=$($REDIS_CLI TABLE.EXEC q ps.t "x OR AGE>0" 0 10)
+assert_equals "" "$result" "A value is never split into conditions"
+result=$($REDIS_CLI TABLE.EXEC q ps.t x 5 2>&1)
+assert_error "wrong number of values" "$result" "Value count checked"
+
+test_start "PREPARE and EXEC writes"
+$REDIS_CLI TABLE.PREPARE u UPDATE ps.t WHERE AGE\>=? SET CITY=? > /dev/null
+result=$($REDIS_CLI TABLE.EXEC u ps.t 30 z)
+assert_equals "2" "$result" "UPDATE with bound values"
+result=$($REDIS_CLI TABLE.SELECT ps.t COLUMNS NAME WHERE CITY=z | tr '\n' ' ')
+assert_equals "c d " "$result" "Rows updated and indexed"
+result=$($REDIS_CLI TABLE.EXEC u ps.t 0 bad=1)
+result=$($REDIS_CLI TABLE.SELECT ps.t COLUMNS CITY WHERE AGE=10)
+assert_equals "bad=1" "$result" "SET value bound as a whole"
+$REDIS_CLI TABLE.PREPARE d DELETE ps.t WHERE NAME=? > /dev/null 2>&1
+result=$($REDIS_CLI TABLE.PREPARE d DELETE ps.t WHERE CITY=?)
+assert_equals "1" "$result" "Statement prepared again under the same name"
+
+test_start "Prepared writes out of memory"
+$REDIS_CLI CONFIG SET maxmemory 1 > /dev/null
+result=$($REDIS_CLI TABLE.EXEC u ps.t 30 w 2>&1)
+assert_error "OOM command not allowed" "$result" "Prepared UPDATE refused like TABLE.UPDATE"
+result=$($REDIS_CLI TABLE.EXEC d ps.t bad=1)
+assert_equals "4" "$result" "DELETE with bound values still runs"
+$REDIS_CLI CONFIG SET maxmemory 0 > /dev/null
+
+test_start "Prepared statement errors"
+result=$($REDIS_CLI TABLE.PREPARE e ps.t WHERE NAME=? 2>&1)
+assert_error "non-indexed column" "$result" "Statement checked on PREPARE"
+result=$($REDIS_CLI TABLE.PREPARE e UPDATE ps.t WHERE AGE=? SET ZZ=? 2>&1)
+assert_error "invalid column" "$result" "SET columns checked on PREPARE"
+result=$($REDIS_CLI TABLE.PREPARE e ps.none WHERE AGE=? 2>&1)
+assert_error "table schema does not exist" "$result" "Unknown table"
+result=$($REDIS_CLI TABLE.EXEC u ps.t 2>&1)
+assert_error "wrong number of values" "$result" "Missing values"
+result=$($REDIS_CLI TABLE.EXEC u ps.other 30 z 2>&1)
+assert_error "on another table" "$result" "EXEC names the table of the statement"
+result=$($REDIS_CLI TABLE.EXEC_RO u ps.t 30 z 2>&1)
+assert_error "prepared SELECTs only" "$result" "EXEC_RO refuses writes"
+result=$($REDIS_CLI TABLE.DEALLOCATE q)
+assert_equals "OK" "$result" "Statement deallocated"
+result=$($REDIS_CLI TABLE.EXEC q ps.t x 5 10 2>&1)
+assert_error "no such prepared statement" "$result" "Deallocated statement gone"
+
+$REDIS_CLI TABLE.DEALLOCATE u > /dev/null
+$REDIS_CLI TABLE.DEALLOCATE d > /dev/null
+$REDIS_CLI TABLE.DROP ps.t FORCE > /dev/null
+$REDIS_CLI DEL "schema:{ps}" > /dev/null
+
+# ============================================
+# TEST SUITE 36: Command Statistics
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 36: Command Statistics ===${NC}"
+
+# Value of a field in the TABLE.STATS reply of a table
+table_stat() {
+    $REDIS_CLI TABLE.STATS "$1" | paste - - | awk -v f="$2" '$1 == f { print $2 }'
+}
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE st > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE st.t NAME:string AGE:integer:btree CITY:string:hash > /dev/null
+$REDIS_CLI TABLE.STATS RESET > /dev/null
+
+test_start "Per-table counters"
+$REDIS_CLI TABLE.INSERTMANY st.t COLUMNS NAME AGE CITY VALUES a 10 x b 20 y c 30 x > /dev/null
+$REDIS_CLI TABLE.INSERT st.t NAME=d AGE=40 CITY=y > /dev/null
+$REDIS_CLI TABLE.SELECT st.t WHERE CITY=x > /dev/null
+$REDIS_CLI TABLE.SELECT st.t WHERE NAME\>b > /dev/null
+$REDIS_CLI TABLE.UPDATE st.t WHERE AGE\>=30 SET CITY=z > /dev/null
+assert_equals "2" "$(table_stat st.t insert_calls)" "Inserts counted"
+assert_equals "2" "$(table_stat st.t select_calls)" "Selects counted"
+assert_equals "1" "$(table_stat st.t update_calls)" "Updates counted"
+assert_equals "4" "$(table_stat st.t rows_returned)" "Rows returned"
+assert_equals "4" "$(table_stat st.t rows_scanned)" "Rows checked one by one"
+assert_equals "2" "$(table_stat st.t index_reads)" "Index reads"
+assert_equals "1" "$(table_stat st.t full_scans)" "Full scans"
+result=$($REDIS_CLI TABLE.STATS st.none 2>&1)
+assert_error "table schema does not exist" "$result" "Unknown table"
+
+test_start "Command latencies"
+result=$($REDIS_CLI TABLE.STATS | head -7 | tr '\n' ' ' | awk '{ print $1, $2 }')
+assert_equals "insert 2" "$result" "Calls per command"
+result=$($REDIS_CLI TABLE.STATS | sed -n '8,9p' | tr '\n' ' ')
+assert_equals "select 2 " "$result" "Selects in the command list"
+result=$($REDIS_CLI INFO)
+assert_contains "select_p99_usec" "$result" "Latency percentiles in INFO"
+assert_contains "rows_scanned:4" "$result" "Counters in INFO"
+result=$($REDIS_CLI TABLE.STATS RESET)
+assert_equals "OK" "$result" "Statistics reset"
+assert_equals "0" "$(table_stat st.t select_calls)" "Counters cleared"
+
+test_start "Background AGGREGATE is not counted as a command"
+$REDIS_CLI TABLE.SCHEMA.CREATE st.bg A:integer > /dev/null
+for k in 0 1 2; do
+    values=$(seq $((k * 4000 + 1)) $((k * 4000 + 4000)) | tr '\n' ' ')
+    $REDIS_CLI TABLE.INSERTMANY st.bg COLUMNS A VALUES $values > /dev/null
+done
+$REDIS_CLI TABLE.STATS RESET > /dev/null
+result=$($REDIS_CLI TABLE.AGGREGATE st.bg SUM A WHERE A\>6000)
+assert_equals "54003000" "$result" "Aggregate of a background scan"
+assert_equals "0" "$(table_stat st.bg insert_calls)" "No insert recorded"
+result=$($REDIS_CLI TABLE.STATS | head -2 | tr '\n' ' ')
+assert_equals "insert 0 " "$result" "No insert latency recorded"
+$REDIS_CLI TABLE.DROP st.bg FORCE > /dev/null
+
+$REDIS_CLI TABLE.DROP st.t FORCE > /dev/null
+$REDIS_CLI DEL "schema:{st}" > /dev/null
+
+# ============================================
+# TEST SUITE 37: Composite Indexes
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 37: Composite Indexes ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE ci > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE ci.o TENANT:string STATUS:string DAY:date AMOUNT:integer \
+    INDEX "(TENANT,STATUS)" INDEX TENANT,DAY:btree > /dev/null
+$REDIS_CLI TABLE.INSERTMANY ci.o COLUMNS TENANT STATUS DAY AMOUNT VALUES \
+    acme open 2024-01-05 10 acme closed 2024-02-05 20 beta open 2024-03-05 30 acme open 2024-04-05 40 > /dev/null
+$REDIS_CLI TABLE.INSERT ci.o TENANT=beta STATUS=closed DAY=2024-05-05 AMOUNT=50 > /dev/null
+
+test_start "Hash composite index"
+result=$($REDIS_CLI TABLE.SELECT ci.o COLUMNS AMOUNT WHERE TENANT=acme AND STATUS=open | tr '\n' ' ')
+assert_equals "10 40 " "$result" "Equality on every column"
+result=$($REDIS_CLI TABLE.EXPLAIN ci.o WHERE STATUS=open AND TENANT=acme)
+assert_contains "composite index (TENANT,STATUS) STATUS=open AND TENANT=acme (est 2)" "$result" "One read of the entry"
+result=$($REDIS_CLI TABLE.SELECT ci.o WHERE STATUS=open 2>&1)
+assert_error "non-indexed column" "$result" "A column alone is not served"
+result=$($REDIS_CLI TABLE.AGGREGATE ci.o COUNT WHERE TENANT=beta AND STATUS=closed)
+assert_equals "1" "$result" "COUNT from the entry size"
+
+test_start "Ordered composite index"
+result=$($REDIS_CLI TABLE.SELECT ci.o COLUMNS DAY WHERE TENANT=acme AND DAY\>=2024-02-01 AND DAY\<2024-04-30 | tr '\n' ' ')
+assert_equals "2024-02-05 2024-04-05 " "$result" "Equality prefix and range on the last column"
+result=$($REDIS_CLI TABLE.EXPLAIN ci.o WHERE TENANT=beta AND DAY\>2024-01-01 AND AMOUNT\>40)
+assert_contains "composite index (TENANT,DAY) TENANT=beta AND DAY>2024-01-01 (est 2)" "$result" "Range read"
+assert_contains "FILTER AMOUNT>40" "$result" "Other conditions checked on its rows"
+result=$($REDIS_CLI TABLE.SELECT ci.o COLUMNS AMOUNT WHERE TENANT=acme AND STATUS=closed OR TENANT=beta AND DAY\<2024-04-01 | tr '\n' ' ')
+assert_equals "20 30 " "$result" "Composite indexes under OR"
+
+test_start "Writes keep composite indexes"
+$REDIS_CLI TABLE.UPDATE ci.o WHERE TENANT=acme AND STATUS=open SET STATUS=closed > /dev/null
+result=$($REDIS_CLI TABLE.SELECT ci.o COLUMNS AMOUNT WHERE TENANT=acme AND STATUS=closed | tr '\n' ' ')
+assert_equals "10 20 40 " "$result" "UPDATE moves rows to the new tuple"
+result=$($REDIS_CLI TABLE.SELECT ci.o WHERE TENANT=acme AND STATUS=open)
+assert_equals "" "$result" "And out of the old one"
+$REDIS_CLI TABLE.UPDATE ci.o WHERE AMOUNT=40 SET DAY=2023-12-31 > /dev/null
+result=$($REDIS_CLI TABLE.SELECT ci.o COLUMNS AMOUNT WHERE TENANT=acme AND DAY\<2024-01-01)
+assert_equals "40" "$result" "UPDATE of the ordered column"
+$REDIS_CLI TABLE.DELETE ci.o WHERE TENANT=beta AND STATUS=open > /dev/null
+result=$($REDIS_CLI EXISTS "{ci.o}:idx:TENANT,STATUS:4:beta,4:open")
+assert_equals "0" "$result" "DELETE removes the entry"
+result=$($REDIS_CLI TABLE.SELECT ci.o COLUMNS AMOUNT WHERE TENANT=beta AND DAY\>2024-01-01)
+assert_equals "50" "$result" "And the row from the ordered index"
+
+test_start "ALTER ADD and DROP composite indexes"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER ci.o ADD INDEX STATUS,AMOUNT:btree)
+assert_equals "OK" "$result" "ADD INDEX over existing rows"
+result=$($REDIS_CLI TABLE.SELECT ci.o COLUMNS AMOUNT WHERE STATUS=closed AND AMOUNT\>=20 | tr '\n' ' ')
+assert_equals "20 40 50 " "$result" "Existing rows indexed"
+result=$($REDIS_CLI TABLE.INDEX.STATUS ci.o | paste -sd' ')
+assert_contains "STATUS,AMOUNT btree ready 4 4" "$result" "Listed by TABLE.INDEX.STATUS"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER ci.o ADD INDEX STATUS,AMOUNT 2>&1)
+assert_error "different index type" "$result" "Index type checked"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER ci.o ADD INDEX STATUS,NOPE 2>&1)
+assert_error "column does not exist" "$result" "Columns checked"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER ci.o ADD INDEX STATUS,STATUS 2>&1)
+assert_error "duplicate column" "$result" "Columns listed once"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER ci.o DROP INDEX TENANT,STATUS)
+assert_equals "OK" "$result" "DROP INDEX"
+wait_index_jobs ci.o
+result=$($REDIS_CLI KEYS "{ci.o}:idx:TENANT,STATUS:*")
+assert_equals "" "$result" "Its keys are deleted"
+result=$($REDIS_CLI TABLE.SELECT ci.o WHERE TENANT=acme AND STATUS=closed 2>&1)
+assert_error "non-indexed column" "$result" "Queries no longer use it"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER ci.o DROP INDEX TENANT,STATUS 2>&1)
+assert_error "does not exist" "$result" "Unknown composite index"
+result=$($REDIS_CLI TABLE.SCHEMA.CREATE ci.n A:string B:string INDEX A,B ENGINE native 2>&1)
+assert_error "need ENGINE hash" "$result" "Hash tables only"
+
+test_start "Composite index built in the background"
+$REDIS_CLI TABLE.SCHEMA.CREATE ci.big T:string N:integer > /dev/null
+values=$(seq 1 2500 | awk '{printf "t%d %d ", $1 % 5, $1}')
+$REDIS_CLI TABLE.INSERTMANY ci.big COLUMNS T N VALUES $values > /dev/null
+$REDIS_CLI TABLE.SCHEMA.ALTER ci.big ADD INDEX T,N:btree > /dev/null
+result=$($REDIS_CLI TABLE.INDEX.STATUS ci.big | sed -n 3p)
+assert_equals "building" "$result" "Large tables are indexed by a job"
+wait_index_jobs ci.big
+result=$($REDIS_CLI TABLE.SELECT ci.big COLUMNS N WHERE T=t1 AND N\<20 | tr '\n' ' ')
+assert_equals "1 6 11 16 " "$result" "Used once built"
+
+$REDIS_CLI TABLE.DROP ci.big FORCE > /dev/null
+$REDIS_CLI TABLE.DROP ci.o FORCE > /dev/null
+$REDIS_CLI DEL "schema:{ci}" > /dev/null
+
+# ============================================
+# TEST SUITE 38: Unique Indexes and Primary Keys
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 38: Unique Indexes and Primary Keys ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE uq > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE uq.o NUM:string:primary EMAIL:string:unique AMOUNT:integer > /dev/null
+$REDIS_CLI TABLE.INSERT uq.o NUM=A1 EMAIL=a@x AMOUNT=10 > /dev/null
+$REDIS_CLI TABLE.INSERTMANY uq.o COLUMNS NUM EMAIL AMOUNT VALUES A2 b@x 20 A3 c@x 30 > /dev/null
+
+test_start "TABLE.GET by primary key"
+result=$($REDIS_CLI TABLE.GET uq.o A2 | paste -sd' ')
+assert_equals "NUM A2 EMAIL b@x AMOUNT 20" "$result" "Row with this key"
+result=$($REDIS_CLI TABLE.GET uq.o A3 COLUMNS AMOUNT,EMAIL | tr '\n' ' ')
+assert_equals "30 c@x " "$result" "Projected values"
+result=$($REDIS_CLI TABLE.GET uq.o A9)
+assert_equals "" "$result" "nil for an unknown key"
+result=$($REDIS_CLI HGET "{uq.o}:unique:NUM" A1)
+assert_equals "1" "$result" "One field per value, no set"
+result=$($REDIS_CLI TABLE.SCHEMA.CREATE uq.t A:string B:integer > /dev/null; $REDIS_CLI TABLE.GET uq.t x 2>&1)
+assert_error "no primary key" "$result" "Tables without primary key"
+
+test_start "Duplicates are rejected"
+result=$($REDIS_CLI TABLE.INSERT uq.o NUM=A1 EMAIL=z@x 2>&1)
+assert_error "duplicate value" "$result" "INSERT of a taken primary key"
+result=$($REDIS_CLI TABLE.INSERT uq.o NUM=A4 EMAIL=a@x 2>&1)
+assert_error "duplicate value" "$result" "INSERT of a taken unique value"
+result=$($REDIS_CLI TABLE.INSERT uq.o EMAIL=z@x 2>&1)
+assert_error "primary key column needs a value" "$result" "The primary key is required"
+result=$($REDIS_CLI TABLE.INSERTMANY uq.o COLUMNS NUM EMAIL VALUES A4 d@x A4 e@x 2>&1)
+assert_error "duplicate value" "$result" "INSERTMANY giving a value twice"
+result=$($REDIS_CLI TABLE.UPDATE uq.o WHERE NUM=A3 SET EMAIL=b@x 2>&1)
+assert_error "duplicate value" "$result" "UPDATE to a taken value"
+result=$($REDIS_CLI TABLE.UPDATE uq.o WHERE AMOUNT\>0 SET EMAIL=same 2>&1)
+assert_error "duplicate value" "$result" "UPDATE giving a value to several rows"
+result=$($REDIS_CLI TABLE.AGGREGATE uq.o COUNT)
+assert_equals "3" "$result" "Nothing written"
+result=$($REDIS_CLI TABLE.SCHEMA.CREATE uq.b A:string:primary B:string:primary 2>&1)
+assert_error "one primary key" "$result" "One primary key per table"
+
+test_start "Queries and writes through the unique index"
+result=$($REDIS_CLI TABLE.EXPLAIN uq.o WHERE EMAIL=c@x AND AMOUNT\>5)
+assert_contains "unique index EMAIL=c@x (est 1)" "$result" "One field read"
+$REDIS_CLI TABLE.UPDATE uq.o WHERE NUM=A3 SET EMAIL=q@x > /dev/null
+result=$($REDIS_CLI TABLE.SELECT uq.o COLUMNS NUM WHERE EMAIL=q@x)
+assert_equals "A3" "$result" "UPDATE moves the value"
+result=$($REDIS_CLI HEXISTS "{uq.o}:unique:EMAIL" c@x)
+assert_equals "0" "$result" "The old value is free"
+$REDIS_CLI TABLE.DELETE uq.o WHERE NUM=A1 > /dev/null
+result=$($REDIS_CLI TABLE.INSERT uq.o NUM=A1 EMAIL=a@x)
+assert_equals "4" "$result" "DELETE frees the values"
+$REDIS_CLI TABLE.DELETE uq.o > /dev/null
+result=$($REDIS_CLI TABLE.INSERT uq.o NUM=A1 EMAIL=a@x)
+assert_equals "5" "$result" "So does a DELETE of every row"
+result=$($REDIS_CLI TABLE.GET uq.o A1 COLUMNS EMAIL)
+assert_equals "a@x" "$result" "Found by its key"
+
+test_start "ALTER ADD and DROP unique indexes"
+$REDIS_CLI TABLE.INSERTMANY uq.o COLUMNS NUM AMOUNT VALUES A2 10 A3 10 > /dev/null
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER uq.o ADD INDEX AMOUNT:unique 2>&1)
+assert_error "duplicate values" "$result" "Existing duplicates"
+result=$($REDIS_CLI EXISTS "{uq.o}:unique:AMOUNT")
+assert_equals "0" "$result" "Nothing left"
+$REDIS_CLI TABLE.UPDATE uq.o WHERE NUM=A3 SET AMOUNT=30 > /dev/null
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER uq.o ADD INDEX AMOUNT:unique)
+assert_equals "OK" "$result" "ADD INDEX over existing rows"
+result=$($REDIS_CLI TABLE.INDEX.STATUS uq.o | paste -sd' ')
+assert_contains "NUM primary ready 3 3" "$result" "Primary key in TABLE.INDEX.STATUS"
+assert_contains "AMOUNT unique ready 3 3" "$result" "Unique index in TABLE.INDEX.STATUS"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER uq.o DROP INDEX AMOUNT)
+assert_equals "OK" "$result" "DROP INDEX"
+result=$($REDIS_CLI EXISTS "{uq.o}:unique:AMOUNT")
+assert_equals "0" "$result" "Its key is deleted"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER uq.o ADD INDEX AMOUNT:primary 2>&1)
+assert_error "declared by TABLE.SCHEMA.CREATE" "$result" "Primary key at CREATE only"
+result=$($REDIS_CLI TABLE.SCHEMA.CREATE uq.n A:string:unique ENGINE native 2>&1)
+assert_error "need ENGINE hash" "$result" "Hash tables only"
+
+test_start "Unique index built in the background"
+$REDIS_CLI TABLE.SCHEMA.CREATE uq.big NAME:string CODE:string > /dev/null
+values=$(seq 1 2500 | awk '{printf "n%d k%d ", $1, $1 % 2000}')
+$REDIS_CLI TABLE.INSERTMANY uq.big COLUMNS NAME CODE VALUES $values > /dev/null
+$REDIS_CLI TABLE.SCHEMA.ALTER uq.big ADD INDEX NAME:unique > /dev/null
+result=$($REDIS_CLI TABLE.INDEX.STATUS uq.big | sed -n 3p)
+assert_equals "building" "$result" "Large tables are indexed by a job"
+wait_index_jobs uq.big
+result=$($REDIS_CLI TABLE.SELECT uq.big COLUMNS CODE WHERE NAME=n2001)
+assert_equals "k1" "$result" "Used once built"
+$REDIS_CLI TABLE.SCHEMA.ALTER uq.big ADD INDEX CODE:unique > /dev/null
+wait_index_jobs uq.big
+result=$($REDIS_CLI TABLE.INDEX.STATUS uq.big | paste -sd' ')
+assert_equals "NAME unique ready 2500 2500" "$result" "A build meeting duplicates is abandoned"
+result=$($REDIS_CLI EXISTS "{uq.big}:unique:CODE")
+assert_equals "0" "$result" "With its key"
+
+$REDIS_CLI TABLE.DROP uq.big FORCE > /dev/null
+$REDIS_CLI TABLE.DROP uq.t FORCE > /dev/null
+$REDIS_CLI TABLE.DROP uq.o FORCE > /dev/null
+$REDIS_CLI DEL "schema:{uq}" > /dev/null
+
+# ============================================
+# TEST SUITE 39: Hash Index Storage
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 39: Hash Index Storage ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE hx > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE hx.s SID:string:hash USER:string:hash INDEX USER,SID > /dev/null
+values=$(seq 1 3000 | awk '{printf "s%d u%d ", $1, $1 % 10}')
+$REDIS_CLI TABLE.INSERTMANY hx.s COLUMNS SID USER VALUES $values > /dev/null
+
+test_start "One key per hash index"
+result=$($REDIS_CLI KEYS "{hx.s}:hash:*" | sort | paste -sd' ')
+assert_equals "{hx.s}:hash:SID {hx.s}:hash:USER {hx.s}:hash:USER,SID" "$result" "Columns and composite, whatever the distinct values"
+result=$($REDIS_CLI TYPE "{hx.s}:hash:SID")
+assert_equals "rtable-ix" "$result" "Module-typed index"
+result=$($REDIS_CLI TABLE.SELECT hx.s COLUMNS USER WHERE SID=s2024)
+assert_equals "u4" "$result" "Equality read"
+result=$($REDIS_CLI TABLE.SELECT hx.s COLUMNS SID WHERE SID=s7 OR SID=s8 | paste -sd' ')
+assert_equals "s7 s8" "$result" "Union of posting lists"
+result=$($REDIS_CLI TABLE.AGGREGATE hx.s COUNT WHERE USER=u3)
+assert_equals "300" "$result" "Count from the posting list"
+result=$($REDIS_CLI TABLE.SELECT hx.s COLUMNS SID WHERE SID=s13 AND USER=u3)
+assert_equals "s13" "$result" "Composite entry read"
+
+test_start "Writes keep the posting lists"
+$REDIS_CLI TABLE.UPDATE hx.s WHERE SID=s13 SET USER=u9 > /dev/null
+result=$($REDIS_CLI TABLE.AGGREGATE hx.s COUNT WHERE USER=u3)
+assert_equals "299" "$result" "Row left its old value"
+result=$($REDIS_CLI TABLE.SELECT hx.s COLUMNS SID WHERE USER=u9 AND SID=s13)
+assert_equals "s13" "$result" "Composite entry moved"
+$REDIS_CLI TABLE.DELETE hx.s WHERE SID=s14 > /dev/null
+result=$($REDIS_CLI TABLE.SELECT hx.s WHERE SID=s14)
+assert_equals "" "$result" "Deleted row gone from the index"
+
+test_start "DROP INDEX unlinks the index key"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER hx.s DROP INDEX SID)
+assert_equals "OK" "$result" "Column index dropped"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER hx.s DROP INDEX USER,SID)
+assert_equals "OK" "$result" "Composite index dropped"
+result=$($REDIS_CLI EXISTS "{hx.s}:hash:SID" "{hx.s}:hash:USER,SID" "{hx.s}:idx:jobs")
+assert_equals "0" "$result" "Keys gone at once, no job"
+result=$($REDIS_CLI TABLE.INDEX.STATUS hx.s | paste -sd' ')
+assert_equals "USER hash ready 2999 2999" "$result" "Remaining index listed"
+
+test_start "Posting lists restored from an AOF rewrite"
+$REDIS_CLI DEL "{hx.s}:hash:USER" > /dev/null
+$REDIS_CLI TABLE._RESTORE "{hx.s}:hash:USER" POSTING u0 10,20 > /dev/null
+$REDIS_CLI TABLE._RESTORE "{hx.s}:hash:USER" POSTING u0 30 > /dev/null
+result=$($REDIS_CLI TABLE.SELECT hx.s COLUMNS SID WHERE USER=u0 | paste -sd' ')
+assert_equals "s10 s20 s30" "$result" "Restored posting list"
+result=$($REDIS_CLI TABLE._RESTORE "{hx.s}:hash:USER" POSTING u0 x 2>&1)
+assert_error "invalid row id" "$result" "Invalid restored ID"
+
+$REDIS_CLI TABLE.DROP hx.s FORCE > /dev/null
+$REDIS_CLI DEL "schema:{hx}" > /dev/null
+
+# ============================================
+# TEST SUITE 40: Result Cache
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 40: Result Cache ===${NC}"
+
+# The cache is enabled by loading the module with result_cache_mb; replies must match the
+# table after every kind of write either way
+cache_on=$($REDIS_CLI INFO table | tr -d '\r' | awk -F: '$1 ~ /cache_max_bytes$/ { print ($2 > 0) }')
+$REDIS_CLI TABLE.NAMESPACE.CREATE rc > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE rc.t NAME:string:hash AGE:integer:btree > /dev/null
+$REDIS_CLI TABLE.INSERTMANY rc.t COLUMNS NAME AGE VALUES a 10 b 20 c 30 > /dev/null
+$REDIS_CLI TABLE.STATS RESET > /dev/null
+
+test_start "Repeated queries"
+result=$($REDIS_CLI TABLE.SELECT rc.t COLUMNS NAME WHERE AGE\>=20 | paste -sd' ')
+assert_equals "b c" "$result" "First SELECT"
+result=$($REDIS_CLI TABLE.SELECT rc.t columns NAME where AGE\>=20 | paste -sd' ')
+assert_equals "b c" "$result" "Same SELECT, keywords in lower case"
+result=$($REDIS_CLI TABLE.AGGREGATE rc.t SUM AGE WHERE AGE\>=20)
+assert_equals "50" "$result" "First AGGREGATE"
+result=$($REDIS_CLI TABLE.AGGREGATE rc.t SUM AGE WHERE AGE\>=20)
+assert_equals "50" "$result" "Same AGGREGATE"
+result=$($REDIS_CLI TABLE.SELECT rc.t COLUMNS NAME WHERE AGE\>=20 LIMIT 1 | paste -sd' ')
+assert_equals "b" "$result" "Other page, other entry"
+if [ "$cache_on" == "1" ]; then
+    assert_equals "2" "$(table_stat rc.t cache_hits)" "Repeats served by the cache"
+    assert_equals "3" "$(table_stat rc.t cache_misses)" "First runs missed"
+else
+    assert_equals "0 0" "$(table_stat rc.t cache_hits) $(table_stat rc.t cache_misses)" "No cache by default"
+fi
+
+test_start "Writes invalidate cached replies"
+$REDIS_CLI TABLE.INSERT rc.t NAME=d AGE=40 > /dev/null
+result=$($REDIS_CLI TABLE.SELECT rc.t COLUMNS NAME WHERE AGE\>=20 | paste -sd' ')
+assert_equals "b c d" "$result" "After INSERT"
+$REDIS_CLI TABLE.UPDATE rc.t WHERE NAME=b SET AGE=5 > /dev/null
+result=$($REDIS_CLI TABLE.SELECT rc.t COLUMNS NAME WHERE AGE\>=20 | paste -sd' ')
+assert_equals "c d" "$result" "After UPDATE"
+result=$($REDIS_CLI TABLE.AGGREGATE rc.t SUM AGE WHERE AGE\>=20)
+assert_equals "70" "$result" "Aggregate after writes"
+$REDIS_CLI TABLE.DELETE rc.t WHERE NAME=c > /dev/null
+result=$($REDIS_CLI TABLE.SELECT rc.t COLUMNS NAME WHERE AGE\>=20 | paste -sd' ')
+assert_equals "d" "$result" "After DELETE"
+$REDIS_CLI TABLE.SCHEMA.ALTER rc.t ADD COLUMN CITY:string > /dev/null
+$REDIS_CLI TABLE.UPDATE rc.t WHERE NAME=d SET CITY=x > /dev/null
+result=$($REDIS_CLI TABLE.SELECT rc.t WHERE AGE\>=20 | paste -sd' ')
+assert_equals "NAME d AGE 40 CITY x" "$result" "After ALTER"
+$REDIS_CLI TABLE.DROP rc.t FORCE > /dev/null
+$REDIS_CLI TABLE.SCHEMA.CREATE rc.t NAME:string:hash AGE:integer:btree > /dev/null
+result=$($REDIS_CLI TABLE.SELECT rc.t COLUMNS NAME WHERE AGE\>=20)
+assert_equals "" "$result" "After DROP and CREATE"
+$REDIS_CLI TABLE.INSERT rc.t NAME=e AGE=50 > /dev/null
+$REDIS_CLI TABLE.SELECT rc.t COLUMNS NAME WHERE AGE\>=20 > /dev/null
+$REDIS_CLI DEL "{rc.t}:1" > /dev/null
+result=$($REDIS_CLI TABLE.SELECT rc.t COLUMNS NAME WHERE AGE\>=20)
+assert_equals "" "$result" "After a row key is deleted"
+
+$REDIS_CLI TABLE.DROP rc.t FORCE > /dev/null
+$REDIS_CLI DEL "schema:{rc}" > /dev/null
+
+# ============================================
+# TEST SUITE 41: Batched UPDATE and DELETE
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 41: Batched UPDATE and DELETE ===${NC}"
+
+# Index edits are applied per batch of rows; 2500 rows span several batches
+$REDIS_CLI TABLE.NAMESPACE.CREATE bw > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE bw.t CODE:string:unique GRP:string:hash NAME:string:btree AGE:integer:btree \
+    INDEX GRP,AGE:btree > /dev/null
+values=$(seq 1 2500 | awk '{printf "c%d g%d n%d %d ", $1, $1 % 2, $1, $1 % 50}')
+$REDIS_CLI TABLE.INSERTMANY bw.t COLUMNS CODE GRP NAME AGE VALUES $values > /dev/null
+
+test_start "UPDATE of many rows"
+result=$($REDIS_CLI TABLE.UPDATE bw.t WHERE GRP=g0 SET GRP=g2 AGE=99 NAME=z)
+assert_equals "1250" "$result" "Rows updated"
+result=$($REDIS_CLI TABLE.AGGREGATE bw.t COUNT WHERE GRP=g2)
+assert_equals "1250" "$result" "Hash index moved"
+result=$($REDIS_CLI TABLE.AGGREGATE bw.t COUNT WHERE GRP=g0)
+assert_equals "0" "$result" "Old hash entries gone"
+result=$($REDIS_CLI TABLE.AGGREGATE bw.t COUNT WHERE AGE=99)
+assert_equals "1250" "$result" "Numeric btree moved"
+result=$($REDIS_CLI TABLE.AGGREGATE bw.t COUNT WHERE NAME=z)
+assert_equals "1250" "$result" "String btree moved"
+result=$($REDIS_CLI ZCARD "{bw.t}:btree:NAME")
+assert_equals "2500" "$result" "One entry per row"
+result=$($REDIS_CLI TABLE.AGGREGATE bw.t COUNT WHERE GRP=g2 AND AGE\>=99)
+assert_equals "1250" "$result" "Composite entries moved"
+result=$($REDIS_CLI TABLE.AGGREGATE bw.t COUNT WHERE GRP=g1 AND AGE\<10)
+assert_equals "250" "$result" "Other composite entries kept"
+result=$($REDIS_CLI TABLE.UPDATE bw.t WHERE GRP=g2 SET AGE=98)
+assert_equals "1250" "$result" "Same ZSET, new scores"
+result=$($REDIS_CLI TABLE.AGGREGATE bw.t COUNT WHERE AGE\>=98 AND AGE\<99)
+assert_equals "1250" "$result" "Ranged by the new value"
+
+test_start "DELETE of many rows"
+result=$($REDIS_CLI TABLE.DELETE bw.t WHERE GRP=g2)
+assert_equals "1250" "$result" "Rows deleted"
+result=$($REDIS_CLI SCARD "{bw.t}:rows")
+assert_equals "1250" "$result" "Rows set"
+result=$($REDIS_CLI ZCARD "{bw.t}:btree:AGE")
+assert_equals "1250" "$result" "Btree entries removed"
+result=$($REDIS_CLI HLEN "{bw.t}:unique:CODE")
+assert_equals "1250" "$result" "Unique values released"
+result=$($REDIS_CLI TABLE.INSERT bw.t CODE=c2 GRP=g3 NAME=n2 AGE=1)
+assert_equals "2501" "$result" "Released value taken again"
+result=$($REDIS_CLI TABLE.DELETE bw.t WHERE AGE\>=0)
+assert_equals "1251" "$result" "Every row deleted"
+result=$($REDIS_CLI EXISTS "{bw.t}:hash:GRP" "{bw.t}:btree:AGE" "{bw.t}:unique:CODE")
+assert_equals "0" "$result" "Emptied index keys removed"
+
+$REDIS_CLI TABLE.DROP bw.t FORCE > /dev/null
+$REDIS_CLI DEL "schema:{bw}" > /dev/null
+
+# ============================================
+# TEST SUITE 42: Row Replies
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 42: Row Replies ===${NC}"
+
+# Rows are replied as maps, which RESP2 clients receive as flat column/value arrays
+$REDIS_CLI TABLE.NAMESPACE.CREATE rr > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE rr.t C1:string:hash C2:string C3:string C4:string C5:string C6:string \
+    C7:string C8:string C9:integer C10:integer > /dev/null
+$REDIS_CLI TABLE.INSERT rr.t C1=a C2=b C3=c C4=d C5=e C6=f C7=g C8=h C9=9 C10=10 > /dev/null
+$REDIS_CLI TABLE.INSERT rr.t C1=x C9=1 > /dev/null
+$REDIS_CLI TABLE.SCHEMA.CREATE rr.n C1:string:hash C2:integer ENGINE native > /dev/null
+$REDIS_CLI TABLE.INSERT rr.n C1=a C2=2 > /dev/null
+
+test_start "Column/value pairs"
+result=$($REDIS_CLI TABLE.SELECT rr.t WHERE C1=a | paste -sd' ')
+assert_equals "C1 a C2 b C3 c C4 d C5 e C6 f C7 g C8 h C9 9 C10 10" "$result" "Every field of a wide row"
+result=$($REDIS_CLI TABLE.SELECT rr.t WHERE C1=x | paste -sd' ')
+assert_equals "C1 x C9 1" "$result" "Only the fields a row has"
+result=$($REDIS_CLI TABLE.SELECT rr.t COLUMNS C9,C1 WHERE C1=x | paste -sd' ')
+assert_equals "1 x" "$result" "Projected values stay an array"
+result=$($REDIS_CLI TABLE.SELECT rr.n WHERE C1=a | paste -sd' ')
+assert_equals "C1 a C2 2" "$result" "Native row"
+
+$REDIS_CLI TABLE.DROP rr.t FORCE > /dev/null
+$REDIS_CLI TABLE.DROP rr.n FORCE > /dev/null
+$REDIS_CLI DEL "schema:{rr}" > /dev/null
+
+# ============================================
+# TEST SUITE 43: Time Partitions and Row TTL
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 43: Time Partitions and Row TTL ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE tp > /dev/null 2>&1
+$REDIS_CLI TABLE.SCHEMA.CREATE tp.t NAME:string:hash DAY:date AMOUNT:integer PARTITION BY DAY > /dev/null
+$REDIS_CLI TABLE.INSERTMANY tp.t COLUMNS NAME DAY AMOUNT VALUES a 2026-01-01 1 b 2026-01-01 2 c 2026-01-02 3 \
+    d 2026-01-03 4 e 2026-01-05 5 > /dev/null
+
+test_start "Rows are kept per day"
+result=$($REDIS_CLI SCARD "{tp.t}:part:2026-01-01")
+assert_equals "2" "$result" "Both rows of the day in its partition"
+result=$($REDIS_CLI ZCARD "{tp.t}:parts")
+assert_equals "4" "$result" "One entry per day in use"
+
+test_start "Ranges read the partitions they cover"
+result=$($REDIS_CLI TABLE.EXPLAIN tp.t WHERE DAY\>=2026-01-02 AND DAY\<2026-01-05)
+assert_contains "partitions DAY in [2026-01-02, 2026-01-05) (est 2)" "$result" "Merged range served by partitions"
+result=$($REDIS_CLI TABLE.SELECT tp.t COLUMNS NAME WHERE DAY\>=2026-01-02 AND DAY\<2026-01-05 | sort | tr '\n' ' ')
+assert_equals "c d " "$result" "Rows of the covered days"
+result=$($REDIS_CLI TABLE.AGGREGATE tp.t COUNT WHERE DAY=2026-01-01)
+assert_equals "2" "$result" "Equality reads one partition"
+result=$($REDIS_CLI TABLE.SELECT tp.t COLUMNS NAME WHERE DAY\>=2026-01-02 AND NAME=e)
+assert_equals "e" "$result" "Partitions intersected with an index"
+$REDIS_CLI TABLE.INSERT tp.t NAME=f DAY=2026-01-04 AMOUNT=6 > /dev/null
+result=$($REDIS_CLI TABLE.AGGREGATE tp.t COUNT WHERE DAY\>2026-01-03)
+assert_equals "2" "$result" "Inserted row in its partition"
+
+test_start "UPDATE and DELETE keep partitions in step"
+result=$($REDIS_CLI TABLE.UPDATE tp.t WHERE NAME=a SET DAY=2026-01-05)
+assert_equals "1" "$result" "Row moved to another day"
+result=$($REDIS_CLI SCARD "{tp.t}:part:2026-01-01")
+assert_equals "1" "$result" "Left its old partition"
+result=$($REDIS_CLI TABLE.AGGREGATE tp.t COUNT WHERE DAY=2026-01-05)
+assert_equals "2" "$result" "Joined its new partition"
+result=$($REDIS_CLI TABLE.DELETE tp.t WHERE DAY=2026-01-05)
+assert_equals "2" "$result" "Rows of a day deleted"
+result=$($REDIS_CLI TABLE.AGGREGATE tp.t COUNT WHERE DAY\>=2026-01-01)
+assert_equals "4" "$result" "Other partitions kept"
+
+test_start "Partition options are checked"
+result=$($REDIS_CLI TABLE.SCHEMA.CREATE tp.bad NAME:string PARTITION BY NAME 2>&1)
+assert_error "PARTITION BY needs a date column" "$result" "Partition column must be a date"
+result=$($REDIS_CLI TABLE.SCHEMA.CREATE tp.bad DAY:date PARTITION BY DAY ENGINE native 2>&1)
+assert_error "partitions need ENGINE hash" "$result" "No partitions on native tables"
+result=$($REDIS_CLI TABLE.SCHEMA.CREATE tp.bad DAY:date PARTITION BY DAY RETENTION 0 2>&1)
+assert_error "RETENTION must be a positive number of days" "$result" "Retention must be positive"
+
+test_start "Partitions past their retention are purged"
+today=$(date -u +%F)
+$REDIS_CLI TABLE.SCHEMA.CREATE tp.r NAME:string:hash DAY:date PARTITION BY DAY RETENTION 30 > /dev/null
+$REDIS_CLI TABLE.INSERTMANY tp.r COLUMNS NAME DAY VALUES old1 2000-01-01 old2 2000-01-02 new1 $today > /dev/null
+# Partitions are checked once a day, and again after a schema change
+$REDIS_CLI TABLE.SCHEMA.ALTER tp.r ADD COLUMN NOTE:string > /dev/null
+$REDIS_CLI TABLE.INSERT tp.r NAME=new2 DAY=$today > /dev/null
+result=$($REDIS_CLI TABLE.AGGREGATE tp.r COUNT WHERE DAY\<2001-01-01)
+assert_equals "0" "$result" "Expired partitions skipped at once"
+wait_purge tp.r
+result=$($REDIS_CLI SCARD "{tp.r}:rows")
+assert_equals "2" "$result" "Rows of expired partitions removed"
+result=$($REDIS_CLI EXISTS "{tp.r}:1")
+assert_equals "0" "$result" "Row keys unlinked"
+result=$($REDIS_CLI TABLE.SELECT tp.r WHERE NAME=old1)
+assert_equals "" "$result" "Index entries removed"
+
+test_start "Rows with a TTL are deleted with their index entries"
+$REDIS_CLI TABLE.SCHEMA.CREATE tp.x NAME:string:hash AGE:integer:btree > /dev/null
+$REDIS_CLI TABLE.INSERT tp.x NAME=keep AGE=1 > /dev/null
+result=$($REDIS_CLI TABLE.INSERT tp.x NAME=gone AGE=2 TTL 1)
+assert_equals "2" "$result" "Row with a TTL inserted"
+result=$($REDIS_CLI TABLE.INSERT tp.x NAME=bad TTL 0 2>&1)
+assert_error "TTL must be a positive number of seconds" "$result" "TTL must be positive"
+result=$($REDIS_CLI PTTL "{tp.x}:ttl:2")
+[ "$result" -gt 0 ] && assert_equals "1" "1" "Shadow key expires" || assert_equals ">0" "$result" "Shadow key expires"
+sleep 1.2
+# Reading the shadow key expires it at once
+$REDIS_CLI EXISTS "{tp.x}:ttl:2" > /dev/null
+sleep 0.2
+result=$($REDIS_CLI TABLE.SELECT tp.x COLUMNS NAME WHERE NAME=gone)
+assert_equals "" "$result" "Expired row gone"
+result=$($REDIS_CLI ZCARD "{tp.x}:btree:AGE")
+assert_equals "1" "$result" "Its btree entry removed"
+result=$($REDIS_CLI ZCARD "{tp.x}:ttl")
+assert_equals "0" "$result" "Its expiry record removed"
+result=$($REDIS_CLI TABLE.SELECT tp.x COLUMNS NAME WHERE NAME=keep)
+assert_equals "keep" "$result" "Rows without a TTL kept"
+$REDIS_CLI TABLE.INSERT tp.x NAME=short AGE=3 TTL 100 > /dev/null
+$REDIS_CLI TABLE.DELETE tp.x WHERE NAME=short > /dev/null
+result=$($REDIS_CLI EXISTS "{tp.x}:ttl:3")
+assert_equals "0" "$result" "DELETE removes the shadow key"
+
+$REDIS_CLI TABLE.DROP tp.t FORCE > /dev/null
+$REDIS_CLI TABLE.DROP tp.r FORCE > /dev/null
+$REDIS_CLI TABLE.DROP tp.x FORCE > /dev/null
+$REDIS_CLI DEL "schema:{tp}" > /dev/null
+
+# ============================================
+# TEST SUITE 44: Sharded Tables
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 44: Sharded Tables ===${NC}"
+
+$REDIS_CLI TABLE.NAMESPACE.CREATE sh > /dev/null 2>&1
+
+test_start "A sharded table creates its shards"
+result=$($REDIS_CLI TABLE.SCHEMA.CREATE sh.u ID:integer:primary NAME:string:hash AGE:integer:btree SHARDS 4)
+assert_equals "OK" "$result" "Sharded table created"
+result=$($REDIS_CLI HGET "{sh.u}:options" shards)
+assert_equals "4" "$result" "Number of shards recorded"
+result=$($REDIS_CLI TABLE.SCHEMA.VIEW "sh.u#3")
+assert_contains "AGE" "$result" "Shard has the columns of the table"
+result=$($REDIS_CLI TABLE.SCHEMA.CREATE sh.bad ID:integer SHARDS 1 2>&1)
+assert_error "SHARDS must be between 2 and 64" "$result" "Too few shards rejected"
+result=$($REDIS_CLI TABLE.SCHEMA.CREATE sh.bad ID:integer CODE:string:unique SHARDS 2 2>&1)
+assert_error "not supported on sharded tables" "$result" "Unique index rejected"
+result=$($REDIS_CLI TABLE.SCHEMA.CREATE "sh.bad#0" ID:integer 2>&1)
+assert_error "'#' is reserved" "$result" "Shard names reserved"
+
+test_start "Rows are spread over the shards"
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    $REDIS_CLI TABLE.INSERT sh.u ID=$i NAME=n$((i % 3)) AGE=$((i * 7 % 11)) > /dev/null
+done
+result=$($REDIS_CLI TABLE.INSERTMANY sh.u COLUMNS ID NAME AGE VALUES 11 n0 5 12 n1 6 13 n2 7)
+assert_equals "3" "$result" "INSERTMANY replies with the rows inserted"
+total=0; used=0
+for k in 0 1 2 3; do
+    n=$($REDIS_CLI SCARD "{sh.u#$k}:rows")
+    total=$((total + n)); [ "$n" -gt 0 ] && used=$((used + 1))
+done
+assert_equals "13" "$total" "Every row in one shard"
+[ "$used" -gt 1 ] && assert_equals "1" "1" "Rows in several shards" || assert_equals ">1" "$used" "Rows in several shards"
+result=$($REDIS_CLI SCARD "{sh.u}:rows")
+assert_equals "0" "$result" "No rows in the sharded table itself"
+result=$($REDIS_CLI TABLE.INSERT sh.u ID=3 NAME=dup 2>&1)
+assert_error "duplicate value for a unique column" "$result" "Primary key still unique"
+
+test_start "Queries merge the shards"
+result=$($REDIS_CLI TABLE.AGGREGATE sh.u COUNT)
+assert_equals "13" "$result" "COUNT over the shards"
+result=$($REDIS_CLI TABLE.AGGREGATE sh.u SUM AGE)
+assert_equals "73" "$result" "SUM over the shards"
+result=$($REDIS_CLI TABLE.AGGREGATE sh.u AVG AGE GROUP BY NAME | tr '\n' ' ')
+assert_equals "n0 8 n1 5.6 n2 3.25 " "$result" "AVG per group from the SUM and COUNT of each shard"
+result=$($REDIS_CLI TABLE.AGGREGATE sh.u MAX AGE WHERE NAME=n1)
+assert_equals "7" "$result" "MAX over the shards"
+result=$($REDIS_CLI TABLE.SELECT sh.u COLUMNS ID,AGE ORDER BY AGE DESC LIMIT 4 OFFSET 1 | tr '\n' ' ')
+assert_equals "6 9 9 8 1 7 13 7 " "$result" "ORDER BY with a page over the shards"
+result=$($REDIS_CLI TABLE.SELECT sh.u COLUMNS ID ORDER BY AGE LIMIT 3 | tr '\n' ' ')
+assert_equals "8 5 2 " "$result" "ORDER BY a column not returned"
+result=$($REDIS_CLI TABLE.SELECT sh.u COLUMNS ID WHERE NAME=n2 ORDER BY ID | tr '\n' ' ')
+assert_equals "2 5 8 13 " "$result" "WHERE on every shard"
+result=$($REDIS_CLI TABLE.GET sh.u 7 COLUMNS NAME,AGE | tr '\n' ' ')
+assert_equals "n1 5 " "$result" "GET reads the shard of the key"
+result=$($REDIS_CLI TABLE.EXPLAIN sh.u WHERE NAME=n1)
+assert_contains "TABLE sh.u sharded over 4 tables" "$result" "EXPLAIN shows the sharding"
+assert_contains "TABLE sh.u#0 engine hash" "$result" "EXPLAIN shows the plan of each shard"
+result=$($REDIS_CLI TABLE.SELECT sh.u CURSOR 0 2>&1)
+assert_error "CURSOR cannot be used on sharded tables" "$result" "No cursor over shards"
+
+test_start "UPDATE, DELETE and ALTER run on every shard"
+result=$($REDIS_CLI TABLE.UPDATE sh.u WHERE NAME=n1 SET AGE=100)
+assert_equals "5" "$result" "Rows updated in every shard"
+result=$($REDIS_CLI TABLE.UPDATE sh.u WHERE NAME=n1 SET ID=100 2>&1)
+assert_error "primary key of a sharded table cannot be updated" "$result" "Rows stay in their shard"
+result=$($REDIS_CLI TABLE.DELETE sh.u WHERE AGE=100)
+assert_equals "5" "$result" "Rows deleted in every shard"
+result=$($REDIS_CLI TABLE.SCHEMA.ALTER sh.u ADD COLUMN CITY:string:hash)
+assert_equals "OK" "$result" "Column added"
+result=$($REDIS_CLI TABLE.SCHEMA.VIEW "sh.u#1")
+assert_contains "CITY" "$result" "Shards altered too"
+result=$($REDIS_CLI TABLE.PREPARE shq SELECT sh.u WHERE NAME=? 2>&1)
+assert_error "cannot be prepared" "$result" "No prepared statements on sharded tables"
+
+test_start "Tables without a primary key are spread by row ID"
+$REDIS_CLI TABLE.SCHEMA.CREATE sh.v NAME:string SHARDS 3 > /dev/null
+$REDIS_CLI TABLE.INSERT sh.v NAME=a > /dev/null
+$REDIS_CLI TABLE.INSERTMANY sh.v COLUMNS NAME VALUES b c d e f > /dev/null
+result=$($REDIS_CLI SCARD "{sh.v#2}:rows")
+assert_equals "2" "$result" "Rows dealt in turn"
+result=$($REDIS_CLI TABLE.AGGREGATE sh.v COUNT NAME)
+assert_equals "6" "$result" "COUNT <col> over the shards"
+result=$($REDIS_CLI TABLE.AGGREGATE sh.v MIN NAME)
+assert_equals "a" "$result" "MIN of a string over the shards"
+
+test_start "DROP removes the shards"
+$REDIS_CLI TABLE.DROP sh.u FORCE > /dev/null
+$REDIS_CLI TABLE.DROP sh.v FORCE > /dev/null
+result=$($REDIS_CLI EXISTS "schema:{sh.u}" "schema:{sh.u#0}" "schema:{sh.u#3}" "{sh.u}:options")
+assert_equals "0" "$result" "Table, shards and options gone"
+$REDIS_CLI DEL "schema:{sh}" > /dev/null
+
+# ============================================
+# TEST SUITE 45: Table Catalog
+# ============================================
+echo -e "\n${YELLOW}=== TEST SUITE 45: Table Catalog ===${NC}"
+
+test_start "NAMESPACE.VIEW lists the tables in name order"
+$REDIS_CLI TABLE.NAMESPACE.CREATE cat > /dev/null
+$REDIS_CLI TABLE.NAMESPACE.CREATE catx > /dev/null
+$REDIS_CLI TABLE.NAMESPACE.CREATE cat-b > /dev/null
+$REDIS_CLI TABLE.SCHEMA.CREATE cat.b NAME:string > /dev/null
+$REDIS_CLI TABLE.SCHEMA.CREATE cat.a NAME:string > /dev/null
+$REDIS_CLI TABLE.SCHEMA.CREATE cat.c NAME:string > /dev/null
+$REDIS_CLI TABLE.SCHEMA.CREATE catx.a NAME:string > /dev/null
+$REDIS_CLI TABLE.SCHEMA.CREATE cat-b.a NAME:string > /dev/null
+$REDIS_CLI TABLE.SCHEMA.CREATE cat.s NAME:string SHARDS 2 > /dev/null
+result=$($REDIS_CLI TABLE.NAMESPACE.VIEW cat | tr '\n' ',')
+assert_equals "cat:a,cat:b,cat:c,cat:s," "$result" "Sorted, one namespace, shards hidden"
+result=$($REDIS_CLI TABLE.NAMESPACE.VIEW catx | tr '\n' ',')
+assert_equals "catx:a," "$result" "A namespace prefix of another is not mixed in"
+result=$($REDIS_CLI TABLE.NAMESPACE.VIEW | grep '^cat' | tr '\n' ',')
+assert_equals "cat:a,cat:b,cat:c,cat:s,cat-b:a,catx:a," "$result" "Ordered by namespace, then table"
+
+test_start "Dropped or deleted tables leave the catalog"
+$REDIS_CLI TABLE.DROP cat.b FORCE > /dev/null
+$REDIS_CLI DEL "schema:{cat.c}" > /dev/null
+result=$($REDIS_CLI TABLE.NAMESPACE.VIEW cat | tr '\n' ',')
+assert_equals "cat:a,cat:s," "$result" "DROP and DEL of the schema key unlist the table"
+$REDIS_CLI RENAME "schema:{cat.a}" "schema:{cat.d}" > /dev/null
+result=$($REDIS_CLI TABLE.NAMESPACE.VIEW cat | tr '\n' ',')
+assert_equals "cat:d,cat:s," "$result" "RENAME of the schema key follows"
+$REDIS_CLI RENAME "schema:{cat.d}" "schema:{cat.a}" > /dev/null
+
+$REDIS_CLI TABLE.DROP cat.a FORCE > /dev/null
+$REDIS_CLI TABLE.DROP cat.s FORCE > /dev/null
+$REDIS_CLI TABLE.DROP catx.a FORCE > /dev/null
+$REDIS_CLI TABLE.DROP cat-b.a FORCE > /dev/null
+$REDIS_CLI DEL "schema:{cat}" "schema:{catx}" "schema:{cat-b}" "{cat.c}:idx:meta" "{cat.c}:id" > /dev/null
+
 # ============================================
 # Final Summary
 # ============================================